@@ -12,6 +12,7 @@
 #include "aac_decoder/aac_decoder.h"
 #include "flac_decoder/flac_decoder.h"
 #include "mp3_decoder/mp3_decoder.h"
+#include <utility>
 
 #ifdef SDFATFS_USED
 fs::SDFATFS SD_SDFAT;
@@ -313,6 +314,7 @@ Audio::~Audio() {
   // InBuff.~AudioBuffer(); #215 the AudioBuffer is automatically destroyed by
   // the destructor
   setDefaults();
+  destroyDecoders();
 #ifndef AUDIO_NO_NETWORK
   if (m_playlistBuff) {
     free(m_playlistBuff);
@@ -328,6 +330,7 @@ Audio::~Audio() {
 //---------------------------------------------------------------------------------------------------------------------
 void Audio::setDefaults() {
   stopSong();
+  selectDecoders();
   initInBuff(); // initialize InputBuffer if not already done
   InBuff.resetBuffer();
   MP3Decoder_FreeBuffers();
@@ -354,13 +357,6 @@ void Audio::setDefaults() {
 
   AUDIO_INFO("buffers freed, free Heap: %u bytes", ESP.getFreeHeap());
 
-  m_f_playing = false;
-  m_f_firstCall =
-      true; // InitSequence for processWebstream and processLokalFile
-  m_f_running = false;
-  m_f_loop = false;   // Set if audio file should loop
-  m_f_unsync = false; // set within ID3 tag but not used
-  m_f_exthdr = false; // ID3 extended header
 #ifndef AUDIO_NO_NETWORK
   m_f_chunked = false; // Assume not chunked
   m_f_firstmetabyte = false;
@@ -375,7 +371,29 @@ void Audio::setDefaults() {
   m_playlistFormat = FORMAT_NONE;
   m_bytesNotDecoded = 0; // counts all not decodable bytes
   m_chunkcount = 0;      // for chunked streams
+  m_contentlength = 0;   // If Content-Length is known, count it
+  m_metaint = 0;         // No metaint yet
+  m_streamTitleHash = 0;
 #endif
+  resetFileState();
+}
+//---------------------------------------------------------------------------------------------------------------------
+void Audio::resetFileState() {
+  // per file state, shared by setDefaults() and startPrerolled()
+  m_f_playing = false;
+  m_f_firstCall =
+      true; // InitSequence for processWebstream and processLokalFile
+  m_f_running = false;
+  m_f_loop = false;   // Set if audio file should loop
+  m_f_unsync = false; // set within ID3 tag but not used
+  m_f_exthdr = false; // ID3 extended header
+  m_f_gapless = false;
+  m_f_decoderReady = false;
+  m_f_fastStart = false;
+  m_f_xingChecked = false;
+  m_f_decoderPending = false;
+  m_f_encoderLimit = false;
+  m_encoderSkip = 0;
   m_codec = CODEC_NONE;
   m_datamode = AUDIO_NONE;
   m_audioCurrentTime = 0; // Reset playtimer
@@ -384,11 +402,6 @@ void Audio::setDefaults() {
   m_audioDataSize = 0;
   m_avr_bitrate = 0; // the same as m_bitrate if CBR, median if VBR
   m_bitRate = 0;     // Bitrate still unknown
-#ifndef AUDIO_NO_NETWORK
-  m_contentlength = 0; // If Content-Length is known, count it
-  m_metaint = 0;       // No metaint yet
-  m_streamTitleHash = 0;
-#endif
   m_curSample = 0;
   m_LFcount = 0;        // For end of header detection
   m_controlCounter = 0; // Status within readID3data() and readWaveHeader()
@@ -397,6 +410,91 @@ void Audio::setDefaults() {
   m_ID3Size = 0;
 }
 
+//---------------------------------------------------------------------------------------------------------------------
+bool Audio::setDecoderPool(const DecoderPool_t *pool) {
+  setDefaults(); // frees the buffers of the contexts in use
+  destroyDecoders();
+  m_mp3Ctx = MP3Decoder_CreateContext(pool);
+  m_aacCtx = AACDecoder_CreateContext(pool);
+  m_flacCtx = FLACDecoder_CreateContext(pool);
+  m_nextMp3Ctx = MP3Decoder_CreateContext(pool);
+  m_nextAacCtx = AACDecoder_CreateContext(pool);
+  m_nextFlacCtx = FLACDecoder_CreateContext(pool);
+  if (m_mp3Ctx && m_aacCtx && m_flacCtx && m_nextMp3Ctx && m_nextAacCtx &&
+      m_nextFlacCtx)
+    return true;
+  log_e("not enough memory for the decoder contexts");
+  destroyDecoders();
+  return false;
+}
+//---------------------------------------------------------------------------------------------------------------------
+void Audio::selectDecoders() {
+  // the decoders work on the calling task's selected context, point it at
+  // ours before use
+  MP3Decoder_SelectContext(m_mp3Ctx);
+  AACDecoder_SelectContext(m_aacCtx);
+  FLACDecoder_SelectContext(m_flacCtx);
+}
+//---------------------------------------------------------------------------------------------------------------------
+void Audio::destroyDecoders() {
+  MP3Decoder_DestroyContext(m_mp3Ctx);
+  AACDecoder_DestroyContext(m_aacCtx);
+  FLACDecoder_DestroyContext(m_flacCtx);
+  MP3Decoder_DestroyContext(m_nextMp3Ctx);
+  AACDecoder_DestroyContext(m_nextAacCtx);
+  FLACDecoder_DestroyContext(m_nextFlacCtx);
+  m_mp3Ctx = NULL;
+  m_aacCtx = NULL;
+  m_flacCtx = NULL;
+  m_nextMp3Ctx = NULL;
+  m_nextAacCtx = NULL;
+  m_nextFlacCtx = NULL;
+  m_f_nextDecoderReady = false;
+}
+//---------------------------------------------------------------------------------------------------------------------
+bool Audio::prepareNextDecoder(uint8_t codec) {
+  // allocates and clears the prerolled file's decoder on the spare contexts
+  // while the current file still plays; the switch then swaps pointers
+  releaseNextDecoder();
+  if (!m_nextMp3Ctx || !m_nextAacCtx || !m_nextFlacCtx)
+    return false;
+  MP3Decoder_SelectContext(m_nextMp3Ctx);
+  AACDecoder_SelectContext(m_nextAacCtx);
+  FLACDecoder_SelectContext(m_nextFlacCtx);
+  bool ready = false;
+  switch (codec) {
+  case CODEC_MP3:
+    ready = MP3Decoder_AllocateBuffers();
+    break;
+  case CODEC_AAC:
+  case CODEC_M4A:
+    ready = AACDecoder_AllocateBuffers();
+    break;
+  case CODEC_FLAC:
+    ready = psramFound() && FLACDecoder_AllocateBuffers();
+    break;
+  default: // WAV needs no decoder, Ogg sets FLAC up after its header
+    break;
+  }
+  selectDecoders();
+  m_f_nextDecoderReady = ready;
+  if (!ready)
+    releaseNextDecoder();
+  return ready;
+}
+//---------------------------------------------------------------------------------------------------------------------
+void Audio::releaseNextDecoder() {
+  m_f_nextDecoderReady = false;
+  if (!m_nextMp3Ctx || !m_nextAacCtx || !m_nextFlacCtx)
+    return;
+  MP3Decoder_SelectContext(m_nextMp3Ctx);
+  AACDecoder_SelectContext(m_nextAacCtx);
+  FLACDecoder_SelectContext(m_nextFlacCtx);
+  MP3Decoder_FreeBuffers();
+  AACDecoder_FreeBuffers();
+  FLACDecoder_FreeBuffers();
+  selectDecoders();
+}
 //---------------------------------------------------------------------------------------------------------------------
 #ifndef AUDIO_NO_NETWORK
 void Audio::setConnectionTimeout(uint16_t timeout_ms, uint16_t timeout_ms_ssl) {
@@ -805,29 +903,9 @@ bool Audio::connecttoFS(fs::FS &fs, const char *path, uint32_t resumeFilePos) {
     return false;
 
   m_resumeFilePos = resumeFilePos;
-  char audioName[256];
   setDefaults(); // free buffers an set defaults
-  memcpy(audioName, path, strlen(path) + 1);
-  if (audioName[0] != '/') {
-    for (int i = 255; i > 0; i--) {
-      audioName[i] = audioName[i - 1];
-    }
-    audioName[0] = '/';
-  }
-
-  AUDIO_INFO("Reading file: \"%s\"", audioName);
-  vTaskDelay(2);
-
-  if (fs.exists(audioName)) {
-    audiofile = fs.open(audioName); // #86
-  } else {
-    UTF8toASCII(audioName);
-    if (fs.exists(audioName)) {
-      audiofile = fs.open(audioName);
-    }
-  }
 
-  if (!audiofile) {
+  if (!openLocalFile(fs, path, audiofile)) {
     if (audio_info) {
       vTaskDelay(2);
       audio_info("Failed to open file for reading");
@@ -847,24 +925,9 @@ bool Audio::connecttoFS(fs::FS &fs, const char *path, uint32_t resumeFilePos) {
   afn = strdup(audiofile.name());
 #endif
 
-  uint8_t dotPos = lastIndexOf(afn, ".");
-  for (uint8_t i = dotPos + 1; i < strlen(afn); i++) {
-    afn[i] = toLowerCase(afn[i]);
-  }
-
-  if (endsWith(afn, ".mp3"))
-    m_codec = CODEC_MP3; // m_codec is by default CODEC_NONE
-  if (endsWith(afn, ".m4a"))
-    m_codec = CODEC_M4A;
-  if (endsWith(afn, ".aac"))
-    m_codec = CODEC_AAC;
-  if (endsWith(afn, ".wav"))
-    m_codec = CODEC_WAV;
-  if (endsWith(afn, ".flac"))
-    m_codec = CODEC_FLAC;
-
+  m_codec = codecFromFileName(afn); // m_codec is by default CODEC_NONE
   if (m_codec == CODEC_NONE)
-    AUDIO_INFO("The %s format is not supported", afn + dotPos);
+    AUDIO_INFO("The %s format is not supported", afn + lastIndexOf(afn, "."));
 
   if (afn) {
     free(afn);
@@ -879,6 +942,187 @@ bool Audio::connecttoFS(fs::FS &fs, const char *path, uint32_t resumeFilePos) {
   return ret;
 }
 //---------------------------------------------------------------------------------------------------------------------
+bool Audio::connecttoFS(fs::FS &fs, const char *path, const StartInfo &start) {
+  uint32_t t0 = millis();
+  if (!connecttoFS(fs, path))
+    return false;
+  if (applyStartInfo(start))
+    AUDIO_INFO("fast start at %u, %u ms", m_audioDataStart, millis() - t0);
+  return true;
+}
+//---------------------------------------------------------------------------------------------------------------------
+bool Audio::applyStartInfo(const StartInfo &start) {
+  // stands in for read_ID3_Header() / read_FLAC_Header(); anything that
+  // does not match the opened file leaves the header walk in charge
+  if (!start.sampleRate || start.fileSize != m_file_size ||
+      start.dataStart >= m_file_size)
+    return false;
+  if (m_codec == CODEC_FLAC) {
+    if ((start.bitsPerSample != 8 && start.bitsPerSample != 16) ||
+        start.flacMaxFrameSize > InBuff.getMaxBlockSize())
+      return false;
+    m_flacMaxBlockSize = start.flacMaxBlockSize;
+    m_flacMaxFrameSize = start.flacMaxFrameSize;
+    m_flacSampleRate = start.sampleRate;
+    m_flacNumChannels = start.channels;
+    m_flacBitsPerSample = start.bitsPerSample;
+    m_flacTotalSamplesInStream = start.flacTotalSamples;
+  } else if (m_codec != CODEC_MP3) {
+    return false;
+  }
+  if (audio_file_io_begin)
+    audio_file_io_begin();
+  bool seeked = audiofile.seek(start.dataStart);
+  if (audio_file_io_end)
+    audio_file_io_end();
+  if (!seeked)
+    return false;
+  m_audioDataStart = start.dataStart;
+  m_audioDataSize = m_file_size - start.dataStart;
+  m_controlCounter = 100; // header done
+  m_f_fastStart = true;
+  // the first decoded frame sets these again, with the same values the
+  // clock is not touched a second time
+  setChannels(start.channels);
+  setBitsPerSample(start.bitsPerSample);
+  setSampleRate(start.sampleRate);
+  return true;
+}
+//---------------------------------------------------------------------------------------------------------------------
+bool Audio::openLocalFile(fs::FS &fs, const char *path, File &file) {
+  char audioName[256];
+  memcpy(audioName, path, strlen(path) + 1);
+  if (audioName[0] != '/') {
+    for (int i = 255; i > 0; i--) {
+      audioName[i] = audioName[i - 1];
+    }
+    audioName[0] = '/';
+  }
+
+  AUDIO_INFO("Reading file: \"%s\"", audioName);
+  vTaskDelay(2);
+
+  if (fs.exists(audioName)) {
+    file = fs.open(audioName); // #86
+  } else {
+    UTF8toASCII(audioName);
+    if (fs.exists(audioName)) {
+      file = fs.open(audioName);
+    }
+  }
+  return (bool)file;
+}
+//---------------------------------------------------------------------------------------------------------------------
+uint8_t Audio::codecFromFileName(const char *name) {
+  int dotPos = lastIndexOf(name, ".");
+  if (dotPos < 0)
+    return CODEC_NONE;
+  char ext[6] = {0};
+  for (uint8_t i = 0; i < sizeof(ext) - 1 && name[dotPos + 1 + i]; i++) {
+    ext[i] = toLowerCase(name[dotPos + 1 + i]);
+  }
+  if (!strcmp(ext, "mp3"))
+    return CODEC_MP3;
+  if (!strcmp(ext, "m4a"))
+    return CODEC_M4A;
+  if (!strcmp(ext, "aac"))
+    return CODEC_AAC;
+  if (!strcmp(ext, "wav"))
+    return CODEC_WAV;
+  if (!strcmp(ext, "flac"))
+    return CODEC_FLAC;
+  if (!strcmp(ext, "oga"))
+    return CODEC_OGG; // FLAC in Ogg, see read_OGG_Header()
+  return CODEC_NONE;
+}
+//---------------------------------------------------------------------------------------------------------------------
+bool Audio::prerollFS(fs::FS &fs, const char *path) {
+  cancelPreroll();
+  if (!path || strlen(path) > 254)
+    return false;
+  uint8_t codec = codecFromFileName(path);
+  if (codec == CODEC_NONE)
+    return false;
+  File file;
+  if (!openLocalFile(fs, path, file))
+    return false;
+
+  // the read-ahead buffer is shared with the current file, which may not
+  // have taken all of its own bytes yet if it is very short
+  if (!m_prerollBuff) {
+    m_prerollSize = psramFound() ? 16 * 1024 : 4 * 1024;
+    m_prerollBuff = psramFound() ? (uint8_t *)ps_malloc(m_prerollSize)
+                                 : (uint8_t *)malloc(m_prerollSize);
+    m_prerollLen = 0;
+    m_prerollPos = 0;
+  }
+  if (m_prerollBuff && m_prerollPos >= m_prerollLen) {
+    if (audio_file_io_begin)
+      audio_file_io_begin();
+    int32_t n = file.read(m_prerollBuff, m_prerollSize);
+    if (audio_file_io_end)
+      audio_file_io_end();
+    m_prerollLen = n > 0 ? n : 0;
+    m_prerollPos = 0;
+    if (n <= 0)
+      file.seek(0);
+  } else {
+    m_prerollLen = 0;
+    m_prerollPos = 0;
+  }
+  m_prerollFile = file;
+  m_prerollCodec = codec;
+  prepareNextDecoder(codec);
+  return true;
+}
+//---------------------------------------------------------------------------------------------------------------------
+void Audio::cancelPreroll() {
+  if (!m_prerollFile)
+    return;
+  m_prerollFile.close();
+  m_prerollFile = File();
+  m_prerollLen = 0;
+  m_prerollPos = 0;
+  releaseNextDecoder();
+}
+//---------------------------------------------------------------------------------------------------------------------
+void Audio::startPrerolled() {
+  // like connecttoFS(), but I2S keeps running: no stopSong(), no silence
+  // from playI2Sremains() and the sample rate stays programmed
+  audiofile.close();
+  MP3Decoder_FreeBuffers();
+  FLACDecoder_FreeBuffers();
+  AACDecoder_FreeBuffers();
+  // the spares were set up for this file: they become ours, and the
+  // contexts just emptied become the spares
+  const bool ready = m_f_nextDecoderReady;
+  if (ready) {
+    std::swap(m_mp3Ctx, m_nextMp3Ctx);
+    std::swap(m_aacCtx, m_nextAacCtx);
+    std::swap(m_flacCtx, m_nextFlacCtx);
+    m_f_nextDecoderReady = false;
+    selectDecoders();
+  }
+  InBuff.resetBuffer();
+  resetFileState();
+  m_f_decoderReady = ready;
+  m_resumeFilePos = 0;
+
+  audiofile = m_prerollFile;
+  m_prerollFile = File();
+  setDatamode(AUDIO_LOCALFILE);
+  m_file_size = audiofile.size();
+  m_codec = m_prerollCodec;
+  m_f_gapless = true;
+  if (initializeDecoder()) {
+    m_f_running = true;
+  } else {
+    audiofile.close();
+    m_prerollLen = 0;
+    m_prerollPos = 0;
+  }
+}
+//---------------------------------------------------------------------------------------------------------------------
 #ifndef AUDIO_NO_NETWORK
 bool Audio::connecttospeech(const char *speech, const char *lang) {
 
@@ -1446,6 +1690,15 @@ size_t Audio::readAudioHeader(uint32_t bytes) {
       m_controlCounter = 100;
     }
   }
+  if (m_codec == CODEC_OGG || m_codec == CODEC_OGG_FLAC) {
+    int res = read_OGG_Header(InBuff.getReadPtr(), bytes);
+    if (res >= 0)
+      bytesReaded = res;
+    else { // error, skip header
+      stopSong();
+      m_controlCounter = 100;
+    }
+  }
   if (!isRunning()) {
     log_e("Processing stopped due to invalid audio header");
     return 0;
@@ -1591,7 +1844,7 @@ int Audio::read_WAV_Header(uint8_t *data, size_t len) {
 #endif
     }
     if (cs) {
-      m_audioDataSize = cs - 44;
+      m_audioDataSize = cs; // size of the data chunk alone
     } else { // sometimes there is nothing here
       if (getDatamode() == AUDIO_LOCALFILE)
         m_audioDataSize = getFileSize() - headerSize;
@@ -2723,6 +2976,7 @@ size_t Audio::process_m3u8_ID3_Header(uint8_t *packet) {
 //---------------------------------------------------------------------------------------------------------------------
 uint32_t Audio::stopSong() {
   uint32_t pos = 0;
+  cancelPreroll();
   if (m_f_running) {
     m_f_running = false;
     if (getDatamode() == AUDIO_LOCALFILE) {
@@ -2742,11 +2996,18 @@ uint32_t Audio::stopSong() {
     log_w("Closing audio file"); // for debug
   }
   memset(m_outBuff, 0, sizeof(m_outBuff)); // Clear OutputBuffer
-  i2s_zero_dma_buffer((i2s_port_t)m_i2s_num);
+  if (!m_f_queuedOutput) // otherwise the draining task owns the DMA
+    i2s_zero_dma_buffer((i2s_port_t)m_i2s_num);
   return pos;
 }
 //---------------------------------------------------------------------------------------------------------------------
 void Audio::playI2Sremains() { // returns true if all dma_buffs flushed
+  if (m_f_queuedOutput) {
+    // the queue keeps the tail playing and is flushed by its owner when the
+    // position is left, silence here would only delay what comes next
+    memset(m_outBuff, 0, sizeof(m_outBuff));
+    return;
+  }
   if (!getSampleRate())
     setSampleRate(96000);
   if (!getChannels())
@@ -2757,9 +3018,15 @@ void Audio::playI2Sremains() { // returns true if all dma_buffs flushed
     memset(m_outBuff, 128,
            sizeof(m_outBuff)); // Clear OutputBuffer (unsigned, PCM 8u)
 
-  m_validSamples = m_i2s_config.dma_buf_len * m_i2s_config.dma_buf_count;
-  while (m_validSamples) {
+  // push dma_buf_len * dma_buf_count frames of silence, a quarter of
+  // m_outBuff at a time so that no format reads past its end
+  uint32_t remains = m_i2s_config.dma_buf_len * m_i2s_config.dma_buf_count;
+  while (remains) {
+    uint16_t n = remains > 1024 ? 1024 : remains;
+    m_validSamples = n;
     playChunk();
+    remains -= n;
+    m_silenceFrames += n;
   }
   i2s_zero_dma_buffer((i2s_port_t)m_i2s_num);
   return;
@@ -2783,96 +3050,168 @@ bool Audio::pauseResume() {
 }
 //---------------------------------------------------------------------------------------------------------------------
 bool Audio::playChunk() {
-  // If we've got data, try and pump it out..
-  int16_t sample[2];
-  if (getBitsPerSample() == 8) {
-    if (getChannels() == 1) {
-      while (m_validSamples) {
-        uint8_t x = m_outBuff[m_curSample] & 0x00FF;
-        uint8_t y = (m_outBuff[m_curSample] & 0xFF00) >> 8;
-        sample[LEFTCHANNEL] = x;
-        sample[RIGHTCHANNEL] = x;
-        while (1) {
-          if (playSample(sample))
-            break;
-        } // Can't send?
-        sample[LEFTCHANNEL] = y;
-        sample[RIGHTCHANNEL] = y;
-        while (1) {
-          if (playSample(sample))
-            break;
-        } // Can't send?
-        m_validSamples--;
-        m_curSample++;
+  // If we've got data, convert it block by block and pump it out..
+  if (getBitsPerSample() != 8 && getBitsPerSample() != 16) {
+    log_e("BitsPer Sample must be 8 or 16!");
+    m_validSamples = 0;
+    stopSong();
+    return false;
+  }
+  bool ret = true;
+  while (m_validSamples) {
+    uint32_t t0 = ESP.getCycleCount();
+    uint16_t frames = stageI2SBlock();
+    if (audio_process_dsp_block) {
+      audio_process_dsp_block(m_i2sStage, frames);
+    }
+    IIR_filterBlock(m_i2sStage, frames);
+    packI2SBlock(m_i2sStage, m_i2sBlock, frames);
+    m_i2sStats.dspCycles += ESP.getCycleCount() - t0;
+
+    if (audio_process_i2s_block) {
+      // process the whole block just before writing to i2s
+      bool continueI2S = false;
+      audio_process_i2s_block(m_i2sBlock, frames, &continueI2S);
+      if (!continueI2S) {
+        continue;
       }
-    }
-    if (getChannels() == 2) {
-      while (m_validSamples) {
-        uint8_t x = m_outBuff[m_curSample] & 0x00FF;
-        uint8_t y = (m_outBuff[m_curSample] & 0xFF00) >> 8;
-        if (!m_f_forceMono) { // stereo mode
-          sample[LEFTCHANNEL] = x;
-          sample[RIGHTCHANNEL] = y;
-        } else { // force mono
-          uint8_t xy = (x + y) / 2;
-          sample[LEFTCHANNEL] = xy;
-          sample[RIGHTCHANNEL] = xy;
+    } else if (audio_process_i2s) {
+      // per sample hook, drop the samples the callback did not pass on
+      uint16_t kept = 0;
+      for (uint16_t i = 0; i < frames; i++) {
+        bool continueI2S = false;
+        audio_process_i2s(&m_i2sBlock[i], &continueI2S);
+        if (continueI2S) {
+          m_i2sBlock[kept++] = m_i2sBlock[i];
         }
-
-        while (1) {
-          if (playSample(sample))
-            break;
-        } // Can't send?
-        m_validSamples--;
-        m_curSample++;
       }
+      frames = kept;
+    }
+    if (!writeI2SBlock(m_i2sBlock, frames)) {
+      ret = false;
     }
-    m_curSample = 0;
-    return true;
   }
-  if (getBitsPerSample() == 16) {
-    if (getChannels() == 1) {
-      while (m_validSamples) {
-        sample[LEFTCHANNEL] = m_outBuff[m_curSample];
-        sample[RIGHTCHANNEL] = m_outBuff[m_curSample];
-        if (!playSample(sample)) {
-          log_e("can't send");
-          return false;
-        } // Can't send
-        m_validSamples--;
-        m_curSample++;
+  m_curSample = 0;
+  return ret;
+}
+//---------------------------------------------------------------------------------------------------------------------
+uint16_t Audio::stageI2SBlock() {
+  // takes up to m_i2sBlockFrames frames from m_outBuff, upsamples 8 bit PCM,
+  // folds mono and widens to 32 bit with volume and balance applied, which
+  // leaves DSP_SHIFT bits below and 4 bits (24 dB) above the 16 bit range
+  // for the filters; nothing is rounded until packI2SBlock()
+  const int32_t gL = m_gainL;
+  const int32_t gR = m_gainR;
+  int32_t *dst = m_i2sStage;
+  uint16_t frames = 0;
+  if (getBitsPerSample() == 8) { // unsigned 8 bits, two samples per word
+    while (m_validSamples && frames + 2 <= m_i2sBlockFrames) {
+      uint8_t x = m_outBuff[m_curSample] & 0x00FF;
+      uint8_t y = (m_outBuff[m_curSample] & 0xFF00) >> 8;
+      m_validSamples--;
+      m_curSample++;
+      if (getChannels() == 1) {
+        int32_t a = (x - 128) << 8;
+        int32_t b = (y - 128) << 8;
+        dst[0] = a * gL;
+        dst[1] = a * gR;
+        dst[2] = b * gL;
+        dst[3] = b * gR;
+        dst += 4;
+        frames += 2;
+        continue;
       }
-    }
-    if (getChannels() == 2) {
-      m_curSample = 0;
-      while (m_validSamples) {
-        if (!m_f_forceMono) { // stereo mode
-          sample[LEFTCHANNEL] = m_outBuff[m_curSample * 2];
-          sample[RIGHTCHANNEL] = m_outBuff[m_curSample * 2 + 1];
-        } else { // mono mode, #100
-          int16_t xy =
-              (m_outBuff[m_curSample * 2] + m_outBuff[m_curSample * 2 + 1]) / 2;
-          sample[LEFTCHANNEL] = xy;
-          sample[RIGHTCHANNEL] = xy;
-        }
-        playSample(sample);
-        m_validSamples--;
-        m_curSample++;
+      if (m_f_forceMono) {
+        x = y = (x + y) / 2;
       }
-    }
-    m_curSample = 0;
+      dst[LEFTCHANNEL] = ((x - 128) << 8) * gL;
+      dst[RIGHTCHANNEL] = ((y - 128) << 8) * gR;
+      dst += 2;
+      frames++;
+    }
+    return frames;
+  }
+  if (getChannels() == 1) {
+    while (m_validSamples && frames < m_i2sBlockFrames) {
+      int32_t a = m_outBuff[m_curSample];
+      dst[0] = a * gL;
+      dst[1] = a * gR;
+      m_validSamples--;
+      m_curSample++;
+      dst += 2;
+      frames++;
+    }
+    return frames;
+  }
+  while (m_validSamples && frames < m_i2sBlockFrames) {
+    int32_t l = m_outBuff[m_curSample * 2];
+    int32_t r = m_outBuff[m_curSample * 2 + 1];
+    if (m_f_forceMono) { // mono mode, #100
+      l = r = (l + r) / 2;
+    }
+    dst[LEFTCHANNEL] = l * gL;
+    dst[RIGHTCHANNEL] = r * gR;
+    m_validSamples--;
+    m_curSample++;
+    dst += 2;
+    frames++;
+  }
+  return frames;
+}
+//---------------------------------------------------------------------------------------------------------------------
+bool Audio::writeI2SBlock(uint32_t *frames, uint16_t count) {
+  // may also be called from another task than loop(), e.g. to drain a ring
+  // the frames were queued into by audio_process_i2s_block()
+  if (!count) {
     return true;
   }
-  log_e("BitsPer Sample must be 8 or 16!");
-  m_validSamples = 0;
-  stopSong();
-  return false;
+  if (m_f_internalDAC) {
+    for (uint16_t i = 0; i < count; i++) {
+      frames[i] += 0x80008000;
+    }
+  }
+  const char *p = (const char *)frames;
+  size_t bytesLeft = count * sizeof(uint32_t);
+  m_i2sStats.blocks++;
+  m_i2sStats.frames += count;
+  uint32_t t0 = ESP.getCycleCount();
+  uint8_t stalls = 0;
+  while (bytesLeft) {
+    m_i2s_bytesWritten = 0;
+    esp_err_t err = i2s_write((i2s_port_t)m_i2s_num, p, bytesLeft,
+                              &m_i2s_bytesWritten, 100);
+    m_i2sStats.writeCalls++;
+    if (err != ESP_OK) {
+      log_e("ESP32 Errorcode %i", err);
+      m_i2sStats.writeCycles += ESP.getCycleCount() - t0;
+      return false;
+    }
+    if (m_i2s_bytesWritten < bytesLeft) {
+      // DMA stayed full for the whole timeout, keep pushing the remainder
+      m_i2sStats.shortWrites++;
+    }
+    if (m_i2s_bytesWritten) {
+      stalls = 0;
+    } else if (++stalls >= I2S_MAX_STALLS) {
+      // DMA is not draining at all (e.g. stopped for a reconfigure), give
+      // up on this block rather than block the caller indefinitely
+      log_w("I2S stalled, dropping %u frames", (unsigned)(bytesLeft / 4));
+      m_i2sStats.droppedBlocks++;
+      m_i2sStats.writeCycles += ESP.getCycleCount() - t0;
+      return false;
+    }
+    p += m_i2s_bytesWritten;
+    bytesLeft -= m_i2s_bytesWritten;
+  }
+  m_i2sStats.writeCycles += ESP.getCycleCount() - t0;
+  return true;
 }
 //---------------------------------------------------------------------------------------------------------------------
 void Audio::loop() {
 
   if (!m_f_running)
     return;
+  selectDecoders();
 
 #ifndef AUDIO_NO_NETWORK
   if (m_playlistFormat != FORMAT_M3U8) { // normal process
@@ -3472,23 +3811,20 @@ void Audio::processLocalFile() {
 
   const uint32_t maxFrameSize =
       InBuff.getMaxBlockSize(); // every mp3/aac frame is not bigger
-  static bool f_stream;
-  static bool f_fileDataComplete;
-  static uint32_t byteCounter; // count received data
   uint32_t availableBytes = 0;
 
   if (m_f_firstCall) { // runs only one time per connection, prepare for start
     m_f_firstCall = false;
-    f_stream = false;
-    f_fileDataComplete = false;
-    byteCounter = 0;
+    m_f_stream = false;
+    m_f_fileDataComplete = false;
+    m_byteCounter = m_f_fastStart ? m_audioDataStart : 0;
     return;
   }
 
   availableBytes = 16 * 1024; // set some large value
 
   availableBytes = min(availableBytes, InBuff.writeSpace());
-  availableBytes = min(availableBytes, audiofile.size() - byteCounter);
+  availableBytes = min(availableBytes, audiofile.size() - m_byteCounter);
 #ifndef AUDIO_NO_NETWORK
   if (m_contentlength) {
     if (m_contentlength > getFilePos())
@@ -3496,31 +3832,46 @@ void Audio::processLocalFile() {
   }
 #endif
   if (m_audioDataSize) {
-    availableBytes =
-        min(availableBytes, m_audioDataSize + m_audioDataStart - byteCounter);
+    availableBytes = min(availableBytes,
+                         m_audioDataSize + m_audioDataStart - m_byteCounter);
   }
 
-  int32_t bytesAddedToBuffer =
-      audiofile.read(InBuff.getWritePtr(), availableBytes);
+  int32_t bytesAddedToBuffer = 0;
+  if (!m_prerollFile && m_prerollPos < m_prerollLen) {
+    // bytes prerollFS() read ahead, the file already stands behind them
+    bytesAddedToBuffer = min(availableBytes, m_prerollLen - m_prerollPos);
+    memcpy(InBuff.getWritePtr(), m_prerollBuff + m_prerollPos,
+           bytesAddedToBuffer);
+    m_prerollPos += bytesAddedToBuffer;
+  } else {
+    if (audio_file_io_begin)
+      audio_file_io_begin();
+    bytesAddedToBuffer = audiofile.read(InBuff.getWritePtr(), availableBytes);
+    if (audio_file_io_end)
+      audio_file_io_end();
+  }
 
   if (bytesAddedToBuffer > 0) {
-    byteCounter += bytesAddedToBuffer; // Pull request #42
+    m_byteCounter += bytesAddedToBuffer; // Pull request #42
     InBuff.bytesWritten(bytesAddedToBuffer);
   }
-  if (!f_stream) {
+  if (!m_f_stream) {
     if (m_controlCounter != 100) {
       if (InBuff.bufferFilled() > maxFrameSize) { // read the file header first
         InBuff.bytesWasRead(readAudioHeader(InBuff.bufferFilled()));
       }
       return;
     } else {
-      if ((InBuff.freeSpace() > maxFrameSize) &&
-          (m_file_size - byteCounter) > maxFrameSize) {
-        // fill the buffer before playing
+      // fill the buffer before playing; after a gapless switch the PCM
+      // still queued downstream covers the refill instead, and a fast start
+      // trades the cushion for latency, the next reads follow at once
+      if (!m_f_gapless && !m_f_fastStart &&
+          (InBuff.freeSpace() > maxFrameSize) &&
+          (m_file_size - m_byteCounter) > maxFrameSize) {
         return;
       }
 
-      f_stream = true;
+      m_f_stream = true;
       AUDIO_INFO("stream ready");
       if (m_f_Log)
         log_i("m_audioDataStart %d", m_audioDataStart);
@@ -3550,7 +3901,9 @@ void Audio::processLocalFile() {
           ((m_resumeFilePos - m_audioDataStart) / m_avr_bitrate) * 8;
     audiofile.seek(m_resumeFilePos);
     InBuff.resetBuffer();
-    byteCounter = m_resumeFilePos;
+    m_byteCounter = m_resumeFilePos;
+    m_prerollPos = m_prerollLen; // read-ahead bytes are stale now
+    m_f_encoderLimit = false;    // the frame count no longer applies
 
     if (m_f_Log) {
       log_i("m_resumeFilePos %d", m_resumeFilePos);
@@ -3559,25 +3912,29 @@ void Audio::processLocalFile() {
       log_i("m_file_size %d", m_file_size);
     }
     m_resumeFilePos = 0;
-    f_stream = false;
+    m_f_stream = false;
   }
 
   // end of file reached? - - - - - - - - - - - - - - - - - - - - - - - - - - -
   // - - - - - - - - - - - - - - - - - -
-  if (f_fileDataComplete && InBuff.bufferFilled() < InBuff.getMaxBlockSize()) {
+  if (m_f_fileDataComplete &&
+      InBuff.bufferFilled() < InBuff.getMaxBlockSize()) {
+    m_silenceAtEof = m_silenceFrames;
     if (InBuff.bufferFilled()) {
       if (!readID3V1Tag()) {
         int bytesDecoded =
             sendBytes(InBuff.getReadPtr(), InBuff.bufferFilled());
-        if (bytesDecoded > 2) {
+        // the rest of a FLAC block comes out without consuming input
+        if (bytesDecoded > 2 || m_f_decoderPending) {
           InBuff.bytesWasRead(bytesDecoded);
           return;
         }
       }
     }
-    playI2Sremains();
+    if (!m_prerollFile)
+      playI2Sremains();
 
-    if (m_f_loop && f_stream) { // eof
+    if (m_f_loop && m_f_stream) { // eof
       AUDIO_INFO("loop from: %u to: %u", getFilePos(),
                  m_audioDataStart); // TEST loop
       setFilePos(m_audioDataStart);
@@ -3590,8 +3947,8 @@ void Audio::processLocalFile() {
          duration 3:43        ====================>        3:33
       */
       m_audioCurrentTime = 0;
-      byteCounter = m_audioDataStart;
-      f_fileDataComplete = false;
+      m_byteCounter = m_audioDataStart;
+      m_f_fileDataComplete = false;
       return;
     } // TEST loop
 
@@ -3602,6 +3959,15 @@ void Audio::processLocalFile() {
     char *afn = strdup(audiofile.name()); // store temporary the name
 #endif
 
+    if (m_prerollFile) {
+      AUDIO_INFO("End of file \"%s\", next one is prerolled", afn);
+      startPrerolled();
+      if (audio_eof_mp3)
+        audio_eof_mp3(afn);
+      free(afn);
+      return;
+    }
+
     stopSong();
     if (m_codec == CODEC_MP3)
       MP3Decoder_FreeBuffers();
@@ -3621,17 +3987,16 @@ void Audio::processLocalFile() {
     return;
   }
 
-  if (byteCounter == audiofile.size()) {
-    f_fileDataComplete = true;
+  if (m_byteCounter == audiofile.size()) {
+    m_f_fileDataComplete = true;
   }
-  if (byteCounter == m_audioDataSize + m_audioDataStart) {
-    f_fileDataComplete = true;
+  if (m_byteCounter == m_audioDataSize + m_audioDataStart) {
+    m_f_fileDataComplete = true;
   }
 
   // play audio data - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
   // - - - - - - - - - - - - - - - - - - -
-  if (f_stream) {
-    static uint8_t cnt = 0;
+  if (m_f_stream) {
     uint8_t compression;
     if (m_codec == CODEC_WAV)
       compression = 1;
@@ -3639,10 +4004,10 @@ void Audio::processLocalFile() {
       compression = 2;
     else
       compression = 3;
-    cnt++;
-    if (cnt == compression) {
+    m_playCounter++;
+    if (m_playCounter == compression) {
       playAudioData();
-      cnt = 0;
+      m_playCounter = 0;
     }
   }
   return;
@@ -3818,7 +4183,8 @@ void Audio::processWebFile() {
       if (!readID3V1Tag()) {
         int bytesDecoded =
             sendBytes(InBuff.getReadPtr(), InBuff.bufferFilled());
-        if (bytesDecoded > 2) {
+        // the rest of a FLAC block comes out without consuming input
+        if (bytesDecoded > 2 || m_f_decoderPending) {
           InBuff.bytesWasRead(bytesDecoded);
           return;
         }
@@ -4491,9 +4857,12 @@ lastToDo:
 #endif // AUDIO_NO_NETWORK
 //---------------------------------------------------------------------------------------------------------------------
 bool Audio::initializeDecoder() {
+  // set up ahead by prepareNextDecoder(), allocated and cleared already
+  const bool ready = m_f_decoderReady;
+  m_f_decoderReady = false;
   switch (m_codec) {
   case CODEC_MP3:
-    if (!MP3Decoder_AllocateBuffers())
+    if (!ready && !MP3Decoder_AllocateBuffers())
       goto exit;
     AUDIO_INFO("MP3Decoder has been initialized, free Heap: %u bytes",
                ESP.getFreeHeap());
@@ -4522,7 +4891,7 @@ bool Audio::initializeDecoder() {
       AUDIO_INFO("FLAC works only with PSRAM!");
       goto exit;
     }
-    if (!FLACDecoder_AllocateBuffers())
+    if (!ready && !FLACDecoder_AllocateBuffers())
       goto exit;
     InBuff.changeMaxBlockSize(m_frameSizeFLAC);
     AUDIO_INFO("FLACDecoder has been initialized, free Heap: %u bytes",
@@ -4532,9 +4901,9 @@ bool Audio::initializeDecoder() {
     InBuff.changeMaxBlockSize(m_frameSizeWav);
     break;
   case CODEC_OGG:
-    m_codec = CODEC_OGG;
-    AUDIO_INFO("ogg not supported");
-    goto exit;
+    // The FLAC decoder is set up once read_OGG_Header() has found the
+    // STREAMINFO; until then the buffer only has to hold header pages.
+    InBuff.changeMaxBlockSize(m_frameSizeFLAC);
     break;
   default:
     goto exit;
@@ -4942,7 +5311,6 @@ int Audio::findNextSync(uint8_t *data, size_t len) {
   //         -1 the sync word was not found within the block with the length len
 
   int nextSync;
-  static uint32_t swnf = 0;
   if (m_codec == CODEC_WAV) {
     m_f_playing = true;
     nextSync = 0;
@@ -4971,19 +5339,19 @@ int Audio::findNextSync(uint8_t *data, size_t len) {
     nextSync = FLACFindSyncWord(data, len);
   }
   if (nextSync == -1) {
-    if (audio_info && swnf == 0)
+    if (audio_info && m_syncNotFound == 0)
       audio_info("syncword not found");
     if (m_codec == CODEC_OGG_FLAC) {
       nextSync = len;
     } else {
-      swnf++; // syncword not found counter, can be multimediadata
+      m_syncNotFound++; // syncword not found counter, can be multimediadata
     }
   }
   if (nextSync == 0) {
-    if (audio_info && swnf > 0) {
-      sprintf(m_chbuf, "syncword not found %i times", swnf);
+    if (audio_info && m_syncNotFound > 0) {
+      sprintf(m_chbuf, "syncword not found %i times", m_syncNotFound);
       audio_info(m_chbuf);
-      swnf = 0;
+      m_syncNotFound = 0;
     } else {
       if (audio_info)
         audio_info("syncword found at pos 0");
@@ -4995,15 +5363,98 @@ int Audio::findNextSync(uint8_t *data, size_t len) {
   return nextSync;
 }
 //---------------------------------------------------------------------------------------------------------------------
+int Audio::skipXingFrame(uint8_t *data, size_t len) {
+  // The first frame of a LAME/ffmpeg encoded file is a silent Xing/Info
+  // frame; its LAME extension gives the encoder delay and the padding that
+  // fill up the last frame. Returns the frame length if it is one.
+  static const uint16_t bitrates[2][15] = {
+      {0, 32, 40, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320},
+      {0, 8, 16, 24, 32, 40, 48, 56, 64, 80, 96, 112, 128, 144, 160}};
+  static const uint16_t samplerates[3] = {44100, 48000, 32000};
+  const uint32_t decoderDelay = 529; // polyphase filterbank, in frames
+
+  if (len < 4 || ((data[1] >> 1) & 3) != 1) // layer III only
+    return 0;
+  uint8_t version = (data[1] >> 3) & 3; // 3: MPEG1, 2: MPEG2, 0: MPEG2.5
+  uint8_t brIdx = data[2] >> 4;
+  uint8_t srIdx = (data[2] >> 2) & 3;
+  if (version == 1 || brIdx == 0 || brIdx == 15 || srIdx == 3)
+    return 0;
+  bool mpeg1 = version == 3;
+  bool mono = (data[3] >> 6) == 3;
+  uint8_t srShift = mpeg1 ? 0 : version == 2 ? 1 : 2; // MPEG2: /2, 2.5: /4
+  uint32_t sampleRate = samplerates[srIdx] >> srShift;
+  uint32_t kbps = bitrates[mpeg1 ? 0 : 1][brIdx];
+  uint32_t frameLen =
+      (mpeg1 ? 144000 : 72000) * kbps / sampleRate + ((data[2] >> 1) & 1);
+  uint32_t samplesPerFrame = mpeg1 ? 1152 : 576;
+  size_t pos = 4 + (mpeg1 ? (mono ? 17 : 32) : (mono ? 9 : 17));
+  if (frameLen > len || pos + 8 > frameLen)
+    return 0;
+  if (memcmp(data + pos, "Xing", 4) && memcmp(data + pos, "Info", 4))
+    return 0;
+
+  uint32_t flags = bigEndian(data + pos + 4, 4);
+  uint32_t frames = 0;
+  pos += 8;
+  if (flags & 1) {
+    frames = bigEndian(data + pos, 4);
+    pos += 4;
+  }
+  if (flags & 2)
+    pos += 4; // bytes
+  if (flags & 4)
+    pos += 100; // TOC
+  if (flags & 8)
+    pos += 4; // quality
+  if (pos + 24 <= frameLen &&
+      (!memcmp(data + pos, "LAME", 4) || !memcmp(data + pos, "Lavc", 4) ||
+       !memcmp(data + pos, "Lavf", 4))) {
+    uint32_t delay = (data[pos + 21] << 4) | (data[pos + 22] >> 4);
+    uint32_t padding = ((data[pos + 22] & 0x0F) << 8) | data[pos + 23];
+    m_encoderSkip = delay + decoderDelay;
+    if (frames && frames * samplesPerFrame > delay + padding) {
+      m_encoderFramesLeft = frames * samplesPerFrame - delay - padding;
+      m_f_encoderLimit = true;
+    }
+    AUDIO_INFO("encoder delay %u, padding %u", delay, padding);
+  }
+  return frameLen;
+}
+//---------------------------------------------------------------------------------------------------------------------
+void Audio::trimEncoderEdges() {
+  // drops the encoder delay at the start and the padding at the end of an
+  // MP3, so consecutive tracks join sample-accurately
+  if (m_encoderSkip && m_validSamples) {
+    uint32_t n = min(m_encoderSkip, (uint32_t)m_validSamples);
+    m_encoderSkip -= n;
+    m_validSamples -= n;
+    m_trimmedFrames += n;
+    if (m_validSamples)
+      memmove(m_outBuff, m_outBuff + n * getChannels(),
+              m_validSamples * getChannels() * sizeof(int16_t));
+  }
+  if (m_f_encoderLimit) {
+    if ((uint32_t)m_validSamples > m_encoderFramesLeft) {
+      m_trimmedFrames += m_validSamples - m_encoderFramesLeft;
+      m_validSamples = m_encoderFramesLeft;
+    }
+    m_encoderFramesLeft -= m_validSamples;
+  }
+}
+//---------------------------------------------------------------------------------------------------------------------
 int Audio::sendBytes(uint8_t *data, size_t len) {
   int bytesLeft;
-  static bool f_setDecodeParamsOnce = true;
   int nextSync = 0;
   if (!m_f_playing) {
-    f_setDecodeParamsOnce = true;
+    m_f_setDecodeParamsOnce = true;
     nextSync = findNextSync(data, len);
     if (nextSync == 0) {
       m_f_playing = true;
+      if (m_codec == CODEC_MP3 && !m_f_xingChecked) {
+        m_f_xingChecked = true;
+        return skipXingFrame(data, len); // 0 for a normal audio frame
+      }
     }
     return nextSync;
   }
@@ -5033,9 +5484,11 @@ int Audio::sendBytes(uint8_t *data, size_t len) {
     break;
   case CODEC_FLAC:
     ret = FLACDecode(data, &bytesLeft, m_outBuff);
+    m_f_decoderPending = ret == GIVE_NEXT_LOOP;
     break;
   case CODEC_OGG_FLAC:
     ret = FLACDecode(data, &bytesLeft, m_outBuff);
+    m_f_decoderPending = ret == GIVE_NEXT_LOOP;
     break; // FLAC webstream wrapped in OGG
   default: {
     log_e("no valid codec found codec = %d", m_codec);
@@ -5074,8 +5527,8 @@ int Audio::sendBytes(uint8_t *data, size_t len) {
       bytesDecoded = 2;
     return bytesDecoded;
   } else { // ret>=0
-    if (f_setDecodeParamsOnce) {
-      f_setDecodeParamsOnce = false;
+    if (m_f_setDecodeParamsOnce) {
+      m_f_setDecodeParamsOnce = false;
       m_PlayingStartTime = millis();
 
       if (m_codec == CODEC_MP3) {
@@ -5100,6 +5553,7 @@ int Audio::sendBytes(uint8_t *data, size_t len) {
     }
     if (m_codec == CODEC_MP3) {
       m_validSamples = MP3GetOutputSamps() / getChannels();
+      trimEncoderEdges();
     }
     if ((m_codec == CODEC_AAC) || (m_codec == CODEC_M4A)) {
       m_validSamples = AACGetOutputSamps() / getChannels();
@@ -5124,11 +5578,6 @@ int Audio::sendBytes(uint8_t *data, size_t len) {
 }
 //---------------------------------------------------------------------------------------------------------------------
 void Audio::compute_audioCurrentTime(int bd) {
-  static uint16_t loop_counter = 0;
-  static int old_bitrate = 0;
-  static uint64_t sum_bitrate = 0;
-  static boolean f_CBR = true; // constant bitrate
-
   if (m_codec == CODEC_MP3) {
     setBitrate(MP3GetBitrate());
   } // if not CBR, bitrate can be changed
@@ -5146,33 +5595,33 @@ void Audio::compute_audioCurrentTime(int bd) {
 
   //- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
   if (m_avr_bitrate == 0) { // first time
-    loop_counter = 0;
-    old_bitrate = 0;
-    sum_bitrate = 0;
-    f_CBR = true;
+    m_bitrateLoops = 0;
+    m_oldBitrate = 0;
+    m_sumBitrate = 0;
+    m_f_CBR = true;
     m_avr_bitrate = getBitRate();
-    old_bitrate = getBitRate();
+    m_oldBitrate = getBitRate();
   }
   if (!m_avr_bitrate)
     return;
   //- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
 
-  if (loop_counter < 1000)
-    loop_counter++;
+  if (m_bitrateLoops < 1000)
+    m_bitrateLoops++;
 
-  if ((old_bitrate != getBitRate()) && f_CBR) {
+  if ((m_oldBitrate != getBitRate()) && m_f_CBR) {
     if (audio_info)
       audio_info("VBR recognized, audioFileDuration is estimated");
-    f_CBR = false; // variable bitrate
+    m_f_CBR = false; // variable bitrate
   }
-  old_bitrate = getBitRate();
+  m_oldBitrate = getBitRate();
 
-  if (!f_CBR) {
-    if (loop_counter > 20 && loop_counter < 200) {
+  if (!m_f_CBR) {
+    if (m_bitrateLoops > 20 && m_bitrateLoops < 200) {
       // if VBR: m_avr_bitrate is average of the first values of m_bitrate
-      sum_bitrate += getBitRate();
-      m_avr_bitrate = sum_bitrate / (loop_counter - 20);
-      if (loop_counter == 199 && m_resumeFilePos) {
+      m_sumBitrate += getBitRate();
+      m_avr_bitrate = m_sumBitrate / (m_bitrateLoops - 20);
+      if (m_bitrateLoops == 199 && m_resumeFilePos) {
         m_audioCurrentTime =
             ((getFilePos() - m_audioDataStart - inBufferFilled()) /
              m_avr_bitrate) *
@@ -5180,7 +5629,7 @@ void Audio::compute_audioCurrentTime(int bd) {
       }
     }
   } else {
-    if (loop_counter == 2) {
+    if (m_bitrateLoops == 2) {
       m_avr_bitrate = getBitRate();
       if (m_resumeFilePos) { // if connecttoFS() is called with resumeFilePos !=
                              // 0
@@ -5398,6 +5847,7 @@ uint32_t Audio::getAudioDataStartPos() {
 }
 //---------------------------------------------------------------------------------------------------------------------
 uint32_t Audio::getAudioFileDuration() {
+  selectDecoders();
   if (getDatamode() == AUDIO_LOCALFILE) {
     if (!audiofile)
       return 0;
@@ -5500,7 +5950,16 @@ bool Audio::audioFileSeek(const float speed) {
 bool Audio::setSampleRate(uint32_t sampRate) {
   if (!sampRate)
     sampRate = 16000; // fuse, if there is no value -> set default #209
-  i2s_set_sample_rates((i2s_port_t)m_i2s_num, sampRate);
+  if (sampRate == m_sampleRate &&
+      (m_f_gapless || m_f_fastStart || m_f_queuedOutput))
+    return true; // reprogramming the clock would drop the queued DMA data
+  if (m_f_queuedOutput && audio_sample_rate) {
+    // frames of the old rate are still queued, the owner of the queue
+    // switches the clock with applySampleRate() when it gets here
+    audio_sample_rate(sampRate);
+  } else {
+    applySampleRate(sampRate);
+  }
   m_sampleRate = sampRate;
   IIR_calculateCoefficients(
       m_gain0, m_gain1,
@@ -5509,6 +5968,19 @@ bool Audio::setSampleRate(uint32_t sampRate) {
 }
 uint32_t Audio::getSampleRate() { return m_sampleRate; }
 //---------------------------------------------------------------------------------------------------------------------
+void Audio::applySampleRate(uint32_t sampRate) {
+  if (sampRate == m_i2sRate)
+    return;
+  if (m_f_queuedOutput) {
+    // let the DMA play out what it holds at the old rate, it is never
+    // more than dma_buf_count buffers
+    uint32_t frames = m_i2s_config.dma_buf_len * m_i2s_config.dma_buf_count;
+    vTaskDelay(pdMS_TO_TICKS(frames * 1000 / m_i2sRate + 1));
+  }
+  i2s_set_sample_rates((i2s_port_t)m_i2s_num, sampRate);
+  m_i2sRate = sampRate;
+}
+//---------------------------------------------------------------------------------------------------------------------
 bool Audio::setBitsPerSample(int bits) {
   if ((bits != 16) && (bits != 8))
     return false;
@@ -5577,53 +6049,6 @@ void Audio::setI2SCommFMT_LSB(bool commFMT) {
   i2s_driver_install((i2s_port_t)m_i2s_num, &m_i2s_config, 0, NULL);
 }
 //---------------------------------------------------------------------------------------------------------------------
-bool Audio::playSample(int16_t sample[2]) {
-
-  if (getBitsPerSample() ==
-      8) { // Upsample from unsigned 8 bits to signed 16 bits
-    sample[LEFTCHANNEL] = ((sample[LEFTCHANNEL] & 0xff) - 128) << 8;
-    sample[RIGHTCHANNEL] = ((sample[RIGHTCHANNEL] & 0xff) - 128) << 8;
-  }
-
-  sample[LEFTCHANNEL] =
-      sample[LEFTCHANNEL] >> 1; // half Vin so we can boost up to 6dB in filters
-  sample[RIGHTCHANNEL] = sample[RIGHTCHANNEL] >> 1;
-
-  // Filterchain, can commented out if not used
-  sample = IIR_filterChain0(sample);
-  sample = IIR_filterChain1(sample);
-  sample = IIR_filterChain2(sample);
-  //-------------------------------------------
-
-  uint32_t s32 = Gain(sample); // vosample2lume;
-
-  if (audio_process_i2s) {
-    // process audio sample just before writing to i2s
-    bool continueI2S = false;
-    audio_process_i2s(&s32, &continueI2S);
-    if (!continueI2S) {
-      return true;
-    }
-  }
-
-  if (m_f_internalDAC) {
-    s32 += 0x80008000;
-  }
-  m_i2s_bytesWritten = 0;
-  esp_err_t err = i2s_write((i2s_port_t)m_i2s_num, (const char *)&s32,
-                            sizeof(uint32_t), &m_i2s_bytesWritten, 100);
-  if (err != ESP_OK) {
-    log_e("ESP32 Errorcode %i", err);
-    return false;
-  }
-  if (m_i2s_bytesWritten < 4) {
-    log_e("Can't stuff any more in I2S..."); // increase waitingtime or
-                                             // outputbuffer
-    return false;
-  }
-  return true;
-}
-//---------------------------------------------------------------------------------------------------------------------
 void Audio::setTone(int8_t gainLowPass, int8_t gainBandPass,
                     int8_t gainHighPass) {
   // see https://www.earlevel.com/main/2013/10/13/biquad-calculator-v2/
@@ -5642,11 +6067,7 @@ void Audio::setTone(int8_t gainLowPass, int8_t gainBandPass,
      produced.
   */
   /*
-  int16_t tmp[2]; tmp[0] = 0; tmp[1]= 0;
-
-  IIR_filterChain0(tmp, true ); // flush the filter
-  IIR_filterChain1(tmp, true ); // flush the filter
-  IIR_filterChain2(tmp, true ); // flush the filter
+  memset(m_filterBuff, 0, sizeof(m_filterBuff)); // flush the filter
   */
 }
 //---------------------------------------------------------------------------------------------------------------------
@@ -5660,12 +6081,14 @@ void Audio::setBalance(int8_t bal) { // bal -16...16
   if (bal > 16)
     bal = 16;
   m_balance = bal;
+  updateGain();
 }
 //---------------------------------------------------------------------------------------------------------------------
 void Audio::setVolume(uint8_t vol) { // vol 22 steps, 0...21
   if (vol > 21)
     vol = 21;
   m_vol = volumetable[vol];
+  updateGain();
 }
 //---------------------------------------------------------------------------------------------------------------------
 uint8_t Audio::getVolume() {
@@ -5679,24 +6102,40 @@ uint8_t Audio::getVolume() {
 //---------------------------------------------------------------------------------------------------------------------
 uint8_t Audio::getI2sPort() { return m_i2s_num; }
 //---------------------------------------------------------------------------------------------------------------------
-int32_t Audio::Gain(int16_t s[2]) {
-  int32_t v[2];
-  float step = (float)m_vol / 64;
-  uint8_t l = 0, r = 0;
-
+void Audio::setQueuedOutput(bool queued) { m_f_queuedOutput = queued; }
+//---------------------------------------------------------------------------------------------------------------------
+void Audio::updateGain() {
+  // volume and balance as one integer factor per channel, applied while the
+  // block is widened in stageI2SBlock(); m_vol 64 keeps the -6 dB the chain
+  // always had, so loudness is unchanged and a +6 dB tone boost still fits
+  int32_t l = 0, r = 0;
   if (m_balance < 0) {
-    step = step * (float)(abs(m_balance) * 4);
-    l = (uint8_t)(step);
+    l = m_vol * -m_balance / 16;
   }
   if (m_balance > 0) {
-    step = step * m_balance * 4;
-    r = (uint8_t)(step);
+    r = m_vol * m_balance / 16;
+  }
+  m_gainL = (m_vol - l) << (DSP_SHIFT - 7);
+  m_gainR = (m_vol - r) << (DSP_SHIFT - 7);
+}
+//---------------------------------------------------------------------------------------------------------------------
+void Audio::packI2SBlock(const int32_t *in, uint32_t *out, uint16_t frames) {
+  // the only requantisation in the chain: round to 16 bit and saturate
+  const int32_t half = 1 << (DSP_SHIFT - 1);
+  for (uint16_t i = 0; i < frames; i++) {
+    int32_t vL = (in[LEFTCHANNEL] + half) >> DSP_SHIFT;
+    int32_t vR = (in[RIGHTCHANNEL] + half) >> DSP_SHIFT;
+    if (vL > 32767)
+      vL = 32767;
+    if (vL < -32768)
+      vL = -32768;
+    if (vR > 32767)
+      vR = 32767;
+    if (vR < -32768)
+      vR = -32768;
+    out[i] = (vL << 16) | (vR & 0xffff);
+    in += 2;
   }
-
-  v[LEFTCHANNEL] = (s[LEFTCHANNEL] * (m_vol - l)) >> 6;
-  v[RIGHTCHANNEL] = (s[RIGHTCHANNEL] * (m_vol - r)) >> 6;
-
-  return (v[LEFTCHANNEL] << 16) | (v[RIGHTCHANNEL] & 0xffff);
 }
 //---------------------------------------------------------------------------------------------------------------------
 uint32_t Audio::inBufferFilled() {
@@ -5821,157 +6260,46 @@ void Audio::IIR_calculateCoefficients(
   //                                                  m_filter[2].b2);
 }
 //---------------------------------------------------------------------------------------------------------------------
-int16_t *
-Audio::IIR_filterChain0(int16_t iir_in[2],
-                        bool clear) { // Infinite Impulse Response (IIR) filters
+void Audio::IIR_filterBlock(
+    int32_t *buff,
+    uint16_t frames) { // Infinite Impulse Response (IIR) filters, L/R pairs
 
-  uint8_t z1 = 0, z2 = 1;
+  enum : uint8_t { z1 = 0, z2 = 1 };
   enum : uint8_t { in = 0, out = 1 };
-  float inSample[2];
-  float outSample[2];
-  static int16_t iir_out[2];
-
-  if (clear) {
-    memset(m_filterBuff, 0, sizeof(m_filterBuff)); // zero IIR filterbuffer
-    iir_out[0] = 0;
-    iir_out[1] = 0;
-    iir_in[0] = 0;
-    iir_in[1] = 0;
-  }
-
-  inSample[LEFTCHANNEL] = (float)(iir_in[LEFTCHANNEL]);
-  inSample[RIGHTCHANNEL] = (float)(iir_in[RIGHTCHANNEL]);
-
-  outSample[LEFTCHANNEL] =
-      m_filter[0].a0 * inSample[LEFTCHANNEL] +
-      m_filter[0].a1 * m_filterBuff[0][z1][in][LEFTCHANNEL] +
-      m_filter[0].a2 * m_filterBuff[0][z2][in][LEFTCHANNEL] -
-      m_filter[0].b1 * m_filterBuff[0][z1][out][LEFTCHANNEL] -
-      m_filter[0].b2 * m_filterBuff[0][z2][out][LEFTCHANNEL];
-
-  m_filterBuff[0][z2][in][LEFTCHANNEL] = m_filterBuff[0][z1][in][LEFTCHANNEL];
-  m_filterBuff[0][z1][in][LEFTCHANNEL] = inSample[LEFTCHANNEL];
-  m_filterBuff[0][z2][out][LEFTCHANNEL] = m_filterBuff[0][z1][out][LEFTCHANNEL];
-  m_filterBuff[0][z1][out][LEFTCHANNEL] = outSample[LEFTCHANNEL];
-  iir_out[LEFTCHANNEL] = (int16_t)outSample[LEFTCHANNEL];
-
-  outSample[RIGHTCHANNEL] =
-      m_filter[0].a0 * inSample[RIGHTCHANNEL] +
-      m_filter[0].a1 * m_filterBuff[0][z1][in][RIGHTCHANNEL] +
-      m_filter[0].a2 * m_filterBuff[0][z2][in][RIGHTCHANNEL] -
-      m_filter[0].b1 * m_filterBuff[0][z1][out][RIGHTCHANNEL] -
-      m_filter[0].b2 * m_filterBuff[0][z2][out][RIGHTCHANNEL];
-
-  m_filterBuff[0][z2][in][RIGHTCHANNEL] = m_filterBuff[0][z1][in][RIGHTCHANNEL];
-  m_filterBuff[0][z1][in][RIGHTCHANNEL] = inSample[RIGHTCHANNEL];
-  m_filterBuff[0][z2][out][RIGHTCHANNEL] =
-      m_filterBuff[0][z1][out][RIGHTCHANNEL];
-  m_filterBuff[0][z1][out][RIGHTCHANNEL] = outSample[RIGHTCHANNEL];
-  iir_out[RIGHTCHANNEL] = (int16_t)outSample[RIGHTCHANNEL];
-
-  return iir_out;
-}
-//---------------------------------------------------------------------------------------------------------------------
-int16_t *
-Audio::IIR_filterChain1(int16_t iir_in[2],
-                        bool clear) { // Infinite Impulse Response (IIR) filters
 
-  uint8_t z1 = 0, z2 = 1;
-  enum : uint8_t { in = 0, out = 1 };
-  float inSample[2];
-  float outSample[2];
-  static int16_t iir_out[2];
-
-  if (clear) {
-    memset(m_filterBuff, 0, sizeof(m_filterBuff)); // zero IIR filterbuffer
-    iir_out[0] = 0;
-    iir_out[1] = 0;
-    iir_in[0] = 0;
-    iir_in[1] = 0;
-  }
-
-  inSample[LEFTCHANNEL] = (float)(iir_in[LEFTCHANNEL]);
-  inSample[RIGHTCHANNEL] = (float)(iir_in[RIGHTCHANNEL]);
-
-  outSample[LEFTCHANNEL] =
-      m_filter[1].a0 * inSample[LEFTCHANNEL] +
-      m_filter[1].a1 * m_filterBuff[1][z1][in][LEFTCHANNEL] +
-      m_filter[1].a2 * m_filterBuff[1][z2][in][LEFTCHANNEL] -
-      m_filter[1].b1 * m_filterBuff[1][z1][out][LEFTCHANNEL] -
-      m_filter[1].b2 * m_filterBuff[1][z2][out][LEFTCHANNEL];
-
-  m_filterBuff[1][z2][in][LEFTCHANNEL] = m_filterBuff[1][z1][in][LEFTCHANNEL];
-  m_filterBuff[1][z1][in][LEFTCHANNEL] = inSample[LEFTCHANNEL];
-  m_filterBuff[1][z2][out][LEFTCHANNEL] = m_filterBuff[1][z1][out][LEFTCHANNEL];
-  m_filterBuff[1][z1][out][LEFTCHANNEL] = outSample[LEFTCHANNEL];
-  iir_out[LEFTCHANNEL] = (int16_t)outSample[LEFTCHANNEL];
-
-  outSample[RIGHTCHANNEL] =
-      m_filter[1].a0 * inSample[RIGHTCHANNEL] +
-      m_filter[1].a1 * m_filterBuff[1][z1][in][RIGHTCHANNEL] +
-      m_filter[1].a2 * m_filterBuff[1][z2][in][RIGHTCHANNEL] -
-      m_filter[1].b1 * m_filterBuff[1][z1][out][RIGHTCHANNEL] -
-      m_filter[1].b2 * m_filterBuff[1][z2][out][RIGHTCHANNEL];
-
-  m_filterBuff[1][z2][in][RIGHTCHANNEL] = m_filterBuff[1][z1][in][RIGHTCHANNEL];
-  m_filterBuff[1][z1][in][RIGHTCHANNEL] = inSample[RIGHTCHANNEL];
-  m_filterBuff[1][z2][out][RIGHTCHANNEL] =
-      m_filterBuff[1][z1][out][RIGHTCHANNEL];
-  m_filterBuff[1][z1][out][RIGHTCHANNEL] = outSample[RIGHTCHANNEL];
-  iir_out[RIGHTCHANNEL] = (int16_t)outSample[RIGHTCHANNEL];
-
-  return iir_out;
-}
-//---------------------------------------------------------------------------------------------------------------------
-int16_t *
-Audio::IIR_filterChain2(int16_t iir_in[2],
-                        bool clear) { // Infinite Impulse Response (IIR) filters
-
-  uint8_t z1 = 0, z2 = 1;
-  enum : uint8_t { in = 0, out = 1 };
-  float inSample[2];
-  float outSample[2];
-  static int16_t iir_out[2];
-
-  if (clear) {
-    memset(m_filterBuff, 0, sizeof(m_filterBuff)); // zero IIR filterbuffer
-    iir_out[0] = 0;
-    iir_out[1] = 0;
-    iir_in[0] = 0;
-    iir_in[1] = 0;
-  }
-
-  inSample[LEFTCHANNEL] = (float)(iir_in[LEFTCHANNEL]);
-  inSample[RIGHTCHANNEL] = (float)(iir_in[RIGHTCHANNEL]);
-
-  outSample[LEFTCHANNEL] =
-      m_filter[2].a0 * inSample[LEFTCHANNEL] +
-      m_filter[2].a1 * m_filterBuff[2][z1][in][LEFTCHANNEL] +
-      m_filter[2].a2 * m_filterBuff[2][z2][in][LEFTCHANNEL] -
-      m_filter[2].b1 * m_filterBuff[2][z1][out][LEFTCHANNEL] -
-      m_filter[2].b2 * m_filterBuff[2][z2][out][LEFTCHANNEL];
-
-  m_filterBuff[2][z2][in][LEFTCHANNEL] = m_filterBuff[2][z1][in][LEFTCHANNEL];
-  m_filterBuff[2][z1][in][LEFTCHANNEL] = inSample[LEFTCHANNEL];
-  m_filterBuff[2][z2][out][LEFTCHANNEL] = m_filterBuff[2][z1][out][LEFTCHANNEL];
-  m_filterBuff[2][z1][out][LEFTCHANNEL] = outSample[LEFTCHANNEL];
-  iir_out[LEFTCHANNEL] = (int16_t)outSample[LEFTCHANNEL];
-
-  outSample[RIGHTCHANNEL] =
-      m_filter[2].a0 * inSample[RIGHTCHANNEL] +
-      m_filter[2].a1 * m_filterBuff[2][z1][in][RIGHTCHANNEL] +
-      m_filter[2].a2 * m_filterBuff[2][z2][in][RIGHTCHANNEL] -
-      m_filter[2].b1 * m_filterBuff[2][z1][out][RIGHTCHANNEL] -
-      m_filter[2].b2 * m_filterBuff[2][z2][out][RIGHTCHANNEL];
-
-  m_filterBuff[2][z2][in][RIGHTCHANNEL] = m_filterBuff[2][z1][in][RIGHTCHANNEL];
-  m_filterBuff[2][z1][in][RIGHTCHANNEL] = inSample[RIGHTCHANNEL];
-  m_filterBuff[2][z2][out][RIGHTCHANNEL] =
-      m_filterBuff[2][z1][out][RIGHTCHANNEL];
-  m_filterBuff[2][z1][out][RIGHTCHANNEL] = outSample[RIGHTCHANNEL];
-  iir_out[RIGHTCHANNEL] = (int16_t)outSample[RIGHTCHANNEL];
-
-  return iir_out;
+  // running each filter over the whole block before the next one gives the
+  // same result as chaining them per sample, but the state stays in registers
+  const int8_t gains[3] = {m_gain0, m_gain1, m_gain2};
+  for (int f = 0; f < 3; f++) {
+    if (gains[f] == 0) {
+      // 0 dB is a pass through, drop the history so that a later boost or
+      // cut does not start from stale samples
+      memset(m_filterBuff[f], 0, sizeof(m_filterBuff[f]));
+      continue;
+    }
+    const filter_t c = m_filter[f];
+    for (int ch = LEFTCHANNEL; ch <= RIGHTCHANNEL; ch++) {
+      float x1 = m_filterBuff[f][z1][in][ch];
+      float x2 = m_filterBuff[f][z2][in][ch];
+      float y1 = m_filterBuff[f][z1][out][ch];
+      float y2 = m_filterBuff[f][z2][out][ch];
+      int32_t *p = buff + ch;
+      for (uint16_t i = 0; i < frames; i++) {
+        float x = (float)(*p);
+        float y = c.a0 * x + c.a1 * x1 + c.a2 * x2 - c.b1 * y1 - c.b2 * y2;
+        x2 = x1;
+        x1 = x;
+        y2 = y1;
+        y1 = y;
+        *p = (int32_t)y;
+        p += 2;
+      }
+      m_filterBuff[f][z1][in][ch] = x1;
+      m_filterBuff[f][z2][in][ch] = x2;
+      m_filterBuff[f][z1][out][ch] = y1;
+      m_filterBuff[f][z2][out][ch] = y2;
+    }
+  }
 }
 //----------------------------------------------------------------------------------------------------------------------
 //    AAC - T R A N S P O R T S T R E A M
@@ -27,6 +27,8 @@
 #include <driver/i2s.h>
 #include <vector>
 
+#include "decoder_pool.h"
+
 #ifdef SDFATFS_USED
 #include <SdFat.h> // https://github.com/greiman/SdFat
 #else
@@ -73,7 +75,14 @@ using namespace fs;
 
 using namespace std;
 
+struct MP3Decoder_t; // decoder contexts, see the decoder headers
+struct AACDecoder_t;
+struct FLACDecoder_t;
+
 extern __attribute__((weak)) void audio_info(const char *);
+// Bracket local file refills so the host can arbitrate a shared SPI bus.
+extern __attribute__((weak)) void audio_file_io_begin();
+extern __attribute__((weak)) void audio_file_io_end();
 extern __attribute__((weak)) void audio_id3data(const char *); // ID3 metadata
 extern __attribute__((weak)) void
 audio_id3image(File &file, const size_t pos,
@@ -96,6 +105,17 @@ audio_process_extern(int16_t *buff, uint16_t len,
 extern __attribute__((weak)) void
 audio_process_i2s(uint32_t *sample,
                   bool *continueI2S); // record audiodata or send via BT
+extern __attribute__((weak)) void
+audio_process_i2s_block(uint32_t *samples, uint16_t frames,
+                        bool *continueI2S); // whole block before i2s_write
+// In place on the 32 bit DSP block (interleaved L/R, 16 bit PCM scaled by
+// 1 << Audio::DSP_SHIFT, volume and balance already applied), before the tone
+// filters and the final saturation to 16 bit
+extern __attribute__((weak)) void audio_process_dsp_block(int32_t *samples,
+                                                          uint16_t frames);
+// With setQueuedOutput(): the frames queued from now on are at a new sample
+// rate; call Audio::applySampleRate() once output gets to them
+extern __attribute__((weak)) void audio_sample_rate(uint32_t rate);
 
 #define AUDIO_INFO(...)                                                        \
   {                                                                            \
@@ -195,6 +215,35 @@ public:
 #endif
   bool connecttoFS(fs::FS &fs, const char *path, uint32_t resumeFilePos = 0);
   bool connecttoSD(const char *path, uint32_t resumeFilePos = 0);
+  // What an earlier pass over the file found out about its header, so a
+  // start can skip the header walk. sampleRate 0 means unknown.
+  struct StartInfo {
+    uint32_t fileSize;   // the file as it was seen
+    uint32_t dataStart;  // first byte of the first audio frame
+    uint32_t sampleRate;
+    uint8_t channels;
+    uint8_t bitsPerSample;
+    uint16_t flacMaxBlockSize; // FLAC STREAMINFO, 0 for MP3
+    uint16_t flacMaxFrameSize;
+    uint32_t flacTotalSamples;
+  };
+  // Like connecttoFS(), but for MP3 and FLAC it seeks straight to dataStart,
+  // programs I2S from start and plays as soon as the first frames are in.
+  // Falls back to the header walk when start does not fit the file.
+  bool connecttoFS(fs::FS &fs, const char *path, const StartInfo &start);
+  // Gapless playback: opens the file that follows the current one, reads
+  // its first bytes ahead and, with setDecoderPool(), sets its decoder up on
+  // a spare set of contexts. At end of file the stream moves straight on to
+  // it, keeping I2S running, and audio_eof_mp3() is called with
+  // isRunning() already true again. stopSong() drops a pending preroll.
+  bool prerollFS(fs::FS &fs, const char *path);
+  void cancelPreroll();
+  bool hasPreroll() { return (bool)m_prerollFile; }
+  // Gives this instance decoder contexts of its own, allocated from pool
+  // (NULL: the decoders' default pool), so it can decode alongside another
+  // Audio object, plus the spare set prerollFS() uses. Without it the
+  // shared default contexts are used. Stops the current song.
+  bool setDecoderPool(const DecoderPool_t *pool);
   bool setFileLoop(bool input); // TEST loop
 #ifndef AUDIO_NO_NETWORK
   void setConnectionTimeout(uint16_t timeout_ms, uint16_t timeout_ms_ssl);
@@ -215,6 +264,13 @@ public:
   void setVolume(uint8_t vol);
   uint8_t getVolume();
   uint8_t getI2sPort();
+  // PCM is queued by audio_process_i2s_block() and written by another task
+  // through writeI2SBlock(): Audio then leaves the DMA alone, no silence
+  // from playI2Sremains() and no i2s_zero_dma_buffer() in stopSong().
+  void setQueuedOutput(bool queued);
+  // Programs the I2S clock; with queued output it first waits until the
+  // DMA has played what it holds. See audio_sample_rate().
+  void applySampleRate(uint32_t sampRate);
 
   uint32_t getAudioDataStartPos();
   uint32_t getFileSize();
@@ -226,6 +282,10 @@ public:
   uint32_t getAudioFileDuration();
   uint32_t getAudioCurrentTime();
   uint32_t getTotalPlayingTime();
+  // Silent frames Audio pushed out itself (playI2Sremains()) since the last
+  // end of file, and MP3 frames dropped as encoder delay and padding.
+  uint32_t getSilenceSinceEof() { return m_silenceFrames - m_silenceAtEof; }
+  uint32_t getTrimmedFrames() { return m_trimmedFrames; }
 
   esp_err_t i2s_mclk_pin_select(const uint8_t pin);
   uint32_t
@@ -237,6 +297,24 @@ public:
   int getCodec() { return m_codec; }
   const char *getCodecname() { return codecname[m_codec]; }
 
+  struct I2SStats {
+    uint32_t blocks = 0;      // blocks handed to the I2S driver
+    uint32_t frames = 0;      // stereo frames written
+    uint32_t writeCalls = 0;  // i2s_write() calls
+    uint32_t shortWrites = 0; // calls that timed out before the block fit
+    uint32_t droppedBlocks = 0; // blocks given up after I2S_MAX_STALLS
+    uint64_t dspCycles = 0;   // CPU cycles spent converting/filtering
+    uint64_t writeCycles = 0; // CPU cycles spent inside i2s_write()
+  };
+  // false on a driver error, or once I2S_MAX_STALLS calls in a row moved
+  // nothing; the rest of the block is dropped
+  bool writeI2SBlock(uint32_t *frames, uint16_t count); // L<<16 | R
+  static const uint8_t I2S_MAX_STALLS = 3; // x 100 ticks write timeout
+  // fractional bits of the 32 bit DSP block below the 16 bit output LSB
+  static const uint8_t DSP_SHIFT = 12;
+  const I2SStats &getI2SStats() { return m_i2sStats; }
+  void resetI2SStats() { m_i2sStats = I2SStats(); }
+
 private:
 #ifndef ESP_ARDUINO_VERSION_VAL
 #define ESP_ARDUINO_VERSION_MAJOR 0
@@ -247,6 +325,17 @@ private:
   void UTF8toASCII(char *str);
   bool latinToUTF8(char *buff, size_t bufflen);
   void setDefaults(); // free buffers and set defaults
+  void selectDecoders();
+  void destroyDecoders();
+  bool prepareNextDecoder(uint8_t codec);
+  void releaseNextDecoder();
+  void resetFileState();
+  bool openLocalFile(fs::FS &fs, const char *path, File &file);
+  uint8_t codecFromFileName(const char *name);
+  void startPrerolled();
+  bool applyStartInfo(const StartInfo &start);
+  int skipXingFrame(uint8_t *data, size_t len);
+  void trimEncoderEdges();
   void initInBuff();
 #ifndef AUDIO_NO_NETWORK
   bool httpPrint(const char *host);
@@ -282,9 +371,10 @@ private:
   bool setChannels(int channels);
   bool setBitrate(int br);
   bool playChunk();
-  bool playSample(int16_t sample[2]);
+  uint16_t stageI2SBlock();
   void playI2Sremains();
-  int32_t Gain(int16_t s[2]);
+  void packI2SBlock(const int32_t *in, uint32_t *out, uint16_t frames);
+  void updateGain();
   bool fill_InputBuf();
   void showstreamtitle(const char *ml);
 #ifndef AUDIO_NO_NETWORK
@@ -297,9 +387,7 @@ private:
 #ifndef AUDIO_NO_NETWORK
   void urlencode(char *buff, uint16_t buffLen, bool spacesOnly = false);
 #endif
-  int16_t *IIR_filterChain0(int16_t iir_in[2], bool clear = false);
-  int16_t *IIR_filterChain1(int16_t *iir_in, bool clear = false);
-  int16_t *IIR_filterChain2(int16_t *iir_in, bool clear = false);
+  void IIR_filterBlock(int32_t *buff, uint16_t frames);
   inline void setDatamode(uint8_t dm) { m_datamode = dm; }
   inline uint8_t getDatamode() { return m_datamode; }
 #ifndef AUDIO_NO_NETWORK
@@ -586,6 +674,40 @@ private:
   } pid_array;
 
   File audiofile; // @suppress("Abstract class cannot be instantiated")
+  File m_prerollFile;            // next file, see prerollFS()
+  uint8_t m_prerollCodec = 0;    // CODEC_xxx of m_prerollFile
+  uint8_t *m_prerollBuff = NULL; // bytes read ahead from the file start
+  uint32_t m_prerollSize = 0;    // capacity of m_prerollBuff
+  uint32_t m_prerollLen = 0;     // bytes in m_prerollBuff
+  uint32_t m_prerollPos = 0;     // bytes of them already moved into InBuff
+  bool m_f_xingChecked = false;     // first MP3 frame looked at
+  bool m_f_decoderPending = false;  // FLAC block not fully handed out yet
+  bool m_f_encoderLimit = false;    // m_encoderFramesLeft is valid
+  uint32_t m_encoderSkip = 0;       // MP3 frames of encoder delay left
+  uint32_t m_encoderFramesLeft = 0; // MP3 frames before the padding
+  uint32_t m_trimmedFrames = 0;     // dropped by trimEncoderEdges()
+  uint32_t m_silenceFrames = 0;     // pushed by playI2Sremains()
+  uint32_t m_silenceAtEof = 0;      // m_silenceFrames at the last eof
+  MP3Decoder_t *m_mp3Ctx = NULL; // own decoder contexts, NULL: shared ones
+  AACDecoder_t *m_aacCtx = NULL;
+  FLACDecoder_t *m_flacCtx = NULL;
+  MP3Decoder_t *m_nextMp3Ctx = NULL; // spares, set up for m_prerollFile
+  AACDecoder_t *m_nextAacCtx = NULL;
+  FLACDecoder_t *m_nextFlacCtx = NULL;
+  bool m_f_nextDecoderReady = false; // spares hold the next file's decoder
+  bool m_f_decoderReady = false;     // ours were set up by the preroll
+  // per stream state of processLocalFile(), findNextSync(), sendBytes() and
+  // compute_audioCurrentTime()
+  bool m_f_stream = false;           // first audio data received
+  bool m_f_fileDataComplete = false; // all file data read
+  uint32_t m_byteCounter = 0;        // bytes read from the file
+  uint8_t m_playCounter = 0;         // loops since the last playAudioData()
+  uint32_t m_syncNotFound = 0;       // sync word misses in a row
+  bool m_f_setDecodeParamsOnce = true;
+  uint16_t m_bitrateLoops = 0; // bitrate samples taken, up to 1000
+  int m_oldBitrate = 0;
+  uint64_t m_sumBitrate = 0;
+  bool m_f_CBR = true; // constant bitrate
 #ifndef AUDIO_NO_NETWORK
   WiFiClient client; // @suppress("Abstract class cannot be instantiated")
   WiFiClientSecure
@@ -617,6 +739,7 @@ private:
   filter_t m_filter[3]; // digital filters
   int m_LFcount = 0;    // Detection of end of header
   uint32_t m_sampleRate = 16000;
+  uint32_t m_i2sRate = 16000; // last rate programmed into I2S
   uint32_t m_bitRate = 0;     // current bitrate given fom decoder
   uint32_t m_avr_bitrate = 0; // average bitrate, median computed by VBR
   int m_readbytes = 0;        // bytes read
@@ -624,6 +747,8 @@ private:
   int m_controlCounter = 0; // Status within readID3data() and readWaveHeader()
   int8_t m_balance = 0;     // -16 (mute left) ... +16 (mute right)
   uint8_t m_vol = 64;       // volume
+  int32_t m_gainL = 64 << 5; // volume and balance, 1 << DSP_SHIFT is 0 dB
+  int32_t m_gainR = 64 << 5;
   uint8_t m_bitsPerSample = 16; // bitsPerSample
   uint8_t m_channels = 2;
   uint8_t m_i2s_num = I2S_NUM_0; // I2S_NUM_0 or I2S_NUM_1
@@ -641,6 +766,14 @@ private:
   int16_t m_outBuff[2048 * 2]; // Interleaved L/R
   int16_t m_validSamples = 0;
   int16_t m_curSample = 0;
+  // playChunk() converts m_outBuff into m_i2sStage (interleaved L/R, 32 bit
+  // with volume and balance applied), runs the EQ hook and the tone filters in
+  // place, rounds and saturates once into L<<16 | R in m_i2sBlock and hands
+  // the whole block to the DMA with a single i2s_write()
+  static const uint16_t m_i2sBlockFrames = 512;
+  int32_t m_i2sStage[m_i2sBlockFrames * 2];
+  uint32_t m_i2sBlock[m_i2sBlockFrames];
+  I2SStats m_i2sStats;
   uint16_t m_datamode = 0; // Statemaschine
 #ifndef AUDIO_NO_NETWORK
   uint16_t m_streamTitleHash =
@@ -674,6 +807,9 @@ private:
   bool m_f_firstCall =
       false; // InitSequence for processWebstream and processLokalFile
   bool m_f_playing = false;   // valid mp3 stream recognized
+  bool m_f_gapless = false;   // file was entered from a preroll
+  bool m_f_fastStart = false; // header taken from a StartInfo
+  bool m_f_queuedOutput = false; // see setQueuedOutput()
   bool m_f_loop = false;      // Set if audio file should loop
   bool m_f_forceMono = false; // if true stereo -> mono
   bool m_f_internalDAC =
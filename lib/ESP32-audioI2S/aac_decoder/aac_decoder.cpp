@@ -83,15 +83,38 @@ const uint16_t nfftTab[2] = {64, 512};
 const uint8_t nfftlog2Tab[2] = {6, 9};
 const uint8_t cos4sin4tabOffset[2] = {0, 128};
 
-PSInfoBase_t *m_PSInfoBase;
-AACDecInfo_t *m_AACDecInfo;
-AACFrameInfo_t m_AACFrameInfo;
-ADTSHeader_t m_fhADTS;
-ADIFHeader_t m_fhADIF;
-ProgConfigElement_t *m_pce[16];
-PulseInfo_t m_pulseInfo[2]; // [MAX_NCHANS_ELEM]
-aac_BitStreamInfo_t m_aac_BitStreamInfo;
-PSInfoSBR_t *m_PSInfoSBR;
+struct AACDecoder_t {
+  const DecoderPool_t *pool;
+  PSInfoBase_t *PSInfoBase;
+  AACDecInfo_t *AACDecInfo;
+  AACFrameInfo_t AACFrameInfo;
+  ADTSHeader_t fhADTS;
+  ADIFHeader_t fhADIF;
+  ProgConfigElement_t *pce[16];
+  PulseInfo_t pulseInfo[2]; // [MAX_NCHANS_ELEM]
+  aac_BitStreamInfo_t aac_BitStreamInfo;
+  PSInfoSBR_t *PSInfoSBR;
+};
+
+static void *defaultAlloc(void *user, size_t size);
+static void defaultRelease(void *user, void *ptr);
+
+static const DecoderPool_t s_defaultPool = {defaultAlloc, defaultRelease,
+                                            NULL};
+static AACDecoder_t s_defaultContext = {&s_defaultPool};
+// selected context, kept per task so tasks never switch each other's
+static thread_local AACDecoder_t *m_aac = &s_defaultContext;
+
+/* the decoder works on these names, they resolve to the selected context */
+#define m_PSInfoBase (m_aac->PSInfoBase)
+#define m_AACDecInfo (m_aac->AACDecInfo)
+#define m_AACFrameInfo (m_aac->AACFrameInfo)
+#define m_fhADTS (m_aac->fhADTS)
+#define m_fhADIF (m_aac->fhADIF)
+#define m_pce (m_aac->pce)
+#define m_pulseInfo (m_aac->pulseInfo)
+#define m_aac_BitStreamInfo (m_aac->aac_BitStreamInfo)
+#define m_PSInfoSBR (m_aac->PSInfoSBR)
 
 //----------------------------------------------------------------------------------------------------------------------
 inline int MULSHIFT32(int x, int y) {
@@ -6805,13 +6828,52 @@ static const int8_t negMask[3] = {~0x03, ~0x07, ~0x0f};
                           MALLOC_CAP_DEFAULT | MALLOC_CAP_SPIRAM)
 #endif
 
+static void *defaultAlloc(void *user, size_t size) {
+  return __malloc_heap_psram(size);
+}
+static void defaultRelease(void *user, void *ptr) { free(ptr); }
+
+static void *poolAlloc(size_t size) {
+  return m_aac->pool->alloc(m_aac->pool->user, size);
+}
+static void poolRelease(void *ptr) {
+  m_aac->pool->release(m_aac->pool->user, ptr);
+}
+
+AACDecoder_t *AACDecoder_CreateContext(const DecoderPool_t *pool) {
+  if (!pool)
+    pool = &s_defaultPool;
+  AACDecoder_t *ctx =
+      (AACDecoder_t *)pool->alloc(pool->user, sizeof(AACDecoder_t));
+  if (!ctx)
+    return NULL;
+  memset(ctx, 0, sizeof(AACDecoder_t));
+  ctx->pool = pool;
+  return ctx;
+}
+
+void AACDecoder_DestroyContext(AACDecoder_t *ctx) {
+  if (!ctx || ctx == &s_defaultContext)
+    return;
+  AACDecoder_t *prev = AACDecoder_SelectContext(ctx);
+  AACDecoder_FreeBuffers();
+  AACDecoder_SelectContext(prev == ctx ? NULL : prev);
+  ctx->pool->release(ctx->pool->user, ctx);
+}
+
+AACDecoder_t *AACDecoder_SelectContext(AACDecoder_t *ctx) {
+  AACDecoder_t *prev = m_aac;
+  m_aac = ctx ? ctx : &s_defaultContext;
+  return prev;
+}
+
 bool AACDecoder_AllocateBuffers(void) {
 
   /* here, sizes are: AACDecInfo_t:96 PSInfoBase_t:27364
    * ProgConfigElement_t*16:1312 PSInfoSBR_t:50788 */
 #ifdef AAC_ENABLE_SBR
   if (!m_PSInfoSBR) {
-    m_PSInfoSBR = (PSInfoSBR_t *)__malloc_heap_psram(sizeof(PSInfoSBR_t));
+    m_PSInfoSBR = (PSInfoSBR_t *)poolAlloc(sizeof(PSInfoSBR_t));
   }
 
   if (!m_PSInfoSBR) {
@@ -6826,13 +6888,13 @@ bool AACDecoder_AllocateBuffers(void) {
 
   /* these could fall back to PSRAM if not enough heap available */
   if (!m_AACDecInfo) {
-    m_AACDecInfo = (AACDecInfo_t *)__malloc_heap_psram(sizeof(AACDecInfo_t));
+    m_AACDecInfo = (AACDecInfo_t *)poolAlloc(sizeof(AACDecInfo_t));
   }
   if (!m_PSInfoBase) {
-    m_PSInfoBase = (PSInfoBase_t *)__malloc_heap_psram(sizeof(PSInfoBase_t));
+    m_PSInfoBase = (PSInfoBase_t *)poolAlloc(sizeof(PSInfoBase_t));
   }
   if (!m_pce[0]) {
-    m_pce[0] = (ProgConfigElement_t *)__malloc_heap_psram(
+    m_pce[0] = (ProgConfigElement_t *)poolAlloc(
         sizeof(ProgConfigElement_t) * 16);
   }
 
@@ -6924,21 +6986,21 @@ void AACDecoder_FreeBuffers(void) {
   //    uint32_t i = ESP.getFreeHeap();
 
   if (m_AACDecInfo) {
-    free(m_AACDecInfo);
+    poolRelease(m_AACDecInfo);
     m_AACDecInfo = NULL;
   }
   if (m_PSInfoBase) {
-    free(m_PSInfoBase);
+    poolRelease(m_PSInfoBase);
     m_PSInfoBase = NULL;
   }
   if (m_pce[0]) {
-    free(m_pce[0]);
+    poolRelease(m_pce[0]);
     m_pce[0] = NULL;
   }
 
 #ifdef AAC_ENABLE_SBR
   if (m_PSInfoSBR) {
-    free(m_PSInfoSBR);
+    poolRelease(m_PSInfoSBR);
     m_PSInfoSBR = NULL;
   } // Clear AACDecInfo
 #endif
@@ -15995,3 +16057,15 @@ void UnpackSBRChannelPair(int chBase) {
     }
   }
 }
+//----------------------------------------------------------------------------------------------------------------------
+
+/* the context names above are private to this file */
+#undef m_PSInfoBase
+#undef m_AACDecInfo
+#undef m_AACFrameInfo
+#undef m_fhADTS
+#undef m_fhADIF
+#undef m_pce
+#undef m_pulseInfo
+#undef m_aac_BitStreamInfo
+#undef m_PSInfoSBR
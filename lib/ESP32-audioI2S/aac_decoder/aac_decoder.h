@@ -4,6 +4,7 @@
 // #pragma GCC diagnostic ignored "-Wnarrowing"
 
 #include "Arduino.h"
+#include "../decoder_pool.h"
 
 #define AAC_ENABLE_MPEG4
 
@@ -454,6 +455,12 @@ typedef struct _PSInfoSBR {
   int XBuf[32 + 8][64][2];
 } PSInfoSBR_t;
 
+// Decoder state lives in a context, the functions below work on the selected
+// one. See FLACDecoder_SelectContext().
+typedef struct AACDecoder_t AACDecoder_t;
+AACDecoder_t *AACDecoder_CreateContext(const DecoderPool_t *pool);
+void AACDecoder_DestroyContext(AACDecoder_t *ctx);
+AACDecoder_t *AACDecoder_SelectContext(AACDecoder_t *ctx); // NULL: default
 bool AACDecoder_AllocateBuffers(void);
 int AACFlushCodec();
 void AACDecoder_FreeBuffers(void);
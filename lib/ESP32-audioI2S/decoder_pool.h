@@ -0,0 +1,24 @@
+/*
+ * decoder_pool.h
+ *
+ * Memory source for the MP3, AAC and FLAC decoder contexts.
+ *
+ * Each task selects its own context (*Decoder_SelectContext); a task that
+ * never selects one works on the shared default context. Two tasks may
+ * decode at the same time on different contexts, but never on the same
+ * one, and only one task may use the default. Destroying a context another
+ * task still has selected leaves that task pointing at freed memory.
+ */
+#pragma once
+
+#include <stddef.h>
+
+// alloc and release get user back, so a caller can hand out blocks from its
+// own arena. A context keeps a pointer to its pool, the pool has to outlive
+// every context created from it. Passing NULL where a pool is expected uses
+// the decoder's default (heap, PSRAM preferred where it pays off).
+typedef struct DecoderPool_t {
+  void *(*alloc)(void *user, size_t size);
+  void (*release)(void *user, void *ptr);
+  void *user;
+} DecoderPool_t;
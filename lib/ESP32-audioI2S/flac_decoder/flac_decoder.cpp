@@ -11,58 +11,116 @@
  *
  */
 #include "flac_decoder.h"
-#include "vector"
 using namespace std;
 
-FLACFrameHeader_t *FLACFrameHeader;
-FLACMetadataBlock_t *FLACMetadataBlock;
-FLACsubFramesBuff_t *FLACsubFramesBuff;
-
-vector<int32_t> coefs;
 const uint16_t outBuffSize = 2048;
-uint16_t m_blockSize = 0;
-uint16_t m_blockSizeLeft = 0;
-uint16_t m_validSamples = 0;
-uint8_t m_status = 0;
-uint8_t *m_inptr;
-int16_t m_bytesAvail;
-int16_t m_bytesDecoded = 0;
-float m_compressionRatio = 0;
-uint16_t m_rIndex = 0;
-uint64_t m_bitBuffer = 0;
-uint8_t m_bitBufferLen = 0;
-bool m_f_OggS_found = false;
+
+struct FLACDecoder_t {
+  const DecoderPool_t *pool;
+  FLACFrameHeader_t *frameHeader;
+  FLACMetadataBlock_t *metadataBlock;
+  FLACsubFramesBuff_t *subFramesBuff;
+  int32_t coefs[32];
+  uint8_t coefCount;
+  uint16_t blockSize;
+  uint16_t blockSizeLeft;
+  uint16_t validSamples;
+  uint16_t outOffset; // samples of the current block already written out
+  uint8_t status;
+  uint8_t *inptr;
+  int16_t bytesAvail;
+  int16_t bytesDecoded;
+  float compressionRatio;
+  uint16_t rIndex;
+  uint64_t bitBuffer;
+  uint8_t bitBufferLen;
+  bool f_OggS_found;
+  uint32_t decodeCycles; // subframe decode cost since the last log line
+  uint32_t decodeSamples;
+};
+
+static void *defaultAlloc(void *user, size_t size) {
+  return psramFound() ? ps_malloc(size) : malloc(size);
+}
+static void defaultRelease(void *user, void *ptr) { free(ptr); }
+
+static const DecoderPool_t s_defaultPool = {defaultAlloc, defaultRelease,
+                                            NULL};
+static FLACDecoder_t s_defaultContext = {&s_defaultPool};
+// selected context, kept per task so tasks never switch each other's
+static thread_local FLACDecoder_t *m_flac = &s_defaultContext;
+
+// The decoder below works on these names; they resolve to the selected
+// context, so switching streams costs a pointer store.
+#define FLACFrameHeader (m_flac->frameHeader)
+#define FLACMetadataBlock (m_flac->metadataBlock)
+#define FLACsubFramesBuff (m_flac->subFramesBuff)
+#define m_coefs (m_flac->coefs)
+#define m_coefCount (m_flac->coefCount)
+#define m_blockSize (m_flac->blockSize)
+#define m_blockSizeLeft (m_flac->blockSizeLeft)
+#define m_validSamples (m_flac->validSamples)
+#define m_outOffset (m_flac->outOffset)
+#define m_status (m_flac->status)
+#define m_inptr (m_flac->inptr)
+#define m_bytesAvail (m_flac->bytesAvail)
+#define m_bytesDecoded (m_flac->bytesDecoded)
+#define m_compressionRatio (m_flac->compressionRatio)
+#define m_rIndex (m_flac->rIndex)
+#define m_bitBuffer (m_flac->bitBuffer)
+#define m_bitBufferLen (m_flac->bitBufferLen)
+#define m_f_OggS_found (m_flac->f_OggS_found)
+#define m_decodeCycles (m_flac->decodeCycles)
+#define m_decodeSamples (m_flac->decodeSamples)
+
+static void *poolAlloc(size_t size) {
+  return m_flac->pool->alloc(m_flac->pool->user, size);
+}
+static void poolRelease(void *ptr) {
+  m_flac->pool->release(m_flac->pool->user, ptr);
+}
 
 //----------------------------------------------------------------------------------------------------------------------
 //          FLAC INI SECTION
 //----------------------------------------------------------------------------------------------------------------------
+FLACDecoder_t *FLACDecoder_CreateContext(const DecoderPool_t *pool) {
+  if (!pool)
+    pool = &s_defaultPool;
+  FLACDecoder_t *ctx =
+      (FLACDecoder_t *)pool->alloc(pool->user, sizeof(FLACDecoder_t));
+  if (!ctx)
+    return NULL;
+  memset(ctx, 0, sizeof(FLACDecoder_t));
+  ctx->pool = pool;
+  return ctx;
+}
+//----------------------------------------------------------------------------------------------------------------------
+void FLACDecoder_DestroyContext(FLACDecoder_t *ctx) {
+  if (!ctx || ctx == &s_defaultContext)
+    return;
+  FLACDecoder_t *prev = FLACDecoder_SelectContext(ctx);
+  FLACDecoder_FreeBuffers();
+  FLACDecoder_SelectContext(prev == ctx ? NULL : prev);
+  ctx->pool->release(ctx->pool->user, ctx);
+}
+//----------------------------------------------------------------------------------------------------------------------
+FLACDecoder_t *FLACDecoder_SelectContext(FLACDecoder_t *ctx) {
+  FLACDecoder_t *prev = m_flac;
+  m_flac = ctx ? ctx : &s_defaultContext;
+  return prev;
+}
+//----------------------------------------------------------------------------------------------------------------------
 bool FLACDecoder_AllocateBuffers(void) {
-  if (psramFound()) {
-    // PSRAM found, Buffer will be allocated in PSRAM
-    if (!FLACFrameHeader) {
-      FLACFrameHeader =
-          (FLACFrameHeader_t *)ps_malloc(sizeof(FLACFrameHeader_t));
-    }
-    if (!FLACMetadataBlock) {
-      FLACMetadataBlock =
-          (FLACMetadataBlock_t *)ps_malloc(sizeof(FLACMetadataBlock_t));
-    }
-    if (!FLACsubFramesBuff) {
-      FLACsubFramesBuff =
-          (FLACsubFramesBuff_t *)ps_malloc(sizeof(FLACsubFramesBuff_t));
-    }
-  } else {
-    if (!FLACFrameHeader) {
-      FLACFrameHeader = (FLACFrameHeader_t *)malloc(sizeof(FLACFrameHeader_t));
-    }
-    if (!FLACMetadataBlock) {
-      FLACMetadataBlock =
-          (FLACMetadataBlock_t *)malloc(sizeof(FLACMetadataBlock_t));
-    }
-    if (!FLACsubFramesBuff) {
-      FLACsubFramesBuff =
-          (FLACsubFramesBuff_t *)malloc(sizeof(FLACsubFramesBuff_t));
-    }
+  if (!FLACFrameHeader) {
+    FLACFrameHeader = (FLACFrameHeader_t *)poolAlloc(sizeof(FLACFrameHeader_t));
+  }
+  if (!FLACMetadataBlock) {
+    FLACMetadataBlock =
+        (FLACMetadataBlock_t *)poolAlloc(sizeof(FLACMetadataBlock_t));
+  }
+  if (!FLACsubFramesBuff) {
+    FLACsubFramesBuff =
+        (FLACsubFramesBuff_t *)poolAlloc(sizeof(FLACsubFramesBuff_t));
   }
   if (!FLACFrameHeader || !FLACMetadataBlock || !FLACsubFramesBuff) {
     log_e("not enough memory to allocate flacdecoder buffers");
@@ -82,31 +140,57 @@ void FLACDecoder_ClearBuffer() {
 //----------------------------------------------------------------------------------------------------------------------
 void FLACDecoder_FreeBuffers() {
   if (FLACFrameHeader) {
-    free(FLACFrameHeader);
+    poolRelease(FLACFrameHeader);
     FLACFrameHeader = NULL;
   }
   if (FLACMetadataBlock) {
-    free(FLACMetadataBlock);
+    poolRelease(FLACMetadataBlock);
     FLACMetadataBlock = NULL;
   }
   if (FLACsubFramesBuff) {
-    free(FLACsubFramesBuff);
+    poolRelease(FLACsubFramesBuff);
     FLACsubFramesBuff = NULL;
   }
 }
 //----------------------------------------------------------------------------------------------------------------------
 //            B I T R E A D E R
 //----------------------------------------------------------------------------------------------------------------------
+// m_bitBuffer holds m_bitBufferLen unread bits in its low end. It is filled
+// a 32-bit word at a time while the input has 4 bytes left, byte by byte
+// near the end so nothing past bytesLeft is touched.
+static inline void refillBits() {
+  if (m_bytesAvail >= 4 && m_bitBufferLen <= 32) {
+    const uint8_t *p = m_inptr + m_rIndex;
+    uint32_t word = ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) |
+                    ((uint32_t)p[2] << 8) | p[3];
+    m_bitBuffer = (m_bitBuffer << 32) | word;
+    m_bitBufferLen += 32;
+    m_rIndex += 4;
+    m_bytesAvail -= 4;
+    return;
+  }
+  uint8_t temp = *(m_inptr + m_rIndex);
+  m_rIndex++;
+  m_bytesAvail--;
+  if (m_bytesAvail < 0) {
+    log_i("error in bitreader");
+  }
+  m_bitBuffer = (m_bitBuffer << 8) | temp;
+  m_bitBufferLen += 8;
+}
+
+// Hands whole bytes still sitting in m_bitBuffer back to the input, so
+// bytesLeft is exact at frame boundaries. Only valid when byte aligned.
+static void returnUnreadBytes() {
+  uint8_t bytes = m_bitBufferLen / 8;
+  m_rIndex -= bytes;
+  m_bytesAvail += bytes;
+  m_bitBufferLen -= bytes * 8;
+}
+
 uint32_t readUint(uint8_t nBits) {
   while (m_bitBufferLen < nBits) {
-    uint8_t temp = *(m_inptr + m_rIndex);
-    m_rIndex++;
-    m_bytesAvail--;
-    if (m_bytesAvail < 0) {
-      log_i("error in bitreader");
-    }
-    m_bitBuffer = (m_bitBuffer << 8) | temp;
-    m_bitBufferLen += 8;
+    refillBits();
   }
   m_bitBufferLen -= nBits;
   uint32_t result = m_bitBuffer >> m_bitBufferLen;
@@ -122,14 +206,30 @@ int32_t readSignedInt(int nBits) {
   return temp;
 }
 
-int64_t readRiceSignedInt(uint8_t param) {
-  long val = 0;
-  while (readUint(1) == 0)
-    val++;
-  val = (val << param) | readUint(param);
-  return (val >> 1) ^ -(val & 1);
+// Unary quotient via count-leading-zeros over the buffered bits, then the
+// param low bits, zigzag-decoded.
+static inline int32_t readRice(uint8_t param) {
+  uint32_t q = 0;
+  for (;;) {
+    if (m_bitBufferLen == 0) {
+      refillBits();
+    }
+    uint64_t bits = m_bitBuffer << (64 - m_bitBufferLen);
+    if (bits) {
+      uint8_t zeros = __builtin_clzll(bits);
+      q += zeros;
+      m_bitBufferLen -= zeros + 1;
+      break;
+    }
+    q += m_bitBufferLen;
+    m_bitBufferLen = 0;
+  }
+  uint32_t val = (q << param) | readUint(param);
+  return (int32_t)(val >> 1) ^ -(int32_t)(val & 1);
 }
 
+int64_t readRiceSignedInt(uint8_t param) { return readRice(param); }
+
 void alignToByte() { m_bitBufferLen -= m_bitBufferLen % 8; }
 //----------------------------------------------------------------------------------------------------------------------
 //              F L A C - D E C O D E R
@@ -147,6 +247,7 @@ void FLACDecoderReset() { // set var to default
   m_status = DECODE_FRAME;
   m_bitBuffer = 0;
   m_bitBufferLen = 0;
+  m_outOffset = 0; // a block cut short must not offset the next one
 }
 //----------------------------------------------------------------------------------------------------------------------
 int FLACFindSyncWord(unsigned char *buf, int nBytes) {
@@ -368,6 +469,7 @@ int8_t FLACDecode(uint8_t *inbuf, int *bytesLeft, short *outbuf) {
       readUint(16);
     }
     readUint(8);
+    returnUnreadBytes();
     m_status = DECODE_SUBFRAMES;
     *bytesLeft = m_bytesAvail;
     m_blockSizeLeft = m_blockSize;
@@ -378,9 +480,20 @@ int8_t FLACDecode(uint8_t *inbuf, int *bytesLeft, short *outbuf) {
   if (m_status == DECODE_SUBFRAMES) {
 
     // Decode each channel's subframe, then skip footer
+    const uint32_t start = ESP.getCycleCount();
     int ret = decodeSubframes();
     if (ret != 0)
       return ret;
+    m_decodeCycles += ESP.getCycleCount() - start;
+    m_decodeSamples += m_blockSize;
+    if (m_decodeSamples >= FLACMetadataBlock->sampleRate * 10) {
+      // Cycles per second of audio, i.e. the MIPS playback needs.
+      log_i("decode %.1f MIPS",
+            (double)m_decodeCycles * FLACMetadataBlock->sampleRate /
+                m_decodeSamples / 1e6);
+      m_decodeCycles = 0;
+      m_decodeSamples = 0;
+    }
     m_status = OUT_SAMPLES;
   }
 
@@ -389,7 +502,7 @@ int8_t FLACDecode(uint8_t *inbuf, int *bytesLeft, short *outbuf) {
     // therefore we need often more than one loop (split outputblock into
     // pieces)
     uint16_t blockSize;
-    static uint16_t offset = 0;
+    uint16_t &offset = m_outOffset;
     if (m_blockSize < outBuffSize + offset)
       blockSize = m_blockSize - offset;
     else
@@ -417,6 +530,7 @@ int8_t FLACDecode(uint8_t *inbuf, int *bytesLeft, short *outbuf) {
 
   alignToByte();
   readUint(16);
+  returnUnreadBytes();
   m_bytesDecoded = *bytesLeft - m_bytesAvail;
   //    log_i("m_bytesDecoded %i", m_bytesDecoded);
   //    m_compressionRatio = (float)m_bytesDecoded / (float)m_blockSize *
@@ -546,28 +660,12 @@ int8_t decodeFixedPredictionSubframe(uint8_t predOrder, uint8_t sampleDepth,
   ret = decodeResiduals(predOrder, ch);
   if (ret)
     return ret;
-  coefs.clear();
-  if (predOrder == 0)
-    coefs.resize(0);
-  if (predOrder == 1)
-    coefs.push_back(1); // FIXED_PREDICTION_COEFFICIENTS
-  if (predOrder == 2) {
-    coefs.push_back(2);
-    coefs.push_back(-1);
-  }
-  if (predOrder == 3) {
-    coefs.push_back(3);
-    coefs.push_back(-3);
-    coefs.push_back(1);
-  }
-  if (predOrder == 4) {
-    coefs.push_back(4);
-    coefs.push_back(-6);
-    coefs.push_back(4);
-    coefs.push_back(-1);
-  }
+  static const int32_t kFixedCoefs[5][4] = {
+      {0, 0, 0, 0}, {1, 0, 0, 0}, {2, -1, 0, 0}, {3, -3, 1, 0}, {4, -6, 4, -1}};
   if (predOrder > 4)
     return ERR_FLAC_PREORDER_TOO_BIG; // Error: preorder > 4"
+  memcpy(m_coefs, kFixedCoefs[predOrder], sizeof(kFixedCoefs[0]));
+  m_coefCount = predOrder;
   restoreLinearPrediction(ch, 0);
   return ERR_FLAC_NONE;
 }
@@ -579,9 +677,9 @@ int8_t decodeLinearPredictiveCodingSubframe(int lpcOrder, int sampleDepth,
     FLACsubFramesBuff->samplesBuffer[ch][i] = readSignedInt(sampleDepth);
   int precision = readUint(4) + 1;
   int shift = readSignedInt(5);
-  coefs.resize(0);
   for (uint8_t i = 0; i < lpcOrder; i++)
-    coefs.push_back(readSignedInt(precision));
+    m_coefs[i] = readSignedInt(precision);
+  m_coefCount = lpcOrder;
   ret = decodeResiduals(lpcOrder, ch);
   if (ret)
     return ret;
@@ -610,8 +708,9 @@ int8_t decodeResiduals(uint8_t warmup, uint8_t ch) {
 
     int param = readUint(paramBits);
     if (param < escapeParam) {
+      int32_t *out = FLACsubFramesBuff->samplesBuffer[ch];
       for (int j = start; j < end; j++) {
-        FLACsubFramesBuff->samplesBuffer[ch][j] = readRiceSignedInt(param);
+        out[j] = readRice(param);
       }
     } else {
       int numBits = readUint(5);
@@ -623,14 +722,74 @@ int8_t decodeResiduals(uint8_t warmup, uint8_t ch) {
   return ERR_FLAC_NONE;
 }
 //----------------------------------------------------------------------------------------------------------------------
-void restoreLinearPrediction(uint8_t ch, uint8_t shift) {
+// Order known at compile time, so the inner loop unrolls and the
+// coefficients stay in registers.
+template <int Order>
+static void restoreOrder(int32_t *s, const int32_t *c, uint8_t shift) {
+  for (int i = Order; i < m_blockSize; i++) {
+    int32_t sum = 0;
+    for (int j = 0; j < Order; j++) {
+      sum += s[i - 1 - j] * c[j];
+    }
+    s[i] += (sum >> shift);
+  }
+}
 
-  for (int i = coefs.size(); i < m_blockSize; i++) {
+void restoreLinearPrediction(uint8_t ch, uint8_t shift) {
+  int32_t *s = FLACsubFramesBuff->samplesBuffer[ch];
+  const int32_t *c = m_coefs;
+  switch (m_coefCount) {
+  case 0:
+    return;
+  case 1:
+    return restoreOrder<1>(s, c, shift);
+  case 2:
+    return restoreOrder<2>(s, c, shift);
+  case 3:
+    return restoreOrder<3>(s, c, shift);
+  case 4:
+    return restoreOrder<4>(s, c, shift);
+  case 5:
+    return restoreOrder<5>(s, c, shift);
+  case 6:
+    return restoreOrder<6>(s, c, shift);
+  case 7:
+    return restoreOrder<7>(s, c, shift);
+  case 8:
+    return restoreOrder<8>(s, c, shift);
+  case 12:
+    return restoreOrder<12>(s, c, shift);
+  default:
+    break;
+  }
+  for (int i = m_coefCount; i < m_blockSize; i++) {
     int32_t sum = 0;
-    for (int j = 0; j < coefs.size(); j++) {
-      sum += FLACsubFramesBuff->samplesBuffer[ch][i - 1 - j] * coefs[j];
+    for (int j = 0; j < m_coefCount; j++) {
+      sum += s[i - 1 - j] * c[j];
     }
-    FLACsubFramesBuff->samplesBuffer[ch][i] += (sum >> shift);
+    s[i] += (sum >> shift);
   }
 }
 //----------------------------------------------------------------------------------------------------------------------
+
+// The context names above are private to this file.
+#undef FLACFrameHeader
+#undef FLACMetadataBlock
+#undef FLACsubFramesBuff
+#undef m_coefs
+#undef m_coefCount
+#undef m_blockSize
+#undef m_blockSizeLeft
+#undef m_validSamples
+#undef m_outOffset
+#undef m_status
+#undef m_inptr
+#undef m_bytesAvail
+#undef m_bytesDecoded
+#undef m_compressionRatio
+#undef m_rIndex
+#undef m_bitBuffer
+#undef m_bitBufferLen
+#undef m_f_OggS_found
+#undef m_decodeCycles
+#undef m_decodeSamples
@@ -17,6 +17,7 @@
 #pragma GCC optimize("Ofast")
 
 #include "Arduino.h"
+#include "../decoder_pool.h"
 
 #define MAX_CHANNELS 2
 #define MAX_BLOCKSIZE 8192
@@ -168,6 +169,16 @@ typedef struct FLACFrameHeader_t {
 
 } FLACFrameHeader_t;
 
+// All decoder state lives in a context. The functions below work on the
+// selected one, a default context is selected until the caller picks
+// another. Interleave streams by selecting each one's context before its
+// calls. The selection is per task, see decoder_pool.h.
+typedef struct FLACDecoder_t FLACDecoder_t;
+FLACDecoder_t *FLACDecoder_CreateContext(const DecoderPool_t *pool);
+void FLACDecoder_DestroyContext(FLACDecoder_t *ctx);
+// Returns the calling task's previous context; NULL selects the default one.
+FLACDecoder_t *FLACDecoder_SelectContext(FLACDecoder_t *ctx);
+
 int FLACFindSyncWord(unsigned char *buf, int nBytes);
 int FLACFindOggSyncWord(unsigned char *buf, int nBytes);
 int FLACparseOggHeader(unsigned char *buf);
@@ -43,23 +43,52 @@ const uint8_t m_NGRANS_MPEG1 = 2;
 const uint8_t m_NGRANS_MPEG2 = 1;
 const uint32_t m_SQRTHALF = 0x5a82799a; // sqrt(0.5) in Q31 format
 
-MP3FrameInfo_t *m_MP3FrameInfo;
-SFBandTable_t m_SFBandTable;
-StereoMode_t m_sMode;        /* mono/stereo mode */
-MPEGVersion_t m_MPEGVersion; /* version ID */
-FrameHeader_t *m_FrameHeader;
-SideInfoSub_t m_SideInfoSub[m_MAX_NGRAN][m_MAX_NCHAN];
-SideInfo_t *m_SideInfo;
-CriticalBandInfo_t
-    m_CriticalBandInfo[m_MAX_NCHAN]; /* filled in dequantizer, used in joint
+struct MP3Decoder_t {
+  const DecoderPool_t *pool;
+  MP3FrameInfo_t *MP3FrameInfo;
+  SFBandTable_t SFBandTable;
+  StereoMode_t sMode;        /* mono/stereo mode */
+  MPEGVersion_t MPEGVersion; /* version ID */
+  FrameHeader_t *FrameHeader;
+  SideInfoSub_t SideInfoSub[m_MAX_NGRAN][m_MAX_NCHAN];
+  SideInfo_t *SideInfo;
+  CriticalBandInfo_t
+      CriticalBandInfo[m_MAX_NCHAN]; /* filled in dequantizer, used in joint
                                         stereo reconstruction */
-DequantInfo_t *m_DequantInfo;
-HuffmanInfo_t *m_HuffmanInfo;
-IMDCTInfo_t *m_IMDCTInfo;
-ScaleFactorInfoSub_t m_ScaleFactorInfoSub[m_MAX_NGRAN][m_MAX_NCHAN];
-ScaleFactorJS_t *m_ScaleFactorJS;
-SubbandInfo_t *m_SubbandInfo;
-MP3DecInfo_t *m_MP3DecInfo;
+  DequantInfo_t *DequantInfo;
+  HuffmanInfo_t *HuffmanInfo;
+  IMDCTInfo_t *IMDCTInfo;
+  ScaleFactorInfoSub_t ScaleFactorInfoSub[m_MAX_NGRAN][m_MAX_NCHAN];
+  ScaleFactorJS_t *ScaleFactorJS;
+  SubbandInfo_t *SubbandInfo;
+  MP3DecInfo_t *MP3DecInfo;
+};
+
+static void *defaultAlloc(void *user, size_t size);
+static void defaultRelease(void *user, void *ptr);
+
+static const DecoderPool_t s_defaultPool = {defaultAlloc, defaultRelease,
+                                            NULL};
+static MP3Decoder_t s_defaultContext = {&s_defaultPool};
+// selected context, kept per task so tasks never switch each other's
+static thread_local MP3Decoder_t *m_mp3 = &s_defaultContext;
+
+/* the decoder works on these names, they resolve to the selected context */
+#define m_MP3FrameInfo (m_mp3->MP3FrameInfo)
+#define m_SFBandTable (m_mp3->SFBandTable)
+#define m_sMode (m_mp3->sMode)
+#define m_MPEGVersion (m_mp3->MPEGVersion)
+#define m_FrameHeader (m_mp3->FrameHeader)
+#define m_SideInfoSub (m_mp3->SideInfoSub)
+#define m_SideInfo (m_mp3->SideInfo)
+#define m_CriticalBandInfo (m_mp3->CriticalBandInfo)
+#define m_DequantInfo (m_mp3->DequantInfo)
+#define m_HuffmanInfo (m_mp3->HuffmanInfo)
+#define m_IMDCTInfo (m_mp3->IMDCTInfo)
+#define m_ScaleFactorInfoSub (m_mp3->ScaleFactorInfoSub)
+#define m_ScaleFactorJS (m_mp3->ScaleFactorJS)
+#define m_SubbandInfo (m_mp3->SubbandInfo)
+#define m_MP3DecInfo (m_mp3->MP3DecInfo)
 
 const unsigned short huffTable[4242] PROGMEM = {
     /* huffTable01[9] */
@@ -5672,35 +5701,72 @@ void MP3Decoder_ClearBuffer(void) {
                           MALLOC_CAP_DEFAULT | MALLOC_CAP_SPIRAM)
 #endif
 
+static void *defaultAlloc(void *user, size_t size) {
+  return __malloc_heap_psram(size);
+}
+static void defaultRelease(void *user, void *ptr) { free(ptr); }
+
+static void *poolAlloc(size_t size) {
+  return m_mp3->pool->alloc(m_mp3->pool->user, size);
+}
+static void poolRelease(void *ptr) {
+  m_mp3->pool->release(m_mp3->pool->user, ptr);
+}
+
+MP3Decoder_t *MP3Decoder_CreateContext(const DecoderPool_t *pool) {
+  if (!pool)
+    pool = &s_defaultPool;
+  MP3Decoder_t *ctx =
+      (MP3Decoder_t *)pool->alloc(pool->user, sizeof(MP3Decoder_t));
+  if (!ctx)
+    return NULL;
+  memset(ctx, 0, sizeof(MP3Decoder_t));
+  ctx->pool = pool;
+  return ctx;
+}
+
+void MP3Decoder_DestroyContext(MP3Decoder_t *ctx) {
+  if (!ctx || ctx == &s_defaultContext)
+    return;
+  MP3Decoder_t *prev = MP3Decoder_SelectContext(ctx);
+  MP3Decoder_FreeBuffers();
+  MP3Decoder_SelectContext(prev == ctx ? NULL : prev);
+  ctx->pool->release(ctx->pool->user, ctx);
+}
+
+MP3Decoder_t *MP3Decoder_SelectContext(MP3Decoder_t *ctx) {
+  MP3Decoder_t *prev = m_mp3;
+  m_mp3 = ctx ? ctx : &s_defaultContext;
+  return prev;
+}
+
 bool MP3Decoder_AllocateBuffers(void) {
   if (!m_MP3DecInfo) {
-    m_MP3DecInfo = (MP3DecInfo_t *)__malloc_heap_psram(sizeof(MP3DecInfo_t));
+    m_MP3DecInfo = (MP3DecInfo_t *)poolAlloc(sizeof(MP3DecInfo_t));
   }
   if (!m_FrameHeader) {
-    m_FrameHeader = (FrameHeader_t *)__malloc_heap_psram(sizeof(FrameHeader_t));
+    m_FrameHeader = (FrameHeader_t *)poolAlloc(sizeof(FrameHeader_t));
   }
   if (!m_SideInfo) {
-    m_SideInfo = (SideInfo_t *)__malloc_heap_psram(sizeof(SideInfo_t));
+    m_SideInfo = (SideInfo_t *)poolAlloc(sizeof(SideInfo_t));
   }
   if (!m_ScaleFactorJS) {
-    m_ScaleFactorJS =
-        (ScaleFactorJS_t *)__malloc_heap_psram(sizeof(ScaleFactorJS_t));
+    m_ScaleFactorJS = (ScaleFactorJS_t *)poolAlloc(sizeof(ScaleFactorJS_t));
   }
   if (!m_HuffmanInfo) {
-    m_HuffmanInfo = (HuffmanInfo_t *)__malloc_heap_psram(sizeof(HuffmanInfo_t));
+    m_HuffmanInfo = (HuffmanInfo_t *)poolAlloc(sizeof(HuffmanInfo_t));
   }
   if (!m_DequantInfo) {
-    m_DequantInfo = (DequantInfo_t *)__malloc_heap_psram(sizeof(DequantInfo_t));
+    m_DequantInfo = (DequantInfo_t *)poolAlloc(sizeof(DequantInfo_t));
   }
   if (!m_IMDCTInfo) {
-    m_IMDCTInfo = (IMDCTInfo_t *)__malloc_heap_psram(sizeof(IMDCTInfo_t));
+    m_IMDCTInfo = (IMDCTInfo_t *)poolAlloc(sizeof(IMDCTInfo_t));
   }
   if (!m_SubbandInfo) {
-    m_SubbandInfo = (SubbandInfo_t *)__malloc_heap_psram(sizeof(SubbandInfo_t));
+    m_SubbandInfo = (SubbandInfo_t *)poolAlloc(sizeof(SubbandInfo_t));
   }
   if (!m_MP3FrameInfo) {
-    m_MP3FrameInfo =
-        (MP3FrameInfo_t *)__malloc_heap_psram(sizeof(MP3FrameInfo_t));
+    m_MP3FrameInfo = (MP3FrameInfo_t *)poolAlloc(sizeof(MP3FrameInfo_t));
   }
 
   if (!m_MP3DecInfo || !m_FrameHeader || !m_SideInfo || !m_ScaleFactorJS ||
@@ -5730,39 +5796,39 @@ void MP3Decoder_FreeBuffers() {
   //    uint32_t i = ESP.getFreeHeap();
 
   if (m_MP3DecInfo) {
-    free(m_MP3DecInfo);
+    poolRelease(m_MP3DecInfo);
     m_MP3DecInfo = NULL;
   }
   if (m_FrameHeader) {
-    free(m_FrameHeader);
+    poolRelease(m_FrameHeader);
     m_FrameHeader = NULL;
   }
   if (m_SideInfo) {
-    free(m_SideInfo);
+    poolRelease(m_SideInfo);
     m_SideInfo = NULL;
   }
   if (m_ScaleFactorJS) {
-    free(m_ScaleFactorJS);
+    poolRelease(m_ScaleFactorJS);
     m_ScaleFactorJS = NULL;
   }
   if (m_HuffmanInfo) {
-    free(m_HuffmanInfo);
+    poolRelease(m_HuffmanInfo);
     m_HuffmanInfo = NULL;
   }
   if (m_DequantInfo) {
-    free(m_DequantInfo);
+    poolRelease(m_DequantInfo);
     m_DequantInfo = 0;
   }
   if (m_IMDCTInfo) {
-    free(m_IMDCTInfo);
+    poolRelease(m_IMDCTInfo);
     m_IMDCTInfo = 0;
   }
   if (m_SubbandInfo) {
-    free(m_SubbandInfo);
+    poolRelease(m_SubbandInfo);
     m_SubbandInfo = 0;
   }
   if (m_MP3FrameInfo) {
-    free(m_MP3FrameInfo);
+    poolRelease(m_MP3FrameInfo);
     m_MP3FrameInfo = 0;
   }
 
@@ -8233,3 +8299,21 @@ void PolyphaseStereo(short *pcm, int *vbuf, const uint32_t *coefBase) {
     pcm += 2;
   }
 }
+//----------------------------------------------------------------------------------------------------------------------
+
+/* the context names above are private to this file */
+#undef m_MP3FrameInfo
+#undef m_SFBandTable
+#undef m_sMode
+#undef m_MPEGVersion
+#undef m_FrameHeader
+#undef m_SideInfoSub
+#undef m_SideInfo
+#undef m_CriticalBandInfo
+#undef m_DequantInfo
+#undef m_HuffmanInfo
+#undef m_IMDCTInfo
+#undef m_ScaleFactorInfoSub
+#undef m_ScaleFactorJS
+#undef m_SubbandInfo
+#undef m_MP3DecInfo
@@ -2,6 +2,7 @@
 #pragma once
 
 #include "Arduino.h"
+#include "../decoder_pool.h"
 #include "assert.h"
 
 static const uint8_t m_HUFF_PAIRTABS = 32;
@@ -483,6 +484,12 @@ const uint32_t csa[8][2] PROGMEM = {
  */
 
 // prototypes
+// Decoder state lives in a context, the functions below work on the selected
+// one. See FLACDecoder_SelectContext().
+typedef struct MP3Decoder_t MP3Decoder_t;
+MP3Decoder_t *MP3Decoder_CreateContext(const DecoderPool_t *pool);
+void MP3Decoder_DestroyContext(MP3Decoder_t *ctx);
+MP3Decoder_t *MP3Decoder_SelectContext(MP3Decoder_t *ctx); // NULL: default
 bool MP3Decoder_AllocateBuffers(void);
 void MP3Decoder_FreeBuffers();
 int MP3Decode(unsigned char *inbuf, int *bytesLeft, short *outbuf, int useSize);
@@ -2,50 +2,151 @@
 
 #include <Arduino.h>
 #include <Preferences.h>
+#include <atomic>
 #include <math.h>
 #include <string.h>
 
+#include "app/eq_presets.h"
+
+// Targets with a single precision FPU (ESP32, ESP32-S3) run the cascade in
+// float, where a multiply-add costs less than the 64 bit products of the Q30
+// kernel. Define EQ_FIXED_POINT to force the integer kernel.
+#if !defined(EQ_FIXED_POINT) &&                                                \
+    (defined(__XTENSA_HARD_FLOAT__) || defined(__riscv_flen) ||                \
+     defined(__x86_64__) || defined(__aarch64__))
+#define EQ_FLOAT_KERNEL 1
+#else
+#define EQ_FLOAT_KERNEL 0
+#endif
+
 namespace app::eq {
 namespace {
-constexpr float kDefaultQ = 1.2f;
-constexpr float kBandFreqs[kBandCount] = {120.0f,  250.0f,  500.0f,
-                                          1000.0f, 2500.0f, 6000.0f};
-
-struct Biquad {
-  int32_t b0 = 0;
-  int32_t b1 = 0;
-  int32_t b2 = 0;
-  int32_t a1 = 0;
-  int32_t a2 = 0;
-  int64_t s1_l = 0;
-  int64_t s2_l = 0;
-  int64_t s1_r = 0;
-  int64_t s2_r = 0;
+constexpr int kDbSteps = kMaxBandDb - kMinBandDb + 1;
+constexpr uint16_t kMinFreq = 20;
+constexpr uint8_t kMinQx10 = 1;
+constexpr uint8_t kMaxQx10 = 100;
+// a new coefficient set is faded in over kRampSteps sub-blocks, about 12 ms;
+// short steps matter more than the total length for keeping it inaudible
+constexpr uint16_t kRampFrames = 8;
+constexpr int kRampSteps = 64;
+constexpr uint16_t kAllBands = (1u << kMaxBands) - 1;
+
+#if EQ_FLOAT_KERNEL
+using Coeff = float;
+using Acc = float;
+// frames converted to float per pass, the scratch lives in State
+constexpr uint16_t kWorkFrames = 256;
+#else
+using Coeff = int32_t; // Q30
+using Acc = int64_t;
+#endif
+// a band that left the cascade is dropped once its state is below a quarter
+// of a 16 bit step at the scale Audio feeds the EQ
+constexpr Acc kQuietState = 1 << 10;
+
+// normalised biquad, a0 == 1; the default is a pass through
+struct Design {
+  float b0 = 1.0f;
+  float b1 = 0.0f;
+  float b2 = 0.0f;
+  float a1 = 0.0f;
+  float a2 = 0.0f;
+};
+
+// The gain independent part of a band design, so that a gain change on the
+// EQ screen is arithmetic on cached values and two table lookups.
+struct Shape {
+  float cosw = 1.0f;
+  float alpha = 0.0f;
+};
+
+struct Taps {
+  Coeff b0 = 0;
+  Coeff b1 = 0;
+  Coeff b2 = 0;
+  Coeff a1 = 0;
+  Coeff a2 = 0;
+};
+
+struct History {
+  Acc s1_l = 0;
+  Acc s2_l = 0;
+  Acc s1_r = 0;
+  Acc s2_r = 0;
+};
+
+// A complete coefficient set. tick() fills it while s_bank_ready is false,
+// the audio thread copies it out while it is true.
+struct Bank {
+  Taps taps[kMaxBands];
+  uint16_t mask = 0; // bands in the cascade
 };
 
 struct State {
-  Settings settings{};
+  Settings settings{}; // last handed to the audio thread
   Settings target{};
-  uint32_t sample_rate = 44100;
+  Settings custom{}; // the user's own layout, kept while a preset plays
+  int preset = kFirstBuiltinPreset;
+  int auto_preset = 0; // built-in index picked for the playing genre
+  // tick() side
   bool dirty = true;
-  int32_t preamp_q30 = 0;
-  Biquad bands[kBandCount];
+  uint16_t stale = kAllBands;       // bands whose design is out of date
+  uint16_t stale_shape = kAllBands; // ... including frequency, Q or type
+  uint32_t design_rate = 0;
+  Shape shape[kMaxBands];
+  Design design[kMaxBands];
+  Bank bank;
+  // audio side
+  Taps taps[kMaxBands]; // what the cascade runs with
+  Taps from[kMaxBands];
+  Taps to[kMaxBands];
+  History history[kMaxBands];
+  uint16_t mask = 0;
+  uint16_t to_mask = 0;
+  uint16_t draining = 0; // left the cascade, still ringing out
+  int ramp_step = kRampSteps;
+#if EQ_FLOAT_KERNEL
+  float work[kWorkFrames * 2];
+#endif
   bool save_pending = false;
   uint32_t last_change_ms = 0;
 };
 
 State s_state;
-
-constexpr uint32_t kEqSettingsVersion = 1;
+// 10^(dB/40) and its square root for every gain step, filled in init()
+float s_gain_a[kDbSteps];
+float s_gain_sqrt_a[kDbSteps];
+std::atomic<bool> s_bank_ready{false};
+std::atomic<uint32_t> s_rate{44100};
+
+constexpr uint32_t kEqSettingsVersion = 2;
+constexpr uint32_t kEqSettingsVersionSixBand = 1;
 constexpr uint32_t kSaveDelayMs = 1000;
 constexpr char kPrefsNamespace[] = "eq";
 constexpr char kPrefsKey[] = "cfg";
 
 #pragma pack(push, 1)
+struct StoredBand {
+  uint8_t type = 0;
+  uint16_t freq_hz = 0;
+  uint8_t q_x10 = 0;
+  int8_t gain_db = 0;
+};
+
 struct StoredSettings {
   uint32_t version = kEqSettingsVersion;
+  uint8_t enabled = 0;
+  uint8_t preset = kFirstBuiltinPreset;
+  int8_t preamp_db = 0; // Custom
+  uint8_t band_count = 0;
+  StoredBand bands[kMaxBands] = {};
+};
+
+// Layout before the parametric engine: six fixed peaking bands.
+struct StoredSixBand {
+  uint32_t version = kEqSettingsVersionSixBand;
   int8_t preamp_db = 0;
-  int8_t band_db[kBandCount] = {};
+  int8_t band_db[6] = {};
   uint8_t enabled = 0;
 };
 #pragma pack(pop)
@@ -60,26 +161,69 @@ int32_t clamp_i32(int32_t v, int32_t lo, int32_t hi) {
   return v;
 }
 
-int32_t clamp_q30(int64_t v) {
-  if (v > 2147483647LL) {
+Coeff lerp(Coeff a, Coeff b, int step) {
+  return static_cast<Coeff>(a + (static_cast<Acc>(b) - a) * step / kRampSteps);
+}
+
+#if EQ_FLOAT_KERNEL
+Coeff to_coeff(float v) { return v; }
+
+int32_t float_to_sample(float v) {
+  if (v >= 2147483520.0f) {
     return 2147483647;
   }
-  if (v < -2147483648LL) {
+  if (v <= -2147483648.0f) {
     return -2147483648LL;
   }
   return static_cast<int32_t>(v);
 }
 
-int16_t clamp_i16(int32_t v) {
-  if (v > 32767) {
-    return 32767;
-  }
-  if (v < -32768) {
-    return -32768;
+// Transposed direct form II, one band at a time over a float copy of the
+// chunk so that coefficients and state stay in FPU registers. Left and right
+// are independent recursions; interleaving them hides the multiply-add
+// latency that a single chain would stall on.
+void run_cascade(int32_t *buffer, uint16_t frames, uint16_t mask) {
+  float *work = s_state.work;
+  while (frames) {
+    const uint16_t n = frames < kWorkFrames ? frames : kWorkFrames;
+    for (uint16_t i = 0; i < n * 2; ++i) {
+      work[i] = static_cast<float>(buffer[i]);
+    }
+    for (int band = 0; band < kMaxBands; ++band) {
+      if (!(mask & (1u << band))) {
+        continue;
+      }
+      const Taps &t = s_state.taps[band];
+      History &f = s_state.history[band];
+      const float b0 = t.b0, b1 = t.b1, b2 = t.b2, a1 = t.a1, a2 = t.a2;
+      float s1l = f.s1_l, s2l = f.s2_l, s1r = f.s1_r, s2r = f.s2_r;
+      float *p = work;
+      for (uint16_t i = 0; i < n; ++i) {
+        const float xl = p[0];
+        const float xr = p[1];
+        const float yl = b0 * xl + s1l;
+        const float yr = b0 * xr + s1r;
+        s1l = b1 * xl - a1 * yl + s2l;
+        s1r = b1 * xr - a1 * yr + s2r;
+        s2l = b2 * xl - a2 * yl;
+        s2r = b2 * xr - a2 * yr;
+        p[0] = yl;
+        p[1] = yr;
+        p += 2;
+      }
+      f.s1_l = s1l;
+      f.s2_l = s2l;
+      f.s1_r = s1r;
+      f.s2_r = s2r;
+    }
+    for (uint16_t i = 0; i < n * 2; ++i) {
+      buffer[i] = float_to_sample(work[i]);
+    }
+    buffer += n * 2;
+    frames -= n;
   }
-  return static_cast<int16_t>(v);
 }
-
+#else
 int32_t float_to_q30(float v) {
   const float scaled = v * 1073741824.0f;
   if (scaled >= 2147483647.0f) {
@@ -91,69 +235,281 @@ int32_t float_to_q30(float v) {
   return static_cast<int32_t>(lrintf(scaled));
 }
 
-int32_t mul_q30(int32_t a, int32_t b) {
-  return static_cast<int32_t>(
-      (static_cast<int64_t>(a) * static_cast<int64_t>(b)) >> 30);
+Coeff to_coeff(float v) { return float_to_q30(v); }
+
+int32_t clamp_q30(int64_t v) {
+  if (v > 2147483647LL) {
+    return 2147483647;
+  }
+  if (v < -2147483648LL) {
+    return -2147483648LL;
+  }
+  return static_cast<int32_t>(v);
+}
+
+// Transposed direct form II in Q30 with 64 bit products, for targets without
+// an FPU. One band at a time over the whole block keeps its state in
+// registers.
+void run_cascade(int32_t *buffer, uint16_t frames, uint16_t mask) {
+  for (int band = 0; band < kMaxBands; ++band) {
+    if (!(mask & (1u << band))) {
+      continue;
+    }
+    const Taps &t = s_state.taps[band];
+    History &f = s_state.history[band];
+    int64_t s1l = f.s1_l;
+    int64_t s2l = f.s2_l;
+    int64_t s1r = f.s1_r;
+    int64_t s2r = f.s2_r;
+    int32_t *p = buffer;
+    for (uint16_t i = 0; i < frames; ++i) {
+      const int32_t xl = p[0];
+      int64_t yl = ((static_cast<int64_t>(t.b0) * xl) >> 30) + s1l;
+      s1l = ((static_cast<int64_t>(t.b1) * xl) >> 30) -
+            ((static_cast<int64_t>(t.a1) * yl) >> 30) + s2l;
+      s2l = ((static_cast<int64_t>(t.b2) * xl) >> 30) -
+            ((static_cast<int64_t>(t.a2) * yl) >> 30);
+      p[0] = clamp_q30(yl);
+
+      const int32_t xr = p[1];
+      int64_t yr = ((static_cast<int64_t>(t.b0) * xr) >> 30) + s1r;
+      s1r = ((static_cast<int64_t>(t.b1) * xr) >> 30) -
+            ((static_cast<int64_t>(t.a1) * yr) >> 30) + s2r;
+      s2r = ((static_cast<int64_t>(t.b2) * xr) >> 30) -
+            ((static_cast<int64_t>(t.a2) * yr) >> 30);
+      p[1] = clamp_q30(yr);
+      p += 2;
+    }
+    f.s1_l = s1l;
+    f.s2_l = s2l;
+    f.s1_r = s1r;
+    f.s2_r = s2r;
+  }
+}
+#endif
+
+Taps to_taps(const Design &d) {
+  Taps t;
+  t.b0 = to_coeff(d.b0);
+  t.b1 = to_coeff(d.b1);
+  t.b2 = to_coeff(d.b2);
+  t.a1 = to_coeff(d.a1);
+  t.a2 = to_coeff(d.a2);
+  return t;
 }
 
-void recalc_band(int band, float gain_db, float sample_rate) {
-  if (band < 0 || band >= kBandCount) {
-    return;
+Band sanitize(Band b) {
+  if (b.type != BandType::LowShelf && b.type != BandType::HighShelf) {
+    b.type = BandType::Peaking;
   }
-  if (sample_rate <= 0.0f) {
-    return;
+  if (b.freq_hz < kMinFreq) {
+    b.freq_hz = kMinFreq;
   }
+  b.q_x10 = static_cast<uint8_t>(clamp_i32(b.q_x10, kMinQx10, kMaxQx10));
+  b.gain_db = static_cast<int8_t>(clamp_i32(b.gain_db, kMinBandDb, kMaxBandDb));
+  return b;
+}
 
-  const float A = powf(10.0f, gain_db / 40.0f);
+Shape make_shape(const Band &b, float sample_rate) {
+  Shape sh;
+  if (sample_rate <= 0.0f) {
+    return sh;
+  }
+  // keep the centre below Nyquist for the low rates some files use
+  float freq = static_cast<float>(b.freq_hz);
+  if (freq > 0.45f * sample_rate) {
+    freq = 0.45f * sample_rate;
+  }
   constexpr float kPi = 3.14159265358979323846f;
-  const float w0 = 2.0f * kPi * (kBandFreqs[band] / sample_rate);
-  const float cosw = cosf(w0);
-  const float sinw = sinf(w0);
-  const float alpha = sinw / (2.0f * kDefaultQ);
-
-  const float b0 = 1.0f + alpha * A;
-  const float b1 = -2.0f * cosw;
-  const float b2 = 1.0f - alpha * A;
-  const float a0 = 1.0f + alpha / A;
-  const float a1 = -2.0f * cosw;
-  const float a2 = 1.0f - alpha / A;
+  const float w0 = 2.0f * kPi * (freq / sample_rate);
+  sh.cosw = cosf(w0);
+  sh.alpha = sinf(w0) / (2.0f * static_cast<float>(b.q_x10) / 10.0f);
+  return sh;
+}
 
+// RBJ cookbook peaking and shelving filters, normalised by a0.
+Design make_design(const Band &b, const Shape &sh) {
+  Design d;
+  if (b.gain_db == 0) {
+    return d;
+  }
+  const float A = s_gain_a[b.gain_db - kMinBandDb];
+  const float c = sh.cosw;
+  const float alpha = sh.alpha;
+  float b0, b1, b2, a0, a1, a2;
+  if (b.type == BandType::Peaking) {
+    b0 = 1.0f + alpha * A;
+    b1 = -2.0f * c;
+    b2 = 1.0f - alpha * A;
+    a0 = 1.0f + alpha / A;
+    a1 = -2.0f * c;
+    a2 = 1.0f - alpha / A;
+  } else {
+    const float k = 2.0f * s_gain_sqrt_a[b.gain_db - kMinBandDb] * alpha;
+    const float ap = A + 1.0f;
+    const float am = A - 1.0f;
+    if (b.type == BandType::LowShelf) {
+      b0 = A * (ap - am * c + k);
+      b1 = 2.0f * A * (am - ap * c);
+      b2 = A * (ap - am * c - k);
+      a0 = ap + am * c + k;
+      a1 = -2.0f * (am + ap * c);
+      a2 = ap + am * c - k;
+    } else {
+      b0 = A * (ap + am * c + k);
+      b1 = -2.0f * A * (am + ap * c);
+      b2 = A * (ap + am * c - k);
+      a0 = ap - am * c + k;
+      a1 = 2.0f * (am - ap * c);
+      a2 = ap - am * c - k;
+    }
+  }
   const float inv_a0 = (a0 != 0.0f) ? (1.0f / a0) : 1.0f;
+  d.b0 = b0 * inv_a0;
+  d.b1 = b1 * inv_a0;
+  d.b2 = b2 * inv_a0;
+  d.a1 = a1 * inv_a0;
+  d.a2 = a2 * inv_a0;
+  return d;
+}
 
-  s_state.bands[band].b0 = float_to_q30(b0 * inv_a0);
-  s_state.bands[band].b1 = float_to_q30(b1 * inv_a0);
-  s_state.bands[band].b2 = float_to_q30(b2 * inv_a0);
-  s_state.bands[band].a1 = float_to_q30(a1 * inv_a0);
-  s_state.bands[band].a2 = float_to_q30(a2 * inv_a0);
+// The band's poles with zeros on top of them: a pass through that a band
+// leaving the cascade can ramp to without moving its poles far. Ramping a
+// low band's taps to a plain pass through instead swings its poles away
+// from z = 1 within the first step and the state it holds rings out.
+Design make_neutral(const Shape &sh) {
+  Design d;
+  if (sh.alpha <= 0.0f) {
+    return d;
+  }
+  const float inv_a0 = 1.0f / (1.0f + sh.alpha);
+  d.b1 = d.a1 = -2.0f * sh.cosw * inv_a0;
+  d.b2 = d.a2 = (1.0f - sh.alpha) * inv_a0;
+  return d;
+}
+
+// Fills the bank from the current designs. Bands at 0 dB stay out of the
+// cascade with their neutral design, and the preamp scales the feed-forward
+// taps of the first band that is left, or of a pass through in band 0 when
+// none is.
+void build_bank() {
+  Bank &bank = s_state.bank;
+  const Settings &t = s_state.target;
+  bank.mask = 0;
+  float preamp = 1.0f;
+  if (t.enabled && t.preamp_db != 0) {
+    preamp = powf(10.0f, static_cast<float>(t.preamp_db) / 20.0f);
+  }
+  bool scaled = false;
+  for (int band = 0; band < kMaxBands; ++band) {
+    Design d;
+    if (band < t.band_count) {
+      d = make_neutral(s_state.shape[band]);
+    }
+    if (t.enabled && band < t.band_count && t.bands[band].gain_db != 0) {
+      d = s_state.design[band];
+      if (!scaled) {
+        d.b0 *= preamp;
+        d.b1 *= preamp;
+        d.b2 *= preamp;
+        scaled = true;
+      }
+      bank.mask |= 1u << band;
+    }
+    bank.taps[band] = to_taps(d);
+  }
+  if (!scaled && preamp != 1.0f) {
+    Design d;
+    d.b0 = preamp;
+    bank.taps[0] = to_taps(d);
+    bank.mask |= 1u;
+  }
 }
 
-void recalc_all() {
-  const float sr = static_cast<float>(s_state.sample_rate);
-  for (int i = 0; i < kBandCount; ++i) {
-    recalc_band(i, static_cast<float>(s_state.settings.band_db[i]), sr);
+// Runs on the UI side: redesigns what changed and hands the audio thread a
+// new bank once it has taken the previous one. Trig only runs for bands whose
+// frequency, Q or type changed, or for all of them after a rate change.
+void publish() {
+  const uint32_t rate = s_rate.load(std::memory_order_relaxed);
+  if (rate != s_state.design_rate) {
+    s_state.design_rate = rate;
+    s_state.stale = s_state.stale_shape = kAllBands;
+    s_state.dirty = true;
+  }
+  if (!s_state.dirty || s_bank_ready.load(std::memory_order_acquire)) {
+    return;
   }
+  const Settings &t = s_state.target;
+  for (int band = 0; band < t.band_count; ++band) {
+    const uint16_t bit = 1u << band;
+    if (s_state.stale_shape & bit) {
+      s_state.shape[band] =
+          make_shape(t.bands[band], static_cast<float>(rate));
+    }
+    if (s_state.stale & bit) {
+      s_state.design[band] = make_design(t.bands[band], s_state.shape[band]);
+    }
+  }
+  s_state.stale = s_state.stale_shape = 0;
+  build_bank();
+  s_state.settings = s_state.target;
+  s_state.dirty = false;
+  s_bank_ready.store(true, std::memory_order_release);
+}
 
-  const float preamp_gain =
-      powf(10.0f, static_cast<float>(s_state.settings.preamp_db) / 20.0f);
-  s_state.preamp_q30 = float_to_q30(preamp_gain);
+// Audio side: a new bank restarts the ramp from whatever is applied now.
+// Bands joining the cascade start from the pass through or neutral design
+// they last had, with no history, which is the same as not running them.
+void take_bank() {
+  for (int band = 0; band < kMaxBands; ++band) {
+    s_state.from[band] = s_state.taps[band];
+    s_state.to[band] = s_state.bank.taps[band];
+  }
+  s_state.to_mask = s_state.bank.mask;
+  s_state.mask |= s_state.to_mask;
+  s_state.draining = 0;
+  s_state.ramp_step = 0;
 }
 
-void apply_target() {
-  s_state.settings = s_state.target;
-  s_state.dirty = true;
+void ramp_taps() {
+  const int step = s_state.ramp_step;
+  for (int band = 0; band < kMaxBands; ++band) {
+    if (!(s_state.mask & (1u << band))) {
+      continue;
+    }
+    const Taps &a = s_state.from[band];
+    const Taps &b = s_state.to[band];
+    Taps &t = s_state.taps[band];
+    t.b0 = lerp(a.b0, b.b0, step);
+    t.b1 = lerp(a.b1, b.b1, step);
+    t.b2 = lerp(a.b2, b.b2, step);
+    t.a1 = lerp(a.a1, b.a1, step);
+    t.a2 = lerp(a.a2, b.a2, step);
+  }
 }
 
-void update_enabled_from_target() {
-  bool any = (s_state.target.preamp_db != 0);
-  if (!any) {
-    for (int i = 0; i < kBandCount; ++i) {
-      if (s_state.target.band_db[i] != 0) {
-        any = true;
-        break;
-      }
+// Bands that left the cascade are neutral now but their state still rings
+// through; they keep running until drain_bands() finds them quiet.
+void finish_ramp() {
+  for (int band = 0; band < kMaxBands; ++band) {
+    s_state.taps[band] = s_state.to[band];
+  }
+  s_state.draining = s_state.mask & ~s_state.to_mask;
+}
+
+bool quiet(Acc v) { return v < kQuietState && v > -kQuietState; }
+
+void drain_bands() {
+  for (int band = 0; band < kMaxBands; ++band) {
+    const uint16_t bit = 1u << band;
+    const History &h = s_state.history[band];
+    if ((s_state.draining & bit) && quiet(h.s1_l) && quiet(h.s2_l) &&
+        quiet(h.s1_r) && quiet(h.s2_r)) {
+      s_state.history[band] = History();
+      s_state.draining &= ~bit;
+      s_state.mask &= ~bit;
     }
   }
-  s_state.target.enabled = any;
 }
 
 void schedule_save() {
@@ -161,65 +517,214 @@ void schedule_save() {
   s_state.last_change_ms = millis();
 }
 
+void mark_all() {
+  s_state.stale = s_state.stale_shape = kAllBands;
+  s_state.dirty = true;
+}
+
+void update_enabled_from_target() {
+  const Settings &t = s_state.target;
+  bool any = (t.preamp_db != 0);
+  for (int i = 0; !any && i < t.band_count; ++i) {
+    any = (t.bands[i].gain_db != 0);
+  }
+  s_state.target.enabled = any;
+}
+
+Settings preset_layout(int preset) {
+  if (preset == kPresetCustom) {
+    return s_state.custom;
+  }
+  const int index = (preset == kPresetAuto) ? s_state.auto_preset
+                                             : preset - kFirstBuiltinPreset;
+  const Preset &p = builtin_preset(index);
+  Settings s;
+  s.preamp_db = p.preamp_db;
+  s.band_count = p.band_count;
+  for (int i = 0; i < p.band_count; ++i) {
+    s.bands[i] = p.bands[i];
+  }
+  return s;
+}
+
+void apply_preset() {
+  s_state.target = preset_layout(s_state.preset);
+  update_enabled_from_target();
+  mark_all();
+}
+
+// An edit always lands in Custom; starting one from a preset copies the
+// preset's layout over first, so the sound does not jump.
+void begin_edit() {
+  if (s_state.preset == kPresetCustom) {
+    return;
+  }
+  s_state.custom = s_state.target;
+  s_state.preset = kPresetCustom;
+}
+
+void end_edit() {
+  update_enabled_from_target();
+  s_state.custom = s_state.target;
+  schedule_save();
+}
+
 void save_settings() {
   Preferences prefs;
   if (!prefs.begin(kPrefsNamespace, false)) {
     return;
   }
+  const Settings &c = s_state.custom;
   StoredSettings stored{};
   stored.version = kEqSettingsVersion;
-  stored.preamp_db = s_state.target.preamp_db;
-  for (int i = 0; i < kBandCount; ++i) {
-    stored.band_db[i] = s_state.target.band_db[i];
-  }
   stored.enabled = s_state.target.enabled ? 1 : 0;
+  stored.preset = static_cast<uint8_t>(s_state.preset);
+  stored.preamp_db = c.preamp_db;
+  stored.band_count = c.band_count;
+  for (int i = 0; i < c.band_count; ++i) {
+    stored.bands[i].type = static_cast<uint8_t>(c.bands[i].type);
+    stored.bands[i].freq_hz = c.bands[i].freq_hz;
+    stored.bands[i].q_x10 = c.bands[i].q_x10;
+    stored.bands[i].gain_db = c.bands[i].gain_db;
+  }
   prefs.putBytes(kPrefsKey, &stored, sizeof(stored));
   prefs.end();
 }
 } // namespace
 
 void init() {
-  memset(&s_state, 0, sizeof(s_state));
-  s_state.settings.enabled = false;
-  s_state.settings.preamp_db = 0;
-  s_state.target = s_state.settings;
-  s_state.sample_rate = 44100;
-  s_state.dirty = true;
+  for (int step = 0; step < kDbSteps; ++step) {
+    const float db = static_cast<float>(kMinBandDb + step);
+    s_gain_a[step] = powf(10.0f, db / 40.0f);
+    s_gain_sqrt_a[step] = powf(10.0f, db / 80.0f);
+  }
+  s_state.custom = preset_layout(kFirstBuiltinPreset);
+  s_state.preset = kFirstBuiltinPreset;
+  s_state.auto_preset = 0;
+  s_state.target = s_state.custom;
+  s_state.settings = s_state.target;
+  s_state.design_rate = 0;
+  mark_all();
+  const Taps pass = to_taps(Design());
+  for (int band = 0; band < kMaxBands; ++band) {
+    s_state.taps[band] = pass;
+    s_state.history[band] = History();
+  }
+  s_state.mask = 0;
+  s_state.to_mask = 0;
+  s_state.draining = 0;
+  s_state.ramp_step = kRampSteps;
+  s_bank_ready.store(false, std::memory_order_relaxed);
 }
 
 Settings get_settings() { return s_state.settings; }
 
-int8_t get_band(int band) {
-  if (band < 0 || band >= kBandCount) {
-    return 0;
+int band_count() { return s_state.target.band_count; }
+
+Band get_band_params(int band) {
+  if (band < 0 || band >= s_state.target.band_count) {
+    return Band();
   }
-  return s_state.target.band_db[band];
+  return s_state.target.bands[band];
 }
 
+void set_band_params(int band, const Band &params) {
+  if (band < 0 || band >= s_state.target.band_count) {
+    return;
+  }
+  begin_edit();
+  const Band next = sanitize(params);
+  Band &cur = s_state.target.bands[band];
+  const uint16_t bit = 1u << band;
+  if (next.type != cur.type || next.freq_hz != cur.freq_hz ||
+      next.q_x10 != cur.q_x10) {
+    s_state.stale_shape |= bit;
+  }
+  cur = next;
+  s_state.stale |= bit;
+  s_state.dirty = true;
+  end_edit();
+}
+
+void set_band_count(int count) {
+  count = clamp_i32(count, 0, kMaxBands);
+  Settings &t = s_state.target;
+  if (count == t.band_count) {
+    return;
+  }
+  begin_edit();
+  for (int band = t.band_count; band < count; ++band) {
+    t.bands[band] = Band();
+    s_state.stale |= 1u << band;
+    s_state.stale_shape |= 1u << band;
+  }
+  t.band_count = static_cast<uint8_t>(count);
+  s_state.dirty = true;
+  end_edit();
+}
+
+int8_t get_band(int band) { return get_band_params(band).gain_db; }
+
 void set_band(int band, int8_t db) {
-  if (band < 0 || band >= kBandCount) {
+  if (band < 0 || band >= s_state.target.band_count) {
     return;
   }
-  s_state.target.band_db[band] = static_cast<int8_t>(clamp_i32(db, -12, 12));
-  update_enabled_from_target();
-  apply_target();
-  schedule_save();
+  Band b = s_state.target.bands[band];
+  b.gain_db = db;
+  set_band_params(band, b);
 }
 
 int8_t get_preamp() { return s_state.target.preamp_db; }
 
 void set_preamp(int8_t db) {
+  begin_edit();
   s_state.target.preamp_db = static_cast<int8_t>(clamp_i32(db, -12, 0));
-  update_enabled_from_target();
-  apply_target();
+  s_state.dirty = true;
+  end_edit();
+}
+
+int preset_count() { return kFirstBuiltinPreset + builtin_preset_count(); }
+
+const char *preset_name(int preset) {
+  if (preset == kPresetCustom) {
+    return "Custom";
+  }
+  if (preset == kPresetAuto) {
+    return "Auto";
+  }
+  if (preset < kFirstBuiltinPreset || preset >= preset_count()) {
+    return "";
+  }
+  return builtin_preset(preset - kFirstBuiltinPreset).name;
+}
+
+int get_preset() { return s_state.preset; }
+
+void set_preset(int preset) {
+  if (preset < 0 || preset >= preset_count() || preset == s_state.preset) {
+    return;
+  }
+  s_state.preset = preset;
+  apply_preset();
   schedule_save();
 }
 
+void set_track_genre(const char *genre) {
+  const int index = builtin_preset_for_genre(genre);
+  if (index == s_state.auto_preset) {
+    return;
+  }
+  s_state.auto_preset = index;
+  if (s_state.preset == kPresetAuto) {
+    apply_preset();
+  }
+}
+
 bool is_enabled() { return s_state.settings.enabled; }
 
 void set_enabled(bool enabled) {
   s_state.target.enabled = enabled;
-  apply_target();
+  s_state.dirty = true;
   schedule_save();
 }
 
@@ -230,27 +735,52 @@ void load_settings() {
   }
 
   StoredSettings stored{};
-  size_t len = prefs.getBytesLength(kPrefsKey);
+  StoredSixBand six{};
+  const size_t len = prefs.getBytesLength(kPrefsKey);
   if (len == sizeof(stored)) {
     prefs.getBytes(kPrefsKey, &stored, sizeof(stored));
+  } else if (len == sizeof(six)) {
+    prefs.getBytes(kPrefsKey, &six, sizeof(six));
   }
   prefs.end();
 
-  if (len != sizeof(stored) || stored.version != kEqSettingsVersion) {
+  Settings &c = s_state.custom;
+  if (len == sizeof(six) && six.version == kEqSettingsVersionSixBand) {
+    // the old fixed bands are Flat's layout
+    c = preset_layout(kFirstBuiltinPreset);
+    c.preamp_db = static_cast<int8_t>(clamp_i32(six.preamp_db, -12, 0));
+    for (int i = 0; i < 6; ++i) {
+      c.bands[i].gain_db = static_cast<int8_t>(
+          clamp_i32(six.band_db[i], kMinBandDb, kMaxBandDb));
+    }
+    s_state.preset = kPresetCustom;
+  } else if (len == sizeof(stored) && stored.version == kEqSettingsVersion) {
+    c = Settings();
+    c.preamp_db = static_cast<int8_t>(clamp_i32(stored.preamp_db, -12, 0));
+    c.band_count =
+        static_cast<uint8_t>(clamp_i32(stored.band_count, 0, kMaxBands));
+    for (int i = 0; i < c.band_count; ++i) {
+      Band b;
+      b.type = static_cast<BandType>(stored.bands[i].type);
+      b.freq_hz = stored.bands[i].freq_hz;
+      b.q_x10 = stored.bands[i].q_x10;
+      b.gain_db = stored.bands[i].gain_db;
+      c.bands[i] = sanitize(b);
+    }
+    s_state.preset = (stored.preset < preset_count()) ? stored.preset
+                                                       : kFirstBuiltinPreset;
+  } else {
     return;
   }
 
-  s_state.target.preamp_db =
-      static_cast<int8_t>(clamp_i32(stored.preamp_db, -12, 0));
-  for (int i = 0; i < kBandCount; ++i) {
-    s_state.target.band_db[i] =
-        static_cast<int8_t>(clamp_i32(stored.band_db[i], -12, 12));
-  }
-  s_state.target.enabled = (stored.enabled != 0);
-  apply_target();
+  apply_preset();
+  const bool enabled = (len == sizeof(six)) ? six.enabled : stored.enabled;
+  s_state.target.enabled = enabled;
+  publish();
 }
 
 void tick() {
+  publish();
   if (!s_state.save_pending) {
     return;
   }
@@ -266,99 +796,41 @@ void set_sample_rate(uint32_t sample_rate) {
   if (sample_rate == 0) {
     return;
   }
-  if (s_state.sample_rate == sample_rate) {
-    return;
-  }
-  s_state.sample_rate = sample_rate;
-  s_state.dirty = true;
+  s_rate.store(sample_rate, std::memory_order_relaxed);
 }
 
-void process_block(int16_t *buffer, uint16_t frames, int channels,
-                   uint32_t sample_rate) {
+void process_block(int32_t *buffer, uint16_t frames, uint32_t sample_rate) {
   if (!buffer || frames == 0) {
     return;
   }
-  if (channels < 1) {
-    channels = 1;
-  }
-  if (channels > 2) {
-    channels = 2;
-  }
 
   if (sample_rate != 0) {
     set_sample_rate(sample_rate);
   }
 
-  if (!s_state.settings.enabled) {
-    return;
+  if (s_bank_ready.load(std::memory_order_acquire)) {
+    take_bank();
+    s_bank_ready.store(false, std::memory_order_release);
   }
 
-  if (s_state.dirty) {
-    recalc_all();
-    s_state.dirty = false;
+  while (frames && s_state.ramp_step < kRampSteps) {
+    s_state.ramp_step++;
+    ramp_taps();
+    const uint16_t n = frames < kRampFrames ? frames : kRampFrames;
+    run_cascade(buffer, n, s_state.mask);
+    buffer += n * 2;
+    frames -= n;
+    if (s_state.ramp_step == kRampSteps) {
+      finish_ramp();
+    }
   }
 
-  const int32_t preamp = s_state.preamp_q30;
-
-  if (channels == 1) {
-    for (uint16_t i = 0; i < frames; ++i) {
-      int32_t x = static_cast<int32_t>(buffer[i]) << 15;
-      x = mul_q30(x, preamp);
-      for (int b = 0; b < kBandCount; ++b) {
-        Biquad &f = s_state.bands[b];
-        int64_t y = (static_cast<int64_t>(f.b0) * x) >> 30;
-        y += f.s1_l;
-        int64_t s1 = static_cast<int64_t>(f.b1) * x;
-        s1 >>= 30;
-        s1 -= (static_cast<int64_t>(f.a1) * y) >> 30;
-        s1 += f.s2_l;
-        int64_t s2 = (static_cast<int64_t>(f.b2) * x) >> 30;
-        s2 -= (static_cast<int64_t>(f.a2) * y) >> 30;
-        f.s1_l = s1;
-        f.s2_l = s2;
-        x = clamp_q30(y);
-      }
-      int32_t out = x >> 15;
-      buffer[i] = clamp_i16(out);
-    }
+  if (frames == 0 || s_state.mask == 0) {
     return;
   }
-
-  for (uint16_t i = 0; i < frames; ++i) {
-    int32_t xl = static_cast<int32_t>(buffer[i * 2]) << 15;
-    int32_t xr = static_cast<int32_t>(buffer[i * 2 + 1]) << 15;
-    xl = mul_q30(xl, preamp);
-    xr = mul_q30(xr, preamp);
-
-    for (int b = 0; b < kBandCount; ++b) {
-      Biquad &f = s_state.bands[b];
-      int64_t yl = (static_cast<int64_t>(f.b0) * xl) >> 30;
-      yl += f.s1_l;
-      int64_t s1l = static_cast<int64_t>(f.b1) * xl;
-      s1l >>= 30;
-      s1l -= (static_cast<int64_t>(f.a1) * yl) >> 30;
-      s1l += f.s2_l;
-      int64_t s2l = (static_cast<int64_t>(f.b2) * xl) >> 30;
-      s2l -= (static_cast<int64_t>(f.a2) * yl) >> 30;
-      f.s1_l = s1l;
-      f.s2_l = s2l;
-      xl = clamp_q30(yl);
-
-      int64_t yr = (static_cast<int64_t>(f.b0) * xr) >> 30;
-      yr += f.s1_r;
-      int64_t s1r = static_cast<int64_t>(f.b1) * xr;
-      s1r >>= 30;
-      s1r -= (static_cast<int64_t>(f.a1) * yr) >> 30;
-      s1r += f.s2_r;
-      int64_t s2r = (static_cast<int64_t>(f.b2) * xr) >> 30;
-      s2r -= (static_cast<int64_t>(f.a2) * yr) >> 30;
-      f.s1_r = s1r;
-      f.s2_r = s2r;
-      xr = clamp_q30(yr);
-    }
-
-    buffer[i * 2] = clamp_i16(xl >> 15);
-    buffer[i * 2 + 1] = clamp_i16(xr >> 15);
+  run_cascade(buffer, frames, s_state.mask);
+  if (s_state.draining) {
+    drain_bands();
   }
 }
 
@@ -3,26 +3,56 @@
 #include <stdint.h>
 
 namespace app::eq {
-constexpr int kBandCount = 6;
+constexpr int kMaxBands = 10;
+constexpr int kMinBandDb = -12;
+constexpr int kMaxBandDb = 12;
+
+enum class BandType : uint8_t { Peaking = 0, LowShelf = 1, HighShelf = 2 };
+
+struct Band {
+  BandType type = BandType::Peaking;
+  uint16_t freq_hz = 1000;
+  uint8_t q_x10 = 12; // Q times ten
+  int8_t gain_db = 0;
+};
 
 struct Settings {
   bool enabled = false;
   int8_t preamp_db = 0;
-  int8_t band_db[kBandCount] = {};
+  uint8_t band_count = 0;
+  Band bands[kMaxBands] = {};
 };
 
+// Preset ids: the user's own layout, the built-in preset matching the genre
+// of the playing track, then the built-in presets in eq_presets.cpp.
+constexpr int kPresetCustom = 0;
+constexpr int kPresetAuto = 1;
+constexpr int kFirstBuiltinPreset = 2;
+
 void init();
 Settings get_settings();
+int band_count();
+Band get_band_params(int band);
+// Editing a band while a built-in preset is active copies it to Custom first.
+void set_band_params(int band, const Band &params);
+void set_band_count(int count);
 int8_t get_band(int band);
 void set_band(int band, int8_t db);
 int8_t get_preamp();
 void set_preamp(int8_t db);
+int preset_count();
+const char *preset_name(int preset);
+int get_preset();
+void set_preset(int preset);
+// Tells kPresetAuto which genre is playing; a no-op for other presets.
+void set_track_genre(const char *genre);
 bool is_enabled();
 void set_enabled(bool enabled);
 void load_settings();
 void tick();
 void set_sample_rate(uint32_t sample_rate);
-void process_block(int16_t *buffer, uint16_t frames, int channels,
-                   uint32_t sample_rate);
+// In place on interleaved L/R 32 bit samples; bands at 0 dB are skipped and
+// the preamp is folded into the first band that is left.
+void process_block(int32_t *buffer, uint16_t frames, uint32_t sample_rate);
 
 } // namespace app::eq
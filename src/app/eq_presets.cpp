@@ -0,0 +1,209 @@
+#include "app/eq_presets.h"
+
+#include <ctype.h>
+#include <string.h>
+
+namespace app::eq {
+namespace {
+constexpr BandType P = BandType::Peaking;
+constexpr BandType LS = BandType::LowShelf;
+constexpr BandType HS = BandType::HighShelf;
+
+// Shelves use Q 0.7 (slope 1), peaks between 1.0 and 1.4. Every preset that
+// boosts carries a preamp so that a full scale track stays below clipping.
+const Preset kPresets[] = {
+    {"Flat",
+     0,
+     6,
+     {{P, 120, 12, 0},
+      {P, 250, 12, 0},
+      {P, 500, 12, 0},
+      {P, 1000, 12, 0},
+      {P, 2500, 12, 0},
+      {P, 6000, 12, 0}}},
+    {"Bass",
+     -6,
+     6,
+     {{LS, 90, 7, 6},
+      {P, 200, 10, 2},
+      {P, 500, 12, 0},
+      {P, 1000, 12, 0},
+      {P, 3000, 12, 0},
+      {HS, 8000, 7, 0}}},
+    {"Treble",
+     -5,
+     6,
+     {{LS, 100, 7, 0},
+      {P, 250, 12, 0},
+      {P, 500, 12, 0},
+      {P, 2000, 10, 1},
+      {P, 5000, 10, 3},
+      {HS, 10000, 7, 5}}},
+    {"Vocal",
+     -4,
+     6,
+     {{LS, 100, 7, -3},
+      {P, 250, 10, -1},
+      {P, 1000, 10, 2},
+      {P, 2500, 12, 4},
+      {P, 5000, 14, 2},
+      {HS, 10000, 7, -1}}},
+    {"Rock",
+     -4,
+     6,
+     {{LS, 80, 7, 4},
+      {P, 250, 12, -1},
+      {P, 800, 10, -2},
+      {P, 2000, 12, 2},
+      {P, 5000, 12, 3},
+      {HS, 10000, 7, 3}}},
+    {"Pop",
+     -3,
+     6,
+     {{LS, 80, 7, -1},
+      {P, 250, 12, 2},
+      {P, 1000, 10, 3},
+      {P, 2500, 12, 2},
+      {P, 6000, 12, 0},
+      {HS, 10000, 7, -1}}},
+    {"Jazz",
+     -3,
+     6,
+     {{LS, 80, 7, 3},
+      {P, 250, 12, 1},
+      {P, 1000, 10, -1},
+      {P, 3000, 12, 1},
+      {P, 6000, 12, 2},
+      {HS, 12000, 7, 2}}},
+    {"Classical",
+     -2,
+     6,
+     {{LS, 80, 7, 2},
+      {P, 250, 12, 0},
+      {P, 1000, 12, 0},
+      {P, 3000, 10, -1},
+      {P, 6000, 12, 0},
+      {HS, 12000, 7, 2}}},
+    {"Electronic",
+     -6,
+     6,
+     {{LS, 60, 7, 6},
+      {P, 150, 12, 2},
+      {P, 600, 10, -2},
+      {P, 2000, 12, 0},
+      {P, 5000, 12, 2},
+      {HS, 12000, 7, 4}}},
+    {"Hip-Hop",
+     -6,
+     6,
+     {{LS, 60, 7, 6},
+      {P, 120, 14, 3},
+      {P, 500, 10, -1},
+      {P, 1500, 12, 1},
+      {P, 4000, 12, 0},
+      {HS, 10000, 7, 2}}},
+    {"Speech",
+     -4,
+     6,
+     {{LS, 120, 7, -6},
+      {P, 300, 10, -2},
+      {P, 1000, 10, 2},
+      {P, 3000, 12, 4},
+      {P, 6000, 12, 1},
+      {HS, 10000, 7, -4}}},
+};
+constexpr int kPresetCount = sizeof(kPresets) / sizeof(kPresets[0]);
+
+struct GenreRule {
+  const char *needle; // lower case, matched anywhere in the tag
+  const char *preset;
+};
+
+// First match wins, so the more specific words come first.
+const GenreRule kGenreRules[] = {
+    {"hip", "Hip-Hop"},
+    {"rap", "Hip-Hop"},
+    {"r&b", "Hip-Hop"},
+    {"trap", "Hip-Hop"},
+    {"electro", "Electronic"},
+    {"techno", "Electronic"},
+    {"house", "Electronic"},
+    {"trance", "Electronic"},
+    {"dance", "Electronic"},
+    {"edm", "Electronic"},
+    {"dubstep", "Electronic"},
+    {"drum", "Electronic"},
+    {"classical", "Classical"},
+    {"orchestra", "Classical"},
+    {"opera", "Classical"},
+    {"baroque", "Classical"},
+    {"symphon", "Classical"},
+    {"jazz", "Jazz"},
+    {"blues", "Jazz"},
+    {"soul", "Jazz"},
+    {"swing", "Jazz"},
+    {"rock", "Rock"},
+    {"metal", "Rock"},
+    {"punk", "Rock"},
+    {"grunge", "Rock"},
+    {"pop", "Pop"},
+    {"speech", "Speech"},
+    {"spoken", "Speech"},
+    {"podcast", "Speech"},
+    {"audiobook", "Speech"},
+    {"vocal", "Vocal"},
+    {"cappella", "Vocal"},
+    {"lo-fi", "Bass"},
+    {"lofi", "Bass"},
+    {"bass", "Bass"},
+};
+
+bool contains_ci(const char *haystack, const char *needle) {
+  for (const char *h = haystack; *h; ++h) {
+    const char *a = h;
+    const char *b = needle;
+    while (*a && *b &&
+           tolower(static_cast<unsigned char>(*a)) ==
+               static_cast<unsigned char>(*b)) {
+      ++a;
+      ++b;
+    }
+    if (!*b) {
+      return true;
+    }
+  }
+  return false;
+}
+
+int find_preset(const char *name) {
+  for (int i = 0; i < kPresetCount; ++i) {
+    if (strcmp(kPresets[i].name, name) == 0) {
+      return i;
+    }
+  }
+  return 0;
+}
+} // namespace
+
+int builtin_preset_count() { return kPresetCount; }
+
+const Preset &builtin_preset(int index) {
+  if (index < 0 || index >= kPresetCount) {
+    return kPresets[0];
+  }
+  return kPresets[index];
+}
+
+int builtin_preset_for_genre(const char *genre) {
+  if (!genre || !genre[0]) {
+    return 0;
+  }
+  for (const GenreRule &rule : kGenreRules) {
+    if (contains_ci(genre, rule.needle)) {
+      return find_preset(rule.preset);
+    }
+  }
+  return 0;
+}
+
+} // namespace app::eq
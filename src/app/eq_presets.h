@@ -0,0 +1,22 @@
+#pragma once
+
+#include "app/eq_dsp.h"
+
+namespace app::eq {
+
+struct Preset {
+  const char *name;
+  int8_t preamp_db;
+  uint8_t band_count;
+  Band bands[kMaxBands];
+};
+
+// Built-in presets, index 0 is Flat: the six peaking bands the EQ started
+// with, which is also the layout Custom starts from. Preset id is
+// kFirstBuiltinPreset + index.
+int builtin_preset_count();
+const Preset &builtin_preset(int index);
+// Index of the built-in preset for a genre tag, Flat when nothing matches.
+int builtin_preset_for_genre(const char *genre);
+
+} // namespace app::eq
@@ -1,28 +1,25 @@
 #include "app/library.h"
 
+#include "app/library_index.h"
+#include "app/library_tags.h"
+#include "app/play_stats.h"
+
 #include <SD.h>
+#include <algorithm>
 #include <cstring>
 #include <esp_heap_caps.h>
+#include <new>
 
 namespace app {
 namespace {
-constexpr size_t kStringPoolSize = 512 * 1024;
+// Path, title and a share of the interned names; overflow pages absorb
+// libraries with longer strings.
+constexpr size_t kPoolBytesPerTrack = 128;
 const char *kUnknownArtist = "Unknown Artist";
 const char *kUnknownAlbum = "Unknown Album";
 const char *kUnknownGenre = "Unknown Genre";
 const char *kUnknownComposer = "Unknown Composer";
 
-struct TagInfo {
-  String title;
-  String artist;
-  String album;
-  String genre;
-  String composer;
-  uint32_t cover_pos = 0;
-  uint32_t cover_len = 0;
-  CoverFormat cover_format = CoverFormat::Unknown;
-};
-
 static const char *empty_or(const char *value, const char *fallback) {
   if (value && value[0] != '\0') {
     return value;
@@ -30,29 +27,6 @@ static const char *empty_or(const char *value, const char *fallback) {
   return fallback ? fallback : "";
 }
 
-static bool same_str(const char *a, const char *b) {
-  if (!a) {
-    a = "";
-  }
-  if (!b) {
-    b = "";
-  }
-  return strcmp(a, b) == 0;
-}
-
-static uint32_t read_u32_be(const uint8_t *data) {
-  return (static_cast<uint32_t>(data[0]) << 24) |
-         (static_cast<uint32_t>(data[1]) << 16) |
-         (static_cast<uint32_t>(data[2]) << 8) | static_cast<uint32_t>(data[3]);
-}
-
-static uint32_t read_syncsafe(const uint8_t *data) {
-  return (static_cast<uint32_t>(data[0] & 0x7F) << 21) |
-         (static_cast<uint32_t>(data[1] & 0x7F) << 14) |
-         (static_cast<uint32_t>(data[2] & 0x7F) << 7) |
-         static_cast<uint32_t>(data[3] & 0x7F);
-}
-
 static String basename_no_ext(const String &path) {
   int slash = path.lastIndexOf('/');
   String name = (slash >= 0) ? path.substring(slash + 1) : path;
@@ -80,328 +54,543 @@ static String parent_dir(const String &path, int levels_up) {
   return dir.substring(last + 1);
 }
 
-static void append_utf8(String &out, uint32_t codepoint) {
-  if (codepoint <= 0x7F) {
-    out += static_cast<char>(codepoint);
-  } else if (codepoint <= 0x7FF) {
-    out += static_cast<char>(0xC0 | ((codepoint >> 6) & 0x1F));
-    out += static_cast<char>(0x80 | (codepoint & 0x3F));
-  } else if (codepoint <= 0xFFFF) {
-    out += static_cast<char>(0xE0 | ((codepoint >> 12) & 0x0F));
-    out += static_cast<char>(0x80 | ((codepoint >> 6) & 0x3F));
-    out += static_cast<char>(0x80 | (codepoint & 0x3F));
-  } else if (codepoint <= 0x10FFFF) {
-    out += static_cast<char>(0xF0 | ((codepoint >> 18) & 0x07));
-    out += static_cast<char>(0x80 | ((codepoint >> 12) & 0x3F));
-    out += static_cast<char>(0x80 | ((codepoint >> 6) & 0x3F));
-    out += static_cast<char>(0x80 | (codepoint & 0x3F));
-  }
-}
-
-static String decode_text_frame(uint8_t encoding, const uint8_t *data,
-                                size_t len) {
-  if (len == 0) {
-    return String();
-  }
-
-  if (encoding == 3) {
-    String out;
-    out.reserve(len + 1);
-    for (size_t i = 0; i < len; ++i) {
-      if (data[i] == '\0') {
-        break;
-      }
-      out += static_cast<char>(data[i]);
+static uint32_t album_hash(const char *name, const char *artist) {
+  return library_hash(artist, strlen(artist),
+                      library_hash(name, strlen(name) + 1));
+}
+
+template <typename Match>
+static int catalog_find(const CatalogIndex &index, uint32_t hash,
+                        Match match) {
+  uint32_t slot = hash & index.slot_mask;
+  while (index.slots[slot] != 0) {
+    const int id = index.slots[slot] - 1;
+    if (index.hashes[id] == hash && match(id)) {
+      return id;
     }
-    out.trim();
-    return out;
+    slot = (slot + 1) & index.slot_mask;
   }
+  return -1;
+}
 
-  if (encoding == 0) {
-    String out;
-    out.reserve(len + 1);
-    for (size_t i = 0; i < len; ++i) {
-      uint8_t b = data[i];
-      if (b == 0x00) {
-        break;
-      }
-      if (b < 0x80) {
-        out += static_cast<char>(b);
-      } else {
-        append_utf8(out, static_cast<uint32_t>(b));
-      }
-    }
-    out.trim();
-    return out;
+static void clear_slots(CatalogIndex &index) {
+  memset(index.slots, 0, (index.slot_mask + 1) * sizeof(int16_t));
+}
+
+static void catalog_insert(CatalogIndex &index, uint32_t hash, int id) {
+  uint32_t slot = hash & index.slot_mask;
+  while (index.slots[slot] != 0) {
+    slot = (slot + 1) & index.slot_mask;
   }
+  index.slots[slot] = static_cast<int16_t>(id + 1);
+  index.hashes[id] = hash;
+}
 
-  // UTF-16/UTF-16BE -> UTF-8
-  bool big_endian = (encoding == 2);
-  size_t start = 0;
-  if (encoding == 1 && len >= 2) {
-    if (data[0] == 0xFF && data[1] == 0xFE) {
-      big_endian = false;
-      start = 2;
-    } else if (data[0] == 0xFE && data[1] == 0xFF) {
-      big_endian = true;
-      start = 2;
-    } else {
-      // Heuristic: look for zero byte position
-      if (data[0] == 0x00 && data[1] != 0x00) {
-        big_endian = true;
-      } else if (data[1] == 0x00 && data[0] != 0x00) {
-        big_endian = false;
-      }
-    }
+static int16_t intern_name(CatalogIndex &index, const char **names,
+                           int &count, int capacity, const char *value) {
+  if (!value || value[0] == '\0') {
+    return -1;
+  }
+  const uint32_t hash = library_hash(value, strlen(value));
+  // Names come from the string pool, so equal names are usually the same
+  // pointer; strcmp only runs for strings stored outside it.
+  int id = catalog_find(index, hash, [&](int i) {
+    return names[i] == value || strcmp(names[i], value) == 0;
+  });
+  if (id < 0 && count < capacity) {
+    id = count++;
+    names[id] = value;
+    catalog_insert(index, hash, id);
   }
+  return static_cast<int16_t>(id);
+}
 
-  if (start < len && ((len - start) & 1)) {
-    len -= 1;
+static int16_t intern_album(Library &lib, const char *name,
+                            const char *artist, int16_t artist_id) {
+  if (!name || name[0] == '\0') {
+    return -1;
   }
+  const uint32_t hash = album_hash(name, artist);
+  int id = catalog_find(lib.album_index, hash, [&](int i) {
+    const AlbumInfo &album = lib.albums[i];
+    return (album.name == name || strcmp(album.name, name) == 0) &&
+           (album.artist == artist || strcmp(album.artist, artist) == 0);
+  });
+  if (id < 0 && lib.album_count < lib.album_capacity) {
+    id = lib.album_count++;
+    lib.albums[id].name = name;
+    lib.albums[id].artist = artist;
+    lib.albums[id].artist_id = artist_id;
+    catalog_insert(lib.album_index, hash, id);
+  }
+  return static_cast<int16_t>(id);
+}
 
-  String out;
-  out.reserve(len / 2 + 1);
-  for (size_t i = start; i + 1 < len; i += 2) {
-    uint16_t w = big_endian
-                     ? (static_cast<uint16_t>(data[i]) << 8) | data[i + 1]
-                     : (static_cast<uint16_t>(data[i + 1]) << 8) | data[i];
-    if (w == 0x0000) {
-      break;
+// Counting sort of member ids by group id. On entry first[g + 1] holds the
+// size of group g; on return first[g] is where group g starts in out.
+template <typename GroupOf>
+static void pack_groups(uint16_t *first, int group_count, int member_count,
+                        uint16_t *out, GroupOf group_of) {
+  for (int g = 0; g < group_count; ++g) {
+    first[g + 1] += first[g];
+  }
+  for (int i = 0; i < member_count; ++i) {
+    const int g = group_of(i);
+    if (g >= 0) {
+      out[first[g]++] = static_cast<uint16_t>(i);
     }
-    if (w >= 0xD800 && w <= 0xDBFF && i + 3 < len) {
-      uint16_t w2 =
-          big_endian ? (static_cast<uint16_t>(data[i + 2]) << 8) | data[i + 3]
-                     : (static_cast<uint16_t>(data[i + 3]) << 8) | data[i + 2];
-      if (w2 >= 0xDC00 && w2 <= 0xDFFF) {
-        uint32_t code = 0x10000 + (((w - 0xD800) << 10) | (w2 - 0xDC00));
-        append_utf8(out, code);
-        i += 2;
-        continue;
-      }
+  }
+  // The fill advanced every first[g] to the start of group g + 1.
+  for (int g = group_count; g > 0; --g) {
+    first[g] = first[g - 1];
+  }
+  first[0] = 0;
+}
+
+static void build_postings(CatalogIndex &index, int id_count,
+                           const Library &lib, int16_t TrackInfo::*field) {
+  memset(index.first, 0, (id_count + 1) * sizeof(uint16_t));
+  for (int i = 0; i < lib.track_count; ++i) {
+    const int id = lib.tracks[i].*field;
+    if (id >= 0) {
+      index.first[id + 1]++;
     }
-    append_utf8(out, static_cast<uint32_t>(w));
   }
-  out.trim();
-  return out;
+  pack_groups(index.first, id_count, lib.track_count, index.tracks,
+              [&](int i) { return lib.tracks[i].*field; });
 }
 
-static void assign_if_empty(String &target, const String &value) {
-  if (target.length() == 0 && value.length() > 0) {
-    target = value;
+static void build_artist_albums(Library &lib) {
+  memset(lib.artist_album_first, 0, (lib.artist_count + 1) * sizeof(uint16_t));
+  for (int i = 0; i < lib.album_count; ++i) {
+    if (lib.albums[i].artist_id >= 0) {
+      lib.artist_album_first[lib.albums[i].artist_id + 1]++;
+    }
   }
+  pack_groups(lib.artist_album_first, lib.artist_count, lib.album_count,
+              lib.artist_albums,
+              [&](int i) { return lib.albums[i].artist_id; });
 }
 
-static bool read_id3_tags(fs::FS &fs, const String &path, TagInfo &out) {
-  File f = fs.open(path, FILE_READ);
-  if (!f) {
-    return false;
+// Adds member to group g of a packed group table (see pack_groups), keeping
+// the group ascending. first has group_count + 1 entries.
+static void group_insert(uint16_t *first, uint16_t *members, int group_count,
+                         int g, int member) {
+  if (g < 0) {
+    return;
+  }
+  uint16_t *end = members + first[g + 1];
+  uint16_t *at = std::lower_bound(members + first[g], end, member);
+  memmove(at + 1, at, (members + first[group_count] - at) * sizeof(uint16_t));
+  *at = static_cast<uint16_t>(member);
+  for (int i = g + 1; i <= group_count; ++i) {
+    first[i]++;
   }
+}
 
-  uint8_t header[10] = {0};
-  if (f.read(header, sizeof(header)) != sizeof(header)) {
-    f.close();
-    return false;
+static void group_erase(uint16_t *first, uint16_t *members, int group_count,
+                        int g, int member) {
+  if (g < 0) {
+    return;
   }
-  if (header[0] != 'I' || header[1] != 'D' || header[2] != '3') {
-    f.close();
-    return false;
+  uint16_t *end = members + first[g + 1];
+  uint16_t *at = std::lower_bound(members + first[g], end, member);
+  if (at == end || *at != member) {
+    return;
   }
+  memmove(at, at + 1,
+          (members + first[group_count] - at - 1) * sizeof(uint16_t));
+  for (int i = g + 1; i <= group_count; ++i) {
+    first[i]--;
+  }
+}
 
-  uint8_t version = header[3];
-  uint32_t tag_size = read_syncsafe(&header[6]);
-  uint32_t pos = 10;
+// intern_name() for a live table: a new id starts with no tracks.
+static int16_t link_name(CatalogIndex &index, const char **names, int &count,
+                         int capacity, const char *value) {
+  const int before = count;
+  const int16_t id = intern_name(index, names, count, capacity, value);
+  if (count != before) {
+    index.first[count] = index.first[before];
+  }
+  return id;
+}
 
-  while (pos + 10 <= tag_size + 10) {
-    uint8_t frame_header[10] = {0};
-    if (f.read(frame_header, sizeof(frame_header)) != sizeof(frame_header)) {
-      break;
-    }
-    pos += 10;
+static int copy_postings(const CatalogIndex &index, int id, int *out,
+                         int max) {
+  if (id < 0) {
+    return 0;
+  }
+  int count = 0;
+  for (int i = index.first[id]; i < index.first[id + 1] && count < max; ++i) {
+    out[count++] = index.tracks[i];
+  }
+  return count;
+}
 
-    if (frame_header[0] == 0) {
-      break;
+static int find_name(const CatalogIndex &index, const char *const *names,
+                     const String &name) {
+  if (!index.slots) {
+    return -1;
+  }
+  const char *value = name.c_str();
+  return catalog_find(index, library_hash(value, name.length()), [&](int i) {
+    return strcmp(names[i], value) == 0;
+  });
+}
+
+// compare returns <0, 0 or >0 like strcmp; equal ids keep their track order.
+// Only ids that keep() accepts are listed.
+template <typename Compare, typename Keep>
+static void build_order(SortOrder &order, int count, Compare compare,
+                        Keep keep) {
+  int listed = 0;
+  for (int i = 0; i < count; ++i) {
+    order.rank[i] = static_cast<uint16_t>(count);
+    if (keep(i)) {
+      order.ids[listed++] = static_cast<uint16_t>(i);
     }
+  }
+  std::sort(order.ids, order.ids + listed, [&](uint16_t a, uint16_t b) {
+    const int c = compare(a, b);
+    return c != 0 ? c < 0 : a < b;
+  });
+  for (int i = 0; i < listed; ++i) {
+    order.rank[order.ids[i]] = static_cast<uint16_t>(i);
+  }
+  order.count = listed;
+}
 
-    char frame_id[5] = {0};
-    memcpy(frame_id, frame_header, 4);
+template <typename Compare>
+static void build_order(SortOrder &order, int count, Compare compare) {
+  build_order(order, count, compare, [](int) { return true; });
+}
 
-    uint32_t frame_size = (version == 4) ? read_syncsafe(&frame_header[4])
-                                         : read_u32_be(&frame_header[4]);
-    if (frame_size == 0 || pos + frame_size > tag_size + 10) {
-      f.seek(tag_size + 10);
-      break;
+// Lists id at its sorted place, shifting the ids after it up by one.
+template <typename Compare>
+static void order_insert(SortOrder &order, int id, Compare compare) {
+  int lo = 0;
+  int hi = order.count;
+  while (lo < hi) {
+    const int mid = (lo + hi) / 2;
+    const int other = order.ids[mid];
+    const int c = compare(other, id);
+    if (c < 0 || (c == 0 && other < id)) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
     }
+  }
+  for (int pos = order.count; pos > lo; --pos) {
+    order.ids[pos] = order.ids[pos - 1];
+    order.rank[order.ids[pos]] = static_cast<uint16_t>(pos);
+  }
+  order.ids[lo] = static_cast<uint16_t>(id);
+  order.rank[id] = static_cast<uint16_t>(lo);
+  order.count++;
+}
 
-    if (frame_id[0] == 'T') {
-      uint8_t encoding = 0;
-      if (frame_size > 0) {
-        f.read(&encoding, 1);
-        frame_size--;
-        pos += 1;
-      }
-      const size_t max_len = 256;
-      size_t read_len = frame_size > max_len ? max_len : frame_size;
-      if ((encoding == 1 || encoding == 2) && (read_len & 1)) {
-        read_len -= 1;
-      }
-      uint8_t buf[max_len];
-      memset(buf, 0, sizeof(buf));
-      if (read_len > 0) {
-        f.read(buf, read_len);
-        pos += read_len;
-      }
-      if (frame_size > read_len) {
-        f.seek(f.position() + (frame_size - read_len));
-        pos += frame_size - read_len;
-      }
+static void order_erase(SortOrder &order, int id) {
+  const int pos = order.rank[id];
+  if (pos >= order.count || order.ids[pos] != id) {
+    return;
+  }
+  for (int i = pos; i + 1 < order.count; ++i) {
+    order.ids[i] = order.ids[i + 1];
+    order.rank[order.ids[i]] = static_cast<uint16_t>(i);
+  }
+  order.count--;
+}
 
-      String text = decode_text_frame(encoding, buf, read_len);
-      if (strcmp(frame_id, "TIT2") == 0) {
-        assign_if_empty(out.title, text);
-      } else if (strcmp(frame_id, "TPE1") == 0) {
-        assign_if_empty(out.artist, text);
-      } else if (strcmp(frame_id, "TALB") == 0) {
-        assign_if_empty(out.album, text);
-      } else if (strcmp(frame_id, "TCON") == 0) {
-        assign_if_empty(out.genre, text);
-      } else if (strcmp(frame_id, "TCOM") == 0) {
-        assign_if_empty(out.composer, text);
-      }
-    } else if (strcmp(frame_id, "APIC") == 0) {
-      if (out.cover_len == 0 && frame_size > 0) {
-        size_t frame_start = f.position();
-        size_t consumed = 0;
-        uint8_t encoding = 0;
-        f.read(&encoding, 1);
-        consumed = 1;
-
-        String mime;
-        while (consumed < frame_size) {
-          uint8_t c = 0;
-          if (f.read(&c, 1) != 1) {
-            break;
-          }
-          consumed++;
-          if (c == 0) {
-            break;
-          }
-          if (mime.length() < 32) {
-            mime += c;
-          }
-        }
+static int compare_desc(uint32_t a, uint32_t b) {
+  return a == b ? 0 : (a > b ? -1 : 1);
+}
 
-        if (consumed < frame_size) {
-          uint8_t pic_type = 0;
-          f.read(&pic_type, 1);
-          consumed++;
-        }
+static int by_title(const TrackInfo *tracks, int a, int b) {
+  const int c = library_compare_names(tracks[a].title, tracks[b].title);
+  return c != 0 ? c : library_compare_names(tracks[a].artist, tracks[b].artist);
+}
 
-        if (consumed < frame_size) {
-          if (encoding == 0 || encoding == 3) {
-            uint8_t c = 0;
-            while (consumed < frame_size) {
-              if (f.read(&c, 1) != 1) {
-                break;
-              }
-              consumed++;
-              if (c == 0) {
-                break;
-              }
-            }
-          } else {
-            uint8_t prev = 0;
-            uint8_t cur = 0;
-            while (consumed + 1 < frame_size) {
-              if (f.read(&cur, 1) != 1) {
-                break;
-              }
-              consumed++;
-              if (prev == 0 && cur == 0) {
-                break;
-              }
-              prev = cur;
-            }
-          }
-        }
+static int by_added(const TrackInfo *tracks, int a, int b) {
+  return compare_desc(tracks[a].added_time, tracks[b].added_time);
+}
 
-        if (consumed < frame_size) {
-          out.cover_pos = frame_start + consumed;
-          out.cover_len = frame_size - consumed;
-          String lower = mime;
-          lower.toLowerCase();
-          if (lower.indexOf("png") >= 0) {
-            out.cover_format = CoverFormat::Png;
-          } else if (lower.indexOf("jpeg") >= 0 || lower.indexOf("jpg") >= 0) {
-            out.cover_format = CoverFormat::Jpeg;
-          } else if (lower.indexOf("bmp") >= 0) {
-            out.cover_format = CoverFormat::Bmp;
-          } else {
-            out.cover_format = CoverFormat::Unknown;
-          }
-        }
+static int by_play_count(const TrackInfo *tracks, int a, int b) {
+  return compare_desc(tracks[a].play_count, tracks[b].play_count);
+}
 
-        f.seek(frame_start + frame_size);
-        pos += frame_size;
-      } else {
-        f.seek(f.position() + frame_size);
-        pos += frame_size;
-      }
-    } else {
-      f.seek(f.position() + frame_size);
-      pos += frame_size;
-    }
+static int by_last_played(const TrackInfo *tracks, int a, int b) {
+  return compare_desc(tracks[a].last_played, tracks[b].last_played);
+}
+
+struct TrackOrder {
+  SortOrder LibraryOrders::*order;
+  int (*compare)(const TrackInfo *tracks, int a, int b);
+};
+
+static const TrackOrder kTrackOrders[] = {
+    {&LibraryOrders::title, by_title},
+    {&LibraryOrders::added, by_added},
+    {&LibraryOrders::play_count, by_play_count},
+    {&LibraryOrders::last_played, by_last_played},
+};
+
+static auto by_name(const char *const *names) {
+  return [names](int a, int b) {
+    return library_compare_names(names[a], names[b]);
+  };
+}
+
+static auto by_album(const AlbumInfo *albums) {
+  return [albums](int a, int b) {
+    const int c = library_compare_names(albums[a].name, albums[b].name);
+    return c != 0 ? c
+                  : library_compare_names(albums[a].artist, albums[b].artist);
+  };
+}
+
+static void build_orders(Library &lib) {
+  const TrackInfo *tracks = lib.tracks;
+  LibraryOrders &order = lib.order;
+  for (const TrackOrder &o : kTrackOrders) {
+    build_order(
+        order.*o.order, lib.track_count,
+        [&](int a, int b) { return o.compare(tracks, a, b); },
+        [&](int i) { return library_track_live(lib, i); });
   }
+  build_order(order.artists, lib.artist_count, by_name(lib.artists));
+  build_order(order.genres, lib.genre_count, by_name(lib.genres));
+  build_order(order.composers, lib.composer_count, by_name(lib.composers));
+  build_order(order.albums, lib.album_count, by_album(lib.albums));
+}
 
-  f.close();
-  return true;
+// Moves id from its current position up to position to, shifting the ids in
+// between down by one.
+static void move_up(SortOrder &order, int id, int to) {
+  int pos = order.rank[id];
+  while (pos > to) {
+    order.ids[pos] = order.ids[pos - 1];
+    order.rank[order.ids[pos]] = static_cast<uint16_t>(pos);
+    --pos;
+  }
+  order.ids[pos] = static_cast<uint16_t>(id);
+  order.rank[id] = static_cast<uint16_t>(pos);
 }
 
-static void add_unique(const char **arr, int &count, int max,
-                       const char *value) {
-  if (!value || value[0] == '\0') {
-    return;
+struct Capacities {
+  int tracks;
+  int artists;
+  int albums;
+  int genres;
+  int composers;
+};
+
+static Capacities capacities_for(int tracks) {
+  Capacities c;
+  c.tracks = tracks;
+  c.artists = std::max(128, tracks / 4);
+  c.albums = std::max(256, tracks / 2);
+  c.genres = std::max(64, tracks / 16);
+  c.composers = std::max(64, tracks / 4);
+  return c;
+}
+
+static uint32_t slot_count_for(int ids) {
+  uint32_t slots = 16;
+  while (slots < static_cast<uint32_t>(ids) * 2) {
+    slots <<= 1;
   }
-  for (int i = 0; i < count; ++i) {
-    if (same_str(arr[i], value)) {
-      return;
-    }
+  return slots;
+}
+
+static size_t catalog_bytes(int ids, int tracks) {
+  return slot_count_for(ids) * sizeof(int16_t) + ids * sizeof(uint32_t) +
+         (ids + 1) * sizeof(uint16_t) + tracks * sizeof(uint16_t);
+}
+
+// Four track orders and one per catalog, each with its rank array.
+static size_t order_bytes(const Capacities &c) {
+  const int ids = 4 * c.tracks + c.artists + c.albums + c.genres + c.composers;
+  return ids * 2 * sizeof(uint16_t);
+}
+
+// Arena bytes for the tables alloc_tables() carves out, plus alignment slack.
+static size_t table_bytes(const Capacities &c) {
+  const size_t names =
+      (c.artists + c.genres + c.composers) * sizeof(const char *);
+  return c.tracks * sizeof(TrackInfo) + c.albums * sizeof(AlbumInfo) + names +
+         catalog_bytes(c.artists, c.tracks) +
+         catalog_bytes(c.albums, c.tracks) +
+         catalog_bytes(c.genres, c.tracks) +
+         catalog_bytes(c.composers, c.tracks) +
+         (c.artists + 1 + c.albums) * sizeof(uint16_t) +
+         order_bytes(c) + 64;
+}
+
+template <typename T> static T *arena_array(LibraryArena &arena, int count) {
+  return static_cast<T *>(arena.alloc(count * sizeof(T), alignof(T)));
+}
+
+static void alloc_catalog(LibraryArena &arena, CatalogIndex &index, int ids,
+                          int tracks) {
+  const uint32_t slots = slot_count_for(ids);
+  index.slots = arena_array<int16_t>(arena, slots);
+  index.hashes = arena_array<uint32_t>(arena, ids);
+  index.first = arena_array<uint16_t>(arena, ids + 1);
+  index.tracks = arena_array<uint16_t>(arena, tracks);
+  index.slot_mask = slots - 1;
+}
+
+static void alloc_order(LibraryArena &arena, SortOrder &order, int ids) {
+  order.ids = arena_array<uint16_t>(arena, ids);
+  order.rank = arena_array<uint16_t>(arena, ids);
+}
+
+static void alloc_tables(Library &lib, const Capacities &c) {
+  LibraryArena &arena = lib.arena;
+  lib.tracks = arena_array<TrackInfo>(arena, c.tracks);
+  for (int i = 0; i < c.tracks; ++i) {
+    new (&lib.tracks[i]) TrackInfo();
   }
-  if (count < max) {
-    arr[count++] = value;
+  lib.albums = arena_array<AlbumInfo>(arena, c.albums);
+  for (int i = 0; i < c.albums; ++i) {
+    new (&lib.albums[i]) AlbumInfo();
   }
+  lib.artists = arena_array<const char *>(arena, c.artists);
+  lib.genres = arena_array<const char *>(arena, c.genres);
+  lib.composers = arena_array<const char *>(arena, c.composers);
+  alloc_catalog(arena, lib.artist_index, c.artists, c.tracks);
+  alloc_catalog(arena, lib.album_index, c.albums, c.tracks);
+  alloc_catalog(arena, lib.genre_index, c.genres, c.tracks);
+  alloc_catalog(arena, lib.composer_index, c.composers, c.tracks);
+  lib.artist_album_first = arena_array<uint16_t>(arena, c.artists + 1);
+  lib.artist_albums = arena_array<uint16_t>(arena, c.albums);
+  alloc_order(arena, lib.order.title, c.tracks);
+  alloc_order(arena, lib.order.added, c.tracks);
+  alloc_order(arena, lib.order.play_count, c.tracks);
+  alloc_order(arena, lib.order.last_played, c.tracks);
+  alloc_order(arena, lib.order.artists, c.artists);
+  alloc_order(arena, lib.order.albums, c.albums);
+  alloc_order(arena, lib.order.genres, c.genres);
+  alloc_order(arena, lib.order.composers, c.composers);
+
+  lib.track_capacity = c.tracks;
+  lib.artist_capacity = c.artists;
+  lib.album_capacity = c.albums;
+  lib.genre_capacity = c.genres;
+  lib.composer_capacity = c.composers;
 }
 
-static void add_unique_album(AlbumInfo *arr, int &count, int max,
-                             const char *name, const char *artist) {
-  if (!name || name[0] == '\0') {
-    return;
+static void *alloc_prefer_psram(size_t bytes) {
+  void *p = heap_caps_malloc(bytes, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+  return p ? p : malloc(bytes);
+}
+
+// Doubles the intern table, or creates it sized to the main block.
+static bool grow_pool_table(StringPool &pool) {
+  uint32_t count = pool.slots ? (pool.slot_mask + 1) * 2 : 1024;
+  while (count < pool.capacity / 64) {
+    count <<= 1;
   }
-  for (int i = 0; i < count; ++i) {
-    if (same_str(arr[i].name, name) && same_str(arr[i].artist, artist)) {
-      return;
+  auto *slots = static_cast<const char **>(
+      alloc_prefer_psram(count * sizeof(const char *)));
+  auto *hashes =
+      static_cast<uint32_t *>(alloc_prefer_psram(count * sizeof(uint32_t)));
+  if (!slots || !hashes) {
+    free(slots);
+    free(hashes);
+    return false;
+  }
+  memset(slots, 0, count * sizeof(const char *));
+  const uint32_t mask = count - 1;
+  if (pool.slots) {
+    for (uint32_t i = 0; i <= pool.slot_mask; ++i) {
+      if (!pool.slots[i]) {
+        continue;
+      }
+      uint32_t slot = pool.slot_hashes[i] & mask;
+      while (slots[slot]) {
+        slot = (slot + 1) & mask;
+      }
+      slots[slot] = pool.slots[i];
+      hashes[slot] = pool.slot_hashes[i];
     }
+    free(pool.slots);
+    free(pool.slot_hashes);
+  }
+  pool.slots = slots;
+  pool.slot_hashes = hashes;
+  pool.slot_mask = mask;
+  return true;
+}
+
+// Reserves need bytes from the main block, then from overflow pages.
+static char *pool_append(StringPool &pool, size_t need) {
+  if (pool.data && pool.used + need <= pool.capacity) {
+    char *out = pool.data + pool.used;
+    pool.used += need;
+    return out;
   }
-  if (count < max) {
-    arr[count].name = name;
-    arr[count].artist = artist;
-    ++count;
+  StringPool::Page *page = pool.pages;
+  if (!page || page->used + need > page->capacity) {
+    const size_t cap = std::max(StringPool::kPageSize, need);
+    page = static_cast<StringPool::Page *>(
+        alloc_prefer_psram(sizeof(StringPool::Page) + cap));
+    if (!page) {
+      return nullptr;
+    }
+    page->next = pool.pages;
+    page->capacity = cap;
+    page->used = 0;
+    pool.pages = page;
+    pool.page_count++;
+    pool.page_bytes += cap;
   }
+  char *out = reinterpret_cast<char *>(page + 1) + page->used;
+  page->used += need;
+  return out;
 }
 
-static bool is_supported_audio(const String &path) {
-  String lower = path;
-  lower.toLowerCase();
-  int dot = lower.lastIndexOf('.');
-  if (dot < 0) {
-    return false;
+// Sizes the library from free PSRAM: half of it goes to the track tables and
+// the string pool, the rest stays for covers, decoders and LVGL.
+static void init_storage(Library &lib) {
+  const size_t psram_free = heap_caps_get_free_size(MALLOC_CAP_SPIRAM);
+  int tracks = kDefaultTrackCapacity;
+  if (psram_free > 0) {
+    const Capacities probe = capacities_for(kMaxTrackCapacity);
+    // The pool's intern table starts at one 8-byte slot per 64 pool bytes.
+    const size_t per_track = table_bytes(probe) / kMaxTrackCapacity +
+                             kPoolBytesPerTrack + kPoolBytesPerTrack / 8;
+    const size_t fit = (psram_free / 2) / per_track;
+    tracks = static_cast<int>(
+        std::min<size_t>(std::max<size_t>(fit, kDefaultTrackCapacity),
+                         kMaxTrackCapacity));
   }
-  String ext = lower.substring(dot + 1);
-  return (ext == "mp3" || ext == "wav");
+
+  Capacities c = capacities_for(tracks);
+  while (!lib.arena.init(table_bytes(c)) && c.tracks > kDefaultTrackCapacity) {
+    c = capacities_for(std::max(kDefaultTrackCapacity, c.tracks / 2));
+  }
+  if (!lib.arena.data) {
+    Serial.printf("[LIB] no memory for %d tracks\n", c.tracks);
+    return;
+  }
+  alloc_tables(lib, c);
+  lib.pool.init(static_cast<size_t>(c.tracks) * kPoolBytesPerTrack);
+
+  Serial.printf("[LIB] capacity %d tracks: tables %u B (%u B/track, %s), "
+                "strings %u B (%s)\n",
+                c.tracks, static_cast<unsigned>(lib.arena.used),
+                static_cast<unsigned>(lib.arena.used / c.tracks),
+                lib.arena.in_psram ? "PSRAM" : "internal",
+                static_cast<unsigned>(lib.pool.capacity),
+                lib.pool.in_psram ? "PSRAM" : "internal");
 }
 
 static void scan_dir(Library &lib, fs::FS &fs, const String &dir,
                      uint8_t levels, int max_files, bool read_tags,
-                     void (*tick)(), int &files_seen) {
+                     void (*tick)(), const LibraryIndex *cache,
+                     int &files_seen) {
   if (lib.track_count >= max_files) {
     return;
   }
@@ -419,7 +608,7 @@ static void scan_dir(Library &lib, fs::FS &fs, const String &dir,
         if (!sub.startsWith("/")) {
           sub = dir + String("/") + sub;
         }
-        scan_dir(lib, fs, sub, levels - 1, max_files, read_tags, tick,
+        scan_dir(lib, fs, sub, levels - 1, max_files, read_tags, tick, cache,
                  files_seen);
       }
     } else {
@@ -435,62 +624,17 @@ static void scan_dir(Library &lib, fs::FS &fs, const String &dir,
           yield();
         }
       }
-      if (!is_supported_audio(fname)) {
+      if (!library_is_supported_audio(fname)) {
         file = root.openNextFile();
         continue;
       }
 
+      const uint32_t file_size = file.size();
+      const uint32_t mtime = file.getLastWrite();
+      TrackTags tags;
+      library_read_tags(fs, fname, file_size, mtime, read_tags, cache, tags);
       TrackInfo &track = lib.tracks[lib.track_count];
-      track.path = lib.pool.store(fname);
-      track.added_time = file.getLastWrite();
-
-      TagInfo tags;
-      if (read_tags) {
-        read_id3_tags(fs, fname, tags);
-      }
-
-      String title = tags.title;
-      String artist = tags.artist;
-      String album = tags.album;
-      String genre = tags.genre;
-      String composer = tags.composer;
-
-      if (title.length() == 0) {
-        title = basename_no_ext(fname);
-      }
-      if (artist.length() == 0) {
-        String guess = parent_dir(fname, 2);
-        artist = guess.length() > 0 ? guess : kUnknownArtist;
-      }
-      if (album.length() == 0) {
-        String guess = parent_dir(fname, 1);
-        album = guess.length() > 0 ? guess : kUnknownAlbum;
-      }
-      if (genre.length() == 0) {
-        genre = kUnknownGenre;
-      }
-      if (composer.length() == 0) {
-        composer = kUnknownComposer;
-      }
-
-      track.title = lib.pool.store(
-          empty_or(title.c_str(), basename_no_ext(fname).c_str()));
-      track.artist = lib.pool.store(empty_or(artist.c_str(), kUnknownArtist));
-      track.album = lib.pool.store(empty_or(album.c_str(), kUnknownAlbum));
-      track.genre = lib.pool.store(empty_or(genre.c_str(), kUnknownGenre));
-      track.composer =
-          lib.pool.store(empty_or(composer.c_str(), kUnknownComposer));
-      track.cover_pos = tags.cover_pos;
-      track.cover_len = tags.cover_len;
-      track.cover_format = tags.cover_format;
-
-      add_unique(lib.artists, lib.artist_count, kMaxArtists, track.artist);
-      add_unique_album(lib.albums, lib.album_count, kMaxAlbums, track.album,
-                       track.artist);
-      add_unique(lib.genres, lib.genre_count, kMaxGenres, track.genre);
-      add_unique(lib.composers, lib.composer_count, kMaxComposers,
-                 track.composer);
-
+      library_store_track(lib, fname, file_size, mtime, tags, track);
       lib.track_count++;
     }
     file = root.openNextFile();
@@ -499,6 +643,34 @@ static void scan_dir(Library &lib, fs::FS &fs, const String &dir,
 
 } // namespace
 
+bool LibraryArena::init(size_t cap) {
+  if (data) {
+    return true;
+  }
+  data = static_cast<uint8_t *>(
+      heap_caps_malloc(cap, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT));
+  in_psram = (data != nullptr);
+  if (!data) {
+    data = static_cast<uint8_t *>(malloc(cap));
+  }
+  if (!data) {
+    return false;
+  }
+  memset(data, 0, cap);
+  capacity = cap;
+  used = 0;
+  return true;
+}
+
+void *LibraryArena::alloc(size_t size, size_t align) {
+  const size_t start = (used + align - 1) & ~(align - 1);
+  if (!data || start + size > capacity) {
+    return nullptr;
+  }
+  used = start + size;
+  return data + start;
+}
+
 void StringPool::init(size_t cap) {
   if (data) {
     return;
@@ -508,47 +680,449 @@ void StringPool::init(size_t cap) {
       heap_caps_malloc(cap, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT));
   if (data) {
     in_psram = true;
-    return;
-  }
-  data = static_cast<char *>(malloc(cap));
-  if (data) {
+  } else {
+    data = static_cast<char *>(malloc(cap));
     in_psram = false;
   }
+  if (!data) {
+    capacity = 0;
+  }
+  grow_pool_table(*this);
+  reset();
 }
 
-void StringPool::reset() { used = 0; }
+void StringPool::reset() {
+  while (pages) {
+    Page *next = pages->next;
+    free(pages);
+    pages = next;
+  }
+  page_count = 0;
+  page_bytes = 0;
+  used = 0;
+  strings = 0;
+  hits = 0;
+  bytes_saved = 0;
+  if (slots) {
+    memset(slots, 0, (slot_mask + 1) * sizeof(const char *));
+  }
+}
 
-const char *StringPool::store_cstr(const char *s) {
+const char *StringPool::store_cstr(const char *s, bool intern) {
   if (!s || s[0] == '\0') {
     return "";
   }
-  size_t len = strlen(s);
-  size_t need = len + 1;
-  if (!data || used + need > capacity) {
-    char *dup = static_cast<char *>(malloc(need));
-    if (!dup) {
+  const size_t len = strlen(s);
+  if (!intern) {
+    char *out = pool_append(*this, len + 1);
+    if (!out) {
       return "";
     }
-    memcpy(dup, s, need);
-    return dup;
+    memcpy(out, s, len + 1);
+    return out;
+  }
+  const uint32_t hash = library_hash(s, len);
+  if (slots && strings * 2 >= slot_mask + 1) {
+    grow_pool_table(*this);
+  }
+
+  uint32_t slot = 0;
+  if (slots) {
+    slot = hash & slot_mask;
+    while (slots[slot]) {
+      if (slot_hashes[slot] == hash && strcmp(slots[slot], s) == 0) {
+        ++hits;
+        bytes_saved += len + 1;
+        return slots[slot];
+      }
+      slot = (slot + 1) & slot_mask;
+    }
+  }
+
+  char *out = pool_append(*this, len + 1);
+  if (!out) {
+    return "";
+  }
+  memcpy(out, s, len + 1);
+  // A full table (growth failed) still stores, it just stops deduplicating.
+  if (slots && strings * 2 < slot_mask + 1) {
+    slots[slot] = out;
+    slot_hashes[slot] = hash;
+    ++strings;
   }
-  char *out = data + used;
-  memcpy(out, s, need);
-  used += need;
   return out;
 }
 
-const char *StringPool::store(const String &s) {
+const char *StringPool::store(const String &s, bool intern) {
   if (s.length() == 0) {
     return "";
   }
-  return store_cstr(s.c_str());
+  return store_cstr(s.c_str(), intern);
+}
+
+uint32_t library_hash(const void *data, size_t len, uint32_t hash) {
+  const uint8_t *p = static_cast<const uint8_t *>(data);
+  for (size_t i = 0; i < len; ++i) {
+    hash ^= p[i];
+    hash *= 16777619u;
+  }
+  return hash;
+}
+
+bool library_is_supported_audio(const String &path) {
+  String lower = path;
+  lower.toLowerCase();
+  int dot = lower.lastIndexOf('.');
+  if (dot < 0) {
+    return false;
+  }
+  String ext = lower.substring(dot + 1);
+  return (ext == "mp3" || ext == "wav" || ext == "flac" || ext == "m4a" ||
+          ext == "aac" || ext == "oga");
+}
+
+void library_read_tags(fs::FS &fs, const String &path, uint32_t file_size,
+                       uint32_t mtime, bool read_tags,
+                       const LibraryIndex *cache, TrackTags &out) {
+  const LibraryIndexRecord *cached =
+      (read_tags && cache) ? cache->find(path.c_str(), file_size, mtime)
+                           : nullptr;
+  if (cached) {
+    out.title = cache->str(cached->title);
+    out.artist = cache->str(cached->artist);
+    out.album = cache->str(cached->album);
+    out.genre = cache->str(cached->genre);
+    out.composer = cache->str(cached->composer);
+    out.cover_pos = cached->cover_pos;
+    out.cover_len = cached->cover_len;
+    out.cover_format = static_cast<CoverFormat>(cached->cover_format);
+    out.duration_sec = cached->duration_sec;
+    out.start = cached->start;
+  } else if (read_tags) {
+    library_read_file_tags(fs, path, out);
+  }
+
+  if (out.title.length() == 0) {
+    out.title = basename_no_ext(path);
+  }
+  if (out.artist.length() == 0) {
+    String guess = parent_dir(path, 2);
+    out.artist = guess.length() > 0 ? guess : kUnknownArtist;
+  }
+  if (out.album.length() == 0) {
+    String guess = parent_dir(path, 1);
+    out.album = guess.length() > 0 ? guess : kUnknownAlbum;
+  }
+  if (out.genre.length() == 0) {
+    out.genre = kUnknownGenre;
+  }
+  if (out.composer.length() == 0) {
+    out.composer = kUnknownComposer;
+  }
+}
+
+void library_store_track(Library &lib, const String &path, uint32_t file_size,
+                         uint32_t mtime, const TrackTags &tags,
+                         TrackInfo &track) {
+  // Paths are unique per track, so they skip the intern table.
+  if (strcmp(track.path, path.c_str()) != 0) {
+    track.path = lib.pool.store(path, false);
+    stats::fill(track);
+  }
+  track.file_size = file_size;
+  track.added_time = mtime;
+  track.title = lib.pool.store(
+      empty_or(tags.title.c_str(), basename_no_ext(path).c_str()));
+  track.artist = lib.pool.store(empty_or(tags.artist.c_str(), kUnknownArtist));
+  track.album = lib.pool.store(empty_or(tags.album.c_str(), kUnknownAlbum));
+  track.genre = lib.pool.store(empty_or(tags.genre.c_str(), kUnknownGenre));
+  track.composer =
+      lib.pool.store(empty_or(tags.composer.c_str(), kUnknownComposer));
+  track.cover_pos = tags.cover_pos;
+  track.cover_len = tags.cover_len;
+  track.cover_format = tags.cover_format;
+  track.duration_sec = tags.duration_sec;
+  track.start = tags.start;
+}
+
+void library_rebuild_catalogs(Library &lib) {
+  const uint32_t start = micros();
+  lib.artist_count = 0;
+  lib.album_count = 0;
+  lib.genre_count = 0;
+  lib.composer_count = 0;
+  if (!lib.tracks) {
+    return;
+  }
+  clear_slots(lib.artist_index);
+  clear_slots(lib.album_index);
+  clear_slots(lib.genre_index);
+  clear_slots(lib.composer_index);
+
+  for (int i = 0; i < lib.track_count; ++i) {
+    TrackInfo &track = lib.tracks[i];
+    track.artist_id =
+        intern_name(lib.artist_index, lib.artists, lib.artist_count,
+                    lib.artist_capacity, track.artist);
+    track.album_id =
+        intern_album(lib, track.album, track.artist, track.artist_id);
+    track.genre_id = intern_name(lib.genre_index, lib.genres, lib.genre_count,
+                                 lib.genre_capacity, track.genre);
+    track.composer_id =
+        intern_name(lib.composer_index, lib.composers, lib.composer_count,
+                    lib.composer_capacity, track.composer);
+  }
+
+  build_postings(lib.artist_index, lib.artist_count, lib,
+                 &TrackInfo::artist_id);
+  build_postings(lib.album_index, lib.album_count, lib, &TrackInfo::album_id);
+  build_postings(lib.genre_index, lib.genre_count, lib, &TrackInfo::genre_id);
+  build_postings(lib.composer_index, lib.composer_count, lib,
+                 &TrackInfo::composer_id);
+  build_artist_albums(lib);
+  build_orders(lib);
+
+  Serial.printf("[LIB] catalogs: %d tracks, %d artists, %d albums, %lu us\n",
+                lib.track_count, lib.artist_count, lib.album_count,
+                static_cast<unsigned long>(micros() - start));
+  const StringPool &pool = lib.pool;
+  Serial.printf("[LIB] strings: %u unique, %u shared, %u B used of %u B, "
+                "%u B saved, %u overflow pages (%u B)\n",
+                static_cast<unsigned>(pool.strings),
+                static_cast<unsigned>(pool.hits),
+                static_cast<unsigned>(pool.used),
+                static_cast<unsigned>(pool.capacity),
+                static_cast<unsigned>(pool.bytes_saved),
+                static_cast<unsigned>(pool.page_count),
+                static_cast<unsigned>(pool.page_bytes));
+}
+
+void library_mark_played(Library &lib, int index, uint32_t now_sec) {
+  if (!library_track_live(lib, index)) {
+    return;
+  }
+  TrackInfo &track = lib.tracks[index];
+  track.play_count++;
+  track.last_played = now_sec;
+  if (!lib.order.play_count.ids) {
+    return;
+  }
+  SortOrder &plays = lib.order.play_count;
+  int to = plays.rank[index];
+  while (to > 0 &&
+         lib.tracks[plays.ids[to - 1]].play_count < track.play_count) {
+    --to;
+  }
+  move_up(plays, index, to);
+  move_up(lib.order.last_played, index, 0);
+}
+
+namespace {
+
+// One catalog as the track-level edits see it.
+struct CatalogRef {
+  CatalogIndex &index;
+  int count;
+  SortOrder &order;
+  int16_t id;
+};
+
+// Takes track index out of its catalogs and the track orders. Catalog
+// entries left without tracks drop out of their lists.
+static void unlink_track(Library &lib, int index) {
+  const TrackInfo &track = lib.tracks[index];
+  CatalogRef refs[] = {
+      {lib.artist_index, lib.artist_count, lib.order.artists, track.artist_id},
+      {lib.album_index, lib.album_count, lib.order.albums, track.album_id},
+      {lib.genre_index, lib.genre_count, lib.order.genres, track.genre_id},
+      {lib.composer_index, lib.composer_count, lib.order.composers,
+       track.composer_id},
+  };
+  for (CatalogRef &ref : refs) {
+    if (ref.id < 0) {
+      continue;
+    }
+    group_erase(ref.index.first, ref.index.tracks, ref.count, ref.id, index);
+    if (library_catalog_size(ref.index, ref.id) == 0) {
+      order_erase(ref.order, ref.id);
+    }
+  }
+  for (const TrackOrder &o : kTrackOrders) {
+    order_erase(lib.order.*o.order, index);
+  }
+}
+
+// Puts stored track index into its catalogs, adding names it brings, and
+// lists it in the track orders.
+static void link_track(Library &lib, int index) {
+  TrackInfo &track = lib.tracks[index];
+  const int artists = lib.artist_count;
+  track.artist_id = link_name(lib.artist_index, lib.artists, lib.artist_count,
+                              lib.artist_capacity, track.artist);
+  if (lib.artist_count != artists) {
+    lib.artist_album_first[lib.artist_count] = lib.artist_album_first[artists];
+  }
+  const int albums = lib.album_count;
+  track.album_id =
+      intern_album(lib, track.album, track.artist, track.artist_id);
+  if (lib.album_count != albums) {
+    lib.album_index.first[lib.album_count] = lib.album_index.first[albums];
+    group_insert(lib.artist_album_first, lib.artist_albums, lib.artist_count,
+                 track.artist_id, track.album_id);
+  }
+  track.genre_id = link_name(lib.genre_index, lib.genres, lib.genre_count,
+                             lib.genre_capacity, track.genre);
+  track.composer_id =
+      link_name(lib.composer_index, lib.composers, lib.composer_count,
+                lib.composer_capacity, track.composer);
+
+  CatalogRef refs[] = {
+      {lib.artist_index, lib.artist_count, lib.order.artists, track.artist_id},
+      {lib.album_index, lib.album_count, lib.order.albums, track.album_id},
+      {lib.genre_index, lib.genre_count, lib.order.genres, track.genre_id},
+      {lib.composer_index, lib.composer_count, lib.order.composers,
+       track.composer_id},
+  };
+  for (CatalogRef &ref : refs) {
+    if (ref.id < 0) {
+      continue;
+    }
+    group_insert(ref.index.first, ref.index.tracks, ref.count, ref.id, index);
+    if (library_catalog_size(ref.index, ref.id) != 1) {
+      continue;
+    }
+    if (&ref.order == &lib.order.albums) {
+      order_insert(ref.order, ref.id, by_album(lib.albums));
+    } else if (&ref.order == &lib.order.artists) {
+      order_insert(ref.order, ref.id, by_name(lib.artists));
+    } else if (&ref.order == &lib.order.genres) {
+      order_insert(ref.order, ref.id, by_name(lib.genres));
+    } else {
+      order_insert(ref.order, ref.id, by_name(lib.composers));
+    }
+  }
+  const TrackInfo *tracks = lib.tracks;
+  for (const TrackOrder &o : kTrackOrders) {
+    order_insert(lib.order.*o.order, index,
+                 [&](int a, int b) { return o.compare(tracks, a, b); });
+  }
+}
+
+} // namespace
+
+int library_catalog_size(const CatalogIndex &index, int id) {
+  return id < 0 ? 0 : index.first[id + 1] - index.first[id];
+}
+
+int library_add_track(Library &lib, const String &path, uint32_t file_size,
+                      uint32_t mtime, const TrackTags &tags) {
+  if (!lib.tracks || lib.track_count >= lib.track_capacity) {
+    return -1;
+  }
+  const int index = lib.track_count++;
+  TrackInfo &track = lib.tracks[index];
+  track = TrackInfo();
+  library_store_track(lib, path, file_size, mtime, tags, track);
+  link_track(lib, index);
+  lib.generation++;
+  return index;
+}
+
+void library_retag_track(Library &lib, int index, const String &path,
+                         uint32_t file_size, uint32_t mtime,
+                         const TrackTags &tags) {
+  if (!library_track_live(lib, index)) {
+    return;
+  }
+  unlink_track(lib, index);
+  library_store_track(lib, path, file_size, mtime, tags, lib.tracks[index]);
+  link_track(lib, index);
+  lib.generation++;
+}
+
+bool library_remove_track(Library &lib, int index) {
+  if (!library_track_live(lib, index)) {
+    return false;
+  }
+  const uint32_t start = micros();
+  unlink_track(lib, index);
+  lib.tracks[index] = TrackInfo();
+  lib.removed_count++;
+  lib.generation++;
+  Serial.printf("[LIB] removed track %d, %d left, %lu us\n", index,
+                lib.track_count - lib.removed_count,
+                static_cast<unsigned long>(micros() - start));
+  return true;
+}
+
+bool library_track_live(const Library &lib, int index) {
+  if (index < 0 || index >= lib.track_count) {
+    return false;
+  }
+  const char *path = lib.tracks[index].path;
+  return path && path[0] != '\0';
+}
+
+bool library_compact(Library &lib, int16_t *remap) {
+  if (lib.removed_count == 0) {
+    return false;
+  }
+  const int old_count = lib.track_count;
+  int out = 0;
+  for (int i = 0; i < old_count; ++i) {
+    if (!library_track_live(lib, i)) {
+      remap[i] = -1;
+      continue;
+    }
+    if (out != i) {
+      lib.tracks[out] = lib.tracks[i];
+    }
+    remap[i] = static_cast<int16_t>(out++);
+  }
+  for (int i = out; i < old_count; ++i) {
+    lib.tracks[i] = TrackInfo();
+  }
+  lib.track_count = out;
+  lib.removed_count = 0;
+  library_rebuild_catalogs(lib);
+  lib.generation++;
+  lib.layout++;
+  return true;
+}
+
+int library_compare_names(const char *a, const char *b) {
+  const unsigned char *pa = reinterpret_cast<const unsigned char *>(a ? a : "");
+  const unsigned char *pb = reinterpret_cast<const unsigned char *>(b ? b : "");
+  for (;; ++pa, ++pb) {
+    unsigned char ca = *pa;
+    unsigned char cb = *pb;
+    if (ca >= 'A' && ca <= 'Z') {
+      ca = static_cast<unsigned char>(ca + ('a' - 'A'));
+    }
+    if (cb >= 'A' && cb <= 'Z') {
+      cb = static_cast<unsigned char>(cb + ('a' - 'A'));
+    }
+    if (ca != cb) {
+      return ca < cb ? -1 : 1;
+    }
+    if (ca == 0) {
+      return 0;
+    }
+  }
 }
 
 void library_reset(Library &lib) {
-  lib.pool.init(kStringPoolSize);
+  if (!lib.tracks) {
+    init_storage(lib);
+  }
+  // Stale entries would point into the pool being reset.
+  for (int i = 0; i < lib.track_count; ++i) {
+    lib.tracks[i] = TrackInfo();
+  }
   lib.pool.reset();
   lib.track_count = 0;
+  lib.removed_count = 0;
+  lib.layout++;
   lib.artist_count = 0;
   lib.album_count = 0;
   lib.genre_count = 0;
@@ -557,7 +1131,8 @@ void library_reset(Library &lib) {
 }
 
 bool library_scan(Library &lib, fs::FS &fs, const char *root_dir, uint8_t depth,
-                  int max_files, bool read_tags, void (*tick)()) {
+                  int max_files, bool read_tags, void (*tick)(),
+                  const LibraryIndex *cache) {
   library_reset(lib);
   String root = root_dir && root_dir[0] ? root_dir : "/";
   if (!root.startsWith("/")) {
@@ -565,87 +1140,83 @@ bool library_scan(Library &lib, fs::FS &fs, const char *root_dir, uint8_t depth,
   }
 
   int limit = max_files;
-  if (limit <= 0 || limit > kMaxTracks) {
-    limit = kMaxTracks;
+  if (limit <= 0 || limit > lib.track_capacity) {
+    limit = lib.track_capacity;
   }
 
   int files_seen = 0;
-  scan_dir(lib, fs, root, depth, limit, read_tags, tick, files_seen);
+  scan_dir(lib, fs, root, depth, limit, read_tags, tick, cache, files_seen);
+  library_rebuild_catalogs(lib);
+  library_log_tag_stats();
 
   lib.scanned = true;
+  lib.generation++;
   return lib.track_count > 0;
 }
 
 int library_find_artist(const Library &lib, const String &name) {
-  for (int i = 0; i < lib.artist_count; ++i) {
-    if (name == lib.artists[i]) {
-      return i;
-    }
-  }
-  return -1;
+  return find_name(lib.artist_index, lib.artists, name);
 }
 
 int library_find_album(const Library &lib, const String &name,
                        const String &artist) {
-  for (int i = 0; i < lib.album_count; ++i) {
-    if (name == lib.albums[i].name && artist == lib.albums[i].artist) {
-      return i;
-    }
-  }
-  return -1;
+  const char *album = name.c_str();
+  const char *by = artist.c_str();
+  return catalog_find(lib.album_index, album_hash(album, by), [&](int i) {
+    return strcmp(lib.albums[i].name, album) == 0 &&
+           strcmp(lib.albums[i].artist, by) == 0;
+  });
 }
 
 int library_tracks_for_artist(const Library &lib, const String &artist,
                               int *out, int max) {
-  int count = 0;
-  for (int i = 0; i < lib.track_count && count < max; ++i) {
-    if (artist == lib.tracks[i].artist) {
-      out[count++] = i;
-    }
-  }
-  return count;
+  const int id = find_name(lib.artist_index, lib.artists, artist);
+  return copy_postings(lib.artist_index, id, out, max);
 }
 
 int library_tracks_for_album(const Library &lib, const String &artist,
                              const String &album, int *out, int max) {
+  if (artist.length() > 0) {
+    const int id = library_find_album(lib, album, artist);
+    return copy_postings(lib.album_index, id, out, max);
+  }
+
+  // Any artist: gather every album with this name, keeping library order.
   int count = 0;
-  for (int i = 0; i < lib.track_count && count < max; ++i) {
-    if (album == lib.tracks[i].album &&
-        (artist.length() == 0 || artist == lib.tracks[i].artist)) {
-      out[count++] = i;
+  for (int i = 0; i < lib.album_count && count < max; ++i) {
+    if (album == lib.albums[i].name) {
+      count += copy_postings(lib.album_index, i, out + count, max - count);
     }
   }
+  std::sort(out, out + count);
   return count;
 }
 
 int library_tracks_for_genre(const Library &lib, const String &genre, int *out,
                              int max) {
-  int count = 0;
-  for (int i = 0; i < lib.track_count && count < max; ++i) {
-    if (genre == lib.tracks[i].genre) {
-      out[count++] = i;
-    }
-  }
-  return count;
+  const int id = find_name(lib.genre_index, lib.genres, genre);
+  return copy_postings(lib.genre_index, id, out, max);
 }
 
 int library_tracks_for_composer(const Library &lib, const String &composer,
                                 int *out, int max) {
-  int count = 0;
-  for (int i = 0; i < lib.track_count && count < max; ++i) {
-    if (composer == lib.tracks[i].composer) {
-      out[count++] = i;
-    }
-  }
-  return count;
+  const int id = find_name(lib.composer_index, lib.composers, composer);
+  return copy_postings(lib.composer_index, id, out, max);
 }
 
 int library_albums_for_artist(const Library &lib, const String &artist,
                               int *out, int max) {
+  const int id = find_name(lib.artist_index, lib.artists, artist);
+  if (id < 0) {
+    return 0;
+  }
   int count = 0;
-  for (int i = 0; i < lib.album_count && count < max; ++i) {
-    if (artist == lib.albums[i].artist) {
-      out[count++] = i;
+  for (int i = lib.artist_album_first[id];
+       i < lib.artist_album_first[id + 1] && count < max; ++i) {
+    const int album = lib.artist_albums[i];
+    // Albums whose tracks were all removed stay until the next rebuild.
+    if (library_catalog_size(lib.album_index, album) > 0) {
+      out[count++] = album;
     }
   }
   return count;
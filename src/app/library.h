@@ -12,23 +12,71 @@ enum class CoverFormat : uint8_t {
   Bmp,
 };
 
-constexpr int kMaxTracks = 512;
-constexpr int kMaxArtists = 128;
-constexpr int kMaxAlbums = 256;
-constexpr int kMaxGenres = 64;
-constexpr int kMaxComposers = 64;
+// Track capacity is picked at first library_reset() from free PSRAM; boards
+// without PSRAM get kDefaultTrackCapacity. Catalog tables scale with it.
+constexpr int kDefaultTrackCapacity = 512;
+constexpr int kMaxTrackCapacity = 32000;
 constexpr int kMaxPlaylistTracks = 256;
 
+// Bump allocator over a single block; everything is released together.
+struct LibraryArena {
+  uint8_t *data = nullptr;
+  size_t capacity = 0;
+  size_t used = 0;
+  bool in_psram = false;
+
+  bool init(size_t cap);
+  void *alloc(size_t size, size_t align = 4);
+};
+
+// Interning string store. Equal strings share one copy, so pointers handed
+// out by store() can be compared directly. Strings live until reset(); once
+// the main block is full they go to overflow pages, PSRAM first.
 struct StringPool {
+  struct Page {
+    Page *next;
+    size_t capacity;
+    size_t used;
+  };
+
+  static constexpr size_t kPageSize = 16 * 1024;
+
   char *data = nullptr;
   size_t capacity = 0;
   size_t used = 0;
   bool in_psram = false;
+  Page *pages = nullptr;
+  size_t page_count = 0;
+  size_t page_bytes = 0;
+
+  // Open-addressed table of stored strings; grows as they are added.
+  const char **slots = nullptr;
+  uint32_t *slot_hashes = nullptr;
+  uint32_t slot_mask = 0;
+
+  uint32_t strings = 0; // unique strings stored
+  uint32_t hits = 0;    // store() calls answered from the table
+  size_t bytes_saved = 0;
 
   void init(size_t cap);
   void reset();
-  const char *store(const String &s);
-  const char *store_cstr(const char *s);
+  // intern = false appends without a lookup, for strings known to be unique.
+  const char *store(const String &s, bool intern = true);
+  const char *store_cstr(const char *s, bool intern = true);
+};
+
+// Where the first audio frame sits and how it decodes, as the tag reader
+// found it (MP3 and FLAC), so playback can skip the header walk. sample_rate
+// 0 means unknown.
+struct AudioStart {
+  uint32_t data_start = 0;
+  uint32_t sample_rate = 0;
+  uint32_t total_samples = 0; // FLAC STREAMINFO
+  uint16_t max_block = 0;     // FLAC STREAMINFO
+  uint16_t max_frame = 0;     // FLAC STREAMINFO, clamped to 16 bits
+  uint8_t channels = 0;
+  uint8_t bits_per_sample = 0;
+  uint8_t reserved[2] = {};
 };
 
 struct TrackInfo {
@@ -42,40 +90,167 @@ struct TrackInfo {
   uint32_t cover_len = 0;
   CoverFormat cover_format = CoverFormat::Unknown;
   uint32_t duration_sec = 0;
+  uint32_t file_size = 0;
   uint32_t added_time = 0;
   uint32_t play_count = 0;
   uint32_t last_played = 0;
+  AudioStart start;
+  // Catalog ids, -1 when the catalog was full.
+  int16_t artist_id = -1;
+  int16_t album_id = -1;
+  int16_t genre_id = -1;
+  int16_t composer_id = -1;
 };
 
 struct AlbumInfo {
   const char *name = "";
   const char *artist = "";
+  int16_t artist_id = -1;
 };
 
+// Open-addressing name -> id table for one catalog, plus the tracks of every
+// id packed back to back: tracks of id i are tracks[first[i]..first[i + 1]).
+struct CatalogIndex {
+  int16_t *slots = nullptr; // id + 1, 0 = empty
+  uint32_t *hashes = nullptr;
+  uint16_t *first = nullptr;  // capacity + 1 entries
+  uint16_t *tracks = nullptr; // one entry per track
+  uint32_t slot_mask = 0;
+};
+
+// One precomputed ordering: ids[i] is the i-th id, rank[id] its position.
+// Only ids[0..count) are listed; a catalog entry whose last track was
+// removed drops out until a track links to it again. rank[id] of an unlisted
+// id is stale, so id is listed only if ids[rank[id]] == id.
+struct SortOrder {
+  uint16_t *ids = nullptr;
+  uint16_t *rank = nullptr;
+  int count = 0;
+};
+
+// Orders rebuilt with the catalogs, so list screens never sort names.
+// Names compare case-insensitively; ties fall back to id.
+struct LibraryOrders {
+  SortOrder title;       // tracks by title, then artist
+  SortOrder added;       // tracks, newest first
+  SortOrder play_count;  // tracks, most played first
+  SortOrder last_played; // tracks, most recent first
+  SortOrder artists;
+  SortOrder albums; // by name, then artist
+  SortOrder genres;
+  SortOrder composers;
+};
+
+struct TrackTags {
+  String title;
+  String artist;
+  String album;
+  String genre;
+  String composer;
+  uint32_t cover_pos = 0;
+  uint32_t cover_len = 0;
+  CoverFormat cover_format = CoverFormat::Unknown;
+  uint32_t duration_sec = 0;
+  AudioStart start;
+};
+
+struct LibraryIndex;
+
 struct Library {
-  TrackInfo tracks[kMaxTracks];
-  int track_count = 0;
+  TrackInfo *tracks = nullptr;
+  int track_count = 0; // slots in use, removed tracks included
+  int track_capacity = 0;
+  // Removed tracks leave an empty slot behind (see library_track_live())
+  // until library_compact() reclaims it.
+  int removed_count = 0;
 
-  const char *artists[kMaxArtists] = {};
+  const char **artists = nullptr;
   int artist_count = 0;
+  int artist_capacity = 0;
 
-  AlbumInfo albums[kMaxAlbums];
+  AlbumInfo *albums = nullptr;
   int album_count = 0;
+  int album_capacity = 0;
 
-  const char *genres[kMaxGenres] = {};
+  const char **genres = nullptr;
   int genre_count = 0;
+  int genre_capacity = 0;
 
-  const char *composers[kMaxComposers] = {};
+  const char **composers = nullptr;
   int composer_count = 0;
+  int composer_capacity = 0;
+
+  CatalogIndex artist_index{};
+  CatalogIndex album_index{};
+  CatalogIndex genre_index{};
+  CatalogIndex composer_index{};
+  // Albums of artist i are artist_albums[artist_album_first[i]..[i + 1]).
+  uint16_t *artist_album_first = nullptr;
+  uint16_t *artist_albums = nullptr;
+  LibraryOrders order{};
 
+  LibraryArena arena{};
   StringPool pool{};
   bool scanned = false;
+  // Bumped whenever tracks are added, removed or re-tagged, so views can
+  // tell when their cached lists are stale.
+  uint32_t generation = 0;
+  // Bumped only when track indexes are renumbered (reset and compaction);
+  // holders of indexes must drop or remap them then.
+  uint32_t layout = 0;
 };
 
 void library_reset(Library &lib);
 bool library_scan(Library &lib, fs::FS &fs, const char *root_dir, uint8_t depth,
-                  int max_files = kMaxTracks, bool read_tags = true,
-                  void (*tick)() = nullptr);
+                  int max_files = 0, bool read_tags = true,
+                  void (*tick)() = nullptr,
+                  const LibraryIndex *cache = nullptr);
+
+// FNV-1a. The on-card index uses it too, so changing it invalidates indexes.
+uint32_t library_hash(const void *data, size_t len,
+                      uint32_t hash = 2166136261u);
+
+bool library_is_supported_audio(const String &path);
+// Fills out for path, taking tags from cache when size and mtime match and
+// falling back to names derived from the path. Does not touch the Library.
+void library_read_tags(fs::FS &fs, const String &path, uint32_t file_size,
+                       uint32_t mtime, bool read_tags,
+                       const LibraryIndex *cache, TrackTags &out);
+void library_store_track(Library &lib, const String &path, uint32_t file_size,
+                         uint32_t mtime, const TrackTags &tags,
+                         TrackInfo &track);
+// Rebuilds the artist/album/genre/composer lists, their hash indexes and the
+// sort orders from the track table. Lookups below are O(result) afterwards.
+void library_rebuild_catalogs(Library &lib);
+// Tracks of catalog id, 0 for -1.
+int library_catalog_size(const CatalogIndex &index, int id);
+
+// In-place edits for single tracks. They keep the catalogs and orders current
+// without sorting or card access, and bump generation. Strings stay in the
+// pool until the next reset.
+// Appends a track; returns its index, or -1 when the table is full. Slots of
+// removed tracks are not reused before library_compact().
+int library_add_track(Library &lib, const String &path, uint32_t file_size,
+                      uint32_t mtime, const TrackTags &tags);
+// Stores new tags for a track and moves it to its new catalogs and places.
+void library_retag_track(Library &lib, int index, const String &path,
+                         uint32_t file_size, uint32_t mtime,
+                         const TrackTags &tags);
+// Removes a track, leaving its slot empty so every other index stays valid.
+// Its entries leave the catalogs and orders, which shifts their packed u16
+// arrays but never the track table.
+bool library_remove_track(Library &lib, int index);
+// False for indexes out of range and for removed tracks.
+bool library_track_live(const Library &lib, int index);
+// Moves the live tracks down over the empty slots and rebuilds the catalogs
+// once. remap (track_count entries) gets each old index's new one, or -1.
+// Returns false, leaving remap untouched, when nothing was removed.
+bool library_compact(Library &lib, int16_t *remap);
+// Counts a play and moves the track up the play count and last played
+// orders without a full rebuild.
+void library_mark_played(Library &lib, int index, uint32_t now_sec);
+// Case-insensitive for ASCII, byte order otherwise; null sorts as "".
+int library_compare_names(const char *a, const char *b);
 
 int library_find_artist(const Library &lib, const String &name);
 int library_find_album(const Library &lib, const String &name,
@@ -0,0 +1,336 @@
+#include "app/library_index.h"
+
+#include <algorithm>
+#include <cstring>
+#include <esp_heap_caps.h>
+
+namespace app {
+namespace {
+constexpr uint32_t kMaxStringsSize = 8 * 1024 * 1024;
+constexpr int kStringsPerTrack = 6;
+
+static void *alloc_buffer(size_t size, bool &in_psram) {
+  void *ptr = heap_caps_malloc(size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+  in_psram = (ptr != nullptr);
+  if (!ptr) {
+    ptr = malloc(size);
+  }
+  return ptr;
+}
+
+// Builds the deduplicated string blob; artist/album/genre names repeat for
+// every track, so most of them collapse to a single copy.
+struct StringTable {
+  char *blob = nullptr;
+  uint32_t size = 0;
+  uint32_t capacity = 0;
+  uint32_t *slots = nullptr; // offset + 1, 0 = empty
+  uint32_t mask = 0;
+  bool blob_psram = false;
+  bool slots_psram = false;
+
+  bool init(uint32_t blob_cap, uint32_t max_strings) {
+    uint32_t slot_count = 16;
+    while (slot_count < max_strings * 2) {
+      slot_count <<= 1;
+    }
+    blob = static_cast<char *>(alloc_buffer(blob_cap, blob_psram));
+    slots = static_cast<uint32_t *>(
+        alloc_buffer(slot_count * sizeof(uint32_t), slots_psram));
+    if (!blob || !slots) {
+      release();
+      return false;
+    }
+    memset(slots, 0, slot_count * sizeof(uint32_t));
+    capacity = blob_cap;
+    mask = slot_count - 1;
+    return true;
+  }
+
+  void release() {
+    free(blob);
+    free(slots);
+    blob = nullptr;
+    slots = nullptr;
+  }
+
+  uint32_t add(const char *s) {
+    if (!s) {
+      s = "";
+    }
+    const size_t len = strlen(s);
+    uint32_t slot = library_hash(s, len) & mask;
+    while (slots[slot] != 0) {
+      const uint32_t offset = slots[slot] - 1;
+      if (strcmp(blob + offset, s) == 0) {
+        return offset;
+      }
+      slot = (slot + 1) & mask;
+    }
+    const uint32_t offset = size;
+    memcpy(blob + size, s, len + 1);
+    size += len + 1;
+    slots[slot] = offset + 1;
+    return offset;
+  }
+};
+
+static size_t str_size(const char *s) { return s ? strlen(s) + 1 : 1; }
+} // namespace
+
+bool LibraryIndex::load(fs::FS &fs, const char *path) {
+  release();
+  File f = fs.open(path, FILE_READ);
+  if (!f) {
+    return false;
+  }
+
+  LibraryIndexHeader header;
+  if (f.read(reinterpret_cast<uint8_t *>(&header), sizeof(header)) !=
+      sizeof(header)) {
+    f.close();
+    return false;
+  }
+  const size_t records_size =
+      static_cast<size_t>(header.track_count) * sizeof(LibraryIndexRecord);
+  const size_t payload = records_size + header.strings_size;
+  if (header.magic != kLibraryIndexMagic ||
+      header.version != kLibraryIndexVersion ||
+      header.record_size != sizeof(LibraryIndexRecord) ||
+      header.track_count > static_cast<uint32_t>(kMaxTrackCapacity) ||
+      header.strings_size == 0 || header.strings_size > kMaxStringsSize ||
+      f.size() != sizeof(header) + payload) {
+    f.close();
+    Serial.printf("[LIB] index %s ignored (format)\n", path);
+    return false;
+  }
+
+  data = static_cast<uint8_t *>(alloc_buffer(payload, in_psram));
+  if (!data) {
+    f.close();
+    return false;
+  }
+  const size_t got = f.read(data, payload);
+  f.close();
+
+  records = reinterpret_cast<const LibraryIndexRecord *>(data);
+  strings = reinterpret_cast<const char *>(data + records_size);
+  count = header.track_count;
+  strings_size = header.strings_size;
+
+  bool valid = (got == payload) &&
+               library_hash(data, payload) == header.checksum &&
+               strings[strings_size - 1] == '\0';
+  for (uint32_t i = 0; valid && i < count; ++i) {
+    const LibraryIndexRecord &r = records[i];
+    valid = r.path < strings_size && r.title < strings_size &&
+            r.artist < strings_size && r.album < strings_size &&
+            r.genre < strings_size && r.composer < strings_size;
+  }
+  if (!valid) {
+    Serial.printf("[LIB] index %s ignored (corrupt)\n", path);
+    release();
+    return false;
+  }
+
+  bool order_psram = false;
+  by_hash = static_cast<uint16_t *>(
+      alloc_buffer((count ? count : 1) * sizeof(uint16_t), order_psram));
+  if (!by_hash) {
+    release();
+    return false;
+  }
+  for (uint32_t i = 0; i < count; ++i) {
+    by_hash[i] = static_cast<uint16_t>(i);
+  }
+  std::sort(by_hash, by_hash + count, [this](uint16_t a, uint16_t b) {
+    return records[a].path_hash < records[b].path_hash;
+  });
+  hits = 0;
+  return true;
+}
+
+void LibraryIndex::release() {
+  free(data);
+  free(by_hash);
+  data = nullptr;
+  by_hash = nullptr;
+  records = nullptr;
+  strings = nullptr;
+  count = 0;
+  strings_size = 0;
+  hits = 0;
+}
+
+const LibraryIndexRecord *LibraryIndex::find(const char *path,
+                                             uint32_t file_size,
+                                             uint32_t mtime) const {
+  if (!records || !path) {
+    return nullptr;
+  }
+  const uint32_t hash = library_path_hash(path);
+  const uint16_t *begin = by_hash;
+  const uint16_t *end = by_hash + count;
+  const uint16_t *it =
+      std::lower_bound(begin, end, hash, [this](uint16_t i, uint32_t h) {
+        return records[i].path_hash < h;
+      });
+  for (; it != end && records[*it].path_hash == hash; ++it) {
+    const LibraryIndexRecord &r = records[*it];
+    if (strcmp(str(r.path), path) != 0) {
+      continue;
+    }
+    if (r.file_size != file_size || r.mtime != mtime) {
+      return nullptr;
+    }
+    ++hits;
+    return &r;
+  }
+  return nullptr;
+}
+
+uint32_t library_path_hash(const char *path) {
+  return library_hash(path, strlen(path));
+}
+
+bool library_load_index(Library &lib, fs::FS &fs, const char *path) {
+  LibraryIndex index;
+  if (!index.load(fs, path)) {
+    return false;
+  }
+  library_reset(lib);
+  for (uint32_t i = 0; i < index.count && lib.track_count < lib.track_capacity;
+       ++i) {
+    const LibraryIndexRecord &r = index.records[i];
+    TrackTags tags;
+    tags.title = index.str(r.title);
+    tags.artist = index.str(r.artist);
+    tags.album = index.str(r.album);
+    tags.genre = index.str(r.genre);
+    tags.composer = index.str(r.composer);
+    tags.cover_pos = r.cover_pos;
+    tags.cover_len = r.cover_len;
+    tags.cover_format = static_cast<CoverFormat>(r.cover_format);
+    tags.duration_sec = r.duration_sec;
+    tags.start = r.start;
+    library_store_track(lib, index.str(r.path), r.file_size, r.mtime, tags,
+                        lib.tracks[lib.track_count++]);
+  }
+  library_rebuild_catalogs(lib);
+  index.release();
+  lib.scanned = true;
+  lib.generation++;
+  return true;
+}
+
+bool library_index_save(const Library &lib, fs::FS &fs, const char *path) {
+  const uint32_t count =
+      static_cast<uint32_t>(lib.track_count - lib.removed_count);
+  size_t blob_cap = 1;
+  for (int i = 0; i < lib.track_count; ++i) {
+    const TrackInfo &t = lib.tracks[i];
+    blob_cap += str_size(t.path) + str_size(t.title) + str_size(t.artist) +
+                str_size(t.album) + str_size(t.genre) + str_size(t.composer);
+  }
+  if (blob_cap > kMaxStringsSize) {
+    return false;
+  }
+
+  StringTable table;
+  if (!table.init(blob_cap, count * kStringsPerTrack + 1)) {
+    return false;
+  }
+  bool records_psram = false;
+  LibraryIndexRecord *records = static_cast<LibraryIndexRecord *>(
+      alloc_buffer((count ? count : 1) * sizeof(LibraryIndexRecord),
+                   records_psram));
+  if (!records) {
+    table.release();
+    return false;
+  }
+
+  table.add("");
+  uint32_t n = 0;
+  for (int i = 0; i < lib.track_count; ++i) {
+    if (!library_track_live(lib, i)) {
+      continue;
+    }
+    const TrackInfo &t = lib.tracks[i];
+    LibraryIndexRecord &r = records[n++];
+    r = LibraryIndexRecord();
+    r.path_hash = library_path_hash(t.path ? t.path : "");
+    r.file_size = t.file_size;
+    r.mtime = t.added_time;
+    r.path = table.add(t.path);
+    r.title = table.add(t.title);
+    r.artist = table.add(t.artist);
+    r.album = table.add(t.album);
+    r.genre = table.add(t.genre);
+    r.composer = table.add(t.composer);
+    r.cover_pos = t.cover_pos;
+    r.cover_len = t.cover_len;
+    r.duration_sec = t.duration_sec;
+    r.cover_format = static_cast<uint8_t>(t.cover_format);
+    r.start = t.start;
+  }
+
+  const size_t records_size = count * sizeof(LibraryIndexRecord);
+  LibraryIndexHeader header;
+  header.magic = kLibraryIndexMagic;
+  header.version = kLibraryIndexVersion;
+  header.record_size = sizeof(LibraryIndexRecord);
+  header.track_count = count;
+  header.strings_size = table.size;
+  header.checksum = library_hash(table.blob, table.size,
+                                 library_hash(records, records_size));
+
+  // Write next to the old index and swap, so a power cut mid-write leaves
+  // either the previous index or none, never a torn one.
+  String tmp = String(path) + ".tmp";
+  bool ok = false;
+  File f = fs.open(tmp.c_str(), FILE_WRITE);
+  if (f) {
+    ok = f.write(reinterpret_cast<const uint8_t *>(&header), sizeof(header)) ==
+             sizeof(header) &&
+         f.write(reinterpret_cast<const uint8_t *>(records), records_size) ==
+             records_size &&
+         f.write(reinterpret_cast<const uint8_t *>(table.blob), table.size) ==
+             table.size;
+    f.close();
+  }
+  free(records);
+  table.release();
+
+  if (!ok) {
+    fs.remove(tmp.c_str());
+    return false;
+  }
+  fs.remove(path);
+  return fs.rename(tmp.c_str(), path);
+}
+
+bool library_scan_indexed(Library &lib, fs::FS &fs, const char *root_dir,
+                          uint8_t depth, int max_files, void (*tick)()) {
+  const uint32_t start = millis();
+  LibraryIndex index;
+  const bool loaded = index.load(fs, kLibraryIndexPath);
+  const bool found =
+      library_scan(lib, fs, root_dir, depth, max_files, true, tick, &index);
+  const uint32_t tracks = static_cast<uint32_t>(lib.track_count);
+  const uint32_t reused = index.hits;
+  const bool stale = !loaded || reused != tracks || index.count != tracks;
+  index.release();
+
+  bool saved = false;
+  if (stale) {
+    saved = library_index_save(lib, fs, kLibraryIndexPath);
+  }
+  Serial.printf("[LIB] %u tracks, %u from index, %s, %lu ms\n",
+                static_cast<unsigned>(tracks), static_cast<unsigned>(reused),
+                stale ? (saved ? "index rewritten" : "index write failed")
+                      : "index current",
+                static_cast<unsigned long>(millis() - start));
+  return found;
+}
+
+} // namespace app
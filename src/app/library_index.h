@@ -0,0 +1,81 @@
+#pragma once
+
+#include <Arduino.h>
+#include <FS.h>
+
+#include "app/library.h"
+
+namespace app {
+
+// On-card cache of the scanned track table so boot only re-parses tags for
+// files whose size or mtime changed since the last scan.
+//
+// Layout (little endian, as written by the ESP32):
+//   LibraryIndexHeader
+//   LibraryIndexRecord[track_count]   in library order
+//   char strings[strings_size]        NUL-terminated, deduplicated
+// Record string fields are byte offsets into strings. checksum is FNV-1a over
+// everything after the header.
+constexpr const char *kLibraryIndexPath = "/lofibox_library.idx";
+constexpr uint32_t kLibraryIndexMagic = 0x4942464C; // "LFBI"
+constexpr uint16_t kLibraryIndexVersion = 3;
+
+struct LibraryIndexHeader {
+  uint32_t magic;
+  uint16_t version;
+  uint16_t record_size;
+  uint32_t track_count;
+  uint32_t strings_size;
+  uint32_t checksum;
+};
+
+struct LibraryIndexRecord {
+  uint32_t path_hash;
+  uint32_t file_size;
+  uint32_t mtime;
+  uint32_t path;
+  uint32_t title;
+  uint32_t artist;
+  uint32_t album;
+  uint32_t genre;
+  uint32_t composer;
+  uint32_t cover_pos;
+  uint32_t cover_len;
+  uint32_t duration_sec;
+  uint8_t cover_format;
+  uint8_t reserved[3];
+  AudioStart start;
+};
+
+struct LibraryIndex {
+  uint8_t *data = nullptr;
+  const LibraryIndexRecord *records = nullptr;
+  const char *strings = nullptr;
+  uint16_t *by_hash = nullptr; // record numbers sorted by path_hash
+  uint32_t count = 0;
+  uint32_t strings_size = 0;
+  bool in_psram = false;
+  // Number of successful find() calls since load().
+  mutable uint32_t hits = 0;
+
+  bool load(fs::FS &fs, const char *path);
+  void release();
+  const LibraryIndexRecord *find(const char *path, uint32_t file_size,
+                                 uint32_t mtime) const;
+  const char *str(uint32_t offset) const { return strings + offset; }
+};
+
+uint32_t library_path_hash(const char *path);
+
+// Fills lib straight from the index without touching the music folder, so
+// the UI can come up before the background rescan has checked the card.
+bool library_load_index(Library &lib, fs::FS &fs, const char *path);
+bool library_index_save(const Library &lib, fs::FS &fs, const char *path);
+
+// library_scan() with tags taken from the index for unchanged files. The
+// index is rewritten only when the scan found something new or missing.
+bool library_scan_indexed(Library &lib, fs::FS &fs, const char *root_dir,
+                          uint8_t depth, int max_files = 0,
+                          void (*tick)() = nullptr);
+
+} // namespace app
@@ -0,0 +1,280 @@
+#include "app/library_scanner.h"
+
+#include <cstring>
+
+#include "app/library_index.h"
+#include "app/library_tags.h"
+
+namespace app {
+
+void LibraryScanner::start(Library &lib, fs::FS &fs, const char *root_dir,
+                           uint8_t depth) {
+  stop();
+  if (!alloc_tables(lib.track_capacity)) {
+    Serial.printf("[LIB] rescan: no memory for %d tracks\n",
+                  lib.track_capacity);
+    return;
+  }
+  lib_ = &lib;
+  fs_ = &fs;
+  root_ = root_dir && root_dir[0] ? root_dir : "/";
+  if (!root_.startsWith("/")) {
+    root_ = String("/") + root_;
+  }
+  depth_ = depth;
+  restart();
+}
+
+// Walks from the top again against the library as it is now.
+void LibraryScanner::restart() {
+  stop();
+  layout_ = lib_->layout;
+  memset(slots_, 0, (slot_mask_ + 1) * sizeof(int16_t));
+  memset(seen_, 0, (capacity_ + 7) / 8);
+  known_count_ = 0;
+  push_dir(root_, depth_);
+
+  changed_ = false;
+  started_ms_ = millis();
+  files_ = 0;
+  added_ = 0;
+  updated_ = 0;
+  removed_ = 0;
+  state_ = State::Walking;
+}
+
+bool LibraryScanner::alloc_tables(int capacity) {
+  if (capacity_ > 0) {
+    return capacity <= capacity_;
+  }
+  uint32_t slots = 16;
+  while (slots < static_cast<uint32_t>(capacity) * 2) {
+    slots <<= 1;
+  }
+  const size_t bytes = slots * sizeof(int16_t) + (capacity + 7) / 8 +
+                       capacity * sizeof(int16_t) + 8;
+  if (capacity <= 0 || !arena_.init(bytes)) {
+    return false;
+  }
+  slots_ = static_cast<int16_t *>(arena_.alloc(slots * sizeof(int16_t), 2));
+  remap_ = static_cast<int16_t *>(arena_.alloc(capacity * sizeof(int16_t), 2));
+  seen_ = static_cast<uint8_t *>(arena_.alloc((capacity + 7) / 8, 1));
+  slot_mask_ = slots - 1;
+  capacity_ = capacity;
+  return true;
+}
+
+void LibraryScanner::stop() {
+  if (dir_) {
+    dir_.close();
+  }
+  dir_ = File();
+  for (int i = 0; i < pending_count_; ++i) {
+    pending_[i] = String();
+  }
+  for (int i = 0; i < journal_count_; ++i) {
+    journal_[i] = Change();
+  }
+  pending_count_ = 0;
+  journal_count_ = 0;
+  pending_adds_ = 0;
+  incomplete_ = false;
+  state_ = State::Idle;
+}
+
+bool LibraryScanner::step(uint32_t budget_ms) {
+  if (state_ == State::Idle) {
+    return false;
+  }
+  if (lib_->layout != layout_) {
+    // Reset or compacted under us, so the indexes in slots_ are stale.
+    Serial.println("[LIB] rescan: library renumbered, starting over");
+    restart();
+    return false;
+  }
+  // Tracks appended since the last step, ours included.
+  while (known_count_ < lib_->track_count) {
+    insert_track(known_count_++);
+  }
+  if (state_ == State::Saving) {
+    bool saved = false;
+    if (changed_) {
+      saved = library_index_save(*lib_, *fs_, kLibraryIndexPath);
+    }
+    Serial.printf("[LIB] rescan: %u files, +%u ~%u -%u%s, %lu ms%s\n",
+                  static_cast<unsigned>(files_), static_cast<unsigned>(added_),
+                  static_cast<unsigned>(updated_),
+                  static_cast<unsigned>(removed_),
+                  incomplete_ ? " (partial)" : "",
+                  static_cast<unsigned long>(millis() - started_ms_),
+                  saved ? ", index rewritten" : "");
+    library_log_tag_stats();
+    stop();
+    return false;
+  }
+  if (state_ == State::Finished || journal_count_ >= kJournalSize) {
+    return true;
+  }
+
+  const uint32_t start = millis();
+  while (static_cast<uint32_t>(millis() - start) < budget_ms) {
+    if (!dir_) {
+      if (pending_count_ == 0) {
+        state_ = State::Finished;
+        return true;
+      }
+      --pending_count_;
+      dir_path_ = pending_[pending_count_];
+      dir_levels_ = pending_levels_[pending_count_];
+      pending_[pending_count_] = String();
+      dir_ = fs_->open(dir_path_.c_str());
+      if (!dir_ || !dir_.isDirectory()) {
+        dir_ = File();
+      }
+      continue;
+    }
+
+    File entry = dir_.openNextFile();
+    if (!entry) {
+      dir_.close();
+      dir_ = File();
+      continue;
+    }
+    visit(entry);
+    if (journal_count_ >= kJournalSize) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void LibraryScanner::visit(File &entry) {
+  String path = String(entry.name());
+  if (!path.startsWith("/")) {
+    path = dir_path_ + String("/") + path;
+  }
+  if (entry.isDirectory()) {
+    if (dir_levels_ > 0 && !push_dir(path, dir_levels_ - 1)) {
+      incomplete_ = true;
+    }
+    return;
+  }
+  if (!library_is_supported_audio(path)) {
+    return;
+  }
+  ++files_;
+
+  const uint32_t file_size = entry.size();
+  const uint32_t mtime = entry.getLastWrite();
+  entry.close();
+
+  const int index = find_track(path.c_str());
+  if (index >= 0) {
+    mark_seen(index);
+    const TrackInfo &track = lib_->tracks[index];
+    if (track.file_size == file_size && track.added_time == mtime) {
+      return;
+    }
+  } else if (lib_->track_count + pending_adds_ >= lib_->track_capacity) {
+    return;
+  } else {
+    ++pending_adds_;
+  }
+
+  Change &change = journal_[journal_count_++];
+  change.index = index;
+  change.path = path;
+  change.file_size = file_size;
+  change.mtime = mtime;
+  change.tags = TrackTags();
+  library_read_tags(*fs_, path, file_size, mtime, true, nullptr, change.tags);
+}
+
+bool LibraryScanner::push_dir(const String &path, uint8_t levels) {
+  if (pending_count_ >= kMaxPendingDirs) {
+    return false;
+  }
+  pending_[pending_count_] = path;
+  pending_levels_[pending_count_] = levels;
+  ++pending_count_;
+  return true;
+}
+
+int LibraryScanner::find_track(const char *path) const {
+  uint32_t slot = library_path_hash(path) & slot_mask_;
+  while (slots_[slot] != 0) {
+    const int index = slots_[slot] - 1;
+    if (strcmp(lib_->tracks[index].path, path) == 0) {
+      return index;
+    }
+    slot = (slot + 1) & slot_mask_;
+  }
+  return -1;
+}
+
+void LibraryScanner::insert_track(int index) {
+  const char *path = lib_->tracks[index].path;
+  uint32_t slot = library_path_hash(path) & slot_mask_;
+  while (slots_[slot] != 0) {
+    slot = (slot + 1) & slot_mask_;
+  }
+  slots_[slot] = static_cast<int16_t>(index + 1);
+}
+
+bool LibraryScanner::apply() {
+  if (state_ == State::Idle) {
+    return false;
+  }
+  Library &lib = *lib_;
+  bool changed = false;
+  for (int i = 0; i < journal_count_; ++i) {
+    Change &change = journal_[i];
+    if (change.index < 0) {
+      const int index = library_add_track(lib, change.path, change.file_size,
+                                          change.mtime, change.tags);
+      if (index >= 0) {
+        mark_seen(index);
+        ++added_;
+        changed = true;
+      }
+    } else if (library_track_live(lib, change.index)) {
+      // Not deleted since it was read.
+      library_retag_track(lib, change.index, change.path, change.file_size,
+                          change.mtime, change.tags);
+      ++updated_;
+      changed = true;
+    }
+    change = Change();
+  }
+  journal_count_ = 0;
+  pending_adds_ = 0;
+
+  bool moved = false;
+  if (state_ == State::Finished) {
+    // A partial walk can't tell a missing file from an unvisited one.
+    if (!incomplete_) {
+      remove_unseen();
+    }
+    remap_count_ = lib.track_count;
+    moved = library_compact(lib, remap_);
+    layout_ = lib.layout;
+    state_ = State::Saving;
+  }
+  changed_ = changed_ || changed || moved;
+  return moved;
+}
+
+// Empties the slots of tracks the walk did not find. library_compact()
+// rebuilds the catalogs right after, so they are not unlinked one by one.
+void LibraryScanner::remove_unseen() {
+  Library &lib = *lib_;
+  for (int i = 0; i < lib.track_count; ++i) {
+    if (!seen(i) && library_track_live(lib, i)) {
+      lib.tracks[i] = TrackInfo();
+      lib.removed_count++;
+      ++removed_;
+    }
+  }
+}
+
+} // namespace app
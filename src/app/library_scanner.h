@@ -0,0 +1,102 @@
+#pragma once
+
+#include <Arduino.h>
+#include <FS.h>
+
+#include "app/library.h"
+
+namespace app {
+
+// Rescans the music folder in the background. step() walks a few directory
+// entries per call from the main loop and compares them with the live
+// Library; the differences are queued and handed over in batches by apply(),
+// which the caller runs while holding the player's library lock. Edits made
+// elsewhere meanwhile (re-tags, deletes) keep indexes and are fine; if the
+// library is reset or compacted under it, the walk starts over.
+class LibraryScanner {
+public:
+  void start(Library &lib, fs::FS &fs, const char *root_dir, uint8_t depth);
+  void stop();
+  bool active() const { return state_ != State::Idle; }
+
+  // Walks for roughly budget_ms. Returns true when apply() has work.
+  bool step(uint32_t budget_ms);
+  // Applies the queued adds and re-tags in place, without re-sorting. Once a
+  // full pass has finished, tracks that were not seen are removed and the
+  // table is compacted with a single catalog rebuild. Returns true when
+  // track indices moved; remap() then maps every old index to its new one,
+  // or -1.
+  bool apply();
+
+  const int16_t *remap() const { return remap_; }
+  int remap_count() const { return remap_count_; }
+
+private:
+  enum class State : uint8_t {
+    Idle = 0,
+    Walking,
+    Finished,
+    Saving,
+  };
+
+  struct Change {
+    int index = -1; // track to re-tag, -1 = new track
+    String path;
+    uint32_t file_size = 0;
+    uint32_t mtime = 0;
+    TrackTags tags;
+  };
+
+  static constexpr int kJournalSize = 32;
+  static constexpr int kMaxPendingDirs = 128;
+
+  void restart();
+  void visit(File &entry);
+  bool alloc_tables(int capacity);
+  bool push_dir(const String &path, uint8_t levels);
+  int find_track(const char *path) const;
+  void insert_track(int index);
+  void mark_seen(int index) { seen_[index >> 3] |= (1u << (index & 7)); }
+  bool seen(int index) const {
+    return (seen_[index >> 3] & (1u << (index & 7))) != 0;
+  }
+  void remove_unseen();
+
+  State state_ = State::Idle;
+  Library *lib_ = nullptr;
+  fs::FS *fs_ = nullptr;
+  uint32_t layout_ = 0;
+  int known_count_ = 0; // tracks [0, known_count_) are in slots_
+  String root_;
+  uint8_t depth_ = 0;
+
+  String pending_[kMaxPendingDirs];
+  uint8_t pending_levels_[kMaxPendingDirs] = {};
+  int pending_count_ = 0;
+  bool incomplete_ = false;
+  File dir_;
+  String dir_path_;
+  uint8_t dir_levels_ = 0;
+
+  // Sized to the library's track capacity on first start().
+  LibraryArena arena_{};
+  int capacity_ = 0;
+  int16_t *slots_ = nullptr; // track index + 1, 0 = empty
+  uint32_t slot_mask_ = 0;
+  uint8_t *seen_ = nullptr;
+  int16_t *remap_ = nullptr;
+  int remap_count_ = 0;
+
+  Change journal_[kJournalSize];
+  int journal_count_ = 0;
+  int pending_adds_ = 0;
+
+  bool changed_ = false;
+  uint32_t started_ms_ = 0;
+  uint32_t files_ = 0;
+  uint32_t added_ = 0;
+  uint32_t updated_ = 0;
+  uint32_t removed_ = 0;
+};
+
+} // namespace app
@@ -0,0 +1,1092 @@
+#include "app/library_tags.h"
+
+#include <cstring>
+
+namespace app {
+namespace {
+constexpr size_t kMaxTextLen = 256;
+constexpr uint32_t kMaxComments = 256;
+constexpr int kMaxFlacBlocks = 64;
+constexpr int kMaxMp4Depth = 6;
+constexpr int kMaxMp4Boxes = 256;
+
+static uint32_t read_u32_be(const uint8_t *data) {
+  return (static_cast<uint32_t>(data[0]) << 24) |
+         (static_cast<uint32_t>(data[1]) << 16) |
+         (static_cast<uint32_t>(data[2]) << 8) | static_cast<uint32_t>(data[3]);
+}
+
+static uint32_t read_u24_be(const uint8_t *data) {
+  return (static_cast<uint32_t>(data[0]) << 16) |
+         (static_cast<uint32_t>(data[1]) << 8) | static_cast<uint32_t>(data[2]);
+}
+
+static uint32_t read_syncsafe(const uint8_t *data) {
+  return (static_cast<uint32_t>(data[0] & 0x7F) << 21) |
+         (static_cast<uint32_t>(data[1] & 0x7F) << 14) |
+         (static_cast<uint32_t>(data[2] & 0x7F) << 7) |
+         static_cast<uint32_t>(data[3] & 0x7F);
+}
+
+static void append_utf8(String &out, uint32_t codepoint) {
+  if (codepoint <= 0x7F) {
+    out += static_cast<char>(codepoint);
+  } else if (codepoint <= 0x7FF) {
+    out += static_cast<char>(0xC0 | ((codepoint >> 6) & 0x1F));
+    out += static_cast<char>(0x80 | (codepoint & 0x3F));
+  } else if (codepoint <= 0xFFFF) {
+    out += static_cast<char>(0xE0 | ((codepoint >> 12) & 0x0F));
+    out += static_cast<char>(0x80 | ((codepoint >> 6) & 0x3F));
+    out += static_cast<char>(0x80 | (codepoint & 0x3F));
+  } else if (codepoint <= 0x10FFFF) {
+    out += static_cast<char>(0xF0 | ((codepoint >> 18) & 0x07));
+    out += static_cast<char>(0x80 | ((codepoint >> 12) & 0x3F));
+    out += static_cast<char>(0x80 | ((codepoint >> 6) & 0x3F));
+    out += static_cast<char>(0x80 | (codepoint & 0x3F));
+  }
+}
+
+static String decode_text_frame(uint8_t encoding, const uint8_t *data,
+                                size_t len) {
+  if (len == 0) {
+    return String();
+  }
+
+  if (encoding == 3) {
+    String out;
+    out.reserve(len + 1);
+    for (size_t i = 0; i < len; ++i) {
+      if (data[i] == '\0') {
+        break;
+      }
+      out += static_cast<char>(data[i]);
+    }
+    out.trim();
+    return out;
+  }
+
+  if (encoding == 0) {
+    String out;
+    out.reserve(len + 1);
+    for (size_t i = 0; i < len; ++i) {
+      uint8_t b = data[i];
+      if (b == 0x00) {
+        break;
+      }
+      if (b < 0x80) {
+        out += static_cast<char>(b);
+      } else {
+        append_utf8(out, static_cast<uint32_t>(b));
+      }
+    }
+    out.trim();
+    return out;
+  }
+
+  // UTF-16/UTF-16BE -> UTF-8
+  bool big_endian = (encoding == 2);
+  size_t start = 0;
+  if (encoding == 1 && len >= 2) {
+    if (data[0] == 0xFF && data[1] == 0xFE) {
+      big_endian = false;
+      start = 2;
+    } else if (data[0] == 0xFE && data[1] == 0xFF) {
+      big_endian = true;
+      start = 2;
+    } else {
+      // Heuristic: look for zero byte position
+      if (data[0] == 0x00 && data[1] != 0x00) {
+        big_endian = true;
+      } else if (data[1] == 0x00 && data[0] != 0x00) {
+        big_endian = false;
+      }
+    }
+  }
+
+  if (start < len && ((len - start) & 1)) {
+    len -= 1;
+  }
+
+  String out;
+  out.reserve(len / 2 + 1);
+  for (size_t i = start; i + 1 < len; i += 2) {
+    uint16_t w = big_endian
+                     ? (static_cast<uint16_t>(data[i]) << 8) | data[i + 1]
+                     : (static_cast<uint16_t>(data[i + 1]) << 8) | data[i];
+    if (w == 0x0000) {
+      break;
+    }
+    if (w >= 0xD800 && w <= 0xDBFF && i + 3 < len) {
+      uint16_t w2 =
+          big_endian ? (static_cast<uint16_t>(data[i + 2]) << 8) | data[i + 3]
+                     : (static_cast<uint16_t>(data[i + 3]) << 8) | data[i + 2];
+      if (w2 >= 0xDC00 && w2 <= 0xDFFF) {
+        uint32_t code = 0x10000 + (((w - 0xD800) << 10) | (w2 - 0xDC00));
+        append_utf8(out, code);
+        i += 2;
+        continue;
+      }
+    }
+    append_utf8(out, static_cast<uint32_t>(w));
+  }
+  out.trim();
+  return out;
+}
+
+static void assign_if_empty(String &target, const String &value) {
+  if (target.length() == 0 && value.length() > 0) {
+    target = value;
+  }
+}
+
+static CoverFormat cover_format_for_mime(const String &mime) {
+  String lower = mime;
+  lower.toLowerCase();
+  if (lower.indexOf("png") >= 0) {
+    return CoverFormat::Png;
+  }
+  if (lower.indexOf("jpeg") >= 0 || lower.indexOf("jpg") >= 0) {
+    return CoverFormat::Jpeg;
+  }
+  if (lower.indexOf("bmp") >= 0) {
+    return CoverFormat::Bmp;
+  }
+  return CoverFormat::Unknown;
+}
+
+// Buffered input over an ID3v2 tag. Bytes come out of a window filled with
+// one large read, so frame headers and text cost no card access of their
+// own; skipping past the window only moves the position, and the next read
+// refills from there. With unsync set, 0xFF 0x00 pairs are read as 0xFF.
+class Id3Stream {
+public:
+  explicit Id3Stream(File &f) : f_(f) {}
+
+  // The first window is read before the tag size is known; drop whatever
+  // of it lies past the tag.
+  void set_end(uint32_t end) {
+    end_ = end;
+    if (win_pos_ + win_len_ > end_) {
+      win_len_ = end_ > win_pos_ + cur_ ? end_ - win_pos_ : cur_;
+    }
+  }
+  void set_unsync(bool unsync) { unsync_ = unsync; }
+  // File offset of the next raw byte.
+  uint32_t offset() const { return win_pos_ + cur_; }
+  uint32_t remaining() const {
+    return offset() < end_ ? end_ - offset() : 0;
+  }
+
+  size_t read(uint8_t *buf, size_t len) {
+    if (unsync_) {
+      size_t done = 0;
+      while (done < len && next(buf[done])) {
+        ++done;
+      }
+      return done;
+    }
+    size_t done = 0;
+    while (done < len && fill()) {
+      size_t n = win_len_ - cur_;
+      if (n > len - done) {
+        n = len - done;
+      }
+      memcpy(buf + done, &win_[cur_], n);
+      cur_ += n;
+      done += n;
+    }
+    return done;
+  }
+
+  bool skip(uint32_t len) {
+    if (unsync_) {
+      uint8_t b;
+      while (len > 0 && next(b)) {
+        --len;
+      }
+      return len == 0;
+    }
+    if (len > remaining()) {
+      return false;
+    }
+    if (cur_ + len <= win_len_) {
+      cur_ += len;
+    } else {
+      win_pos_ = offset() + len;
+      win_len_ = 0;
+      cur_ = 0;
+    }
+    return true;
+  }
+
+private:
+  static constexpr size_t kWindow = 1024;
+  // Card bytes one tag may cost; unsynchronised tags are read through.
+  static constexpr uint32_t kReadBudget = 32 * 1024;
+
+  bool fill() {
+    if (cur_ < win_len_) {
+      return true;
+    }
+    win_pos_ += cur_;
+    cur_ = 0;
+    win_len_ = 0;
+    uint32_t want = remaining();
+    if (want > kWindow) {
+      want = kWindow;
+    }
+    if (want == 0 || budget_used_ + want > kReadBudget ||
+        !f_.seek(win_pos_)) {
+      return false;
+    }
+    win_len_ = f_.read(win_, want);
+    budget_used_ += win_len_;
+    return win_len_ > 0;
+  }
+
+  bool next(uint8_t &b) {
+    if (!fill()) {
+      return false;
+    }
+    b = win_[cur_++];
+    if (b == 0x00 && prev_ff_) {
+      if (!fill()) {
+        return false;
+      }
+      b = win_[cur_++];
+    }
+    prev_ff_ = (b == 0xFF);
+    return true;
+  }
+
+  File &f_;
+  uint8_t win_[kWindow];
+  uint32_t win_pos_ = 0;
+  uint32_t win_len_ = 0;
+  uint32_t cur_ = 0;
+  uint32_t end_ = UINT32_MAX;
+  uint32_t budget_used_ = 0;
+  bool unsync_ = false;
+  bool prev_ff_ = false;
+};
+
+// Undoes per-frame unsynchronisation (ID3v2.4) in place.
+static size_t remove_unsync(uint8_t *data, size_t len) {
+  size_t out = 0;
+  for (size_t i = 0; i < len; ++i) {
+    data[out++] = data[i];
+    if (data[i] == 0xFF && i + 1 < len && data[i + 1] == 0x00) {
+      ++i;
+    }
+  }
+  return out;
+}
+
+// Skips a terminated string of the given text encoding; returns the index
+// just past the terminator, or len when there is none.
+static size_t skip_id3_string(const uint8_t *data, size_t pos, size_t len,
+                              uint8_t encoding) {
+  if (encoding == 1 || encoding == 2) {
+    for (; pos + 1 < len; pos += 2) {
+      if (data[pos] == 0 && data[pos + 1] == 0) {
+        return pos + 2;
+      }
+    }
+    return len;
+  }
+  while (pos < len && data[pos] != 0) {
+    ++pos;
+  }
+  return pos < len ? pos + 1 : len;
+}
+
+struct Id3TextFrame {
+  const char *id;    // v2.3/v2.4
+  const char *id_v2; // v2.2
+  String TrackTags::*field;
+};
+
+const Id3TextFrame kId3TextFrames[] = {
+    {"TIT2", "TT2", &TrackTags::title},   {"TPE1", "TP1", &TrackTags::artist},
+    {"TALB", "TAL", &TrackTags::album},   {"TCON", "TCO", &TrackTags::genre},
+    {"TCOM", "TCM", &TrackTags::composer},
+};
+
+// APIC (PIC in v2.2): encoding, MIME type (a 3-char format in v2.2),
+// picture type, description, then the image. head holds the start of the
+// frame; the image offset is only recorded when the bytes on the card are
+// the image itself, i.e. not unsynchronised.
+static void read_id3_picture(const uint8_t *head, size_t len,
+                             uint32_t frame_pos, uint32_t frame_size,
+                             bool v22, bool raw, TrackTags &out,
+                             bool &have_front) {
+  if (have_front || len < 2) {
+    return;
+  }
+  const uint8_t encoding = head[0];
+  size_t pos = 1;
+  String mime;
+  if (v22) {
+    if (len < 5) {
+      return;
+    }
+    for (pos = 1; pos < 4; ++pos) {
+      mime += static_cast<char>(head[pos]);
+    }
+  } else {
+    const size_t end = skip_id3_string(head, pos, len, 0);
+    for (size_t i = pos; i < end && head[i] != 0; ++i) {
+      mime += static_cast<char>(head[i]);
+    }
+    pos = end;
+  }
+  if (pos >= len) {
+    return;
+  }
+  const uint8_t type = head[pos++];
+  if (out.cover_len > 0 && type != 3) {
+    return;
+  }
+  pos = skip_id3_string(head, pos, len, encoding);
+  if (!raw || pos >= len || pos >= frame_size) {
+    return;
+  }
+  out.cover_pos = frame_pos + pos;
+  out.cover_len = frame_size - pos;
+  out.cover_format = cover_format_for_mime(mime);
+  have_front = (type == 3);
+}
+
+// ID3v2.2 to v2.4. The tag is parsed out of Id3Stream windows; payloads
+// past what a frame needs (text beyond kMaxTextLen, image data) are
+// skipped without being read. Compressed and encrypted frames are skipped.
+static bool read_id3_tags(File &f, TrackTags &out) {
+  Id3Stream in(f);
+  uint8_t header[10];
+  if (in.read(header, sizeof(header)) != sizeof(header) ||
+      memcmp(header, "ID3", 3) != 0) {
+    return false;
+  }
+  const uint8_t version = header[3];
+  const uint8_t flags = header[5];
+  if (version < 2 || version > 4) {
+    return false;
+  }
+  in.set_end(10 + read_syncsafe(&header[6]));
+  const bool v22 = version == 2;
+  // v2.2 flag 0x40 is compression, which nothing implements.
+  if (v22 && (flags & 0x40)) {
+    return true;
+  }
+  // Tag-wide unsynchronisation covers frame headers too before v2.4; in
+  // v2.4 it is applied per frame and sizes count the stored bytes.
+  const bool tag_unsync = (flags & 0x80) != 0;
+  in.set_unsync(tag_unsync && version < 4);
+
+  if (!v22 && (flags & 0x40)) {
+    uint8_t ext[4];
+    if (in.read(ext, 4) != 4) {
+      return true;
+    }
+    // v2.3 gives the size without these 4 bytes, v2.4 with them.
+    const uint32_t ext_size =
+        version == 3 ? read_u32_be(ext) : read_syncsafe(ext) - 4;
+    if (!in.skip(ext_size)) {
+      return true;
+    }
+  }
+
+  const size_t header_len = v22 ? 6 : 10;
+  bool have_front = false;
+  uint8_t buf[kMaxTextLen];
+  while (in.remaining() > header_len) {
+    uint8_t fh[10];
+    if (in.read(fh, header_len) != header_len || fh[0] == 0) {
+      break;
+    }
+    uint32_t size = v22 ? read_u24_be(&fh[3])
+                    : version == 4 ? read_syncsafe(&fh[4])
+                                   : read_u32_be(&fh[4]);
+    if (size == 0 || size > in.remaining()) {
+      break;
+    }
+    bool frame_unsync = version == 4 && tag_unsync;
+    bool skip_frame = false;
+    uint32_t prefix = 0;
+    if (version == 3) {
+      skip_frame = (fh[9] & 0xC0) != 0; // compressed, encrypted
+      prefix = (fh[9] & 0x20) ? 1 : 0;  // group id
+    } else if (version == 4) {
+      skip_frame = (fh[9] & 0x0C) != 0;
+      frame_unsync = frame_unsync || (fh[9] & 0x02) != 0;
+      prefix = ((fh[9] & 0x40) ? 1 : 0) + ((fh[9] & 0x01) ? 4 : 0);
+    }
+    if (skip_frame || prefix >= size) {
+      if (!in.skip(size)) {
+        break;
+      }
+      continue;
+    }
+    if (!in.skip(prefix)) {
+      break;
+    }
+    size -= prefix;
+
+    const char *id = reinterpret_cast<const char *>(fh);
+    const size_t id_len = v22 ? 3 : 4;
+    const uint32_t frame_pos = in.offset();
+    String TrackTags::*field = nullptr;
+    for (const Id3TextFrame &text : kId3TextFrames) {
+      if (memcmp(id, v22 ? text.id_v2 : text.id, id_len) == 0) {
+        field = text.field;
+        break;
+      }
+    }
+    const bool picture = memcmp(id, v22 ? "PIC" : "APIC", id_len) == 0;
+    const bool wanted = field ? (out.*field).length() == 0
+                              : picture && !have_front;
+    if (!wanted) {
+      if (!in.skip(size)) {
+        break;
+      }
+      continue;
+    }
+
+    size_t len = size < sizeof(buf) ? size : sizeof(buf);
+    if (in.read(buf, len) != len || !in.skip(size - len)) {
+      break;
+    }
+    if (frame_unsync) {
+      len = remove_unsync(buf, len);
+    }
+    if (field) {
+      assign_if_empty(out.*field, decode_text_frame(buf[0], &buf[1], len - 1));
+    } else {
+      read_id3_picture(buf, len, frame_pos, size, v22,
+                       !frame_unsync && !tag_unsync, out, have_front);
+    }
+  }
+
+  return true;
+}
+
+// MPEG-1 rates; MPEG-2 halves them and MPEG-2.5 quarters them.
+const uint32_t kMpegRates[3] = {44100, 48000, 32000};
+
+// Steps over the ID3v2 tags at the top of the file to the first frame header
+// and takes its format, so playback can start there without the tag walk.
+static void read_mp3_start(File &f, TrackTags &out) {
+  uint32_t pos = 0;
+  uint8_t h[10];
+  for (;;) {
+    if (!f.seek(pos) || f.read(h, sizeof(h)) != sizeof(h)) {
+      return;
+    }
+    if (memcmp(h, "ID3", 3) != 0) {
+      break;
+    }
+    pos += 10 + read_syncsafe(&h[6]) + ((h[3] == 4 && (h[5] & 0x10)) ? 10 : 0);
+  }
+  const uint8_t version = (h[1] >> 3) & 3; // 3 MPEG-1, 2 MPEG-2, 0 MPEG-2.5
+  const uint8_t layer = (h[1] >> 1) & 3;
+  const uint8_t rate = (h[2] >> 2) & 3;
+  if (h[0] != 0xFF || (h[1] & 0xE0) != 0xE0 || version == 1 || layer == 0 ||
+      rate == 3 || (h[2] >> 4) == 0x0F) {
+    return; // junk before the first frame, the decoder has to sync
+  }
+  AudioStart &start = out.start;
+  start.data_start = pos;
+  const int shift = version == 3 ? 0 : (version == 2 ? 1 : 2);
+  start.sample_rate = kMpegRates[rate] >> shift;
+  start.channels = (h[3] >> 6) == 3 ? 1 : 2;
+  start.bits_per_sample = 16;
+}
+
+static uint32_t read_u32_le(const uint8_t *data) {
+  return static_cast<uint32_t>(data[0]) |
+         (static_cast<uint32_t>(data[1]) << 8) |
+         (static_cast<uint32_t>(data[2]) << 16) |
+         (static_cast<uint32_t>(data[3]) << 24);
+}
+
+static constexpr uint32_t fourcc(char a, char b, char c, char d) {
+  return (static_cast<uint32_t>(static_cast<uint8_t>(a)) << 24) |
+         (static_cast<uint32_t>(static_cast<uint8_t>(b)) << 16) |
+         (static_cast<uint32_t>(static_cast<uint8_t>(c)) << 8) |
+         static_cast<uint32_t>(static_cast<uint8_t>(d));
+}
+
+// Sequential input for the Vorbis comment reader: a FLAC metadata block read
+// straight from the file, or an Ogg packet spread over pages.
+class ByteSource {
+public:
+  virtual ~ByteSource() = default;
+  virtual size_t read(uint8_t *buf, size_t len) = 0;
+  virtual bool skip(uint32_t len) = 0;
+};
+
+class FileSource : public ByteSource {
+public:
+  FileSource(File &f, uint32_t len) : f_(f), left_(len) {}
+
+  size_t read(uint8_t *buf, size_t len) override {
+    if (len > left_) {
+      len = left_;
+    }
+    size_t rd = f_.read(buf, len);
+    left_ -= rd;
+    return rd;
+  }
+
+  bool skip(uint32_t len) override {
+    if (len > left_) {
+      return false;
+    }
+    left_ -= len;
+    return f_.seek(f_.position() + len);
+  }
+
+private:
+  File &f_;
+  uint32_t left_;
+};
+
+// Reads one Ogg packet at a time, following it across page boundaries.
+// Only page headers and lacing tables are read to get from page to page.
+class OggPacketSource : public ByteSource {
+public:
+  explicit OggPacketSource(File &f) : f_(f) {}
+
+  bool begin() {
+    f_.seek(0);
+    return load_page();
+  }
+
+  // Skips what is left of the current packet and stops at the next one.
+  bool next_packet() {
+    while (fill()) {
+      if (!f_.seek(f_.position() + seg_left_)) {
+        return false;
+      }
+      seg_left_ = 0;
+    }
+    if (!ok_) {
+      return false;
+    }
+    if (++seg_ == segs_) {
+      return load_page();
+    }
+    seg_left_ = lacing_[seg_];
+    return true;
+  }
+
+  size_t read(uint8_t *buf, size_t len) override {
+    size_t done = 0;
+    while (done < len && fill()) {
+      size_t n = len - done;
+      if (n > seg_left_) {
+        n = seg_left_;
+      }
+      size_t rd = f_.read(buf + done, n);
+      done += rd;
+      seg_left_ -= rd;
+      if (rd < n) {
+        ok_ = false;
+        break;
+      }
+    }
+    return done;
+  }
+
+  bool skip(uint32_t len) override {
+    while (len > 0 && fill()) {
+      uint32_t n = len < seg_left_ ? len : seg_left_;
+      if (!f_.seek(f_.position() + n)) {
+        ok_ = false;
+        return false;
+      }
+      seg_left_ -= n;
+      len -= n;
+    }
+    return len == 0;
+  }
+
+private:
+  static constexpr int kMaxPages = 64;
+
+  bool load_page() {
+    uint8_t header[27];
+    if (++pages_ > kMaxPages || f_.read(header, sizeof(header)) != 27 ||
+        memcmp(header, "OggS", 4) != 0) {
+      ok_ = false;
+      return false;
+    }
+    segs_ = header[26];
+    if (segs_ == 0 || f_.read(lacing_, segs_) != segs_) {
+      ok_ = false;
+      return false;
+    }
+    seg_ = 0;
+    seg_left_ = lacing_[0];
+    return true;
+  }
+
+  // True while the current packet has bytes left; moves on to the next
+  // segment, or page, as segments run out.
+  bool fill() {
+    while (ok_ && seg_left_ == 0) {
+      if (lacing_[seg_] < 255) {
+        return false;
+      }
+      if (++seg_ == segs_) {
+        if (!load_page()) {
+          return false;
+        }
+      } else {
+        seg_left_ = lacing_[seg_];
+      }
+    }
+    return ok_;
+  }
+
+  File &f_;
+  uint8_t lacing_[255] = {};
+  uint16_t segs_ = 0;
+  uint16_t seg_ = 0;
+  uint32_t seg_left_ = 0;
+  int pages_ = 0;
+  bool ok_ = true;
+};
+
+// Vendor string, then count x "KEY=value" (keys case-insensitive). Long
+// values are truncated and embedded pictures skipped over.
+static void read_vorbis_comments(ByteSource &src, TrackTags &out) {
+  uint8_t word[4];
+  if (src.read(word, 4) != 4 || !src.skip(read_u32_le(word)) ||
+      src.read(word, 4) != 4) {
+    return;
+  }
+  uint32_t count = read_u32_le(word);
+  if (count > kMaxComments) {
+    count = kMaxComments;
+  }
+  char buf[kMaxTextLen + 1];
+  for (uint32_t i = 0; i < count; ++i) {
+    if (src.read(word, 4) != 4) {
+      return;
+    }
+    const uint32_t len = read_u32_le(word);
+    const size_t take = len < kMaxTextLen ? len : kMaxTextLen;
+    if (src.read(reinterpret_cast<uint8_t *>(buf), take) != take ||
+        !src.skip(len - take)) {
+      return;
+    }
+    buf[take] = '\0';
+    char *eq = strchr(buf, '=');
+    if (!eq) {
+      continue;
+    }
+    *eq = '\0';
+    String value(eq + 1);
+    value.trim();
+    if (strcasecmp(buf, "TITLE") == 0) {
+      assign_if_empty(out.title, value);
+    } else if (strcasecmp(buf, "ARTIST") == 0) {
+      assign_if_empty(out.artist, value);
+    } else if (strcasecmp(buf, "ALBUM") == 0) {
+      assign_if_empty(out.album, value);
+    } else if (strcasecmp(buf, "GENRE") == 0) {
+      assign_if_empty(out.genre, value);
+    } else if (strcasecmp(buf, "COMPOSER") == 0) {
+      assign_if_empty(out.composer, value);
+    }
+  }
+}
+
+// First 18 bytes of STREAMINFO: 20-bit sample rate, 36-bit total samples.
+static void read_streaminfo(const uint8_t *info, TrackTags &out) {
+  const uint32_t rate = (static_cast<uint32_t>(info[10]) << 12) |
+                        (static_cast<uint32_t>(info[11]) << 4) |
+                        (info[12] >> 4);
+  const uint64_t total =
+      (static_cast<uint64_t>(info[13] & 0x0F) << 32) | read_u32_be(&info[14]);
+  if (rate > 0 && total > 0 && out.duration_sec == 0) {
+    out.duration_sec = static_cast<uint32_t>(total / rate);
+  }
+}
+
+// The STREAMINFO fields Audio::read_FLAC_Header() takes. The result only
+// counts once the last metadata block, and so data_start, is known.
+static void read_flac_start(const uint8_t *info, AudioStart &start) {
+  start.sample_rate = read_u24_be(&info[10]) >> 4;
+  start.max_block = static_cast<uint16_t>((info[2] << 8) | info[3]);
+  const uint32_t max_frame = read_u24_be(&info[7]);
+  start.max_frame = max_frame > 0xFFFF ? 0xFFFF : max_frame;
+  start.channels = ((info[12] >> 1) & 0x07) + 1;
+  start.bits_per_sample = (((info[12] & 0x01) << 4) | (info[13] >> 4)) + 1;
+  start.total_samples = read_u32_be(&info[14]);
+}
+
+// PICTURE block: type, MIME, description, geometry, then the image bytes.
+// A front cover (type 3) replaces any picture taken before it.
+static void read_flac_picture(File &f, uint32_t block_end, TrackTags &out,
+                              bool &have_front) {
+  uint8_t word[8];
+  if (have_front || f.read(word, 8) != 8) {
+    return;
+  }
+  const uint32_t type = read_u32_be(word);
+  if (out.cover_len > 0 && type != 3) {
+    return;
+  }
+  uint32_t mime_len = read_u32_be(&word[4]);
+  char mime_buf[33] = {};
+  const uint32_t take = mime_len < 32 ? mime_len : 32;
+  if (f.read(reinterpret_cast<uint8_t *>(mime_buf), take) != take ||
+      !f.seek(f.position() + (mime_len - take)) || f.read(word, 4) != 4 ||
+      !f.seek(f.position() + read_u32_be(word) + 16) || f.read(word, 4) != 4) {
+    return;
+  }
+  const uint32_t data_len = read_u32_be(word);
+  const uint32_t data_pos = f.position();
+  if (data_len == 0 || data_pos + data_len > block_end) {
+    return;
+  }
+  out.cover_pos = data_pos;
+  out.cover_len = data_len;
+  out.cover_format = cover_format_for_mime(String(mime_buf));
+  have_front = (type == 3);
+}
+
+static bool read_flac_tags(File &f, TrackTags &out) {
+  uint8_t header[10];
+  if (f.read(header, 4) != 4) {
+    return false;
+  }
+  // Some taggers put an ID3v2 tag in front of the stream. The player's
+  // FLAC header reader does not skip it, so such files get no start info.
+  const bool id3_prefix = memcmp(header, "ID3", 3) == 0;
+  if (id3_prefix) {
+    if (f.read(&header[4], 6) != 6 ||
+        !f.seek(10 + read_syncsafe(&header[6])) || f.read(header, 4) != 4) {
+      return false;
+    }
+  }
+  if (memcmp(header, "fLaC", 4) != 0) {
+    return false;
+  }
+  bool have_front = false;
+  AudioStart audio;
+  for (int i = 0; i < kMaxFlacBlocks; ++i) {
+    if (f.read(header, 4) != 4) {
+      break;
+    }
+    const bool last = (header[0] & 0x80) != 0;
+    const uint8_t type = header[0] & 0x7F;
+    const uint32_t len = read_u24_be(&header[1]);
+    const uint32_t start = f.position();
+    if (type == 0 && len >= 18) {
+      uint8_t info[18];
+      if (f.read(info, sizeof(info)) == sizeof(info)) {
+        read_streaminfo(info, out);
+        read_flac_start(info, audio);
+      }
+    } else if (type == 4) {
+      FileSource src(f, len);
+      read_vorbis_comments(src, out);
+    } else if (type == 6) {
+      read_flac_picture(f, start + len, out, have_front);
+    }
+    if (last && !id3_prefix) {
+      audio.data_start = start + len;
+      out.start = audio;
+    }
+    if (last || !f.seek(start + len)) {
+      break;
+    }
+  }
+  return true;
+}
+
+struct Mp4Box {
+  uint32_t type;
+  uint32_t body;
+  uint32_t end;
+};
+
+// Box header at pos. Sizes past the parent, or 64-bit sizes past 4 GB, end
+// the walk.
+static bool read_mp4_box(File &f, uint32_t pos, uint32_t parent_end,
+                         Mp4Box &box) {
+  uint8_t header[16];
+  if (pos + 8 > parent_end || !f.seek(pos) || f.read(header, 8) != 8) {
+    return false;
+  }
+  uint64_t size = read_u32_be(header);
+  box.type = read_u32_be(&header[4]);
+  box.body = pos + 8;
+  if (size == 1) {
+    if (f.read(&header[8], 8) != 8) {
+      return false;
+    }
+    size = (static_cast<uint64_t>(read_u32_be(&header[8])) << 32) |
+           read_u32_be(&header[12]);
+    box.body = pos + 16;
+  } else if (size == 0) {
+    size = parent_end - pos;
+  }
+  if (size < box.body - pos || pos + size > parent_end) {
+    return false;
+  }
+  box.end = static_cast<uint32_t>(pos + size);
+  return true;
+}
+
+// One ilst item, e.g. (c)nam, holding a 'data' box: 4 bytes of type flags
+// (1 = UTF-8, 13 = JPEG, 14 = PNG, 27 = BMP), 4 bytes locale, then the value.
+static void read_mp4_item(File &f, const Mp4Box &item, TrackTags &out) {
+  Mp4Box data;
+  uint8_t flags[8];
+  if (!read_mp4_box(f, item.body, item.end, data) ||
+      data.type != fourcc('d', 'a', 't', 'a') || data.end - data.body < 8 ||
+      f.read(flags, 8) != 8) {
+    return;
+  }
+  const uint32_t kind = read_u32_be(flags) & 0xFFFFFF;
+  const uint32_t value_pos = data.body + 8;
+  const uint32_t value_len = data.end - value_pos;
+
+  if (item.type == fourcc('c', 'o', 'v', 'r')) {
+    if (out.cover_len == 0 && value_len > 0) {
+      out.cover_pos = value_pos;
+      out.cover_len = value_len;
+      out.cover_format = kind == 13   ? CoverFormat::Jpeg
+                         : kind == 14 ? CoverFormat::Png
+                         : kind == 27 ? CoverFormat::Bmp
+                                      : CoverFormat::Unknown;
+    }
+    return;
+  }
+  String *target = nullptr;
+  switch (item.type) {
+  case fourcc('\xA9', 'n', 'a', 'm'):
+    target = &out.title;
+    break;
+  case fourcc('\xA9', 'A', 'R', 'T'):
+    target = &out.artist;
+    break;
+  case fourcc('\xA9', 'a', 'l', 'b'):
+    target = &out.album;
+    break;
+  case fourcc('\xA9', 'g', 'e', 'n'):
+    target = &out.genre;
+    break;
+  case fourcc('\xA9', 'w', 'r', 't'):
+    target = &out.composer;
+    break;
+  default:
+    return;
+  }
+  if (kind != 1) {
+    return;
+  }
+  uint8_t buf[kMaxTextLen];
+  const size_t take = value_len < kMaxTextLen ? value_len : kMaxTextLen;
+  if (f.read(buf, take) == take) {
+    assign_if_empty(*target, decode_text_frame(3, buf, take));
+  }
+}
+
+// mvhd: version byte, then timescale and duration, 32- or 64-bit.
+static void read_mp4_duration(File &f, const Mp4Box &box, TrackTags &out) {
+  uint8_t buf[32];
+  if (box.end - box.body < 20 || f.read(buf, 1) != 1) {
+    return;
+  }
+  const bool v1 = buf[0] == 1;
+  const uint32_t need = v1 ? 32 : 20;
+  if (box.end - box.body < need || f.read(&buf[1], need - 1) != need - 1) {
+    return;
+  }
+  const uint32_t scale = read_u32_be(v1 ? &buf[20] : &buf[12]);
+  const uint64_t duration =
+      v1 ? (static_cast<uint64_t>(read_u32_be(&buf[24])) << 32) |
+               read_u32_be(&buf[28])
+         : read_u32_be(&buf[16]);
+  if (scale > 0 && out.duration_sec == 0) {
+    out.duration_sec = static_cast<uint32_t>(duration / scale);
+  }
+}
+
+// Walks moov -> udta -> meta -> ilst, seeking over every other box (mdat
+// included) by its size.
+static void walk_mp4(File &f, uint32_t pos, uint32_t end, int depth,
+                     TrackTags &out) {
+  Mp4Box box;
+  int boxes = 0;
+  while (depth < kMaxMp4Depth && ++boxes <= kMaxMp4Boxes &&
+         read_mp4_box(f, pos, end, box)) {
+    switch (box.type) {
+    case fourcc('m', 'o', 'o', 'v'):
+    case fourcc('u', 'd', 't', 'a'):
+      walk_mp4(f, box.body, box.end, depth + 1, out);
+      break;
+    case fourcc('m', 'e', 't', 'a'): {
+      // ISO meta is a full box with 4 bytes of version/flags before its
+      // children; QuickTime files omit them and start with hdlr.
+      uint8_t peek[8];
+      const bool quicktime =
+          f.read(peek, 8) == 8 &&
+          read_u32_be(&peek[4]) == fourcc('h', 'd', 'l', 'r');
+      const uint32_t children = quicktime ? box.body : box.body + 4;
+      walk_mp4(f, children, box.end, depth + 1, out);
+      break;
+    }
+    case fourcc('m', 'v', 'h', 'd'):
+      read_mp4_duration(f, box, out);
+      break;
+    case fourcc('i', 'l', 's', 't'): {
+      Mp4Box item;
+      uint32_t item_pos = box.body;
+      int items = 0;
+      while (++items <= kMaxMp4Boxes &&
+             read_mp4_box(f, item_pos, box.end, item)) {
+        read_mp4_item(f, item, out);
+        item_pos = item.end;
+      }
+      break;
+    }
+    default:
+      break;
+    }
+    pos = box.end;
+  }
+}
+
+static bool read_mp4_tags(File &f, TrackTags &out) {
+  uint8_t header[8];
+  if (f.read(header, sizeof(header)) != sizeof(header) ||
+      read_u32_be(&header[4]) != fourcc('f', 't', 'y', 'p')) {
+    return false;
+  }
+  walk_mp4(f, 0, f.size(), 0, out);
+  return true;
+}
+
+// Ogg FLAC: the first packet is 0x7F "FLAC", version, header count, "fLaC"
+// and STREAMINFO; each following header packet is one metadata block. The
+// comment block is read across pages; pictures are left alone since page
+// headers may split their bytes.
+static bool read_ogg_tags(File &f, TrackTags &out) {
+  OggPacketSource packets(f);
+  uint8_t first[13 + 4 + 18];
+  if (!packets.begin() ||
+      packets.read(first, sizeof(first)) != sizeof(first) ||
+      first[0] != 0x7F || memcmp(&first[1], "FLAC", 4) != 0 ||
+      memcmp(&first[9], "fLaC", 4) != 0) {
+    return false;
+  }
+  read_streaminfo(&first[17], out);
+  for (int i = 0; i < kMaxFlacBlocks && packets.next_packet(); ++i) {
+    uint8_t header[4];
+    if (packets.read(header, 4) != 4) {
+      break;
+    }
+    if ((header[0] & 0x7F) == 4) {
+      read_vorbis_comments(packets, out);
+      break;
+    }
+    if (header[0] & 0x80) {
+      break;
+    }
+  }
+  return true;
+}
+
+enum class TagFormat : uint8_t {
+  Id3 = 0,
+  Flac,
+  Mp4,
+  Ogg,
+  Count,
+};
+
+struct TagStats {
+  uint32_t files;
+  uint32_t total_us;
+  uint32_t max_us;
+};
+
+constexpr int kTagFormats = static_cast<int>(TagFormat::Count);
+const char *const kTagFormatNames[kTagFormats] = {"id3", "flac", "mp4", "ogg"};
+TagStats s_tag_stats[kTagFormats] = {};
+
+static TagFormat tag_format_for(const String &path) {
+  String lower = path;
+  lower.toLowerCase();
+  if (lower.endsWith(".flac")) {
+    return TagFormat::Flac;
+  }
+  if (lower.endsWith(".m4a")) {
+    return TagFormat::Mp4;
+  }
+  if (lower.endsWith(".oga")) {
+    return TagFormat::Ogg;
+  }
+  return TagFormat::Id3;
+}
+} // namespace
+
+bool library_read_file_tags(fs::FS &fs, const String &path, TrackTags &out) {
+  File f = fs.open(path, FILE_READ);
+  if (!f) {
+    return false;
+  }
+  const TagFormat format = tag_format_for(path);
+  const uint32_t start = micros();
+  bool ok = false;
+  switch (format) {
+  case TagFormat::Flac:
+    ok = read_flac_tags(f, out);
+    break;
+  case TagFormat::Mp4:
+    ok = read_mp4_tags(f, out);
+    break;
+  case TagFormat::Ogg:
+    ok = read_ogg_tags(f, out);
+    break;
+  default:
+    ok = read_id3_tags(f, out);
+    if (path.length() > 4 &&
+        path.substring(path.length() - 4).equalsIgnoreCase(".mp3")) {
+      read_mp3_start(f, out);
+    }
+    break;
+  }
+  f.close();
+
+  const uint32_t elapsed = micros() - start;
+  TagStats &st = s_tag_stats[static_cast<int>(format)];
+  st.files++;
+  st.total_us += elapsed;
+  if (elapsed > st.max_us) {
+    st.max_us = elapsed;
+  }
+  return ok;
+}
+
+void library_log_tag_stats() {
+  for (int i = 0; i < kTagFormats; ++i) {
+    TagStats &st = s_tag_stats[i];
+    if (st.files == 0) {
+      continue;
+    }
+    Serial.printf("[LIB] tags %s: %u files, avg %lu us, max %lu us\n",
+                  kTagFormatNames[i], static_cast<unsigned>(st.files),
+                  static_cast<unsigned long>(st.total_us / st.files),
+                  static_cast<unsigned long>(st.max_us));
+    st = TagStats{};
+  }
+}
+
+} // namespace app
@@ -0,0 +1,20 @@
+#pragma once
+
+#include <Arduino.h>
+#include <FS.h>
+
+#include "app/library.h"
+
+namespace app {
+
+// Tag readers for the scanner, picked by file extension: ID3v2 (mp3, aac,
+// wav), FLAC metadata blocks, MP4 ilst atoms (m4a) and Ogg FLAC. Each one
+// seeks from header to header and never reads audio payload; covers are
+// recorded as an offset and length into the file, not copied. Fields already
+// set in out are kept.
+bool library_read_file_tags(fs::FS &fs, const String &path, TrackTags &out);
+
+// Prints per-format parse counts and times since the last call.
+void library_log_tag_stats();
+
+} // namespace app
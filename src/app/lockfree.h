@@ -0,0 +1,82 @@
+#pragma once
+
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+
+namespace app {
+
+// Fixed-size single-producer/single-consumer queue. Exactly one task may call
+// push() and exactly one other task may call pop(); neither side blocks or
+// takes a lock.
+template <typename T, size_t N> class SpscQueue {
+  static_assert(N > 0 && (N & (N - 1)) == 0, "capacity must be a power of 2");
+
+public:
+  bool push(const T &item) {
+    const uint32_t head = head_.load(std::memory_order_relaxed);
+    const uint32_t tail = tail_.load(std::memory_order_acquire);
+    if (head - tail >= N) {
+      return false;
+    }
+    items_[head & (N - 1)] = item;
+    head_.store(head + 1, std::memory_order_release);
+    return true;
+  }
+
+  bool pop(T &out) {
+    const uint32_t tail = tail_.load(std::memory_order_relaxed);
+    const uint32_t head = head_.load(std::memory_order_acquire);
+    if (head == tail) {
+      return false;
+    }
+    out = items_[tail & (N - 1)];
+    tail_.store(tail + 1, std::memory_order_release);
+    return true;
+  }
+
+  bool empty() const {
+    return head_.load(std::memory_order_acquire) ==
+           tail_.load(std::memory_order_acquire);
+  }
+
+private:
+  T items_[N];
+  std::atomic<uint32_t> head_{0};
+  std::atomic<uint32_t> tail_{0};
+};
+
+// Single-writer snapshot cell. The writer never waits; readers retry while a
+// write is in flight, so they always see a consistent copy of T.
+template <typename T> class Seqlock {
+public:
+  void store(const T &value) {
+    const uint32_t seq = seq_.load(std::memory_order_relaxed);
+    seq_.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    value_ = value;
+    std::atomic_thread_fence(std::memory_order_release);
+    seq_.store(seq + 2, std::memory_order_relaxed);
+  }
+
+  T load() const {
+    T out;
+    uint32_t before = 0;
+    uint32_t after = 0;
+    do {
+      before = seq_.load(std::memory_order_acquire);
+      out = value_;
+      std::atomic_thread_fence(std::memory_order_acquire);
+      after = seq_.load(std::memory_order_relaxed);
+    } while ((before & 1) != 0 || before != after);
+    return out;
+  }
+
+  uint32_t version() const { return seq_.load(std::memory_order_acquire); }
+
+private:
+  T value_{};
+  std::atomic<uint32_t> seq_{0};
+};
+
+} // namespace app
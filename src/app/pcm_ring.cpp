@@ -0,0 +1,95 @@
+#include "app/pcm_ring.h"
+
+#include <cstring>
+#include <esp_heap_caps.h>
+
+namespace app {
+
+bool PcmRing::init(uint32_t frames) {
+  if (data_) {
+    return true;
+  }
+  uint32_t cap = 1;
+  while (cap < frames) {
+    cap <<= 1;
+  }
+  const size_t bytes = cap * sizeof(uint32_t);
+  data_ = static_cast<uint32_t *>(
+      heap_caps_malloc(bytes, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT));
+  if (!data_) {
+    data_ = static_cast<uint32_t *>(malloc(bytes));
+  }
+  if (!data_) {
+    return false;
+  }
+  mask_ = cap - 1;
+  head_.store(0, std::memory_order_relaxed);
+  tail_.store(0, std::memory_order_relaxed);
+  return true;
+}
+
+uint32_t PcmRing::available() const {
+  return head_.load(std::memory_order_acquire) -
+         tail_.load(std::memory_order_acquire);
+}
+
+uint32_t PcmRing::free_space() const {
+  if (!data_) {
+    return 0;
+  }
+  return capacity() - available();
+}
+
+uint32_t PcmRing::write(const uint32_t *frames, uint32_t count) {
+  if (!data_ || !frames) {
+    return 0;
+  }
+  const uint32_t head = head_.load(std::memory_order_relaxed);
+  const uint32_t tail = tail_.load(std::memory_order_acquire);
+  const uint32_t space = capacity() - (head - tail);
+  if (count > space) {
+    count = space;
+  }
+  const uint32_t start = head & mask_;
+  const uint32_t first =
+      (count < capacity() - start) ? count : capacity() - start;
+  memcpy(data_ + start, frames, first * sizeof(uint32_t));
+  memcpy(data_, frames + first, (count - first) * sizeof(uint32_t));
+  head_.store(head + count, std::memory_order_release);
+  return count;
+}
+
+uint32_t PcmRing::write_pos() const {
+  return head_.load(std::memory_order_relaxed);
+}
+
+uint32_t PcmRing::read(uint32_t *out, uint32_t count) {
+  if (!data_ || !out) {
+    return 0;
+  }
+  const uint32_t tail = tail_.load(std::memory_order_relaxed);
+  const uint32_t head = head_.load(std::memory_order_acquire);
+  if (count > head - tail) {
+    count = head - tail;
+  }
+  const uint32_t start = tail & mask_;
+  const uint32_t first =
+      (count < capacity() - start) ? count : capacity() - start;
+  memcpy(out, data_ + start, first * sizeof(uint32_t));
+  memcpy(out + first, data_, (count - first) * sizeof(uint32_t));
+  tail_.store(tail + count, std::memory_order_release);
+  return count;
+}
+
+uint32_t PcmRing::read_pos() const {
+  return tail_.load(std::memory_order_relaxed);
+}
+
+void PcmRing::discard_until(uint32_t pos) {
+  const uint32_t tail = tail_.load(std::memory_order_relaxed);
+  if (static_cast<int32_t>(pos - tail) > 0) {
+    tail_.store(pos, std::memory_order_release);
+  }
+}
+
+} // namespace app
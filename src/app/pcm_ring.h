@@ -0,0 +1,34 @@
+#pragma once
+
+#include <Arduino.h>
+#include <atomic>
+
+namespace app {
+
+// Lock-free ring of packed stereo frames (L << 16 | R) between one producer
+// task (the decoder) and one consumer task (the I2S writer).
+class PcmRing {
+public:
+  bool init(uint32_t frames);
+  uint32_t capacity() const { return mask_ + 1; }
+  uint32_t available() const;
+  uint32_t free_space() const;
+
+  // Producer side.
+  uint32_t write(const uint32_t *frames, uint32_t count);
+  uint32_t write_pos() const;
+
+  // Consumer side. discard_until() drops every frame written before a
+  // position previously taken with write_pos().
+  uint32_t read(uint32_t *out, uint32_t count);
+  uint32_t read_pos() const;
+  void discard_until(uint32_t pos);
+
+private:
+  uint32_t *data_ = nullptr;
+  uint32_t mask_ = 0;
+  std::atomic<uint32_t> head_{0};
+  std::atomic<uint32_t> tail_{0};
+};
+
+} // namespace app
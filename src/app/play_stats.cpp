@@ -0,0 +1,418 @@
+#include "app/play_stats.h"
+
+#include "app/library_index.h"
+#include "board/spi_bus.h"
+
+#include <cstddef>
+#include <cstring>
+#include <esp_heap_caps.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+
+namespace app::stats {
+namespace {
+// One small append per interval at most; a play every few minutes leaves
+// one or two records per write.
+constexpr uint32_t kFlushIntervalMs = 5 * 60 * 1000;
+constexpr size_t kCompactBytes = 1024 * sizeof(StatsRecord);
+constexpr uint32_t kInitialCapacity = 512;
+constexpr int kBatchRecords = 64; // records per read or write call
+
+struct Entry {
+  uint32_t id;
+  uint32_t play_count;
+  uint32_t last_played;
+  bool queued; // changed since the last append
+};
+
+// Open-addressed id -> entry table over a dense entry array.
+struct Table {
+  Entry *entries = nullptr;
+  uint32_t count = 0;
+  uint32_t capacity = 0;
+  uint32_t *slots = nullptr; // entry index + 1, 0 = empty
+  uint32_t slot_mask = 0;
+};
+
+Table s_table;
+SemaphoreHandle_t s_lock = nullptr;
+fs::FS *s_fs = nullptr;
+uint32_t s_queued = 0;
+uint32_t s_first_queued_ms = 0;
+uint32_t s_clock_base = 0;
+size_t s_log_bytes = 0;
+bool s_log_damaged = false; // appends would land behind a bad record
+
+class Lock {
+public:
+  Lock() {
+    if (s_lock) {
+      xSemaphoreTake(s_lock, portMAX_DELAY);
+    }
+  }
+  ~Lock() {
+    if (s_lock) {
+      xSemaphoreGive(s_lock);
+    }
+  }
+};
+
+static void *alloc_buffer(void *ptr, size_t size) {
+  void *out =
+      heap_caps_realloc(ptr, size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+  return out ? out : realloc(ptr, size);
+}
+
+static uint32_t record_check(const StatsRecord &r) {
+  return library_hash(&r, offsetof(StatsRecord, check));
+}
+
+static bool grow(Table &t) {
+  const uint32_t capacity = t.capacity ? t.capacity * 2 : kInitialCapacity;
+  Entry *entries = static_cast<Entry *>(
+      alloc_buffer(t.entries, capacity * sizeof(Entry)));
+  if (!entries) {
+    return false;
+  }
+  t.entries = entries;
+  uint32_t *slots = static_cast<uint32_t *>(
+      alloc_buffer(t.slots, capacity * 2 * sizeof(uint32_t)));
+  if (!slots) {
+    return false;
+  }
+  t.slots = slots;
+  t.capacity = capacity;
+  t.slot_mask = capacity * 2 - 1;
+  memset(t.slots, 0, capacity * 2 * sizeof(uint32_t));
+  for (uint32_t i = 0; i < t.count; ++i) {
+    uint32_t slot = t.entries[i].id & t.slot_mask;
+    while (t.slots[slot] != 0) {
+      slot = (slot + 1) & t.slot_mask;
+    }
+    t.slots[slot] = i + 1;
+  }
+  return true;
+}
+
+static Entry *find(const Table &t, uint32_t id) {
+  if (!t.slots) {
+    return nullptr;
+  }
+  uint32_t slot = id & t.slot_mask;
+  while (t.slots[slot] != 0) {
+    Entry &e = t.entries[t.slots[slot] - 1];
+    if (e.id == id) {
+      return &e;
+    }
+    slot = (slot + 1) & t.slot_mask;
+  }
+  return nullptr;
+}
+
+static Entry *find_or_add(Table &t, uint32_t id) {
+  if (Entry *e = find(t, id)) {
+    return e;
+  }
+  if (t.count == t.capacity && !grow(t)) {
+    return nullptr;
+  }
+  Entry &e = t.entries[t.count];
+  e = Entry{id, 0, 0, false};
+  uint32_t slot = id & t.slot_mask;
+  while (t.slots[slot] != 0) {
+    slot = (slot + 1) & t.slot_mask;
+  }
+  t.slots[slot] = ++t.count;
+  return &e;
+}
+
+// Both values only grow, so keeping the larger one makes replay order and
+// duplicates irrelevant.
+static void apply(const StatsRecord &r) {
+  if (Entry *e = find_or_add(s_table, r.id)) {
+    if (r.play_count > e->play_count) {
+      e->play_count = r.play_count;
+    }
+    if (r.last_played > e->last_played) {
+      e->last_played = r.last_played;
+    }
+  }
+  if (r.last_played >= s_clock_base) {
+    s_clock_base = r.last_played + 1;
+  }
+}
+
+static void clear_table() {
+  s_table.count = 0;
+  s_queued = 0; // the queued entries went with the table
+  if (s_table.slots) {
+    memset(s_table.slots, 0, (s_table.slot_mask + 1) * sizeof(uint32_t));
+  }
+  s_clock_base = 0;
+}
+
+static bool load_snapshot(fs::FS &fs, const char *path) {
+  File f = fs.open(path, FILE_READ);
+  if (!f) {
+    return false;
+  }
+  StatsSnapshotHeader header;
+  if (spibus::read(f, reinterpret_cast<uint8_t *>(&header), sizeof(header),
+                   spibus::Client::Ui) != sizeof(header) ||
+      header.magic != kSnapshotMagic || header.version != kSnapshotVersion ||
+      header.record_size != sizeof(StatsRecord) ||
+      f.size() != sizeof(header) + header.count * sizeof(StatsRecord)) {
+    f.close();
+    Serial.printf("[STATS] snapshot %s ignored (format)\n", path);
+    return false;
+  }
+
+  StatsRecord batch[kBatchRecords];
+  uint32_t checksum = library_hash(nullptr, 0);
+  uint32_t left = header.count;
+  bool ok = true;
+  while (ok && left > 0) {
+    const uint32_t n = left < kBatchRecords ? left : kBatchRecords;
+    const size_t bytes = n * sizeof(StatsRecord);
+    ok = spibus::read(f, reinterpret_cast<uint8_t *>(batch), bytes,
+                      spibus::Client::Ui) == bytes;
+    checksum = library_hash(batch, bytes, checksum);
+    for (uint32_t i = 0; ok && i < n; ++i) {
+      apply(batch[i]);
+    }
+    left -= n;
+  }
+  f.close();
+  if (!ok || checksum != header.checksum) {
+    Serial.printf("[STATS] snapshot %s ignored (corrupt)\n", path);
+    clear_table();
+    return false;
+  }
+  return true;
+}
+
+// Returns false when the log ends in a torn or damaged record.
+static bool replay_log(fs::FS &fs, uint32_t &replayed) {
+  replayed = 0;
+  s_log_bytes = 0;
+  File f = fs.open(kLogPath, FILE_READ);
+  if (!f) {
+    return true;
+  }
+  const size_t size = f.size();
+  StatsRecord batch[kBatchRecords];
+  bool clean = true;
+  while (clean && s_log_bytes < size) {
+    size_t bytes = size - s_log_bytes;
+    if (bytes > sizeof(batch)) {
+      bytes = sizeof(batch);
+    }
+    const size_t got = spibus::read(f, reinterpret_cast<uint8_t *>(batch),
+                                    bytes, spibus::Client::Ui);
+    const size_t n = got / sizeof(StatsRecord);
+    for (size_t i = 0; i < n; ++i) {
+      if (batch[i].check != record_check(batch[i])) {
+        clean = false;
+        break;
+      }
+      apply(batch[i]);
+      ++replayed;
+      s_log_bytes += sizeof(StatsRecord);
+    }
+    if (got != bytes || n * sizeof(StatsRecord) != got) {
+      clean = false; // short read or a partial record at the end
+    }
+  }
+  f.close();
+  return clean;
+}
+
+// Writes the whole table as the new snapshot and drops the log. Everything
+// queued must already be in the log, so a failure here loses nothing.
+static bool compact(fs::FS &fs) {
+  const uint32_t start = millis();
+  uint32_t count;
+  StatsRecord *records;
+  {
+    Lock lock;
+    count = s_table.count;
+    records = static_cast<StatsRecord *>(
+        alloc_buffer(nullptr, (count ? count : 1) * sizeof(StatsRecord)));
+    if (!records) {
+      return false;
+    }
+    for (uint32_t i = 0; i < count; ++i) {
+      const Entry &e = s_table.entries[i];
+      records[i] = StatsRecord{e.id, e.play_count, e.last_played, 0};
+      records[i].check = record_check(records[i]);
+    }
+  }
+  const size_t records_size = count * sizeof(StatsRecord);
+  StatsSnapshotHeader header;
+  header.magic = kSnapshotMagic;
+  header.version = kSnapshotVersion;
+  header.record_size = sizeof(StatsRecord);
+  header.count = count;
+  header.checksum = library_hash(records, records_size);
+
+  // Same swap as the library index: a power cut leaves the old snapshot,
+  // or the finished temp file that load() falls back to.
+  String tmp = String(kSnapshotPath) + ".tmp";
+  bool ok = false;
+  File f = fs.open(tmp.c_str(), FILE_WRITE);
+  if (f) {
+    ok = spibus::write(f, reinterpret_cast<const uint8_t *>(&header),
+                       sizeof(header), spibus::Client::Ui) == sizeof(header) &&
+         spibus::write(f, reinterpret_cast<const uint8_t *>(records),
+                       records_size, spibus::Client::Ui) == records_size;
+    f.close();
+  }
+  free(records);
+  if (!ok) {
+    fs.remove(tmp.c_str());
+    return false;
+  }
+  fs.remove(kSnapshotPath);
+  if (!fs.rename(tmp.c_str(), kSnapshotPath)) {
+    return false;
+  }
+  fs.remove(kLogPath);
+  s_log_bytes = 0;
+  s_log_damaged = false;
+  Serial.printf("[STATS] snapshot of %u tracks written, %lu ms\n",
+                static_cast<unsigned>(count),
+                static_cast<unsigned long>(millis() - start));
+  return true;
+}
+} // namespace
+
+bool load(fs::FS &fs) {
+  const uint32_t start = millis();
+  if (!s_lock) {
+    s_lock = xSemaphoreCreateMutex();
+  }
+  s_fs = &fs;
+  bool loaded;
+  bool clean;
+  uint32_t replayed = 0;
+  {
+    Lock lock;
+    clear_table();
+    loaded = load_snapshot(fs, kSnapshotPath);
+    if (!loaded) {
+      loaded = load_snapshot(fs, (String(kSnapshotPath) + ".tmp").c_str());
+    }
+    clean = replay_log(fs, replayed);
+  }
+  Serial.printf("[STATS] %u tracks, %u log records%s, %lu ms\n",
+                static_cast<unsigned>(s_table.count),
+                static_cast<unsigned>(replayed), clean ? "" : ", torn tail",
+                static_cast<unsigned long>(millis() - start));
+  s_log_damaged = !clean;
+  if (s_log_damaged) {
+    compact(fs);
+  }
+  return loaded || replayed > 0;
+}
+
+uint32_t now_sec() { return s_clock_base + millis() / 1000; }
+
+void fill(TrackInfo &track) {
+  const uint32_t id = library_path_hash(track.path ? track.path : "");
+  Lock lock;
+  const Entry *e = find(s_table, id);
+  track.play_count = e ? e->play_count : 0;
+  track.last_played = e ? e->last_played : 0;
+}
+
+void record(const TrackInfo &track) {
+  if (!track.path || track.path[0] == '\0') {
+    return;
+  }
+  const uint32_t id = library_path_hash(track.path);
+  Lock lock;
+  Entry *e = find_or_add(s_table, id);
+  if (!e) {
+    return;
+  }
+  e->play_count = track.play_count;
+  e->last_played = track.last_played;
+  if (!e->queued) {
+    e->queued = true;
+    if (s_queued++ == 0) {
+      s_first_queued_ms = millis();
+    }
+  }
+}
+
+void tick() {
+  if (s_queued == 0 ||
+      static_cast<uint32_t>(millis() - s_first_queued_ms) < kFlushIntervalMs) {
+    return;
+  }
+  flush();
+}
+
+bool flush() {
+  if (!s_fs || s_queued == 0) {
+    return true;
+  }
+  if (s_log_damaged && !compact(*s_fs)) {
+    return false;
+  }
+  File f = s_fs->open(kLogPath, FILE_APPEND);
+  if (!f) {
+    return false;
+  }
+  StatsRecord batch[kBatchRecords];
+  uint32_t scan = 0;
+  bool ok = true;
+  while (ok) {
+    int n = 0;
+    uint32_t ids[kBatchRecords];
+    {
+      Lock lock;
+      for (; scan < s_table.count && n < kBatchRecords; ++scan) {
+        Entry &e = s_table.entries[scan];
+        if (!e.queued) {
+          continue;
+        }
+        e.queued = false;
+        --s_queued;
+        ids[n] = e.id;
+        batch[n] = StatsRecord{e.id, e.play_count, e.last_played, 0};
+        batch[n].check = record_check(batch[n]);
+        ++n;
+      }
+    }
+    if (n == 0) {
+      break;
+    }
+    const size_t bytes = n * sizeof(StatsRecord);
+    ok = spibus::write(f, reinterpret_cast<const uint8_t *>(batch), bytes,
+                       spibus::Client::Ui) == bytes;
+    if (ok) {
+      s_log_bytes += bytes;
+      continue;
+    }
+    // Queue the batch again. A partly written record stops replay, so the
+    // next flush starts with a fresh snapshot.
+    s_log_damaged = true;
+    Lock lock;
+    for (int i = 0; i < n; ++i) {
+      Entry *e = find(s_table, ids[i]);
+      if (e && !e->queued) {
+        e->queued = true;
+        ++s_queued;
+      }
+    }
+    s_first_queued_ms = millis();
+  }
+  f.close();
+  if (ok && s_log_bytes >= kCompactBytes) {
+    compact(*s_fs);
+  }
+  return ok;
+}
+
+} // namespace app::stats
@@ -4,20 +4,146 @@
 #include <Audio.h>
 #include <FS.h>
 #include <SD.h>
+#include <atomic>
 #include <cstring>
+#include <freertos/semphr.h>
+#include <freertos/task.h>
 
+#include "app/library_index.h"
+#include "app/lockfree.h"
+#include "app/pcm_ring.h"
+#include "app/play_stats.h"
 #include "board/BoardBase.h"
+#include "board/spi_bus.h"
 
 namespace app {
 namespace {
+// Playback runs on two tasks pinned to the core the Arduino loop does not
+// use: the decode task drives Audio::loop() and owns s_task_state, the I2S
+// task drains the PCM ring into the DMA. The UI only talks to them through
+// s_commands and reads back s_snapshot, so a slow redraw never stalls audio.
+enum class CommandKind : uint8_t {
+  Play = 0,
+  SetPaused,
+  Next,
+  Prev,
+  Stop,
+  SetVolume,
+  SetMode,
+  Seek,
+  Reindex,
+  Release,
+};
+
+struct Command {
+  CommandKind kind = CommandKind::Stop;
+  int32_t value = 0;
+  uint32_t seq = 0;
+};
+
+struct PlayerSnapshot {
+  uint32_t cmd_seq = 0;
+  int current_index = -1;
+  bool is_playing = false;
+  bool paused = false;
+  bool cover_ready = false;
+  uint32_t cover_version = 0;
+  uint32_t meta_version = 0;
+  int cover_track_index = -1;
+  uint32_t cover_pos = 0;
+  uint32_t cover_len = 0;
+  CoverFormat cover_format = CoverFormat::Unknown;
+  uint32_t current_time = 0;
+  uint32_t duration = 0;
+};
+
 static Audio s_audio;
 static Library *s_library = nullptr;
+static PlayerState s_task_state;
 static PlayerState *s_state = nullptr;
 
+static SpscQueue<Command, 16> s_commands;
+// Tracks the decode task started. The UI task counts the plays: moving a
+// track in the play-count and last-played orders under the list screens
+// that read them unlocked would tear their copies.
+static SpscQueue<int, 8> s_played;
+
+// Tags the stream reported for the playing track. The decode task only
+// records them; the UI task retags the track, which moves it between the
+// catalogs and orders the list screens read.
+enum TagField { kTagTitle, kTagArtist, kTagAlbum, kTagGenre, kTagComposer };
+constexpr int kTagFields = 5;
+constexpr size_t kTagLen = 96;
+struct StreamTags {
+  int index = -1;
+  uint32_t path_hash = 0; // tells a reindexed track apart
+  char fields[kTagFields][kTagLen] = {};
+};
+static Seqlock<StreamTags> s_stream_tags;
+static StreamTags s_tags_pending; // decode task only
+static uint32_t s_tags_seen = 0;  // UI task only
+static Seqlock<PlayerSnapshot> s_snapshot;
+static PcmRing s_ring;
+static SemaphoreHandle_t s_library_lock = nullptr;
+static TaskHandle_t s_decode_task = nullptr;
+static TaskHandle_t s_i2s_task = nullptr;
+static std::atomic<bool> s_output_paused{false};
+static std::atomic<bool> s_flush_pending{false};
+static std::atomic<uint32_t> s_flush_pos{0};
+static uint32_t s_cmd_sent = 0;      // UI task only
+static uint32_t s_cmd_applied = 0;   // decode task only
+static bool s_snapshot_dirty = true; // decode task only
+static PlaybackMode s_sent_mode = PlaybackMode::Sequential;
+static int s_preroll_index = -1;    // decode task only
+static bool s_preroll_tried = false; // decode task only
+// A track the UI is deleting; not opened again until the library update
+// that removes it.
+static int s_released_index = -1; // decode task only
+
+// Track change gap. handle_eof() arms it, the first decoded block of the
+// next track marks where it starts in the ring, and the I2S task adds up
+// how long the ring ran dry before reaching that point. Silence Audio
+// pushed itself between the tracks counts as gap too.
+static std::atomic<bool> s_gap_armed{false};
+static std::atomic<bool> s_gap_marked{false};
+static std::atomic<uint32_t> s_gap_start_pos{0};
+static std::atomic<uint32_t> s_gap_silence{0};
+
+// Track start latency. start_track() arms it when it drops the old output,
+// the first decoded block of the new track marks where it enters the ring,
+// and the I2S task logs the time until that frame has gone out.
+static std::atomic<bool> s_start_armed{false};
+static std::atomic<bool> s_start_marked{false};
+static std::atomic<bool> s_start_fast{false};
+static std::atomic<uint32_t> s_start_pos{0};
+static std::atomic<uint32_t> s_start_us{0};
+
+// Sample rate changes. Audio reports a new rate while the old track's tail
+// is still queued; the I2S task switches the clock once it has read up to
+// the ring position where the new rate starts.
+struct RateChange {
+  uint32_t pos = 0;
+  uint32_t rate = 0;
+};
+static Seqlock<RateChange> s_rate_change;
+
 constexpr size_t kCoverScanMax = 16384;
 constexpr size_t kCoverChunkSize = 512;
 constexpr size_t kCoverMaxBytes = 512 * 1024;
 
+constexpr uint32_t kPcmRingFrames = 8192;
+// Most frames a single Audio::loop() call can emit (one decoded FLAC block).
+constexpr uint32_t kDecodeHeadroomFrames = 4096;
+constexpr uint16_t kI2SWriteFrames = 512;
+constexpr uint32_t kSnapshotPeriodMs = 50;
+constexpr uint32_t kDecodeTaskStack = 12 * 1024;
+constexpr uint32_t kI2STaskStack = 4 * 1024;
+constexpr UBaseType_t kDecodeTaskPriority = 3;
+constexpr UBaseType_t kI2STaskPriority = 4;
+constexpr BaseType_t kAudioCore = 0;
+// How long before the end of a track the next one is opened.
+constexpr uint32_t kPrerollLeadSec = 5;
+
 static bool match_sig(const uint8_t *buf, size_t len, const uint8_t *sig,
                       size_t siglen) {
   if (len < siglen) {
@@ -43,7 +169,7 @@ static CoverFormat detect_cover_format(File &file, size_t pos) {
   uint8_t buf[8] = {};
   size_t saved = file.position();
   file.seek(pos);
-  size_t rd = file.read(buf, sizeof(buf));
+  size_t rd = spibus::read(file, buf, sizeof(buf), spibus::Client::Cover);
   file.seek(saved);
   if (rd >= 2) {
     const uint8_t sig_jpg[2] = {0xFF, 0xD8};
@@ -85,7 +211,7 @@ static bool find_cover_start(File &file, size_t pos, size_t size,
     if (to_read > sizeof(buf)) {
       to_read = sizeof(buf);
     }
-    size_t rd = file.read(buf, to_read);
+    size_t rd = spibus::read(file, buf, to_read, spibus::Client::Cover);
     if (rd == 0) {
       break;
     }
@@ -130,20 +256,52 @@ static void reset_cover(PlayerState &state) {
   state.cover_version++;
 }
 
-static void start_track(int index) {
-  if (!s_library || !s_state) {
+static void log_i2s_stats() {
+  const Audio::I2SStats &st = s_audio.getI2SStats();
+  if (st.frames == 0) {
     return;
   }
-  if (index < 0 || index >= s_library->track_count) {
-    return;
+  Serial.printf("[I2S] frames=%u blocks=%u writes=%u short=%u dropped=%u "
+                "dsp_cyc/frame=%u write_cyc/frame=%u\n",
+                static_cast<unsigned>(st.frames),
+                static_cast<unsigned>(st.blocks),
+                static_cast<unsigned>(st.writeCalls),
+                static_cast<unsigned>(st.shortWrites),
+                static_cast<unsigned>(st.droppedBlocks),
+                static_cast<unsigned>(st.dspCycles / st.frames),
+                static_cast<unsigned>(st.writeCycles / st.frames));
+  s_audio.resetI2SStats();
+}
+
+// Drops everything queued for output so far; used when the user leaves the
+// current position. Track changes at end of file keep the tail playing.
+static void flush_output() {
+  s_flush_pos.store(s_ring.write_pos(), std::memory_order_relaxed);
+  s_flush_pending.store(true, std::memory_order_release);
+  if (s_i2s_task) {
+    xTaskNotifyGive(s_i2s_task);
+  }
+}
+
+// Makes index the current track and returns its path and what the scan
+// found about its header; false when the index is out of range.
+static bool enter_track(int index, String &path, Audio::StartInfo &start) {
+  xSemaphoreTake(s_library_lock, portMAX_DELAY);
+  if (!library_track_live(*s_library, index) || index == s_released_index) {
+    xSemaphoreGive(s_library_lock);
+    return false;
   }
 
   TrackInfo &track = s_library->tracks[index];
   s_state->current_index = index;
   s_state->is_playing = true;
   s_state->paused = false;
-  track.play_count++;
-  track.last_played = millis() / 1000;
+  if (!s_played.push(index)) {
+    Serial.println("[PLAYER] play count queue full, play not counted");
+  }
+  s_tags_pending = StreamTags();
+  s_tags_pending.index = index;
+  s_tags_pending.path_hash = library_path_hash(track.path);
   reset_cover(*s_state);
   if (track.cover_len > 0 && track.cover_format != CoverFormat::Unknown) {
     s_state->cover_pos = track.cover_pos;
@@ -153,14 +311,61 @@ static void start_track(int index) {
     s_state->cover_ready = true;
   }
 
-  s_audio.stopSong();
-  s_audio.connecttoFS(SD, track.path ? track.path : "");
+  path = track.path ? track.path : "";
+  start.fileSize = track.file_size;
+  start.dataStart = track.start.data_start;
+  start.sampleRate = track.start.sample_rate;
+  start.channels = track.start.channels;
+  start.bitsPerSample = track.start.bits_per_sample;
+  start.flacMaxBlockSize = track.start.max_block;
+  start.flacMaxFrameSize = track.start.max_frame;
+  start.flacTotalSamples = track.start.total_samples;
+  xSemaphoreGive(s_library_lock);
+
+  s_preroll_index = -1;
+  s_preroll_tried = false;
+  s_output_paused.store(false, std::memory_order_release);
+  s_snapshot_dirty = true;
+  log_i2s_stats();
+  return true;
 }
 
-static void pick_next(bool forward) {
-  if (!s_library || !s_state || s_library->track_count == 0) {
+static void start_track(int index, bool flush) {
+  if (!s_library || !s_state) {
+    return;
+  }
+  const uint32_t t0 = micros();
+  String path;
+  Audio::StartInfo start{};
+  if (!enter_track(index, path, start)) {
     return;
   }
+  s_audio.stopSong();
+  if (flush) {
+    s_gap_armed.store(false, std::memory_order_relaxed);
+    flush_output();
+    s_start_us.store(t0, std::memory_order_relaxed);
+    s_start_fast.store(start.sampleRate != 0, std::memory_order_relaxed);
+    s_start_marked.store(false, std::memory_order_relaxed);
+    s_start_armed.store(true, std::memory_order_release);
+  }
+  s_audio.connecttoFS(SD, path.c_str(), start);
+}
+
+// The first live track from index on, stepping by step and wrapping; -1
+// when every slot is a removed track.
+static int live_track_from(int index, int step) {
+  const int count = s_library->track_count;
+  for (int n = 0; n < count; ++n) {
+    if (library_track_live(*s_library, index)) {
+      return index;
+    }
+    index = (index + step + count) % count;
+  }
+  return -1;
+}
+
+static int next_track_index(bool forward) {
 
   int next_index = s_state->current_index;
   if (s_state->mode == PlaybackMode::RepeatOne) {
@@ -179,68 +384,411 @@ static void pick_next(bool forward) {
       }
     }
   }
+  return live_track_from(next_index, forward ? 1 : -1);
+}
 
-  start_track(next_index);
+static void pick_next(bool forward, bool flush) {
+  if (!s_library || !s_state || s_library->track_count == 0) {
+    return;
+  }
+  start_track(next_track_index(forward), flush);
+}
+
+// Opens the track that will follow once the current one is within
+// kPrerollLeadSec of its end, so Audio can run into it without a gap.
+static void preroll_next() {
+  if (s_preroll_tried || !s_audio.isRunning() || !s_library ||
+      s_library->track_count == 0) {
+    return;
+  }
+  const uint32_t duration = s_audio.getAudioFileDuration();
+  if (duration == 0 ||
+      s_audio.getAudioCurrentTime() + kPrerollLeadSec < duration) {
+    return;
+  }
+  s_preroll_tried = true;
+
+  const int index = next_track_index(true);
+  xSemaphoreTake(s_library_lock, portMAX_DELAY);
+  String path;
+  if (library_track_live(*s_library, index) && index != s_released_index) {
+    path = s_library->tracks[index].path;
+  }
+  xSemaphoreGive(s_library_lock);
+
+  spibus::Guard bus(spibus::Client::Audio);
+  if (path.length() > 0 && s_audio.prerollFS(SD, path.c_str())) {
+    s_preroll_index = index;
+  }
+}
+
+static void cancel_preroll() {
+  s_audio.cancelPreroll();
+  s_preroll_index = -1;
+  s_preroll_tried = false;
 }
 
 static void update_from_id3(const char *info) {
-  if (!s_library || !s_state || s_state->current_index < 0 || !info) {
+  if (!s_state || s_tags_pending.index < 0 || !info) {
     return;
   }
 
   String s(info);
   s.trim();
-  if (s.length() == 0) {
+  static const struct {
+    const char *key;
+    TagField field;
+  } kKeys[] = {
+      {"Title", kTagTitle},       {"TIT2", kTagTitle},
+      {"Artist", kTagArtist},     {"TPE1", kTagArtist},
+      {"Album", kTagAlbum},       {"TALB", kTagAlbum},
+      {"Genre", kTagGenre},       {"TCON", kTagGenre},
+      {"Composer", kTagComposer}, {"TCOM", kTagComposer},
+  };
+  for (const auto &k : kKeys) {
+    if (!s.startsWith(k.key)) {
+      continue;
+    }
+    unsigned pos = strlen(k.key);
+    if (pos < s.length() && (s[pos] == ':' || s[pos] == '=')) {
+      pos++;
+    }
+    String v = s.substring(pos);
+    v.trim();
+    char *out = s_tags_pending.fields[k.field];
+    if (v.length() == 0 || same_str(out, v.c_str())) {
+      return;
+    }
+    snprintf(out, kTagLen, "%s", v.c_str());
+    s_stream_tags.store(s_tags_pending);
+    // Published after the tags, so a UI that sees the new version finds
+    // them already stored.
+    s_state->meta_version++;
+    s_snapshot_dirty = true;
+    return;
+  }
+}
+
+static void publish_snapshot() {
+  PlayerSnapshot snap;
+  snap.cmd_seq = s_cmd_applied;
+  snap.current_index = s_state->current_index;
+  snap.is_playing = s_state->is_playing;
+  snap.paused = s_state->paused;
+  snap.cover_ready = s_state->cover_ready;
+  snap.cover_version = s_state->cover_version;
+  snap.meta_version = s_state->meta_version;
+  snap.cover_track_index = s_state->cover_track_index;
+  snap.cover_pos = s_state->cover_pos;
+  snap.cover_len = s_state->cover_len;
+  snap.cover_format = s_state->cover_format;
+  snap.duration = s_audio.getAudioFileDuration();
+
+  // Audio::getAudioCurrentTime() counts decoded data; subtract what is still
+  // waiting in the ring so the progress bar follows what is audible.
+  uint32_t time = s_audio.getAudioCurrentTime();
+  const uint32_t sr = s_audio.getSampleRate();
+  if (sr > 0) {
+    const uint32_t queued = (s_ring.available() + sr / 2) / sr;
+    time = (time > queued) ? time - queued : 0;
+  }
+  snap.current_time = time;
+  s_snapshot.store(snap);
+}
+
+static void apply_command(const Command &cmd) {
+  switch (cmd.kind) {
+  case CommandKind::Play:
+    start_track(cmd.value, true);
+    break;
+  case CommandKind::SetPaused:
+    if (s_state->is_playing) {
+      s_state->paused = (cmd.value != 0);
+      s_output_paused.store(s_state->paused, std::memory_order_release);
+    }
+    break;
+  case CommandKind::Next:
+    pick_next(true, true);
+    break;
+  case CommandKind::Prev:
+    pick_next(false, true);
+    break;
+  case CommandKind::Stop:
+    s_audio.stopSong();
+    flush_output();
+    s_state->is_playing = false;
+    s_state->paused = false;
+    s_output_paused.store(false, std::memory_order_release);
+    break;
+  case CommandKind::Release:
+    s_released_index = cmd.value;
+    cancel_preroll();
+    if (s_state->is_playing && s_state->current_index == cmd.value) {
+      s_audio.stopSong();
+      flush_output();
+      s_state->is_playing = false;
+      s_state->paused = false;
+      s_output_paused.store(false, std::memory_order_release);
+    }
+    break;
+  case CommandKind::SetVolume:
+    s_state->volume = static_cast<uint8_t>(cmd.value);
+    s_audio.setVolume(s_state->volume);
+    break;
+  case CommandKind::SetMode:
+    s_state->mode = static_cast<PlaybackMode>(cmd.value);
+    cancel_preroll();
+    break;
+  case CommandKind::Seek:
+    if (s_state->is_playing) {
+      s_audio.setAudioPlayPosition(static_cast<uint16_t>(cmd.value));
+      flush_output();
+    }
+    break;
+  case CommandKind::Reindex:
+    s_released_index = -1;
+    cancel_preroll();
+    if (s_state->cover_track_index == s_state->current_index) {
+      s_state->cover_track_index = cmd.value;
+    }
+    s_state->current_index = cmd.value;
+    if (cmd.value < 0 && s_state->is_playing) {
+      s_audio.stopSong();
+      flush_output();
+      s_state->is_playing = false;
+      s_state->paused = false;
+      s_output_paused.store(false, std::memory_order_release);
+    }
+    break;
+  }
+  s_cmd_applied = cmd.seq;
+  s_snapshot_dirty = true;
+}
+
+static void decode_task(void *arg) {
+  (void)arg;
+  uint32_t last_publish = 0;
+  for (;;) {
+    Command cmd;
+    while (s_commands.pop(cmd)) {
+      apply_command(cmd);
+    }
+
+    // Only decode when a whole Audio::loop() worth of output fits, so the
+    // PCM hook never has to wait and commands are picked up promptly.
+    const bool decode = s_state->is_playing && !s_state->paused &&
+                        s_ring.free_space() >= kDecodeHeadroomFrames;
+    if (decode) {
+      s_audio.loop();
+      preroll_next();
+    }
+
+    const uint32_t now = millis();
+    if (s_snapshot_dirty ||
+        static_cast<uint32_t>(now - last_publish) >= kSnapshotPeriodMs) {
+      publish_snapshot();
+      s_snapshot_dirty = false;
+      last_publish = now;
+    }
+    vTaskDelay(decode ? 1 : pdMS_TO_TICKS(5));
+  }
+}
+
+// Called by the I2S task for every ring read while a track change is
+// armed; logs the gap once output reaches the next track.
+static void measure_gap(uint32_t frames_read, uint32_t &dry_since,
+                        uint32_t &dry_us) {
+  const uint32_t now = micros();
+  if (frames_read == 0) {
+    if (dry_since == 0) {
+      dry_since = now | 1;
+    }
+    return;
+  }
+  if (dry_since != 0) {
+    dry_us += now - dry_since;
+    dry_since = 0;
+  }
+  if (!s_gap_marked.load(std::memory_order_acquire) ||
+      static_cast<int32_t>(s_ring.read_pos() -
+                           s_gap_start_pos.load(std::memory_order_relaxed)) <
+          0) {
+    return;
+  }
+  const uint32_t rate = s_audio.getSampleRate();
+  const uint32_t underrun =
+      static_cast<uint32_t>(static_cast<uint64_t>(dry_us) * rate / 1000000);
+  const uint32_t silence = s_gap_silence.load(std::memory_order_relaxed);
+  Serial.printf("[GAP] %u frames (silence %u, underrun %u), trimmed %u\n",
+                static_cast<unsigned>(silence + underrun),
+                static_cast<unsigned>(silence),
+                static_cast<unsigned>(underrun),
+                static_cast<unsigned>(s_audio.getTrimmedFrames()));
+  s_gap_marked.store(false, std::memory_order_relaxed);
+  s_gap_armed.store(false, std::memory_order_release);
+  dry_us = 0;
+}
+
+// Called by the I2S task after each write once a start is marked.
+static void measure_start() {
+  if (static_cast<int32_t>(s_ring.read_pos() -
+                           s_start_pos.load(std::memory_order_relaxed)) <=
+      0) {
     return;
   }
+  Serial.printf("[I2S] start latency %lu us (%s)\n",
+                static_cast<unsigned long>(
+                    micros() - s_start_us.load(std::memory_order_relaxed)),
+                s_start_fast.load(std::memory_order_relaxed) ? "fast start"
+                                                             : "header walk");
+  s_start_marked.store(false, std::memory_order_relaxed);
+}
 
-  auto assignKV = [&](const char *key, const char *&out) {
-    int n = strlen(key);
-    if (s.startsWith(key)) {
-      int pos = n;
-      if (pos < s.length() && (s[pos] == ':' || s[pos] == '=')) {
-        pos++;
+static void i2s_task(void *arg) {
+  (void)arg;
+  static uint32_t block[kI2SWriteFrames];
+  bool zeroed = false;
+  uint32_t dry_since = 0;
+  uint32_t dry_us = 0;
+  uint32_t rate_seen = 0;
+  for (;;) {
+    if (s_flush_pending.exchange(false, std::memory_order_acquire)) {
+      s_ring.discard_until(s_flush_pos.load(std::memory_order_relaxed));
+      i2s_zero_dma_buffer(static_cast<i2s_port_t>(s_audio.getI2sPort()));
+    }
+    if (s_output_paused.load(std::memory_order_acquire)) {
+      if (!zeroed) {
+        i2s_zero_dma_buffer(static_cast<i2s_port_t>(s_audio.getI2sPort()));
+        zeroed = true;
       }
-      String v = s.substring(pos);
-      v.trim();
-      if (v.length() > 0 && !same_str(out, v.c_str())) {
-        out = s_library->pool.store(v);
-        return true;
+      ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(10));
+      continue;
+    }
+    zeroed = false;
+
+    uint32_t want = kI2SWriteFrames;
+    const uint32_t rate_version = s_rate_change.version();
+    if (rate_version != rate_seen) {
+      const RateChange change = s_rate_change.load();
+      const int32_t ahead =
+          static_cast<int32_t>(change.pos - s_ring.read_pos());
+      if (ahead <= 0) {
+        s_audio.applySampleRate(change.rate);
+        rate_seen = rate_version;
+      } else if (static_cast<uint32_t>(ahead) < want) {
+        want = static_cast<uint32_t>(ahead);
       }
     }
-    return false;
-  };
 
-  TrackInfo &track = s_library->tracks[s_state->current_index];
-  bool changed = false;
-  if (!assignKV("Title", track.title)) {
-    changed |= assignKV("TIT2", track.title);
-  } else {
-    changed = true;
+    const uint32_t n = s_ring.read(block, want);
+    if (s_gap_armed.load(std::memory_order_acquire)) {
+      measure_gap(n, dry_since, dry_us);
+    } else {
+      dry_since = 0;
+      dry_us = 0;
+    }
+    if (n == 0) {
+      ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(10));
+      continue;
+    }
+    s_audio.writeI2SBlock(block, static_cast<uint16_t>(n));
+    if (s_start_marked.load(std::memory_order_acquire)) {
+      measure_start();
+    }
   }
-  if (!assignKV("Artist", track.artist)) {
-    changed |= assignKV("TPE1", track.artist);
-  } else {
-    changed = true;
+}
+
+static void queue_pcm(uint32_t *frames, uint16_t count, bool *continueI2S) {
+  if (!s_i2s_task) {
+    // No ring (allocation failed), let Audio write to the DMA itself.
+    *continueI2S = true;
+    return;
   }
-  if (!assignKV("Album", track.album)) {
-    changed |= assignKV("TALB", track.album);
-  } else {
-    changed = true;
+  *continueI2S = false;
+  while (count > 0) {
+    const uint32_t written = s_ring.write(frames, count);
+    frames += written;
+    count -= written;
+    xTaskNotifyGive(s_i2s_task);
+    if (count > 0) {
+      vTaskDelay(1);
+    }
   }
-  if (!assignKV("Genre", track.genre)) {
-    changed |= assignKV("TCON", track.genre);
-  } else {
-    changed = true;
+}
+
+static void queue_sample_rate(uint32_t rate) {
+  RateChange change;
+  change.pos = s_ring.write_pos();
+  change.rate = rate;
+  s_rate_change.store(change);
+  if (s_i2s_task) {
+    xTaskNotifyGive(s_i2s_task);
   }
-  if (!assignKV("Composer", track.composer)) {
-    changed |= assignKV("TCOM", track.composer);
-  } else {
-    changed = true;
+}
+
+static void send_command(CommandKind kind, int32_t value = 0) {
+  Command cmd;
+  cmd.kind = kind;
+  cmd.value = value;
+  cmd.seq = ++s_cmd_sent;
+  while (!s_commands.push(cmd)) {
+    vTaskDelay(1);
   }
+}
 
-  if (changed) {
-    s_state->meta_version++;
+// UI task: retags the playing track with what its stream reported, when
+// that differs from the catalogue.
+static void apply_stream_tags() {
+  const uint32_t version = s_stream_tags.version();
+  if (version == s_tags_seen) {
+    return;
+  }
+  const StreamTags tags = s_stream_tags.load();
+  s_tags_seen = version;
+  Library &lib = *s_library;
+  if (!library_track_live(lib, tags.index) ||
+      library_path_hash(lib.tracks[tags.index].path) != tags.path_hash) {
+    return;
+  }
+
+  const TrackInfo &track = lib.tracks[tags.index];
+  TrackTags next;
+  String *out[kTagFields] = {&next.title, &next.artist, &next.album,
+                             &next.genre, &next.composer};
+  const char *cur[kTagFields] = {track.title, track.artist, track.album,
+                                 track.genre, track.composer};
+  bool changed = false;
+  for (int i = 0; i < kTagFields; ++i) {
+    const bool refined = tags.fields[i][0] && !same_str(cur[i], tags.fields[i]);
+    *out[i] = refined ? tags.fields[i] : cur[i];
+    changed |= refined;
+  }
+  if (!changed) {
+    return;
+  }
+  next.cover_pos = track.cover_pos;
+  next.cover_len = track.cover_len;
+  next.cover_format = track.cover_format;
+  next.duration_sec = track.duration_sec;
+  next.start = track.start;
+  const String path = track.path;
+  const uint32_t file_size = track.file_size;
+  const uint32_t mtime = track.added_time;
+
+  xSemaphoreTake(s_library_lock, portMAX_DELAY);
+  library_retag_track(lib, tags.index, path, file_size, mtime, next);
+  xSemaphoreGive(s_library_lock);
+}
+
+// UI task: applies the plays the decode task queued.
+static void count_plays() {
+  int index = 0;
+  while (s_played.pop(index)) {
+    if (!library_track_live(*s_library, index)) {
+      continue;
+    }
+    library_mark_played(*s_library, index, stats::now_sec());
+    stats::record(s_library->tracks[index]);
   }
 }
 } // namespace
@@ -251,7 +799,36 @@ static void handle_eof() {
   if (!s_state) {
     return;
   }
-  pick_next(true);
+  s_gap_marked.store(false, std::memory_order_relaxed);
+  s_gap_armed.store(true, std::memory_order_release);
+  // Audio already runs the prerolled file when it is still running here.
+  String path;
+  Audio::StartInfo start{};
+  if (s_preroll_index >= 0 && s_audio.isRunning() &&
+      enter_track(s_preroll_index, path, start)) {
+    return;
+  }
+  pick_next(true, false);
+}
+
+// First decoded block of a track: a start latency or an end of file gap
+// ends where it enters the ring.
+static void mark_track_start(uint16_t frames) {
+  if (frames == 0) {
+    return;
+  }
+  if (s_start_armed.exchange(false, std::memory_order_acquire)) {
+    s_start_pos.store(s_ring.write_pos(), std::memory_order_relaxed);
+    s_start_marked.store(true, std::memory_order_release);
+  }
+  if (!s_gap_armed.load(std::memory_order_acquire) ||
+      s_gap_marked.load(std::memory_order_relaxed)) {
+    return;
+  }
+  s_gap_start_pos.store(s_ring.write_pos(), std::memory_order_relaxed);
+  s_gap_silence.store(s_audio.getSilenceSinceEof(),
+                      std::memory_order_relaxed);
+  s_gap_marked.store(true, std::memory_order_release);
 }
 
 static void handle_id3_image(File &file, size_t pos, size_t size) {
@@ -291,13 +868,14 @@ static void handle_id3_image(File &file, size_t pos, size_t size) {
   s_state->cover_len = static_cast<uint32_t>(image_len);
   s_state->cover_track_index = s_state->current_index;
   s_state->cover_version++;
+  s_snapshot_dirty = true;
 
   file.seek(saved_pos);
 }
 
 void player_init(PlayerState &state, Library &lib) {
   s_library = &lib;
-  s_state = &state;
+  s_state = &s_task_state;
   state.cover_ready = false;
   state.cover_path = "";
   state.cover_version = 0;
@@ -306,6 +884,9 @@ void player_init(PlayerState &state, Library &lib) {
   state.cover_pos = 0;
   state.cover_len = 0;
   state.cover_format = CoverFormat::Unknown;
+  s_task_state.volume = state.volume;
+  s_task_state.mode = state.mode;
+  s_sent_mode = state.mode;
 
   uint8_t bclk = 0;
   uint8_t lrck = 0;
@@ -315,43 +896,99 @@ void player_init(PlayerState &state, Library &lib) {
   board.initAudio(bclk, lrck, dout, mclk);
   s_audio.setPinout(bclk, lrck, dout, I2S_PIN_NO_CHANGE, mclk);
   s_audio.setVolume(state.volume);
+  // Give the player its own decoder contexts (default pool) so another
+  // Audio instance, e.g. a background analysis, never shares its state.
+  s_audio.setDecoderPool(nullptr);
+  publish_snapshot();
+
+  s_library_lock = xSemaphoreCreateMutex();
+  if (s_ring.init(kPcmRingFrames)) {
+    xTaskCreatePinnedToCore(i2s_task, "i2s_out", kI2STaskStack, nullptr,
+                            kI2STaskPriority, &s_i2s_task, kAudioCore);
+  }
+  s_audio.setQueuedOutput(s_i2s_task != nullptr);
+  xTaskCreatePinnedToCore(decode_task, "decode", kDecodeTaskStack, nullptr,
+                          kDecodeTaskPriority, &s_decode_task, kAudioCore);
 }
 
 void player_loop(PlayerState &state) {
-  if (!state.is_playing || state.paused) {
+  count_plays();
+  if (state.mode != s_sent_mode) {
+    s_sent_mode = state.mode;
+    send_command(CommandKind::SetMode, static_cast<int32_t>(state.mode));
+  }
+
+  // While commands are in flight keep the UI's optimistic view; otherwise
+  // adopt what the decode task last published. Tags are applied after the
+  // load, so a new meta_version always comes with its tags in place.
+  const PlayerSnapshot snap = s_snapshot.load();
+  apply_stream_tags();
+  if (snap.cmd_seq != s_cmd_sent) {
     return;
   }
-  s_audio.loop();
+  state.current_index = snap.current_index;
+  state.is_playing = snap.is_playing;
+  state.paused = snap.paused;
+  state.cover_ready = snap.cover_ready;
+  state.cover_version = snap.cover_version;
+  state.meta_version = snap.meta_version;
+  state.cover_track_index = snap.cover_track_index;
+  state.cover_pos = snap.cover_pos;
+  state.cover_len = snap.cover_len;
+  state.cover_format = snap.cover_format;
 }
 
 void player_play(PlayerState &state, int track_index) {
-  (void)state;
-  start_track(track_index);
+  state.current_index = track_index;
+  state.is_playing = true;
+  state.paused = false;
+  send_command(CommandKind::Play, track_index);
 }
 
 void player_toggle_pause(PlayerState &state) {
   if (!state.is_playing) {
-    start_track(state.current_index >= 0 ? state.current_index : 0);
+    player_play(state, state.current_index >= 0 ? state.current_index : 0);
     return;
   }
   state.paused = !state.paused;
-  s_audio.pauseResume();
+  send_command(CommandKind::SetPaused, state.paused ? 1 : 0);
 }
 
 void player_next(PlayerState &state) {
   (void)state;
-  pick_next(true);
+  send_command(CommandKind::Next);
 }
 
 void player_prev(PlayerState &state) {
   (void)state;
-  pick_next(false);
+  send_command(CommandKind::Prev);
 }
 
 void player_stop(PlayerState &state) {
-  s_audio.stopSong();
   state.is_playing = false;
   state.paused = false;
+  send_command(CommandKind::Stop);
+}
+
+void player_seek(PlayerState &state, uint32_t sec) {
+  (void)state;
+  send_command(CommandKind::Seek, static_cast<int32_t>(sec));
+}
+
+void player_release_track(PlayerState &state, int track_index) {
+  if (state.current_index == track_index) {
+    state.is_playing = false;
+    state.paused = false;
+  }
+  send_command(CommandKind::Release, track_index);
+  if (!s_decode_task) {
+    return;
+  }
+  // The decode task publishes right after applying a command.
+  const uint32_t seq = s_cmd_sent;
+  while (static_cast<int32_t>(s_snapshot.load().cmd_seq - seq) < 0) {
+    vTaskDelay(1);
+  }
 }
 
 uint8_t player_get_volume(const PlayerState &state) { return state.volume; }
@@ -361,12 +998,35 @@ void player_set_volume(PlayerState &state, uint8_t volume) {
     volume = 21;
   }
   state.volume = volume;
-  s_audio.setVolume(volume);
+  send_command(CommandKind::SetVolume, volume);
+}
+
+void player_begin_library_update(PlayerState &state) {
+  (void)state;
+  xSemaphoreTake(s_library_lock, portMAX_DELAY);
+  // Queued indices still name the tracks they were taken for; the update
+  // may move them, and the decode task cannot queue more until it is done.
+  count_plays();
+}
+
+void player_end_library_update(PlayerState &state) {
+  (void)state;
+  xSemaphoreGive(s_library_lock);
 }
 
-uint32_t player_current_time() { return s_audio.getAudioCurrentTime(); }
+void player_end_library_update(PlayerState &state, int current_index) {
+  xSemaphoreGive(s_library_lock);
+  state.current_index = current_index;
+  if (current_index < 0) {
+    state.is_playing = false;
+    state.paused = false;
+  }
+  send_command(CommandKind::Reindex, current_index);
+}
+
+uint32_t player_current_time() { return s_snapshot.load().current_time; }
 
-uint32_t player_duration() { return s_audio.getAudioFileDuration(); }
+uint32_t player_duration() { return s_snapshot.load().duration; }
 
 uint32_t player_sample_rate() { return s_audio.getSampleRate(); }
 
@@ -378,6 +1038,10 @@ uint8_t player_bits_per_sample() { return s_audio.getBitsPerSample(); }
 
 void audio_info(const char *info) { (void)info; }
 
+void audio_file_io_begin() { spibus::acquire(spibus::Client::Audio); }
+
+void audio_file_io_end() { spibus::release(spibus::Client::Audio); }
+
 void audio_id3data(const char *info) { app::handle_id3(info); }
 
 void audio_id3image(File &file, const size_t pos, const size_t size) {
@@ -388,3 +1052,16 @@ void audio_eof_mp3(const char *info) {
   (void)info;
   app::handle_eof();
 }
+
+void audio_process_extern(int16_t *buff, uint16_t len, bool *continueI2S) {
+  (void)buff;
+  app::mark_track_start(len);
+  *continueI2S = true;
+}
+
+void audio_process_i2s_block(uint32_t *samples, uint16_t frames,
+                             bool *continueI2S) {
+  app::queue_pcm(samples, frames, continueI2S);
+}
+
+void audio_sample_rate(uint32_t rate) { app::queue_sample_rate(rate); }
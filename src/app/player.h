@@ -37,6 +37,18 @@ void player_prev(PlayerState &state);
 void player_stop(PlayerState &state);
 uint8_t player_get_volume(const PlayerState &state);
 void player_set_volume(PlayerState &state, uint8_t volume);
+void player_seek(PlayerState &state, uint32_t sec);
+// Stops track_index if it is playing and drops any preroll, then waits for
+// the audio task to close their files, so the track can be deleted. The
+// track is not opened again until the next library update.
+void player_release_track(PlayerState &state, int track_index);
+
+// Bracket any change to the Library while playback is running. The audio task
+// stays off the track table in between. If tracks moved, pass the playing
+// track's new position, or -1 if it disappeared.
+void player_begin_library_update(PlayerState &state);
+void player_end_library_update(PlayerState &state);
+void player_end_library_update(PlayerState &state, int current_index);
 
 uint32_t player_current_time();
 uint32_t player_duration();
@@ -0,0 +1,199 @@
+#include "board/spi_bus.h"
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <freertos/task.h>
+#include <string.h>
+
+namespace spibus {
+namespace {
+constexpr int kClients = static_cast<int>(Client::Count);
+constexpr const char *kClientNames[kClients] = {"audio", "cover", "ui"};
+// Upper bounds of the wait histogram buckets; the last bucket is open.
+constexpr uint32_t kBucketUs[] = {50, 200, 500, 1000, 2000, 5000, 10000};
+constexpr int kBuckets = sizeof(kBucketUs) / sizeof(kBucketUs[0]) + 1;
+
+struct WaitStats {
+  uint32_t count;
+  uint32_t max_us;
+  uint64_t total_us;
+  uint32_t buckets[kBuckets];
+};
+
+portMUX_TYPE s_mux = portMUX_INITIALIZER_UNLOCKED;
+bool s_ready = false;
+// busy stays set while the bus is handed from release() to a woken waiter,
+// so nobody can slip in between.
+bool s_busy = false;
+TaskHandle_t s_owner = nullptr;
+uint32_t s_depth = 0;
+uint16_t s_waiting[kClients] = {};
+SemaphoreHandle_t s_wake[kClients] = {};
+WaitStats s_stats[kClients] = {};
+uint32_t s_stats_ms = 0;
+
+int index_of(Client client) {
+  const int c = static_cast<int>(client);
+  return (c >= 0 && c < kClients) ? c : kClients - 1;
+}
+
+void record_wait(int c, uint32_t wait_us) {
+  WaitStats &st = s_stats[c];
+  int b = 0;
+  while (b < kBuckets - 1 && wait_us > kBucketUs[b]) {
+    ++b;
+  }
+  st.buckets[b]++;
+  st.count++;
+  st.total_us += wait_us;
+  if (wait_us > st.max_us) {
+    st.max_us = wait_us;
+  }
+}
+} // namespace
+
+void init() {
+  if (s_ready) {
+    return;
+  }
+  for (int c = 0; c < kClients; ++c) {
+    s_wake[c] = xSemaphoreCreateCounting(16, 0);
+  }
+  s_ready = true;
+}
+
+void acquire(Client client) {
+  if (!s_ready) {
+    return;
+  }
+  const int c = index_of(client);
+  TaskHandle_t self = xTaskGetCurrentTaskHandle();
+  const uint32_t start = micros();
+  bool wait = false;
+  portENTER_CRITICAL(&s_mux);
+  if (s_busy && s_owner == self) {
+    s_depth++;
+    portEXIT_CRITICAL(&s_mux);
+    return;
+  }
+  if (!s_busy) {
+    s_busy = true;
+    s_owner = self;
+    s_depth = 1;
+  } else {
+    s_waiting[c]++;
+    wait = true;
+  }
+  portEXIT_CRITICAL(&s_mux);
+
+  if (wait) {
+    xSemaphoreTake(s_wake[c], portMAX_DELAY);
+    portENTER_CRITICAL(&s_mux);
+    s_owner = self;
+    s_depth = 1;
+    portEXIT_CRITICAL(&s_mux);
+  }
+  // Stats are only touched by the bus owner.
+  record_wait(c, micros() - start);
+}
+
+void release(Client client) {
+  (void)client;
+  if (!s_ready) {
+    return;
+  }
+  int next = -1;
+  portENTER_CRITICAL(&s_mux);
+  if (--s_depth > 0) {
+    portEXIT_CRITICAL(&s_mux);
+    return;
+  }
+  s_owner = nullptr;
+  for (int c = 0; c < kClients; ++c) {
+    if (s_waiting[c] > 0) {
+      s_waiting[c]--;
+      next = c;
+      break;
+    }
+  }
+  if (next < 0) {
+    s_busy = false;
+  }
+  portEXIT_CRITICAL(&s_mux);
+  if (next >= 0) {
+    xSemaphoreGive(s_wake[next]);
+  }
+}
+
+size_t read(File &file, uint8_t *buf, size_t len, Client client) {
+  size_t done = 0;
+  while (done < len) {
+    size_t chunk = len - done;
+    if (chunk > kFileSliceBytes) {
+      chunk = kFileSliceBytes;
+    }
+    size_t rd;
+    {
+      Guard guard(client);
+      rd = file.read(buf + done, chunk);
+    }
+    done += rd;
+    if (rd < chunk) {
+      break;
+    }
+  }
+  return done;
+}
+
+size_t write(File &file, const uint8_t *buf, size_t len, Client client) {
+  size_t done = 0;
+  while (done < len) {
+    size_t chunk = len - done;
+    if (chunk > kFileSliceBytes) {
+      chunk = kFileSliceBytes;
+    }
+    size_t wr;
+    {
+      Guard guard(client);
+      wr = file.write(buf + done, chunk);
+    }
+    done += wr;
+    if (wr < chunk) {
+      break;
+    }
+  }
+  return done;
+}
+
+void log_stats(uint32_t now_ms, uint32_t period_ms) {
+  if (!s_ready || now_ms - s_stats_ms < period_ms) {
+    return;
+  }
+  s_stats_ms = now_ms;
+  WaitStats snap[kClients];
+  // Taken under the bus so no owner is mid-update.
+  acquire(Client::Ui);
+  memcpy(snap, s_stats, sizeof(snap));
+  memset(s_stats, 0, sizeof(s_stats));
+  release(Client::Ui);
+
+  for (int c = 0; c < kClients; ++c) {
+    const WaitStats &st = snap[c];
+    if (st.count == 0) {
+      continue;
+    }
+    char hist[96];
+    size_t used = 0;
+    for (int b = 0; b < kBuckets && used < sizeof(hist); ++b) {
+      used += snprintf(hist + used, sizeof(hist) - used, b ? " %lu" : "%lu",
+                       static_cast<unsigned long>(st.buckets[b]));
+    }
+    Serial.printf("[BUS] %s: %lu waits, avg %lu us, max %lu us, "
+                  "hist(<=50/200/500/1k/2k/5k/10k/more us) %s\n",
+                  kClientNames[c], static_cast<unsigned long>(st.count),
+                  static_cast<unsigned long>(st.total_us / st.count),
+                  static_cast<unsigned long>(st.max_us), hist);
+  }
+}
+
+} // namespace spibus
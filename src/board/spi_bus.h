@@ -0,0 +1,49 @@
+#pragma once
+
+#include <Arduino.h>
+#include <FS.h>
+
+// Priority arbitration for the SPI host the SD card shares with the panel.
+// Clients hold the bus for one bounded transaction at a time; on release it
+// goes to the highest-priority waiter, so an audio refill never waits longer
+// than one slice of a lower-priority transfer. Nesting on one task is fine.
+namespace spibus {
+
+enum class Client : uint8_t {
+  Audio = 0, // decoder refills
+  Cover,     // cover art reads and the cover cache
+  Ui,        // panel transfers and LVGL file reads
+  Count,
+};
+
+// Longest single hold for panel pixels (~1.6 ms at 40 MHz) and for file
+// reads and writes done through read()/write() below.
+constexpr size_t kDisplaySliceBytes = 8 * 1024;
+constexpr size_t kFileSliceBytes = 4 * 1024;
+
+// Until init() runs (early board bring-up, single task) acquire() and
+// release() do nothing.
+void init();
+void acquire(Client client);
+void release(Client client);
+
+class Guard {
+public:
+  explicit Guard(Client client) : client_(client) { acquire(client_); }
+  ~Guard() { release(client_); }
+  Guard(const Guard &) = delete;
+  Guard &operator=(const Guard &) = delete;
+
+private:
+  Client client_;
+};
+
+// File I/O split into kFileSliceBytes pieces, each under the bus.
+size_t read(File &file, uint8_t *buf, size_t len, Client client);
+size_t write(File &file, const uint8_t *buf, size_t len, Client client);
+
+// Prints each client's wait-time histogram and clears it, at most once per
+// period_ms.
+void log_stats(uint32_t now_ms, uint32_t period_ms = 10000);
+
+} // namespace spibus
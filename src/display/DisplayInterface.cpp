@@ -1,4 +1,5 @@
 #include "display/DisplayInterface.h"
+#include "board/spi_bus.h"
 #include <Arduino.h>
 #include <vector>
 
@@ -6,21 +7,22 @@
 #define DISP_CMD_CASET (0x2A)
 #define DISP_CMD_RASET (0x2B)
 #define DISP_CMD_RAMWR (0x2C)
+#define DISP_CMD_RAMWRC (0x3C)
 #define DISP_CMD_SLPIN (0x10)
 #define DISP_CMD_SLPOUT (0x11)
 
 bool LilyGoDispArduinoSPI::lock(TickType_t xTicksToWait) {
-  return xSemaphoreTake(_lock, xTicksToWait) == pdTRUE;
+  return xSemaphoreTakeRecursive(_lock, xTicksToWait) == pdTRUE;
 }
 
-void LilyGoDispArduinoSPI::unlock() { xSemaphoreGive(_lock); }
+void LilyGoDispArduinoSPI::unlock() { xSemaphoreGiveRecursive(_lock); }
 
 void LilyGoDispArduinoSPI::setBrightness(uint8_t level) { _brightness = level; }
 
 bool LilyGoDispArduinoSPI::init(int sck, int miso, int mosi, int cs, int rst,
                                 int dc, int backlight, uint32_t freq_Mhz,
                                 SPIClass &spi) {
-  _lock = xSemaphoreCreateMutex();
+  _lock = xSemaphoreCreateRecursiveMutex();
   _spi = &spi;
 
   if (rst != -1) {
@@ -63,7 +65,7 @@ bool LilyGoDispArduinoSPI::init(int sck, int miso, int mosi, int cs, int rst,
 
   std::vector<uint16_t> draw_buf(_width * _height * 2, 0x0000);
   pushColors(0, 0, _width, _height, draw_buf.data());
-  xSemaphoreGive(_lock);
+  xSemaphoreGiveRecursive(_lock);
   return true;
 }
 
@@ -83,21 +85,45 @@ void LilyGoDispArduinoSPI::setRotation(uint8_t rotation) {
   _offset_y = _rotation_configs[_rotation].offset_y;
 }
 
+// Pixels go out in bus slices so SD reads can run in between; each slice
+// after the first resumes the memory write where the last one stopped.
 void LilyGoDispArduinoSPI::pushColors(uint16_t *data, uint32_t len) {
-  xSemaphoreTake(_lock, portMAX_DELAY);
-  digitalWrite(_cs, LOW);
-  _spi->beginTransaction(SPISettings(_spi_freq, MSBFIRST, SPI_MODE0));
-  digitalWrite(_dc, HIGH);
-  _spi->writeBytes((const uint8_t *)data, len * sizeof(uint16_t));
-  _spi->endTransaction();
-  digitalWrite(_cs, HIGH);
-  xSemaphoreGive(_lock);
+  const uint8_t *bytes = (const uint8_t *)data;
+  size_t remaining = len * sizeof(uint16_t);
+  bool resume = false;
+  xSemaphoreTakeRecursive(_lock, portMAX_DELAY);
+  while (remaining > 0) {
+    const size_t chunk = remaining < spibus::kDisplaySliceBytes
+                             ? remaining
+                             : spibus::kDisplaySliceBytes;
+    spibus::Guard bus(spibus::Client::Ui);
+    if (resume) {
+      writeCommand(DISP_CMD_RAMWRC);
+    }
+    _spi->beginTransaction(SPISettings(_spi_freq, MSBFIRST, SPI_MODE0));
+    digitalWrite(_cs, LOW);
+    digitalWrite(_dc, HIGH);
+    _spi->writeBytes(bytes, chunk);
+    digitalWrite(_cs, HIGH);
+    _spi->endTransaction();
+    bytes += chunk;
+    remaining -= chunk;
+    resume = true;
+  }
+  xSemaphoreGiveRecursive(_lock);
 }
 
 void LilyGoDispArduinoSPI::pushColors(uint16_t x1, uint16_t y1, uint16_t x2,
                                       uint16_t y2, uint16_t *color) {
-  setAddrWindow(x1, y1, x1 + x2 - 1, y1 + y2 - 1);
+  // Held across window and pixels so a command from another task (sleep,
+  // rotation) cannot land in between.
+  xSemaphoreTakeRecursive(_lock, portMAX_DELAY);
+  {
+    spibus::Guard bus(spibus::Client::Ui);
+    setAddrWindow(x1, y1, x1 + x2 - 1, y1 + y2 - 1);
+  }
   pushColors(color, x2 * y2);
+  xSemaphoreGiveRecursive(_lock);
 }
 
 void LilyGoDispArduinoSPI::sleep() { writeCommand(DISP_CMD_SLPIN); }
@@ -125,26 +151,28 @@ void LilyGoDispArduinoSPI::setAddrWindow(uint16_t xs, uint16_t ys, uint16_t xe,
 }
 
 void LilyGoDispArduinoSPI::writeCommand(uint8_t cmd) {
-  xSemaphoreTake(_lock, portMAX_DELAY);
-  digitalWrite(_cs, LOW);
+  xSemaphoreTakeRecursive(_lock, portMAX_DELAY);
+  spibus::Guard bus(spibus::Client::Ui);
   _spi->beginTransaction(SPISettings(_spi_freq, MSBFIRST, SPI_MODE0));
+  digitalWrite(_cs, LOW);
   digitalWrite(_dc, LOW);
   _spi->write(cmd);
   digitalWrite(_dc, HIGH);
-  _spi->endTransaction();
   digitalWrite(_cs, HIGH);
-  xSemaphoreGive(_lock);
+  _spi->endTransaction();
+  xSemaphoreGiveRecursive(_lock);
 }
 
 void LilyGoDispArduinoSPI::writeData(uint8_t data) {
-  xSemaphoreTake(_lock, portMAX_DELAY);
-  digitalWrite(_cs, LOW);
+  xSemaphoreTakeRecursive(_lock, portMAX_DELAY);
+  spibus::Guard bus(spibus::Client::Ui);
   _spi->beginTransaction(SPISettings(_spi_freq, MSBFIRST, SPI_MODE0));
+  digitalWrite(_cs, LOW);
   digitalWrite(_dc, HIGH);
   _spi->write(data);
-  _spi->endTransaction();
   digitalWrite(_cs, HIGH);
-  xSemaphoreGive(_lock);
+  _spi->endTransaction();
+  xSemaphoreGiveRecursive(_lock);
 }
 
 void LilyGoDispArduinoSPI::writeParams(uint8_t cmd, uint8_t *data,
@@ -3,8 +3,12 @@
 
 #include "app/eq_dsp.h"
 #include "app/library.h"
+#include "app/library_index.h"
+#include "app/library_scanner.h"
+#include "app/play_stats.h"
 #include "app/player.h"
 #include "board/BoardBase.h"
+#include "board/spi_bus.h"
 #include "ui/LV_Helper.h"
 #include "ui/assets/assets.h"
 #include "ui/fonts/fonts.h"
@@ -13,8 +17,11 @@
 namespace {
 app::Library s_library{};
 app::PlayerState s_player{};
+app::LibraryScanner s_scanner;
+constexpr uint32_t kScanStepBudgetMs = 4;
 lv_obj_t *s_boot_root = nullptr;
 lv_obj_t *s_boot_label = nullptr;
+int s_eq_track = -1;
 
 void boot_tick() {
   lvHelperTick();
@@ -44,6 +51,32 @@ void show_boot_screen() {
   boot_tick();
 }
 
+void apply_scan_changes() {
+  app::player_begin_library_update(s_player);
+  if (!s_scanner.apply()) {
+    app::player_end_library_update(s_player);
+    return;
+  }
+  int current = s_player.current_index;
+  if (current >= 0 && current < s_scanner.remap_count()) {
+    current = s_scanner.remap()[current];
+  }
+  app::player_end_library_update(s_player, current);
+  lofi::ui::remap_tracks(s_scanner.remap(), s_scanner.remap_count());
+}
+
+// Lets the automatic EQ preset follow the genre of the playing track.
+void follow_track_genre() {
+  int current = s_player.current_index;
+  if (current == s_eq_track) {
+    return;
+  }
+  s_eq_track = current;
+  if (current >= 0 && current < s_library.track_count) {
+    app::eq::set_track_genre(s_library.tracks[current].genre);
+  }
+}
+
 void hide_boot_screen() {
   if (s_boot_root) {
     lv_obj_del(s_boot_root);
@@ -57,6 +90,7 @@ void setup() {
   Serial.begin(115200);
   delay(50);
 
+  spibus::init();
   board.begin();
   beginLvglHelper();
   randomSeed(micros());
@@ -66,8 +100,8 @@ void setup() {
   app::eq::load_settings();
   show_boot_screen();
   const uint32_t boot_start = millis();
-  app::library_scan(s_library, SD, "/music", 8, app::kMaxTracks, true,
-                    boot_tick);
+  app::stats::load(SD);
+  app::library_load_index(s_library, SD, app::kLibraryIndexPath);
   uint32_t elapsed = millis() - boot_start;
   while (elapsed < 3000) {
     boot_tick();
@@ -77,14 +111,21 @@ void setup() {
 
   app::player_init(s_player, s_library);
   lofi::ui::init(&s_library, &s_player);
+  s_scanner.start(s_library, SD, "/music", 8);
 }
 
 void loop() {
   board.handlePowerButton();
   app::player_loop(s_player);
+  if (s_scanner.step(kScanStepBudgetMs)) {
+    apply_scan_changes();
+  }
+  follow_track_genre();
   app::eq::tick();
+  app::stats::tick();
   lofi::ui::tick();
   lvHelperTick();
   lv_timer_handler();
+  spibus::log_stats(millis());
   delay(2);
 }
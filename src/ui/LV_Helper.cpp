@@ -3,11 +3,14 @@
 #include <Arduino.h>
 #include <Preferences.h>
 #include <SD.h>
+#include <atomic>
+#include <esp_heap_caps.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include "app/input_keys.h"
 #include "board/BoardBase.h"
+#include "board/spi_bus.h"
 #include "ui/lofibox/lofibox_ui.h"
 
 extern bool ui_take_screenshot_to_sd();
@@ -24,10 +27,15 @@ namespace {
 static lv_display_t *s_display = nullptr;
 static lv_color_t *s_buf1 = nullptr;
 static lv_color_t *s_buf2 = nullptr;
-static lv_color_t *s_framebuffer = nullptr;
-static uint16_t s_fb_width = 0;
-static uint16_t s_fb_height = 0;
-static bool s_fb_ready = false;
+// One area is in flight at a time: LVGL waits for flush_ready before it
+// hands over the other buffer, so a single job slot is enough.
+struct FlushJob {
+  lv_display_t *disp;
+  int32_t x, y, w, h;
+  uint16_t *pixels;
+};
+static FlushJob s_flush_job{};
+static TaskHandle_t s_flush_task = nullptr;
 static lv_indev_t *s_indev_keyboard = nullptr;
 static bool s_key_pending = false;
 static uint32_t s_last_key = 0;
@@ -41,7 +49,26 @@ static uint32_t s_sleep_timeout_ms = 0;
 static bool s_settings_loaded = false;
 static bool s_sleep_requested = false;
 
+// Frame timing, logged every kFrameStatsPeriodMs. wire_us is spent pushing
+// pixels on the flush task; wait_us is how long LVGL blocked on it. The
+// difference is transfer time hidden behind rendering.
+struct FrameStats {
+  uint32_t frames = 0;
+  uint32_t frame_us = 0;
+  uint32_t wait_us = 0;
+  std::atomic<uint32_t> flushes{0};
+  std::atomic<uint32_t> wire_us{0};
+};
+static FrameStats s_frame_stats;
+static uint32_t s_refr_start_us = 0;
+static uint32_t s_wait_start_us = 0;
+static uint32_t s_frame_stats_ms = 0;
+
 constexpr uint32_t kMinTimeoutMs = 1000;
+constexpr uint32_t kFlushTaskStack = 3 * 1024;
+constexpr UBaseType_t kFlushTaskPriority = 2;
+constexpr BaseType_t kFlushCore = 0;
+constexpr uint32_t kFrameStatsPeriodMs = 10000;
 constexpr char kPrefsNamespace[] = "ui";
 constexpr char kPrefsKeyBacklight[] = "bl_ms";
 
@@ -161,33 +188,90 @@ void toggle_screen_power() {
   }
 }
 
+static void push_area(const FlushJob &job) {
+  const uint32_t start = micros();
+  board.displayPushColors(job.x, job.y, job.w, job.h, job.pixels);
+  s_frame_stats.wire_us += micros() - start;
+  s_frame_stats.flushes++;
+}
+
+static void flush_task(void *arg) {
+  (void)arg;
+  for (;;) {
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    push_area(s_flush_job);
+    lv_display_flush_ready(s_flush_job.disp);
+  }
+}
+
 static void disp_flush(lv_display_t *disp_drv, const lv_area_t *area,
                        uint8_t *color_p) {
-  (void)disp_drv;
   int32_t w = area->x2 - area->x1 + 1;
   int32_t h = area->y2 - area->y1 + 1;
 
-  if (s_framebuffer && w > 0 && h > 0) {
-    const uint8_t *src = color_p;
-    const int32_t row_bytes = w * static_cast<int32_t>(sizeof(lv_color_t));
-    for (int32_t y = 0; y < h; ++y) {
-      uint16_t *dst = reinterpret_cast<uint16_t *>(s_framebuffer) +
-                      (area->y1 + y) * s_fb_width + area->x1;
-      memcpy(dst, src, row_bytes);
-      src += row_bytes;
-    }
-    s_fb_ready = true;
-  }
-
 #if defined(BOARD_TLORA_PAGER)
   lv_draw_sw_rgb565_swap(color_p, w * h);
 #endif
 
-  board.displayPushColors(area->x1, area->y1, w, h,
-                          reinterpret_cast<uint16_t *>(color_p));
+  s_flush_job = {disp_drv, area->x1, area->y1,
+                 w,        h,        reinterpret_cast<uint16_t *>(color_p)};
+  if (s_flush_task) {
+    // The flush task signals flush_ready once the area is out, while LVGL
+    // goes on rendering into the other buffer.
+    xTaskNotifyGive(s_flush_task);
+    return;
+  }
+  push_area(s_flush_job);
   lv_display_flush_ready(disp_drv);
 }
 
+static void frame_event_cb(lv_event_t *e) {
+  const uint32_t now = micros();
+  switch (lv_event_get_code(e)) {
+  case LV_EVENT_REFR_START:
+    s_refr_start_us = now;
+    break;
+  case LV_EVENT_REFR_READY:
+    s_frame_stats.frames++;
+    s_frame_stats.frame_us += now - s_refr_start_us;
+    break;
+  case LV_EVENT_FLUSH_WAIT_START:
+    s_wait_start_us = now;
+    break;
+  case LV_EVENT_FLUSH_WAIT_FINISH:
+    s_frame_stats.wait_us += now - s_wait_start_us;
+    break;
+  default:
+    break;
+  }
+}
+
+static void log_frame_stats(uint32_t now_ms) {
+  if (now_ms - s_frame_stats_ms < kFrameStatsPeriodMs) {
+    return;
+  }
+  s_frame_stats_ms = now_ms;
+  FrameStats &st = s_frame_stats;
+  if (st.frames == 0) {
+    return;
+  }
+  const uint32_t flushes = st.flushes.exchange(0);
+  const uint32_t wire_us = st.wire_us.exchange(0);
+  const uint32_t hidden_us = wire_us > st.wait_us ? wire_us - st.wait_us : 0;
+  Serial.printf("[DISP] %lu frames, %lu us/frame, %lu flushes, wire %lu us, "
+                "waited %lu us, overlap %lu%%\n",
+                static_cast<unsigned long>(st.frames),
+                static_cast<unsigned long>(st.frame_us / st.frames),
+                static_cast<unsigned long>(flushes),
+                static_cast<unsigned long>(wire_us),
+                static_cast<unsigned long>(st.wait_us),
+                static_cast<unsigned long>(
+                    wire_us ? 100ULL * hidden_us / wire_us : 0));
+  st.frames = 0;
+  st.frame_us = 0;
+  st.wait_us = 0;
+}
+
 static uint32_t lv_tick_get_callback() { return millis(); }
 
 static void keypad_read(lv_indev_t *drv, lv_indev_data_t *data) {
@@ -307,7 +391,8 @@ static lv_fs_res_t sd_read_cb(lv_fs_drv_t *drv, void *file_p, void *buf,
   if (!handle) {
     return LV_FS_RES_INV_PARAM;
   }
-  size_t read_bytes = handle->read(static_cast<uint8_t *>(buf), btr);
+  size_t read_bytes = spibus::read(*handle, static_cast<uint8_t *>(buf), btr,
+                                   spibus::Client::Ui);
   if (br) {
     *br = static_cast<uint32_t>(read_bytes);
   }
@@ -321,7 +406,8 @@ static lv_fs_res_t sd_write_cb(lv_fs_drv_t *drv, void *file_p, const void *buf,
   if (!handle) {
     return LV_FS_RES_INV_PARAM;
   }
-  size_t written = handle->write(static_cast<const uint8_t *>(buf), btw);
+  size_t written = spibus::write(*handle, static_cast<const uint8_t *>(buf),
+                                 btw, spibus::Client::Ui);
   if (bw) {
     *bw = static_cast<uint32_t>(written);
   }
@@ -382,16 +468,17 @@ void beginLvglHelper() {
   const uint32_t buffer_pixels = (width * height) / 6;
   const size_t buffer_size = buffer_pixels * sizeof(lv_color_t);
 
-  s_buf1 = static_cast<lv_color_t *>(malloc(buffer_size));
-  s_buf2 = static_cast<lv_color_t *>(malloc(buffer_size));
-  s_framebuffer = static_cast<lv_color_t *>(
-      malloc(static_cast<size_t>(width) * height * sizeof(lv_color_t)));
-  if (s_framebuffer) {
-    memset(s_framebuffer, 0,
-           static_cast<size_t>(width) * height * sizeof(lv_color_t));
-    s_fb_width = static_cast<uint16_t>(width);
-    s_fb_height = static_cast<uint16_t>(height);
-    s_fb_ready = false;
+  // Internal RAM: large mallocs land in PSRAM, which is slow to render into
+  // and to feed the SPI FIFO from.
+  s_buf1 = static_cast<lv_color_t *>(
+      heap_caps_malloc(buffer_size, MALLOC_CAP_INTERNAL | MALLOC_CAP_DMA));
+  s_buf2 = static_cast<lv_color_t *>(
+      heap_caps_malloc(buffer_size, MALLOC_CAP_INTERNAL | MALLOC_CAP_DMA));
+  if (!s_buf1) {
+    s_buf1 = static_cast<lv_color_t *>(malloc(buffer_size));
+  }
+  if (!s_buf2) {
+    s_buf2 = static_cast<lv_color_t *>(malloc(buffer_size));
   }
 
   s_display = lv_display_create(width, height);
@@ -399,6 +486,14 @@ void beginLvglHelper() {
                          LV_DISPLAY_RENDER_MODE_PARTIAL);
   lv_display_set_color_format(s_display, LV_COLOR_FORMAT_RGB565);
   lv_display_set_flush_cb(s_display, disp_flush);
+  lv_display_add_event_cb(s_display, frame_event_cb, LV_EVENT_ALL, nullptr);
+  // Without a second buffer there is nothing to render while a flush is in
+  // flight, so keep pushing inline.
+  if (s_buf2) {
+    xTaskCreatePinnedToCore(flush_task, "disp_flush", kFlushTaskStack,
+                            nullptr, kFlushTaskPriority, &s_flush_task,
+                            kFlushCore);
+  }
   lv_tick_set_cb(lv_tick_get_callback);
 
   s_indev_keyboard = lv_indev_create();
@@ -414,19 +509,6 @@ void beginLvglHelper() {
   }
 }
 
-const uint16_t *lvHelperGetFrameBuffer(uint16_t *width, uint16_t *height) {
-  if (!s_framebuffer || !s_fb_ready) {
-    return nullptr;
-  }
-  if (width) {
-    *width = s_fb_width;
-  }
-  if (height) {
-    *height = s_fb_height;
-  }
-  return reinterpret_cast<const uint16_t *>(s_framebuffer);
-}
-
 void lvHelperTick() {
   uint32_t now = millis();
   uint32_t idle_ms = static_cast<uint32_t>(now - s_last_input_ms);
@@ -448,6 +530,7 @@ void lvHelperTick() {
     board.softwareShutdown();
   }
 
+  log_frame_stats(now);
   ui_process_screenshot();
 }
 
@@ -4,7 +4,6 @@
 
 void beginLvglHelper();
 void lvHelperTick();
-const uint16_t *lvHelperGetFrameBuffer(uint16_t *width, uint16_t *height);
 uint32_t lvHelperGetBacklightTimeoutMs();
 uint32_t lvHelperGetSleepTimeoutMs();
 void lvHelperSetBacklightTimeoutMs(uint32_t timeout_ms);
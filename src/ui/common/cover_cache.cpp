@@ -0,0 +1,257 @@
+#include "ui/common/cover_cache.h"
+#include "board/spi_bus.h"
+
+#include <SD.h>
+#include <cstring>
+#include <esp_heap_caps.h>
+
+namespace lofi::ui::cover {
+namespace {
+constexpr int kEntries = 6;
+constexpr const char *kStoreDir = "/.lofibox_covers";
+constexpr uint32_t kStoreMagic = 0x4342464Cu; // "LFBC"
+// Bump whenever the decoded pixels change, so thumbnails made by an older
+// decoder or resampler are dropped instead of shown.
+constexpr uint32_t kStoreVersion = 2;
+// Thumbnails are 45 KB at the default cover size, so the store stays near
+// 12 MB. Going over evicts a batch, not one file per save, so the directory
+// is not rescanned every time.
+constexpr int kStoreMaxFiles = 256;
+constexpr int kStoreEvictBatch = 32;
+
+struct Entry {
+  uint32_t key = 0;
+  int size = 0;
+  uint32_t last_used = 0;
+  uint16_t *pixels = nullptr;
+};
+
+struct StoreHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t key;
+  uint32_t size;
+};
+
+Entry s_entries[kEntries];
+uint32_t s_clock = 0;
+CacheStats s_stats;
+bool s_store_ready = false;
+int s_store_files = 0;
+
+size_t pixel_bytes(int size) {
+  return static_cast<size_t>(size) * static_cast<size_t>(size) *
+         sizeof(uint16_t);
+}
+
+String store_path(uint32_t key) {
+  char name[32];
+  snprintf(name, sizeof(name), "%s/%08lx.rgb", kStoreDir,
+           static_cast<unsigned long>(key));
+  return String(name);
+}
+
+Entry *find_entry(uint32_t key, int size) {
+  for (Entry &entry : s_entries) {
+    if (entry.pixels && entry.key == key && entry.size == size) {
+      return &entry;
+    }
+  }
+  return nullptr;
+}
+
+// Keeps pixels in the least recently used slot. PSRAM only: without it the
+// cache stays empty and covers fall back to the card store or a decode.
+void remember(uint32_t key, int size, const uint16_t *pixels) {
+  Entry *slot = find_entry(key, size);
+  if (!slot) {
+    slot = &s_entries[0];
+    for (Entry &entry : s_entries) {
+      if (!entry.pixels || entry.last_used < slot->last_used) {
+        slot = &entry;
+        if (!entry.pixels) {
+          break;
+        }
+      }
+    }
+  }
+  if (slot->pixels && slot->size != size) {
+    heap_caps_free(slot->pixels);
+    slot->pixels = nullptr;
+  }
+  if (!slot->pixels) {
+    slot->pixels = static_cast<uint16_t *>(
+        heap_caps_malloc(pixel_bytes(size), MALLOC_CAP_SPIRAM));
+    if (!slot->pixels) {
+      return;
+    }
+  }
+  memcpy(slot->pixels, pixels, pixel_bytes(size));
+  slot->key = key;
+  slot->size = size;
+  slot->last_used = ++s_clock;
+}
+
+// Every card access, not only the sliced reads and writes, holds the bus.
+File open_file(const char *path, const char *mode) {
+  spibus::Guard bus(spibus::Client::Cover);
+  return SD.open(path, mode);
+}
+
+void close_file(File &f) {
+  spibus::Guard bus(spibus::Client::Cover);
+  f.close();
+}
+
+bool file_exists(const char *path) {
+  spibus::Guard bus(spibus::Client::Cover);
+  return SD.exists(path);
+}
+
+bool remove_file(const char *path) {
+  spibus::Guard bus(spibus::Client::Cover);
+  return SD.remove(path);
+}
+
+bool load_from_card(uint32_t key, int size, uint16_t *out) {
+  File f = open_file(store_path(key).c_str(), FILE_READ);
+  if (!f) {
+    return false;
+  }
+  StoreHeader header{};
+  const size_t bytes = pixel_bytes(size);
+  const bool current =
+      spibus::read(f, reinterpret_cast<uint8_t *>(&header), sizeof(header),
+                   spibus::Client::Cover) == sizeof(header) &&
+      header.magic == kStoreMagic && header.version == kStoreVersion &&
+      header.key == key && header.size == static_cast<uint32_t>(size);
+  const bool ok = current &&
+                  spibus::read(f, reinterpret_cast<uint8_t *>(out), bytes,
+                               spibus::Client::Cover) == bytes;
+  close_file(f);
+  if (!ok) {
+    // Stale or damaged: remove it so save_to_card() can write a new one.
+    if (remove_file(store_path(key).c_str()) && s_store_files > 0) {
+      --s_store_files;
+    }
+  }
+  return ok;
+}
+
+// Counts the thumbnails on the card, or deletes up to `evict` of them in
+// directory order, which on FAT is roughly oldest first. Returns how many
+// files are left.
+int scan_store(int evict) {
+  File dir = open_file(kStoreDir, FILE_READ);
+  if (!dir) {
+    return 0;
+  }
+  if (!dir.isDirectory()) {
+    close_file(dir);
+    return 0;
+  }
+  int files = 0;
+  while (true) {
+    spibus::Guard bus(spibus::Client::Cover);
+    File entry = dir.openNextFile();
+    if (!entry) {
+      break;
+    }
+    const bool is_file = !entry.isDirectory();
+    const String path = entry.path();
+    entry.close();
+    if (!is_file) {
+      continue;
+    }
+    if (evict > 0 && remove_file(path.c_str())) {
+      --evict;
+    } else {
+      ++files;
+    }
+  }
+  close_file(dir);
+  return files;
+}
+
+void save_to_card(uint32_t key, int size, const uint16_t *pixels) {
+  if (!s_store_ready) {
+    bool ready = file_exists(kStoreDir);
+    if (!ready) {
+      spibus::Guard bus(spibus::Client::Cover);
+      ready = SD.mkdir(kStoreDir);
+    }
+    if (!ready) {
+      return;
+    }
+    s_store_files = scan_store(0);
+    s_store_ready = true;
+  }
+  const String path = store_path(key);
+  if (file_exists(path.c_str())) {
+    return;
+  }
+  if (s_store_files >= kStoreMaxFiles) {
+    s_store_files = scan_store(s_store_files - kStoreMaxFiles +
+                               kStoreEvictBatch);
+  }
+  File f = open_file(path.c_str(), FILE_WRITE);
+  if (!f) {
+    return;
+  }
+  const StoreHeader header{kStoreMagic, kStoreVersion, key,
+                           static_cast<uint32_t>(size)};
+  const size_t bytes = pixel_bytes(size);
+  bool ok = spibus::write(f, reinterpret_cast<const uint8_t *>(&header),
+                          sizeof(header), spibus::Client::Cover) ==
+                sizeof(header) &&
+            spibus::write(f, reinterpret_cast<const uint8_t *>(pixels), bytes,
+                          spibus::Client::Cover) == bytes;
+  close_file(f);
+  if (!ok) {
+    remove_file(path.c_str());
+  } else {
+    ++s_store_files;
+  }
+}
+} // namespace
+
+// Album and artist name the art, so every track of an album maps to one key;
+// the embedded image length guards against albums whose tracks differ.
+uint32_t cache_key(const app::TrackInfo &track, uint32_t cover_len, int size) {
+  const char *album = track.album ? track.album : "";
+  const char *artist = track.artist ? track.artist : "";
+  uint32_t hash = app::library_hash(album, strlen(album) + 1);
+  hash = app::library_hash(artist, strlen(artist) + 1, hash);
+  hash = app::library_hash(&cover_len, sizeof(cover_len), hash);
+  return app::library_hash(&size, sizeof(size), hash);
+}
+
+bool cache_lookup(uint32_t key, int size, uint16_t *out) {
+  if (!out || size <= 0) {
+    return false;
+  }
+  if (Entry *entry = find_entry(key, size)) {
+    memcpy(out, entry->pixels, pixel_bytes(size));
+    entry->last_used = ++s_clock;
+    ++s_stats.hits;
+    return true;
+  }
+  if (load_from_card(key, size, out)) {
+    remember(key, size, out);
+    ++s_stats.card_hits;
+    return true;
+  }
+  ++s_stats.misses;
+  return false;
+}
+
+void cache_store(uint32_t key, int size, const uint16_t *pixels) {
+  if (!pixels || size <= 0) {
+    return;
+  }
+  remember(key, size, pixels);
+  save_to_card(key, size, pixels);
+}
+
+const CacheStats &cache_stats() { return s_stats; }
+} // namespace lofi::ui::cover
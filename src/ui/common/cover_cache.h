@@ -0,0 +1,22 @@
+#pragma once
+
+#include <Arduino.h>
+
+#include "app/library.h"
+
+namespace lofi::ui::cover {
+// Decoded covers, already scaled to the Now Playing canvas, kept as RGB565 in
+// a small PSRAM LRU and mirrored to thumbnail files on the card. Tracks of
+// one album share an entry, so album playback decodes its art once.
+struct CacheStats {
+  uint32_t hits = 0;      // served from PSRAM
+  uint32_t card_hits = 0; // loaded from the thumbnail store
+  uint32_t misses = 0;    // had to be decoded
+};
+
+uint32_t cache_key(const app::TrackInfo &track, uint32_t cover_len, int size);
+// Copies the size x size cover for key into out. False on a miss.
+bool cache_lookup(uint32_t key, int size, uint16_t *out);
+void cache_store(uint32_t key, int size, const uint16_t *pixels);
+const CacheStats &cache_stats();
+} // namespace lofi::ui::cover
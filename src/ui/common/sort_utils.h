@@ -4,10 +4,10 @@
 
 namespace lofi::ui::sort {
 int compare_ci(const char *a, const char *b);
-void string_indices(const char *const *arr, int *idx, int count);
+// Copies up to max listed ids of a precomputed library order into out.
+int copy_order(const app::SortOrder &order, int count, int *out, int max);
+// Sorts a subset of ids by their position in a precomputed library order.
+void by_rank(const app::SortOrder &order, int *idx, int count);
 void album_indices(const app::Library &lib, int *idx, int count);
 void track_indices_by_title(const app::Library &lib, int *idx, int count);
-void tracks_by_added(const app::Library &lib, int *idx, int count);
-void tracks_by_play_count(const app::Library &lib, int *idx, int count);
-void tracks_by_last_played(const app::Library &lib, int *idx, int count);
 } // namespace lofi::ui::sort
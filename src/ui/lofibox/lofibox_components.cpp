@@ -146,7 +146,7 @@ void play_track(UiScreen &screen, int track_index) {
   if (!screen.library || !screen.player) {
     return;
   }
-  if (track_index < 0 || track_index >= screen.library->track_count) {
+  if (!app::library_track_live(*screen.library, track_index)) {
     return;
   }
 
@@ -193,42 +193,6 @@ void toggle_repeat(UiScreen &screen) {
 }
 } // namespace
 
-void reset_items(UiScreen &screen) { screen.items_count = 0; }
-
-ListItem *add_item(UiScreen &screen, const char *left, const char *right,
-                   UiIntentKind action, PageId next, int value, int value2,
-                   const lv_image_dsc_t *icon) {
-  if (screen.items_count >= UiScreen::kMaxItems) {
-    return nullptr;
-  }
-  ListItem &item = screen.items[screen.items_count++];
-  item.left = left ? left : "";
-  item.right = right ? right : "";
-  item.action = action;
-  item.next = next;
-  item.value = value;
-  item.value2 = value2;
-  item.icon = icon;
-  return &item;
-}
-
-ListItem *add_item(UiScreen &screen, const String &left, const String &right,
-                   UiIntentKind action, PageId next, int value, int value2,
-                   const lv_image_dsc_t *icon) {
-  if (screen.items_count >= UiScreen::kMaxItems) {
-    return nullptr;
-  }
-  ListItem &item = screen.items[screen.items_count++];
-  item.left = left;
-  item.right = right;
-  item.action = action;
-  item.next = next;
-  item.value = value;
-  item.value2 = value2;
-  item.icon = icon;
-  return &item;
-}
-
 static void build_main_menu(UiScreen &screen) {
   screens::main_menu::styles::init_once();
   screens::main_menu::styles::apply_content(screen.view.root.content);
@@ -559,7 +523,8 @@ void update_main_menu(UiScreen &screen) {
     meta.intent.next = screen.items[item_idx].next;
     meta.intent.value = screen.items[item_idx].value;
     meta.intent.value2 = screen.items[item_idx].value2;
-    meta.intent.item = &screen.items[item_idx];
+    meta.intent.left = screen.items[item_idx].left.c_str();
+    meta.intent.right = screen.items[item_idx].right.c_str();
   }
 
   int active_dot =
@@ -605,33 +570,33 @@ NavCommand handle_intent(UiScreen &screen, const UiIntent &intent) {
     cmd.target = PageId::Songs;
     break;
   case UiIntentKind::OpenArtist:
-    if (intent.item) {
-      screen.state.selected_artist = intent.item->left;
+    if (intent.left) {
+      screen.state.selected_artist = intent.left;
     }
     screen.state.album_filter = AlbumFilter::Artist;
     cmd.type = NavCommand::Type::NavigateTo;
     cmd.target = PageId::Albums;
     break;
   case UiIntentKind::OpenAlbum:
-    if (intent.item) {
-      screen.state.selected_album = intent.item->left;
-      screen.state.selected_album_artist = intent.item->right;
+    if (intent.left) {
+      screen.state.selected_album = intent.left;
+      screen.state.selected_album_artist = intent.right ? intent.right : "";
     }
     screen.state.song_context = SongContext::Album;
     cmd.type = NavCommand::Type::NavigateTo;
     cmd.target = PageId::Songs;
     break;
   case UiIntentKind::OpenGenre:
-    if (intent.item) {
-      screen.state.selected_genre = intent.item->left;
+    if (intent.left) {
+      screen.state.selected_genre = intent.left;
     }
     screen.state.song_context = SongContext::Genre;
     cmd.type = NavCommand::Type::NavigateTo;
     cmd.target = PageId::Songs;
     break;
   case UiIntentKind::OpenComposer:
-    if (intent.item) {
-      screen.state.selected_composer = intent.item->left;
+    if (intent.left) {
+      screen.state.selected_composer = intent.left;
     }
     screen.state.song_context = SongContext::Composer;
     cmd.type = NavCommand::Type::NavigateTo;
@@ -21,6 +21,10 @@ void update_now_playing(UiScreen &screen);
 void update_main_menu(UiScreen &screen);
 NavCommand handle_intent(UiScreen &screen, const UiIntent &intent);
 void reset_items(UiScreen &screen);
+// Makes the current list virtual: count rows, produced on demand by fn.
+void set_row_source(UiScreen &screen, ListRowFn fn, int count);
+// Row index of the current list, from row_source or items[].
+void list_row(const UiScreen &screen, int index, ListRow &out);
 
 ListItem *add_item(UiScreen &screen, const char *left, const char *right,
                    UiIntentKind action, PageId next, int value = 0,
@@ -0,0 +1,70 @@
+#include "ui/lofibox/lofibox_components.h"
+
+// Item and row plumbing shared by every list page. Nothing here touches
+// LVGL, so host tests link it without the display stack.
+namespace lofi::ui::components {
+
+void reset_items(UiScreen &screen) {
+  screen.items_count = 0;
+  screen.row_source = nullptr;
+}
+
+void set_row_source(UiScreen &screen, ListRowFn fn, int count) {
+  screen.row_source = fn;
+  screen.items_count = count;
+}
+
+void list_row(const UiScreen &screen, int index, ListRow &out) {
+  out = ListRow();
+  if (index < 0 || index >= screen.items_count) {
+    return;
+  }
+  if (screen.row_source) {
+    screen.row_source(screen, index, out);
+    return;
+  }
+  const ListItem &item = screen.items[index];
+  out.left = item.left.c_str();
+  out.right = item.right.c_str();
+  out.action = item.action;
+  out.next = item.next;
+  out.value = item.value;
+  out.value2 = item.value2;
+  out.icon = item.icon;
+}
+
+ListItem *add_item(UiScreen &screen, const char *left, const char *right,
+                   UiIntentKind action, PageId next, int value, int value2,
+                   const lv_image_dsc_t *icon) {
+  if (screen.items_count >= UiScreen::kMaxItems) {
+    return nullptr;
+  }
+  ListItem &item = screen.items[screen.items_count++];
+  item.left = left ? left : "";
+  item.right = right ? right : "";
+  item.action = action;
+  item.next = next;
+  item.value = value;
+  item.value2 = value2;
+  item.icon = icon;
+  return &item;
+}
+
+ListItem *add_item(UiScreen &screen, const String &left, const String &right,
+                   UiIntentKind action, PageId next, int value, int value2,
+                   const lv_image_dsc_t *icon) {
+  if (screen.items_count >= UiScreen::kMaxItems) {
+    return nullptr;
+  }
+  ListItem &item = screen.items[screen.items_count++];
+  item.left = left;
+  item.right = right;
+  item.action = action;
+  item.next = next;
+  item.value = value;
+  item.value2 = value2;
+  item.icon = icon;
+  return &item;
+}
+
+} // namespace lofi::ui::components
@@ -2,6 +2,7 @@
 
 #include <Arduino.h>
 #include <SD.h>
+#include <esp_heap_caps.h>
 
 #include "ui/fonts/fonts.h"
 #include "ui/lofibox/lofibox_components.h"
@@ -82,6 +83,9 @@ void destroy_view(UiScreen &screen) {
 
 void build_view(UiScreen &screen) {
   screen.alive = true;
+  if (screen.library) {
+    screen.state.library_generation = screen.library->generation;
+  }
   components::build_page(screen);
   attach_delete_hook(screen);
   start_timers(screen);
@@ -114,6 +118,31 @@ void rebuild_current(UiScreen &screen) {
   build_view(screen);
 }
 
+bool page_shows_library(PageId id) {
+  switch (id) {
+  case PageId::NowPlaying:
+  case PageId::Settings:
+  case PageId::Eq:
+  case PageId::About:
+    return false;
+  default:
+    return true;
+  }
+}
+
+// Rebuilds list pages once the background rescan has changed the library.
+void refresh_if_library_changed(UiScreen &screen) {
+  if (!screen.library || screen.delete_prompt_active ||
+      screen.library->generation == screen.state.library_generation) {
+    return;
+  }
+  if (!page_shows_library(screen.state.current)) {
+    screen.state.library_generation = screen.library->generation;
+    return;
+  }
+  rebuild_current(screen);
+}
+
 int resolve_delete_track(UiScreen &screen) {
   if (!screen.library) {
     return -1;
@@ -121,7 +150,8 @@ int resolve_delete_track(UiScreen &screen) {
   int idx = -1;
   if (screen.state.list_selected >= 0 &&
       screen.state.list_selected < screen.items_count) {
-    ListItem &item = screen.items[screen.state.list_selected];
+    ListRow item;
+    components::list_row(screen, screen.state.list_selected, item);
     if (item.action == UiIntentKind::PlayTrack) {
       idx = item.value;
     }
@@ -129,7 +159,7 @@ int resolve_delete_track(UiScreen &screen) {
   if (idx < 0 && screen.player) {
     idx = screen.player->current_index;
   }
-  if (idx < 0 || idx >= screen.library->track_count) {
+  if (!app::library_track_live(*screen.library, idx)) {
     return -1;
   }
   return idx;
@@ -190,69 +220,59 @@ void show_delete_prompt(UiScreen &screen) {
   screen.delete_label = label;
 }
 
-void rescan_library(UiScreen &screen) {
-  if (!screen.library) {
-    return;
-  }
-
-  String keep_path;
-  if (screen.player && screen.player->current_index >= 0 &&
-      screen.player->current_index < screen.library->track_count) {
-    const char *path =
-        screen.library->tracks[screen.player->current_index].path;
-    if (path) {
-      keep_path = path;
-    }
-  }
-
-  app::library_reset(*screen.library);
-  app::library_scan(*screen.library, SD, "/music", 8, app::kMaxTracks, true,
-                    nullptr);
-
-  if (screen.player) {
-    int new_index = -1;
-    if (keep_path.length() > 0) {
-      for (int i = 0; i < screen.library->track_count; ++i) {
-        const char *path = screen.library->tracks[i].path;
-        if (path && keep_path == path) {
-          new_index = i;
-          break;
-        }
-      }
-    }
-    screen.player->current_index = new_index;
-    if (new_index < 0) {
-      screen.player->is_playing = false;
-      screen.player->paused = false;
+// Maps every track index in ids through map, dropping the ones that map to -1.
+template <typename Map> void remap_refs(int *ids, int &count, Map map) {
+  int out = 0;
+  for (int i = 0; i < count; ++i) {
+    const int mapped = map(ids[i]);
+    if (mapped >= 0) {
+      ids[out++] = mapped;
     }
   }
-
-  screen.state.list_offset = 0;
-  screen.state.list_selected = 0;
-  screen.state.last_track_index = -2;
-  screen.state.last_meta_version = 0;
-  screen.state.last_cover_version = 0;
+  count = out;
 }
 
 void perform_delete(UiScreen &screen) {
   int idx = screen.delete_track_index;
   hide_delete_prompt(screen);
-  if (!screen.library || idx < 0 || idx >= screen.library->track_count) {
+  if (!screen.library || !app::library_track_live(*screen.library, idx)) {
     return;
   }
 
-  bool deleting_current =
-      (screen.player && screen.player->current_index == idx);
-  if (deleting_current && screen.player) {
-    app::player_stop(*screen.player);
+  // The decode task must be done with the file, the playing copy and any
+  // preroll of it, before it goes.
+  if (screen.player) {
+    app::player_release_track(*screen.player, idx);
   }
 
   const char *path = screen.library->tracks[idx].path;
-  if (path && SD.exists(path)) {
-    SD.remove(path);
+  if (path && SD.exists(path) && !SD.remove(path)) {
+    Serial.printf("[LIB] delete failed: %s\n", path);
+    if (screen.player) {
+      // Nothing moved; this lets the player open the track again.
+      app::player_begin_library_update(*screen.player);
+      app::player_end_library_update(*screen.player,
+                                     screen.player->current_index);
+    }
+    return;
   }
 
-  rescan_library(screen);
+  // Only this track leaves the library and no other index moves; the
+  // scanner brings the on-card index up to date on its next pass.
+  auto map = [idx](int i) { return i == idx ? -1 : i; };
+  if (screen.player) {
+    app::player_begin_library_update(*screen.player);
+  }
+  app::library_remove_track(*screen.library, idx);
+  if (screen.player) {
+    app::player_end_library_update(*screen.player,
+                                   map(screen.player->current_index));
+  }
+  remap_refs(screen.on_the_go, screen.on_the_go_count, map);
+  remap_refs(screen.playlist_tracks, screen.playlist_count, map);
+
+  screen.state.last_track_index = -2;
+  screen.state.last_meta_version = 0;
   rebuild_current(screen);
 }
 } // namespace
@@ -326,6 +346,15 @@ void init(app::Library *library, app::PlayerState *player) {
   }
   s_screen.library = library;
   s_screen.player = player;
+  if (!s_screen.scratch && library && library->track_capacity > 0) {
+    const size_t bytes = library->track_capacity * sizeof(int);
+    s_screen.scratch = static_cast<int *>(
+        heap_caps_malloc(bytes, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT));
+    if (!s_screen.scratch) {
+      s_screen.scratch = static_cast<int *>(malloc(bytes));
+    }
+    s_screen.scratch_size = s_screen.scratch ? library->track_capacity : 0;
+  }
   s_screen.state = {};
   s_screen.delete_prompt_active = false;
   s_screen.delete_track_index = -1;
@@ -344,6 +373,7 @@ void tick() {
   if (!screen_alive(&s_screen)) {
     return;
   }
+  refresh_if_library_changed(s_screen);
   if (!s_screen.has_pending_intent) {
     return;
   }
@@ -452,4 +482,16 @@ void rebuild() {
   rebuild_current(s_screen);
 }
 
+void remap_tracks(const int16_t *remap, int count) {
+  auto map = [remap, count](int idx) {
+    return (idx >= 0 && idx < count) ? remap[idx] : -1;
+  };
+  remap_refs(s_screen.on_the_go, s_screen.on_the_go_count, map);
+  remap_refs(s_screen.playlist_tracks, s_screen.playlist_count, map);
+
+  if (s_screen.delete_prompt_active) {
+    hide_delete_prompt(s_screen);
+  }
+}
+
 } // namespace lofi::ui
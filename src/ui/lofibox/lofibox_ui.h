@@ -23,5 +23,8 @@ void tick();
 void handle_media_key(MediaKey key);
 void handle_global_key(GlobalKey key);
 void rebuild();
+// Called after tracks were removed from the library; remap[old] is the new
+// index of each old track, or -1.
+void remap_tracks(const int16_t *remap, int count);
 
 } // namespace lofi::ui
@@ -76,14 +76,31 @@ struct ListItem {
   const lv_image_dsc_t *icon = nullptr;
 };
 
+// One list row as the list page sees it. Text points into the string pool,
+// a literal or a ListItem, never at a temporary.
+struct ListRow {
+  const char *left = "";
+  const char *right = "";
+  UiIntentKind action = UiIntentKind::None;
+  PageId next = PageId::None;
+  int value = 0;
+  int value2 = 0;
+  const lv_image_dsc_t *icon = nullptr;
+};
+
 struct UiScreen;
 
+// Library lists don't materialize items: they keep ids in UiScreen::scratch
+// and the list page asks for the rows on screen only.
+using ListRowFn = void (*)(const UiScreen &screen, int index, ListRow &out);
+
 struct UiIntent {
   UiIntentKind kind = UiIntentKind::None;
   PageId next = PageId::None;
   int value = 0;
   int value2 = 0;
-  ListItem *item = nullptr;
+  const char *left = nullptr;
+  const char *right = nullptr;
 };
 
 struct RowMeta {
@@ -135,12 +152,15 @@ struct UiState {
 
   int current_playlist = -1;
   int last_track_index = -2;
+  uint32_t library_generation = 0;
   uint32_t last_meta_version = 0;
   uint32_t last_cover_version = 0;
   int list_offset = 0;
   int list_selected = 0;
   PageId last_list_page = PageId::None;
   int eq_selected_band = 0;
+  int eq_first_band = 0;
+  uint8_t eq_field = 0;
   bool eq_editing = false;
 };
 
@@ -166,9 +186,12 @@ struct UiScreen {
   UiState state{};
   UiView view{};
 
-  static constexpr int kMaxItems = app::kMaxTracks;
+  // Fixed menus fill items[]; library lists set row_source instead, and
+  // items_count is then the length of the virtual list.
+  static constexpr int kMaxItems = 32;
   ListItem items[kMaxItems] = {};
   int items_count = 0;
+  ListRowFn row_source = nullptr;
   RowMeta rows[kMaxItems] = {};
   int row_count = 0;
 
@@ -177,6 +200,10 @@ struct UiScreen {
   int playlist_tracks[app::kMaxPlaylistTracks] = {};
   int playlist_count = 0;
 
+  // Index buffer for populate(), one slot per library track (PSRAM).
+  int *scratch = nullptr;
+  int scratch_size = 0;
+
   UiIntent pending_intent{};
   bool has_pending_intent = false;
 };
@@ -2,36 +2,50 @@
 #include "ui/common/sort_utils.h"
 
 namespace lofi::ui::screens::albums {
+namespace {
+void get_row(const UiScreen &screen, int index, ListRow &out) {
+  const int id = screen.scratch[index];
+  if (id >= screen.library->album_count) {
+    return;
+  }
+  const app::AlbumInfo &album = screen.library->albums[id];
+  out.left = album.name;
+  out.right = album.artist;
+  out.action = UiIntentKind::OpenAlbum;
+  out.next = PageId::Songs;
+  out.value = id;
+}
+} // namespace
+
 void populate(UiScreen &screen) {
   components::reset_items(screen);
-  if (!screen.library || screen.library->album_count == 0) {
+  if (!screen.library || screen.library->album_count == 0 ||
+      !screen.scratch) {
     components::add_item(screen, "No Music", nullptr, UiIntentKind::None,
                          PageId::None);
     return;
   }
 
-  int idx[app::kMaxAlbums];
+  int *idx = screen.scratch;
   int count = 0;
   if (screen.state.album_filter == AlbumFilter::Artist &&
       screen.state.selected_artist.length() > 0) {
     count = app::library_albums_for_artist(
-        *screen.library, screen.state.selected_artist, idx, app::kMaxAlbums);
+        *screen.library, screen.state.selected_artist, idx,
+        screen.scratch_size);
+    sort::album_indices(*screen.library, idx, count);
   } else {
-    for (int i = 0; i < screen.library->album_count; ++i) {
-      idx[count++] = i;
-    }
+    count = sort::copy_order(screen.library->order.albums,
+                             screen.library->album_count, idx,
+                             screen.scratch_size);
   }
-  sort::album_indices(*screen.library, idx, count);
 
-  for (int i = 0; i < count; ++i) {
-    const app::AlbumInfo &album = screen.library->albums[idx[i]];
-    components::add_item(screen, album.name, album.artist,
-                         UiIntentKind::OpenAlbum, PageId::Songs, idx[i]);
-  }
   if (count == 0) {
     components::add_item(screen, "No Albums", nullptr, UiIntentKind::None,
                          PageId::None);
+    return;
   }
+  components::set_row_source(screen, get_row, count);
 }
 
 } // namespace lofi::ui::screens::albums
@@ -2,25 +2,32 @@
 #include "ui/common/sort_utils.h"
 
 namespace lofi::ui::screens::artists {
+namespace {
+void get_row(const UiScreen &screen, int index, ListRow &out) {
+  const int id = screen.scratch[index];
+  if (id >= screen.library->artist_count) {
+    return;
+  }
+  out.left = screen.library->artists[id];
+  out.action = UiIntentKind::OpenArtist;
+  out.next = PageId::Albums;
+  out.value = id;
+}
+} // namespace
+
 void populate(UiScreen &screen) {
   components::reset_items(screen);
-  if (!screen.library || screen.library->artist_count == 0) {
+  if (!screen.library || screen.library->artist_count == 0 ||
+      !screen.scratch) {
     components::add_item(screen, "No Music", nullptr, UiIntentKind::None,
                          PageId::None);
     return;
   }
 
-  int idx[app::kMaxArtists];
-  for (int i = 0; i < screen.library->artist_count; ++i) {
-    idx[i] = i;
-  }
-  sort::string_indices(screen.library->artists, idx,
-                       screen.library->artist_count);
-
-  for (int i = 0; i < screen.library->artist_count; ++i) {
-    components::add_item(screen, screen.library->artists[idx[i]], "",
-                         UiIntentKind::OpenArtist, PageId::Albums, idx[i]);
-  }
+  const int count = sort::copy_order(screen.library->order.artists,
+                                     screen.library->artist_count,
+                                     screen.scratch, screen.scratch_size);
+  components::set_row_source(screen, get_row, count);
 }
 
 } // namespace lofi::ui::screens::artists
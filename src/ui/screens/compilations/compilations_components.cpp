@@ -1,45 +1,68 @@
 #include "ui/screens/compilations/compilations_components.h"
 #include "ui/common/sort_utils.h"
+#include <algorithm>
 #include <cstring>
 
 namespace lofi::ui::screens::compilations {
+namespace {
+// Compilations span artists, so the album opens with no artist filter.
+void get_row(const UiScreen &screen, int index, ListRow &out) {
+  const int id = screen.scratch[index];
+  if (id >= screen.library->album_count) {
+    return;
+  }
+  out.left = screen.library->albums[id].name;
+  out.action = UiIntentKind::OpenAlbum;
+  out.next = PageId::Songs;
+  out.value = id;
+}
+} // namespace
+
 void populate(UiScreen &screen) {
   components::reset_items(screen);
-  if (!screen.library || screen.library->album_count == 0) {
+  if (!screen.library || screen.library->album_count == 0 ||
+      !screen.scratch) {
     components::add_item(screen, "No Music", nullptr, UiIntentKind::None,
                          PageId::None);
     return;
   }
 
-  bool is_compilation[app::kMaxAlbums] = {};
-  for (int i = 0; i < screen.library->album_count; ++i) {
-    for (int j = i + 1; j < screen.library->album_count; ++j) {
-      if (strcmp(screen.library->albums[i].name,
-                 screen.library->albums[j].name) == 0 &&
-          strcmp(screen.library->albums[i].artist,
-                 screen.library->albums[j].artist) != 0) {
-        is_compilation[i] = true;
-        is_compilation[j] = true;
-      }
+  // Group albums by exact name; a name shared by more than one artist is a
+  // compilation. Sorting keeps this O(n log n) for large libraries.
+  const app::AlbumInfo *albums = screen.library->albums;
+  const int album_limit =
+      std::min(screen.library->album_count, screen.scratch_size);
+  int *idx = screen.scratch;
+  int album_count = 0;
+  for (int i = 0; i < album_limit; ++i) {
+    if (app::library_catalog_size(screen.library->album_index, i) > 0) {
+      idx[album_count++] = i;
     }
   }
+  std::sort(idx, idx + album_count, [albums](int a, int b) {
+    const int c = strcmp(albums[a].name, albums[b].name);
+    if (c != 0) {
+      return c < 0;
+    }
+    return strcmp(albums[a].artist, albums[b].artist) < 0;
+  });
 
-  const char *names[app::kMaxAlbums] = {};
   int name_count = 0;
-  for (int i = 0; i < screen.library->album_count; ++i) {
-    if (!is_compilation[i]) {
-      continue;
-    }
-    bool exists = false;
-    for (int j = 0; j < name_count; ++j) {
-      if (strcmp(names[j], screen.library->albums[i].name) == 0) {
-        exists = true;
-        break;
+  for (int i = 0; i < album_count;) {
+    const int first = idx[i];
+    bool mixed = false;
+    int j = i + 1;
+    while (j < album_count &&
+           strcmp(albums[idx[j]].name, albums[first].name) == 0) {
+      if (strcmp(albums[idx[j]].artist, albums[first].artist) != 0) {
+        mixed = true;
       }
+      ++j;
     }
-    if (!exists && name_count < app::kMaxAlbums) {
-      names[name_count++] = screen.library->albums[i].name;
+    if (mixed) {
+      idx[name_count++] = first;
     }
+    i = j;
   }
 
   if (name_count == 0) {
@@ -48,15 +71,8 @@ void populate(UiScreen &screen) {
     return;
   }
 
-  int idx[app::kMaxAlbums];
-  for (int i = 0; i < name_count; ++i) {
-    idx[i] = i;
-  }
-  sort::string_indices(names, idx, name_count);
-  for (int i = 0; i < name_count; ++i) {
-    components::add_item(screen, names[idx[i]], "", UiIntentKind::OpenAlbum,
-                         PageId::Songs);
-  }
+  sort::album_indices(*screen.library, idx, name_count);
+  components::set_row_source(screen, get_row, name_count);
 }
 
 } // namespace lofi::ui::screens::compilations
@@ -2,25 +2,32 @@
 #include "ui/common/sort_utils.h"
 
 namespace lofi::ui::screens::composers {
+namespace {
+void get_row(const UiScreen &screen, int index, ListRow &out) {
+  const int id = screen.scratch[index];
+  if (id >= screen.library->composer_count) {
+    return;
+  }
+  out.left = screen.library->composers[id];
+  out.action = UiIntentKind::OpenComposer;
+  out.next = PageId::Songs;
+  out.value = id;
+}
+} // namespace
+
 void populate(UiScreen &screen) {
   components::reset_items(screen);
-  if (!screen.library || screen.library->composer_count == 0) {
+  if (!screen.library || screen.library->composer_count == 0 ||
+      !screen.scratch) {
     components::add_item(screen, "No Composers", nullptr, UiIntentKind::None,
                          PageId::None);
     return;
   }
 
-  int idx[app::kMaxComposers];
-  for (int i = 0; i < screen.library->composer_count; ++i) {
-    idx[i] = i;
-  }
-  sort::string_indices(screen.library->composers, idx,
-                       screen.library->composer_count);
-
-  for (int i = 0; i < screen.library->composer_count; ++i) {
-    components::add_item(screen, screen.library->composers[idx[i]], "",
-                         UiIntentKind::OpenComposer, PageId::Songs, idx[i]);
-  }
+  const int count = sort::copy_order(screen.library->order.composers,
+                                     screen.library->composer_count,
+                                     screen.scratch, screen.scratch_size);
+  components::set_row_source(screen, get_row, count);
 }
 
 } // namespace lofi::ui::screens::composers
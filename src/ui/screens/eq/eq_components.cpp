@@ -9,12 +9,43 @@
 
 namespace lofi::ui::screens::eq {
 namespace {
-constexpr int kVisibleBands = 6;
-const int kBandMap[kVisibleBands] = {0, 1, 2, 3, 4, 5};
-const char *kLeftLabels[kVisibleBands] = {"120 Hz", "250 Hz",  "500 Hz",
-                                          "1 kHz",  "2.5 kHz", "6 kHz"};
-const char *kBottomLabels[kVisibleBands] = {"120", "250",  "500",
-                                            "1k",  "2.5k", "6k"};
+constexpr int kSliderSlots = 6;
+
+// The six slider columns show a window of the bands that scrolls with the
+// selection.
+int visible_bands() {
+  int count = app::eq::band_count();
+  return count < kSliderSlots ? count : kSliderSlots;
+}
+
+// "120 Hz" / "2.5 kHz" with units, "120" / "2.5k" without.
+void format_freq(char *out, size_t len, uint16_t hz, bool units) {
+  if (!out || len == 0) {
+    return;
+  }
+  if (hz < 1000) {
+    snprintf(out, len, units ? "%u Hz" : "%u", static_cast<unsigned>(hz));
+    return;
+  }
+  const unsigned whole = hz / 1000;
+  const unsigned tenth = (hz % 1000) / 100;
+  if (tenth == 0) {
+    snprintf(out, len, units ? "%u kHz" : "%uk", whole);
+    return;
+  }
+  snprintf(out, len, units ? "%u.%u kHz" : "%u.%uk", whole, tenth);
+}
+
+const char *type_name(app::eq::BandType type) {
+  switch (type) {
+  case app::eq::BandType::LowShelf:
+    return "Low";
+  case app::eq::BandType::HighShelf:
+    return "High";
+  default:
+    return "Peak";
+  }
+}
 
 void format_db_label(char *out, size_t len, int8_t db) {
   if (!out || len == 0) {
@@ -27,45 +58,148 @@ void format_db_label(char *out, size_t len, int8_t db) {
   snprintf(out, len, "%d dB", db);
 }
 
+void set_selected(lv_obj_t *obj, bool selected, bool editing) {
+  if (!obj) {
+    return;
+  }
+  if (selected) {
+    lv_obj_add_state(obj, LV_STATE_CHECKED);
+  } else {
+    lv_obj_clear_state(obj, LV_STATE_CHECKED);
+  }
+  if (selected && editing) {
+    lv_obj_add_state(obj, LV_STATE_USER_1);
+  } else {
+    lv_obj_clear_state(obj, LV_STATE_USER_1);
+  }
+}
+
+// Selection band_count() is the preset row under the sliders.
 void apply_selection(UiScreen &screen) {
+  const int count = app::eq::band_count();
+  const int visible = visible_bands();
   int sel = screen.state.eq_selected_band;
   if (sel < 0) {
     sel = 0;
   }
-  if (sel >= kVisibleBands) {
-    sel = kVisibleBands - 1;
+  if (sel > count) {
+    sel = count;
   }
   screen.state.eq_selected_band = sel;
 
-  for (int i = 0; i < kVisibleBands; ++i) {
-    if (!screen.view.eq.sliders[i]) {
-      continue;
+  int first = screen.state.eq_first_band;
+  if (sel < count) {
+    if (sel < first) {
+      first = sel;
+    } else if (sel >= first + visible) {
+      first = sel - visible + 1;
     }
-    if (i == sel) {
-      lv_obj_add_state(screen.view.eq.sliders[i], LV_STATE_CHECKED);
-      if (screen.state.eq_editing) {
-        lv_obj_add_state(screen.view.eq.sliders[i], LV_STATE_USER_1);
+  }
+  if (first > count - visible) {
+    first = count - visible;
+  }
+  if (first < 0) {
+    first = 0;
+  }
+  screen.state.eq_first_band = first;
+
+  set_selected(screen.view.eq.preset_value, sel == count,
+               screen.state.eq_editing);
+  for (int i = 0; i < visible; ++i) {
+    const bool selected = (first + i) == sel;
+    set_selected(screen.view.eq.sliders[i], selected, screen.state.eq_editing);
+    set_selected(screen.view.eq.value_labels[i], selected,
+                 screen.state.eq_editing);
+  }
+}
+
+// The value label under a column shows the gain, or while that band is
+// edited the setting Enter has reached.
+void format_band_value(char *out, size_t len, const app::eq::Band &band,
+                       int field) {
+  switch (field) {
+  case kFieldFreq:
+    format_freq(out, len, band.freq_hz, false);
+    break;
+  case kFieldQ:
+    snprintf(out, len, "Q%u.%u", static_cast<unsigned>(band.q_x10 / 10),
+             static_cast<unsigned>(band.q_x10 % 10));
+    break;
+  case kFieldType:
+    snprintf(out, len, "%s", type_name(band.type));
+    break;
+  default:
+    format_db_label(out, len, band.gain_db);
+    break;
+  }
+}
+
+void refresh_preset_row(UiScreen &screen) {
+  const bool count_field = screen.state.eq_editing &&
+                           screen.state.eq_field == kFieldBandCount &&
+                           screen.state.eq_selected_band ==
+                               app::eq::band_count();
+  if (screen.view.eq.preset) {
+    lv_label_set_text(screen.view.eq.preset,
+                      count_field ? "Bands:" : "Preset:");
+  }
+  if (!screen.view.eq.preset_value) {
+    return;
+  }
+  if (count_field) {
+    char count_text[8] = {0};
+    snprintf(count_text, sizeof(count_text), "%d", app::eq::band_count());
+    lv_label_set_text(screen.view.eq.preset_value, count_text);
+    return;
+  }
+  lv_label_set_text(screen.view.eq.preset_value,
+                    app::eq::preset_name(app::eq::get_preset()));
+}
+
+void refresh_bands(UiScreen &screen) {
+  const int visible = visible_bands();
+  const int first = screen.state.eq_first_band;
+  for (int i = 0; i < kSliderSlots; ++i) {
+    const bool shown = i < visible;
+    lv_obj_t *objs[] = {screen.view.eq.slider_cols[i], screen.view.eq.labels[i],
+                        screen.view.eq.labels[i + 6]};
+    for (lv_obj_t *obj : objs) {
+      if (!obj) {
+        continue;
+      }
+      if (shown) {
+        lv_obj_clear_flag(obj, LV_OBJ_FLAG_HIDDEN);
       } else {
-        lv_obj_clear_state(screen.view.eq.sliders[i], LV_STATE_USER_1);
+        lv_obj_add_flag(obj, LV_OBJ_FLAG_HIDDEN);
       }
-    } else {
-      lv_obj_clear_state(screen.view.eq.sliders[i], LV_STATE_CHECKED);
-      lv_obj_clear_state(screen.view.eq.sliders[i], LV_STATE_USER_1);
+    }
+    if (!shown) {
+      continue;
+    }
+    const int index = first + i;
+    const app::eq::Band band = app::eq::get_band_params(index);
+    const bool editing =
+        screen.state.eq_editing && index == screen.state.eq_selected_band;
+    if (screen.view.eq.sliders[i]) {
+      lv_slider_set_value(screen.view.eq.sliders[i], band.gain_db, LV_ANIM_OFF);
     }
     if (screen.view.eq.value_labels[i]) {
-      if (i == sel) {
-        lv_obj_add_state(screen.view.eq.value_labels[i], LV_STATE_CHECKED);
-        if (screen.state.eq_editing) {
-          lv_obj_add_state(screen.view.eq.value_labels[i], LV_STATE_USER_1);
-        } else {
-          lv_obj_clear_state(screen.view.eq.value_labels[i], LV_STATE_USER_1);
-        }
-      } else {
-        lv_obj_clear_state(screen.view.eq.value_labels[i], LV_STATE_CHECKED);
-        lv_obj_clear_state(screen.view.eq.value_labels[i], LV_STATE_USER_1);
-      }
+      char value_text[12] = {0};
+      format_band_value(value_text, sizeof(value_text), band,
+                        editing ? screen.state.eq_field : kFieldGain);
+      lv_label_set_text(screen.view.eq.value_labels[i], value_text);
+    }
+    char freq_text[16] = {0};
+    if (screen.view.eq.labels[i]) {
+      format_freq(freq_text, sizeof(freq_text), band.freq_hz, true);
+      lv_label_set_text(screen.view.eq.labels[i], freq_text);
+    }
+    if (screen.view.eq.labels[i + 6]) {
+      format_freq(freq_text, sizeof(freq_text), band.freq_hz, false);
+      lv_label_set_text(screen.view.eq.labels[i + 6], freq_text);
     }
   }
+  refresh_preset_row(screen);
 }
 } // namespace
 
@@ -75,6 +209,7 @@ void build(UiScreen &screen) {
   screen.row_count = 0;
   screen.view.eq = {};
   screen.state.eq_editing = false;
+  screen.state.eq_field = 0;
   screen.view.eq = layout::create(screen.view.root.content);
 
   if (screen.view.root.content) {
@@ -88,25 +223,19 @@ void build(UiScreen &screen) {
   styles::apply_preset(screen.view.eq.preset);
   styles::apply_preset_value(screen.view.eq.preset_value);
 
-  for (int i = 0; i < kVisibleBands; ++i) {
-    int band = kBandMap[i];
+  for (int i = 0; i < kSliderSlots; ++i) {
     if (screen.view.eq.sliders[i]) {
       styles::apply_slider(screen.view.eq.sliders[i]);
       styles::apply_slider_selected(screen.view.eq.sliders[i]);
-      lv_slider_set_range(screen.view.eq.sliders[i], -12, 12);
+      lv_slider_set_range(screen.view.eq.sliders[i], app::eq::kMinBandDb,
+                          app::eq::kMaxBandDb);
       lv_slider_set_mode(screen.view.eq.sliders[i], LV_SLIDER_MODE_SYMMETRICAL);
-      lv_slider_set_value(screen.view.eq.sliders[i], app::eq::get_band(band),
-                          LV_ANIM_OFF);
     }
     if (screen.view.eq.value_labels[i]) {
       styles::apply_value_label(screen.view.eq.value_labels[i]);
-      char db_text[12] = {0};
-      format_db_label(db_text, sizeof(db_text), app::eq::get_band(band));
-      lv_label_set_text(screen.view.eq.value_labels[i], db_text);
     }
     if (screen.view.eq.labels[i]) {
       styles::apply_label(screen.view.eq.labels[i]);
-      lv_label_set_text(screen.view.eq.labels[i], kLeftLabels[i]);
       if (i == 0) {
         lv_obj_set_style_text_color(screen.view.eq.labels[i],
                                     lv_color_hex(0xffffff), LV_PART_MAIN);
@@ -120,7 +249,6 @@ void build(UiScreen &screen) {
     }
     if (screen.view.eq.labels[i + 6]) {
       styles::apply_label(screen.view.eq.labels[i + 6]);
-      lv_label_set_text(screen.view.eq.labels[i + 6], kBottomLabels[i]);
       lv_obj_set_style_text_color(screen.view.eq.labels[i + 6],
                                   lv_color_hex(0x9ba1a8), LV_PART_MAIN);
       lv_obj_set_style_text_align(screen.view.eq.labels[i + 6],
@@ -129,6 +257,7 @@ void build(UiScreen &screen) {
   }
 
   apply_selection(screen);
+  refresh_bands(screen);
   input::attach(screen, screen.view.eq.key_sink);
 }
 
@@ -136,19 +265,8 @@ void update(UiScreen &screen) {
   if (screen.state.current != PageId::Eq) {
     return;
   }
-  for (int i = 0; i < kVisibleBands; ++i) {
-    int band = kBandMap[i];
-    if (screen.view.eq.sliders[i]) {
-      lv_slider_set_value(screen.view.eq.sliders[i], app::eq::get_band(band),
-                          LV_ANIM_OFF);
-    }
-    if (screen.view.eq.value_labels[i]) {
-      char db_text[12] = {0};
-      format_db_label(db_text, sizeof(db_text), app::eq::get_band(band));
-      lv_label_set_text(screen.view.eq.value_labels[i], db_text);
-    }
-  }
   apply_selection(screen);
+  refresh_bands(screen);
 }
 
 } // namespace lofi::ui::screens::eq
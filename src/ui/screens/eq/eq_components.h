@@ -3,6 +3,17 @@
 #include "ui/lofibox/lofibox_components.h"
 
 namespace lofi::ui::screens::eq {
+// Settings Enter steps through while editing. Band columns use all four;
+// the preset row below them uses the first two as preset and band count.
+constexpr uint8_t kFieldGain = 0;
+constexpr uint8_t kFieldFreq = 1;
+constexpr uint8_t kFieldQ = 2;
+constexpr uint8_t kFieldType = 3;
+constexpr uint8_t kBandFields = 4;
+constexpr uint8_t kFieldPreset = 0;
+constexpr uint8_t kFieldBandCount = 1;
+constexpr uint8_t kPresetFields = 2;
+
 void build(UiScreen &screen);
 void update(UiScreen &screen);
 
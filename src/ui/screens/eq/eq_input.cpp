@@ -5,18 +5,99 @@
 
 namespace lofi::ui::screens::eq::input {
 namespace {
-constexpr int kVisibleBands = 6;
-const int kBandMap[kVisibleBands] = {0, 1, 2, 3, 4, 5};
+// Frequency steps follow the third-octave centres, Q a coarse ladder.
+const uint16_t kFreqSteps[] = {
+    20,   25,   31,   40,   50,   63,   80,   100,   125,   160,   200,
+    250,  315,  400,  500,  630,  800,  1000, 1250,  1600,  2000,  2500,
+    3150, 4000, 5000, 6300, 8000, 10000, 12500, 16000, 20000};
+const uint8_t kQSteps[] = {3, 5, 7, 10, 12, 14, 20, 30, 40, 60, 80, 100};
+
+// Next entry of steps above (delta > 0) or below value, clamped at the ends.
+template <typename T, size_t N>
+T step_value(const T (&steps)[N], T value, int delta) {
+  if (delta > 0) {
+    for (size_t i = 0; i < N; ++i) {
+      if (steps[i] > value) {
+        return steps[i];
+      }
+    }
+    return steps[N - 1];
+  }
+  for (size_t i = N; i > 0; --i) {
+    if (steps[i - 1] < value) {
+      return steps[i - 1];
+    }
+  }
+  return steps[0];
+}
+
+void step_band(int band, uint8_t field, int delta) {
+  app::eq::Band params = app::eq::get_band_params(band);
+  switch (field) {
+  case kFieldFreq:
+    params.freq_hz = step_value(kFreqSteps, params.freq_hz, delta);
+    break;
+  case kFieldQ:
+    params.q_x10 = step_value(kQSteps, params.q_x10, delta);
+    break;
+  case kFieldType: {
+    const int type = (static_cast<int>(params.type) + delta + 3) % 3;
+    params.type = static_cast<app::eq::BandType>(type);
+    break;
+  }
+  default:
+    params.gain_db = static_cast<int8_t>(params.gain_db + delta);
+    break;
+  }
+  app::eq::set_band_params(band, params);
+}
+
+void step_preset(int delta) {
+  int count = app::eq::preset_count();
+  if (count <= 0) {
+    return;
+  }
+  app::eq::set_preset((app::eq::get_preset() + delta + count) % count);
+}
+
+void step_band_count(int delta) {
+  int count = app::eq::band_count() + delta;
+  if (count < 1) {
+    count = 1;
+  }
+  if (count > app::eq::kMaxBands) {
+    count = app::eq::kMaxBands;
+  }
+  app::eq::set_band_count(count);
+}
+
+// Enter starts editing, then moves on through the fields of the selection
+// and finally leaves editing.
+void next_field(UiScreen &screen) {
+  if (!screen.state.eq_editing) {
+    screen.state.eq_editing = true;
+    screen.state.eq_field = 0;
+    return;
+  }
+  const bool preset_row =
+      screen.state.eq_selected_band >= app::eq::band_count();
+  const uint8_t fields = preset_row ? kPresetFields : kBandFields;
+  if (++screen.state.eq_field >= fields) {
+    screen.state.eq_editing = false;
+    screen.state.eq_field = 0;
+  }
+}
 
 void handle_key(UiScreen &screen, uint32_t key) {
   if (key == LV_KEY_ENTER) {
-    screen.state.eq_editing = !screen.state.eq_editing;
+    next_field(screen);
     update(screen);
     return;
   }
   if (key == LV_KEY_ESC || key == LV_KEY_BACKSPACE) {
     if (screen.state.eq_editing) {
       screen.state.eq_editing = false;
+      screen.state.eq_field = 0;
       update(screen);
       return;
     }
@@ -35,9 +116,17 @@ void handle_key(UiScreen &screen, uint32_t key) {
     }
     if (delta != 0) {
       int slot = screen.state.eq_selected_band;
-      int band = (slot >= 0 && slot < kVisibleBands) ? kBandMap[slot] : 0;
-      int8_t db = app::eq::get_band(band);
-      app::eq::set_band(band, static_cast<int8_t>(db + delta));
+      if (slot >= app::eq::band_count()) {
+        if (screen.state.eq_field == kFieldBandCount) {
+          step_band_count(delta);
+        } else {
+          step_preset(delta);
+        }
+        // the preset row stays selected when the band count changes
+        screen.state.eq_selected_band = app::eq::band_count();
+      } else if (slot >= 0) {
+        step_band(slot, screen.state.eq_field, delta);
+      }
       update(screen);
     }
     return;
@@ -54,8 +143,8 @@ void handle_key(UiScreen &screen, uint32_t key) {
     if (screen.state.eq_selected_band < 0) {
       screen.state.eq_selected_band = 0;
     }
-    if (screen.state.eq_selected_band >= kVisibleBands) {
-      screen.state.eq_selected_band = kVisibleBands - 1;
+    if (screen.state.eq_selected_band > app::eq::band_count()) {
+      screen.state.eq_selected_band = app::eq::band_count();
     }
     update(screen);
     return;
@@ -196,6 +196,9 @@ void apply_preset(lv_obj_t *obj) {
 
 void apply_preset_value(lv_obj_t *obj) {
   lv_obj_add_style(obj, &s_preset_value, LV_PART_MAIN);
+  lv_obj_add_style(obj, &s_value_label_checked,
+                   LV_PART_MAIN | LV_STATE_CHECKED);
+  lv_obj_add_style(obj, &s_value_label_edit, LV_PART_MAIN | LV_STATE_USER_1);
   lv_obj_set_style_pad_left(obj, 6, LV_PART_MAIN);
 }
 
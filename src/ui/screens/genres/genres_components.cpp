@@ -2,25 +2,32 @@
 #include "ui/common/sort_utils.h"
 
 namespace lofi::ui::screens::genres {
+namespace {
+void get_row(const UiScreen &screen, int index, ListRow &out) {
+  const int id = screen.scratch[index];
+  if (id >= screen.library->genre_count) {
+    return;
+  }
+  out.left = screen.library->genres[id];
+  out.action = UiIntentKind::OpenGenre;
+  out.next = PageId::Songs;
+  out.value = id;
+}
+} // namespace
+
 void populate(UiScreen &screen) {
   components::reset_items(screen);
-  if (!screen.library || screen.library->genre_count == 0) {
+  if (!screen.library || screen.library->genre_count == 0 ||
+      !screen.scratch) {
     components::add_item(screen, "No Genres", nullptr, UiIntentKind::None,
                          PageId::None);
     return;
   }
 
-  int idx[app::kMaxGenres];
-  for (int i = 0; i < screen.library->genre_count; ++i) {
-    idx[i] = i;
-  }
-  sort::string_indices(screen.library->genres, idx,
-                       screen.library->genre_count);
-
-  for (int i = 0; i < screen.library->genre_count; ++i) {
-    components::add_item(screen, screen.library->genres[idx[i]], "",
-                         UiIntentKind::OpenGenre, PageId::Songs, idx[i]);
-  }
+  const int count = sort::copy_order(screen.library->order.genres,
+                                     screen.library->genre_count,
+                                     screen.scratch, screen.scratch_size);
+  components::set_row_source(screen, get_row, count);
 }
 
 } // namespace lofi::ui::screens::genres
@@ -293,6 +293,9 @@ void build_list_page(UiScreen &screen, const BuildApi &api) {
   } else if (visible > screen.items_count) {
     visible = screen.items_count;
   }
+  if (visible > UiScreen::kMaxItems) {
+    visible = UiScreen::kMaxItems;
+  }
 
   screen.row_count = 0;
   for (int i = 0; i < visible; ++i) {
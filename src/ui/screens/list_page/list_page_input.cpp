@@ -1,5 +1,6 @@
 #include "ui/screens/list_page/list_page_input.h"
 
+#include "ui/lofibox/lofibox_components.h"
 #include "ui/screens/list_page/list_page_layout.h"
 #include "ui/screens/list_page/list_page_styles.h"
 
@@ -25,12 +26,14 @@ void apply_item_to_row(UiScreen &screen, RowMeta &meta, int item_index) {
     lv_obj_clear_flag(meta.row, LV_OBJ_FLAG_HIDDEN);
   }
 
-  ListItem &item = screen.items[item_index];
+  ListRow item;
+  components::list_row(screen, item_index, item);
   meta.intent.kind = item.action;
   meta.intent.next = item.next;
   meta.intent.value = item.value;
   meta.intent.value2 = item.value2;
-  meta.intent.item = &item;
+  meta.intent.left = item.left;
+  meta.intent.right = item.right;
 
   if (meta.icon) {
     bool show_icon = (item.icon != nullptr);
@@ -49,11 +52,10 @@ void apply_item_to_row(UiScreen &screen, RowMeta &meta, int item_index) {
   }
 
   if (meta.left_label) {
-    lv_label_set_text(meta.left_label, item.left.c_str());
+    lv_label_set_text(meta.left_label, item.left);
   }
 
-  const char *right_text =
-      item.right.length() > 0 ? item.right.c_str() : nullptr;
+  const char *right_text = item.right[0] != '\0' ? item.right : nullptr;
   if (!right_text) {
     switch (item.action) {
     case UiIntentKind::Navigate:
@@ -1,19 +1,32 @@
 #include "ui/screens/now_playing/now_playing_components.h"
 
+#include "board/spi_bus.h"
+#include "ui/common/cover_cache.h"
 #include "ui/screens/now_playing/now_playing_input.h"
 #include "ui/screens/now_playing/now_playing_layout.h"
 #include "ui/screens/now_playing/now_playing_styles.h"
 
-#include "src/libs/tjpgd/tjpgd.h"
 #include <Arduino.h>
 #include <SD.h>
 #include <cstring>
 #include <pngle.h>
+#include <rom/tjpgd.h>
 
 namespace lofi::ui::screens::now_playing {
 namespace {
-#if LV_USE_TJPGD
+// Covers use the TJpgDec in the ESP32-S3 ROM rather than LVGL's copy: the
+// ROM build has output scaling on, and LVGL builds its copy without it.
+// The ROM decoder hands out RGB888 in R, G, B order.
 constexpr size_t kJpegWorkBufSize = 8192;
+// A box stops taking samples at this count so its 16 bit sums cannot wrap.
+constexpr uint16_t kMaxBoxSamples = 256;
+
+struct BoxSum {
+  uint16_t r;
+  uint16_t g;
+  uint16_t b;
+  uint16_t n;
+};
 
 struct CoverDecodeCtx {
   File *file = nullptr;
@@ -25,9 +38,16 @@ struct CoverDecodeCtx {
   lv_coord_t buf_h = 0;
   lv_coord_t offset_x = 0;
   lv_coord_t offset_y = 0;
-  int scale_fp = 1024;
+  // Decoded pixel p lands on cover pixel p * dst_span / src_span.
+  int src_span = 1;
+  int dst_span = 1;
+  // Box sums for the cover rows the current MCU row can reach, used as a
+  // ring; null when the decoded image is not larger than the cover.
+  BoxSum *boxes = nullptr;
+  int box_rows = 0;
+  int next_row = 0;
+  int mcu_top = -1;
 };
-#endif
 
 void format_time(uint32_t seconds, char *out, size_t len, bool unknown) {
   if (unknown) {
@@ -78,7 +98,7 @@ bool find_cover_start(File &file, size_t pos, size_t size, size_t &image_pos,
     if (to_read > sizeof(buf)) {
       to_read = sizeof(buf);
     }
-    size_t rd = file.read(buf, to_read);
+    size_t rd = spibus::read(file, buf, to_read, spibus::Client::Cover);
     if (rd == 0) {
       break;
     }
@@ -124,8 +144,7 @@ void clear_cover_buffer(layout::NowPlayingLayout &view, uint16_t color) {
   }
 }
 
-#if LV_USE_TJPGD
-size_t cover_input(JDEC *jd, uint8_t *buf, size_t len) {
+uint32_t cover_input(JDEC *jd, uint8_t *buf, uint32_t len) {
   auto *ctx = static_cast<CoverDecodeCtx *>(jd ? jd->device : nullptr);
   if (!ctx || !ctx->file || !(*ctx->file)) {
     return 0;
@@ -133,9 +152,9 @@ size_t cover_input(JDEC *jd, uint8_t *buf, size_t len) {
   if (ctx->pos >= ctx->size) {
     return 0;
   }
-  size_t remaining = ctx->size - ctx->pos;
+  const size_t remaining = ctx->size - ctx->pos;
   if (len > remaining) {
-    len = remaining;
+    len = static_cast<uint32_t>(remaining);
   }
 
   if (!buf) {
@@ -144,12 +163,37 @@ size_t cover_input(JDEC *jd, uint8_t *buf, size_t len) {
     return len;
   }
 
-  size_t rd = ctx->file->read(buf, len);
+  size_t rd = spibus::read(*ctx->file, buf, len, spibus::Client::Cover);
   ctx->pos += rd;
-  return rd;
+  return static_cast<uint32_t>(rd);
+}
+
+int cover_map(const CoverDecodeCtx &ctx, int src) {
+  return (src * ctx.dst_span) / ctx.src_span;
+}
+
+// Writes out the averaged cover rows before `end`, which no later MCU row
+// can add to, and clears their boxes for reuse.
+void flush_cover_rows(CoverDecodeCtx &ctx, int end) {
+  if (end > ctx.buf_h) {
+    end = ctx.buf_h;
+  }
+  for (; ctx.next_row < end; ++ctx.next_row) {
+    BoxSum *box = &ctx.boxes[(ctx.next_row % ctx.box_rows) * ctx.buf_w];
+    uint16_t *dst = &ctx.buf[ctx.next_row * ctx.buf_w];
+    for (int x = 0; x < ctx.buf_w; ++x, ++box) {
+      const uint16_t n = box->n;
+      if (n != 0) {
+        dst[x] = rgb565_from_rgb(static_cast<uint8_t>((box->r + n / 2) / n),
+                                 static_cast<uint8_t>((box->g + n / 2) / n),
+                                 static_cast<uint8_t>((box->b + n / 2) / n));
+      }
+      *box = BoxSum{};
+    }
+  }
 }
 
-int cover_output(JDEC *jd, void *data, JRECT *rect) {
+uint32_t cover_output(JDEC *jd, void *data, JRECT *rect) {
   auto *ctx = static_cast<CoverDecodeCtx *>(jd ? jd->device : nullptr);
   if (!ctx || !data || !rect || !ctx->buf) {
     return 0;
@@ -158,25 +202,75 @@ int cover_output(JDEC *jd, void *data, JRECT *rect) {
   int rect_w = static_cast<int>(rect->right - rect->left + 1);
   int rect_h = static_cast<int>(rect->bottom - rect->top + 1);
 
+  if (ctx->boxes) {
+    // MCUs arrive in raster order, so a new MCU row finishes every cover
+    // row that lies wholly above it.
+    if (rect->top != ctx->mcu_top) {
+      ctx->mcu_top = rect->top;
+      flush_cover_rows(*ctx, cover_map(*ctx, rect->top) - ctx->offset_y);
+    }
+    for (int y = 0; y < rect_h; ++y) {
+      int dst_y = cover_map(*ctx, rect->top + y) - ctx->offset_y;
+      if (dst_y < 0 || dst_y >= ctx->buf_h) {
+        src += rect_w * 3;
+        continue;
+      }
+      BoxSum *row = &ctx->boxes[(dst_y % ctx->box_rows) * ctx->buf_w];
+      for (int x = 0; x < rect_w; ++x, src += 3) {
+        int dst_x = cover_map(*ctx, rect->left + x) - ctx->offset_x;
+        if (dst_x < 0 || dst_x >= ctx->buf_w) {
+          continue;
+        }
+        BoxSum &box = row[dst_x];
+        if (box.n < kMaxBoxSamples) {
+          box.r += src[0];
+          box.g += src[1];
+          box.b += src[2];
+          ++box.n;
+        }
+      }
+    }
+    return 1;
+  }
+
+  // Not larger than the cover: each decoded pixel fills the cover pixels up
+  // to where the next one starts.
   for (int y = 0; y < rect_h; ++y) {
-    for (int x = 0; x < rect_w; ++x) {
-      uint8_t b = *src++;
-      uint8_t g = *src++;
-      uint8_t r = *src++;
+    int src_y = static_cast<int>(rect->top) + y;
+    int y0 = cover_map(*ctx, src_y) - ctx->offset_y;
+    int y1 = cover_map(*ctx, src_y + 1) - ctx->offset_y;
+    if (y1 <= y0) {
+      y1 = y0 + 1;
+    }
+    for (int x = 0; x < rect_w; ++x, src += 3) {
       int src_x = static_cast<int>(rect->left) + x;
-      int src_y = static_cast<int>(rect->top) + y;
-      int dst_x = (src_x * 1024) / ctx->scale_fp - ctx->offset_x;
-      int dst_y = (src_y * 1024) / ctx->scale_fp - ctx->offset_y;
-      if (dst_x < 0 || dst_y < 0 || dst_x >= ctx->buf_w ||
-          dst_y >= ctx->buf_h) {
-        continue;
+      int x0 = cover_map(*ctx, src_x) - ctx->offset_x;
+      int x1 = cover_map(*ctx, src_x + 1) - ctx->offset_x;
+      if (x1 <= x0) {
+        x1 = x0 + 1;
+      }
+      uint16_t color = rgb565_from_rgb(src[0], src[1], src[2]);
+      for (int dy = (y0 < 0) ? 0 : y0; dy < y1 && dy < ctx->buf_h; ++dy) {
+        for (int dx = (x0 < 0) ? 0 : x0; dx < x1 && dx < ctx->buf_w; ++dx) {
+          ctx->buf[dy * ctx->buf_w + dx] = color;
+        }
       }
-      ctx->buf[dst_y * ctx->buf_w + dst_x] = rgb565_from_rgb(r, g, b);
     }
   }
   return 1;
 }
 
+// Largest TJpgDec output scale (1/2^n) that still leaves the short side at
+// least `target` pixels; the box filter takes care of the rest.
+uint8_t pick_jpeg_scale(const JDEC &jd, int target) {
+  int short_side = (jd.width < jd.height) ? jd.width : jd.height;
+  uint8_t scale = 0;
+  while (scale < 3 && (short_side >> (scale + 1)) >= target) {
+    ++scale;
+  }
+  return scale;
+}
+
 bool decode_cover_jpeg(layout::NowPlayingLayout &view, File &file, size_t pos,
                        size_t len) {
   if (!view.cover_buf || view.cover_size <= 0 || !file || len == 0) {
@@ -188,6 +282,7 @@ bool decode_cover_jpeg(layout::NowPlayingLayout &view, File &file, size_t pos,
     return false;
   }
 
+  const uint32_t start_us = micros();
   CoverDecodeCtx ctx{};
   ctx.file = &file;
   ctx.start = pos;
@@ -200,7 +295,7 @@ bool decode_cover_jpeg(layout::NowPlayingLayout &view, File &file, size_t pos,
   file.seek(pos);
   JDEC jd{};
   JRESULT rc = jd_prepare(&jd, cover_input, work, kJpegWorkBufSize, &ctx);
-  if (rc != JDR_OK) {
+  if (rc != JDR_OK || jd.width == 0 || jd.height == 0) {
     Serial.printf("[COVER] jpeg prepare fail rc=%d pos=%u len=%u\n",
                   static_cast<int>(rc), static_cast<unsigned>(pos),
                   static_cast<unsigned>(len));
@@ -208,42 +303,32 @@ bool decode_cover_jpeg(layout::NowPlayingLayout &view, File &file, size_t pos,
     return false;
   }
 
-  uint8_t scale = 0;
-  int scale_fp = 1024;
-  int ratio_w = (jd.width > 0 && view.cover_size > 0)
-                    ? static_cast<int>((static_cast<int64_t>(jd.width) * 1024) /
-                                       view.cover_size)
-                    : 1024;
-  int ratio_h =
-      (jd.height > 0 && view.cover_size > 0)
-          ? static_cast<int>((static_cast<int64_t>(jd.height) * 1024) /
-                             view.cover_size)
-          : 1024;
-  scale_fp = (ratio_w < ratio_h) ? ratio_w : ratio_h;
-  if (scale_fp <= 0) {
-    scale_fp = 1024;
-  }
-#if JD_USE_SCALE == 0
-  scale = 0;
-#endif
-  ctx.scale_fp = scale_fp;
-  lv_coord_t dec_w = static_cast<lv_coord_t>(
-      (static_cast<int64_t>(jd.width) * 1024 + scale_fp - 1) / scale_fp);
-  lv_coord_t dec_h = static_cast<lv_coord_t>(
-      (static_cast<int64_t>(jd.height) * 1024 + scale_fp - 1) / scale_fp);
-  if (dec_w < 1) {
-    dec_w = 1;
-  }
-  if (dec_h < 1) {
-    dec_h = 1;
-  }
-  ctx.offset_x = (dec_w - view.cover_size) / 2;
-  ctx.offset_y = (dec_h - view.cover_size) / 2;
-  if (ctx.offset_x < 0) {
-    ctx.offset_x = 0;
-  }
-  if (ctx.offset_y < 0) {
-    ctx.offset_y = 0;
+  // Crop to fill the square cover, as before, but from the image TJpgDec
+  // hands out at the chosen scale.
+  const uint8_t scale = pick_jpeg_scale(jd, view.cover_size);
+  const int round = (1 << scale) - 1;
+  const int dec_w = (jd.width + round) >> scale;
+  const int dec_h = (jd.height + round) >> scale;
+  ctx.src_span = (dec_w < dec_h) ? dec_w : dec_h;
+  ctx.dst_span = view.cover_size;
+  ctx.offset_x =
+      static_cast<lv_coord_t>((cover_map(ctx, dec_w) - view.cover_size) / 2);
+  ctx.offset_y =
+      static_cast<lv_coord_t>((cover_map(ctx, dec_h) - view.cover_size) / 2);
+
+  if (ctx.src_span > ctx.dst_span) {
+    // One MCU row covers at most this many cover rows, plus the row it
+    // shares with the MCU row above.
+    int mcu_rows = (jd.msy * 8) >> scale;
+    ctx.box_rows = ((mcu_rows > 0) ? mcu_rows : 1) + 1;
+    size_t box_bytes = sizeof(BoxSum) * static_cast<size_t>(ctx.box_rows) *
+                       static_cast<size_t>(ctx.buf_w);
+    ctx.boxes = static_cast<BoxSum *>(lv_malloc(box_bytes));
+    if (!ctx.boxes) {
+      lv_free(work);
+      return false;
+    }
+    memset(ctx.boxes, 0, box_bytes);
   }
 
   rc = jd_decomp(&jd, cover_output, scale);
@@ -251,20 +336,21 @@ bool decode_cover_jpeg(layout::NowPlayingLayout &view, File &file, size_t pos,
     Serial.printf("[COVER] jpeg decomp fail rc=%d pos=%u len=%u\n",
                   static_cast<int>(rc), static_cast<unsigned>(pos),
                   static_cast<unsigned>(len));
-  }
+  } else {
+    if (ctx.boxes) {
+      flush_cover_rows(ctx, ctx.buf_h);
+    }
+    Serial.printf("[COVER] jpeg %ux%u 1/%u -> %d in %lu us, read %u bytes\n",
+                  static_cast<unsigned>(jd.width),
+                  static_cast<unsigned>(jd.height), 1u << scale,
+                  static_cast<int>(view.cover_size),
+                  static_cast<unsigned long>(micros() - start_us),
+                  static_cast<unsigned>(ctx.pos));
+  }
+  lv_free(ctx.boxes);
   lv_free(work);
   return (rc == JDR_OK);
 }
-#else
-bool decode_cover_jpeg(layout::NowPlayingLayout &view, File &file, size_t pos,
-                       size_t len) {
-  (void)view;
-  (void)file;
-  (void)pos;
-  (void)len;
-  return false;
-}
-#endif
 
 struct CoverScale {
   int scale = 1024;
@@ -300,7 +386,8 @@ bool decode_cover_bmp(layout::NowPlayingLayout &view, File &file, size_t pos,
 
   uint8_t header[54] = {};
   file.seek(pos);
-  if (file.read(header, sizeof(header)) != sizeof(header)) {
+  if (spibus::read(file, header, sizeof(header), spibus::Client::Cover) !=
+      sizeof(header)) {
     return false;
   }
   if (header[0] != 'B' || header[1] != 'M') {
@@ -352,7 +439,8 @@ bool decode_cover_bmp(layout::NowPlayingLayout &view, File &file, size_t pos,
     uint32_t row_pos = static_cast<uint32_t>(
         pos + off_bits + static_cast<uint32_t>(file_row) * row_size);
     file.seek(row_pos);
-    if (file.read(row, row_size) != row_size) {
+    if (spibus::read(file, row, row_size, spibus::Client::Cover) !=
+        row_size) {
       lv_free(row);
       return false;
     }
@@ -465,7 +553,8 @@ bool decode_cover_png(layout::NowPlayingLayout &view, File &file, size_t pos,
     if (to_read > remaining) {
       to_read = remaining;
     }
-    size_t rd = file.read(buf + cached, to_read);
+    size_t rd =
+        spibus::read(file, buf + cached, to_read, spibus::Client::Cover);
     if (rd == 0) {
       ok = false;
       break;
@@ -503,6 +592,15 @@ bool decode_cover_png(layout::NowPlayingLayout &view, File &file, size_t pos,
   return ok;
 }
 
+void log_cover_cache(const char *how, uint32_t ms) {
+  const cover::CacheStats &stats = cover::cache_stats();
+  Serial.printf("[COVER] %s in %lu ms (hits %lu, card %lu, misses %lu)\n", how,
+                static_cast<unsigned long>(ms),
+                static_cast<unsigned long>(stats.hits),
+                static_cast<unsigned long>(stats.card_hits),
+                static_cast<unsigned long>(stats.misses));
+}
+
 void update_cover(UiScreen &screen) {
   if (!screen.player || !screen.library) {
     return;
@@ -528,6 +626,16 @@ void update_cover(UiScreen &screen) {
 
   const app::TrackInfo &track =
       screen.library->tracks[screen.player->current_index];
+  const uint32_t start_ms = millis();
+  const uint32_t key =
+      cover::cache_key(track, screen.player->cover_len, view.cover_size);
+  if (cover::cache_lookup(key, view.cover_size, view.cover_buf)) {
+    lv_obj_invalidate(view.cover);
+    lv_obj_clear_flag(view.cover, LV_OBJ_FLAG_HIDDEN);
+    log_cover_cache("cached", millis() - start_ms);
+    return;
+  }
+
   File f = SD.open(track.path ? track.path : "", FILE_READ);
   if (!f) {
     clear_cover_buffer(view, bg);
@@ -572,7 +680,9 @@ void update_cover(UiScreen &screen) {
   lv_obj_invalidate(view.cover);
 
   if (ok) {
+    cover::cache_store(key, view.cover_size, view.cover_buf);
     lv_obj_clear_flag(view.cover, LV_OBJ_FLAG_HIDDEN);
+    log_cover_cache("decoded", millis() - start_ms);
   } else {
     Serial.printf("[COVER] decode failed fmt=%d pos=%u len=%u\n",
                   static_cast<int>(fmt), static_cast<unsigned>(image_pos),
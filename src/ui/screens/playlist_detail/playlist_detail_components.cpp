@@ -18,30 +18,50 @@ int build_playlist_tracks(UiScreen &screen) {
     return screen.playlist_count;
   }
 
-  for (int i = 0; i < screen.library->track_count &&
-                  screen.playlist_count < app::kMaxPlaylistTracks;
-       ++i) {
-    screen.playlist_tracks[screen.playlist_count++] = i;
-  }
-
+  // Smart playlists are the head of the library's cached orders.
+  const app::LibraryOrders &order = screen.library->order;
+  const app::SortOrder *source = nullptr;
   switch (screen.state.current_playlist) {
   case 1:
-    sort::tracks_by_added(*screen.library, screen.playlist_tracks,
-                          screen.playlist_count);
+    source = &order.added;
     break;
   case 2:
-    sort::tracks_by_play_count(*screen.library, screen.playlist_tracks,
-                               screen.playlist_count);
+    source = &order.play_count;
     break;
   case 3:
-    sort::tracks_by_last_played(*screen.library, screen.playlist_tracks,
-                                screen.playlist_count);
+    source = &order.last_played;
     break;
   default:
     break;
   }
+  if (source) {
+    screen.playlist_count =
+        sort::copy_order(*source, screen.library->track_count,
+                         screen.playlist_tracks, app::kMaxPlaylistTracks);
+  } else {
+    for (int i = 0; i < screen.library->track_count &&
+                    screen.playlist_count < app::kMaxPlaylistTracks;
+         ++i) {
+      if (app::library_track_live(*screen.library, i)) {
+        screen.playlist_tracks[screen.playlist_count++] = i;
+      }
+    }
+  }
   return screen.playlist_count;
 }
+
+void get_row(const UiScreen &screen, int index, ListRow &out) {
+  const int id = screen.playlist_tracks[index];
+  if (!app::library_track_live(*screen.library, id)) {
+    return;
+  }
+  const app::TrackInfo &track = screen.library->tracks[id];
+  out.left = track.title;
+  out.right = track.artist;
+  out.action = UiIntentKind::PlayTrack;
+  out.next = PageId::NowPlaying;
+  out.value = id;
+}
 } // namespace
 
 void populate(UiScreen &screen) {
@@ -51,16 +71,7 @@ void populate(UiScreen &screen) {
                          PageId::None);
     return;
   }
-
-  for (int i = 0; i < screen.playlist_count; ++i) {
-    int idx = screen.playlist_tracks[i];
-    if (idx < 0 || idx >= screen.library->track_count) {
-      continue;
-    }
-    const app::TrackInfo &track = screen.library->tracks[idx];
-    components::add_item(screen, track.title, track.artist,
-                         UiIntentKind::PlayTrack, PageId::NowPlaying, idx);
-  }
+  components::set_row_source(screen, get_row, screen.playlist_count);
 }
 
 } // namespace lofi::ui::screens::playlist_detail
@@ -2,42 +2,81 @@
 #include "ui/common/sort_utils.h"
 
 namespace lofi::ui::screens::songs {
+namespace {
+void fill_row(const app::Library &lib, int id, ListRow &out) {
+  if (!app::library_track_live(lib, id)) {
+    return;
+  }
+  out.left = lib.tracks[id].title;
+  out.action = UiIntentKind::PlayTrack;
+  out.next = PageId::NowPlaying;
+  out.value = id;
+}
+
+void get_row(const UiScreen &screen, int index, ListRow &out) {
+  fill_row(*screen.library, screen.scratch[index], out);
+}
+
+// All songs reads the title order in place; nothing is copied per open.
+void get_title_row(const UiScreen &screen, int index, ListRow &out) {
+  const app::SortOrder &order = screen.library->order.title;
+  if (!order.ids || index >= order.count) {
+    return;
+  }
+  fill_row(*screen.library, order.ids[index], out);
+}
+} // namespace
+
 void populate(UiScreen &screen) {
   components::reset_items(screen);
-  if (!screen.library || screen.library->track_count == 0) {
+  if (!screen.library || screen.library->track_count == 0 ||
+      !screen.scratch) {
     components::add_item(screen, "No Songs", nullptr, UiIntentKind::None,
                          PageId::None);
     return;
   }
 
-  int idx[app::kMaxTracks];
+  if (screen.state.song_context == SongContext::All) {
+    const int count = screen.library->order.title.ids
+                          ? screen.library->order.title.count
+                          : 0;
+    if (count == 0) {
+      components::add_item(screen, "No Songs", nullptr, UiIntentKind::None,
+                           PageId::None);
+      return;
+    }
+    Serial.printf("[SONGS] context=%d count=%d\n",
+                  static_cast<int>(screen.state.song_context), count);
+    components::set_row_source(screen, get_title_row, count);
+    return;
+  }
+
+  const uint32_t start_us = micros();
+  int *idx = screen.scratch;
+  const int max = screen.scratch_size;
   int count = 0;
 
   switch (screen.state.song_context) {
   case SongContext::Artist:
     count = app::library_tracks_for_artist(
-        *screen.library, screen.state.selected_artist, idx, app::kMaxTracks);
+        *screen.library, screen.state.selected_artist, idx, max);
     break;
   case SongContext::Album: {
     String artist = screen.state.selected_album_artist;
-    count = app::library_tracks_for_album(*screen.library, artist,
-                                          screen.state.selected_album, idx,
-                                          app::kMaxTracks);
+    count = app::library_tracks_for_album(
+        *screen.library, artist, screen.state.selected_album, idx, max);
     break;
   }
   case SongContext::Genre:
     count = app::library_tracks_for_genre(
-        *screen.library, screen.state.selected_genre, idx, app::kMaxTracks);
+        *screen.library, screen.state.selected_genre, idx, max);
     break;
   case SongContext::Composer:
     count = app::library_tracks_for_composer(
-        *screen.library, screen.state.selected_composer, idx, app::kMaxTracks);
+        *screen.library, screen.state.selected_composer, idx, max);
     break;
   case SongContext::All:
   default:
-    for (int i = 0; i < screen.library->track_count; ++i) {
-      idx[count++] = i;
-    }
     break;
   }
 
@@ -48,6 +87,7 @@ void populate(UiScreen &screen) {
   }
 
   sort::track_indices_by_title(*screen.library, idx, count);
+  const uint32_t sort_us = micros() - start_us;
 
   bool has_zero = false;
   for (int i = 0; i < count; ++i) {
@@ -56,18 +96,15 @@ void populate(UiScreen &screen) {
       break;
     }
   }
-  Serial.printf("[SONGS] context=%d count=%d has_idx0=%d first=\"%s\"\n",
+  Serial.printf("[SONGS] context=%d count=%d has_idx0=%d sort=%lu us "
+                "first=\"%s\"\n",
                 static_cast<int>(screen.state.song_context), count,
-                has_zero ? 1 : 0,
+                has_zero ? 1 : 0, static_cast<unsigned long>(sort_us),
                 (count > 0 && screen.library->tracks[idx[0]].title)
                     ? screen.library->tracks[idx[0]].title
                     : "");
 
-  for (int i = 0; i < count; ++i) {
-    const app::TrackInfo &track = screen.library->tracks[idx[i]];
-    components::add_item(screen, track.title, "", UiIntentKind::PlayTrack,
-                         PageId::NowPlaying, idx[i]);
-  }
+  components::set_row_source(screen, get_row, count);
 }
 
 } // namespace lofi::ui::screens::songs
@@ -0,0 +1,16 @@
+// Minimal assertions for the host tests: report and keep going, then
+// return the failure count from main().
+#pragma once
+
+#include <cstdio>
+
+static int g_failures = 0;
+
+#define CHECK(cond)                                                            \
+  do {                                                                         \
+    if (!(cond)) {                                                             \
+      std::fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__,    \
+                   #cond);                                                     \
+      ++g_failures;                                                            \
+    }                                                                          \
+  } while (0)
@@ -0,0 +1,112 @@
+// Cover thumbnail store: thumbnails come back from the card once they have
+// left the PSRAM cache, the store stays under its file cap however many
+// albums are played, and files from an older format are replaced rather
+// than shown.
+#include <SD.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "check.h"
+#include "ui/common/cover_cache.h"
+
+// The library's FNV-1a, without building the library around it.
+namespace app {
+uint32_t library_hash(const void *data, size_t len, uint32_t hash) {
+  const uint8_t *p = static_cast<const uint8_t *>(data);
+  for (size_t i = 0; i < len; ++i) {
+    hash ^= p[i];
+    hash *= 16777619u;
+  }
+  return hash;
+}
+} // namespace app
+
+using namespace lofi::ui::cover;
+
+namespace {
+
+constexpr int kSize = 8;
+constexpr int kPixels = kSize * kSize;
+constexpr uint32_t kAlbums = 600;
+constexpr int kStoreMaxFiles = 256;
+
+void fill(uint32_t key, uint16_t *px) {
+  for (int i = 0; i < kPixels; ++i) {
+    px[i] = static_cast<uint16_t>(key * 31 + i);
+  }
+}
+
+int store_files() {
+  int n = 0;
+  File dir = SD.open("/.lofibox_covers");
+  for (File f = dir.openNextFile(); f; f = dir.openNextFile()) {
+    ++n;
+  }
+  return n;
+}
+
+void test_bounded_store() {
+  uint16_t px[kPixels];
+  int most = 0;
+  for (uint32_t key = 1; key <= kAlbums; ++key) {
+    fill(key, px);
+    cache_store(key, kSize, px);
+    const int n = store_files();
+    most = n > most ? n : most;
+  }
+  std::printf("store peaked at %d files for %u albums\n", most, kAlbums);
+  CHECK(most <= kStoreMaxFiles);
+  CHECK(most > kStoreMaxFiles / 2);
+
+  // Recent albums are still on the card after leaving PSRAM.
+  const uint32_t card_hits = cache_stats().card_hits;
+  uint16_t got[kPixels];
+  uint16_t want[kPixels];
+  fill(kAlbums - 20, want);
+  CHECK(cache_lookup(kAlbums - 20, kSize, got));
+  CHECK(memcmp(got, want, sizeof(got)) == 0);
+  CHECK(cache_stats().card_hits == card_hits + 1);
+}
+
+// A thumbnail left by the format before versioned headers: magic, key and
+// size, then pixels that no longer match what the decoder produces.
+void test_stale_file() {
+  const uint32_t key = 0xABCD1234u;
+  const uint32_t header[3] = {0x4342464Cu, key, kSize};
+  char path[40];
+  std::snprintf(path, sizeof(path), "/.lofibox_covers/%08lx.rgb",
+                static_cast<unsigned long>(key));
+  File f = SD.open(path, FILE_WRITE);
+  f.write(reinterpret_cast<const uint8_t *>(header), sizeof(header));
+  uint16_t old_px[kPixels] = {};
+  f.write(reinterpret_cast<const uint8_t *>(old_px), sizeof(old_px));
+  f.close();
+
+  uint16_t got[kPixels];
+  CHECK(!cache_lookup(key, kSize, got));
+  CHECK(!SD.exists(path));
+
+  uint16_t px[kPixels];
+  fill(key, px);
+  cache_store(key, kSize, px);
+  CHECK(SD.exists(path));
+  // Push it out of PSRAM so the next lookup has to read the card.
+  for (uint32_t other = 1; other <= 10; ++other) {
+    cache_store(other, kSize, px);
+  }
+  const uint32_t card_hits = cache_stats().card_hits;
+  CHECK(cache_lookup(key, kSize, got));
+  CHECK(memcmp(got, px, sizeof(px)) == 0);
+  CHECK(cache_stats().card_hits == card_hits + 1);
+}
+
+} // namespace
+
+int main() {
+  test_bounded_store();
+  test_stale_file();
+  std::printf("%d failures\n", g_failures);
+  return g_failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
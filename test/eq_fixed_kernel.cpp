@@ -0,0 +1,16 @@
+// eq_dsp.cpp built with -DEQ_FIXED_POINT, the Q30 kernel of targets without
+// an FPU, renamed to app::eq_fixed so that it links next to the float build.
+// Every header it shares with the rest of the program is included first, so
+// the rename reaches only the EQ's own code.
+#include <Arduino.h>
+#include <Preferences.h>
+
+#include <atomic>
+#include <ctype.h>
+#include <math.h>
+#include <string.h>
+
+#define EQ_FIXED_POINT 1
+#define eq eq_fixed
+#include "app/eq_dsp.cpp"
+#include "app/eq_presets.cpp"
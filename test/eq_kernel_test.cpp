@@ -0,0 +1,225 @@
+// The float EQ kernel against the Q30 kernel it replaced on FPU targets: the
+// same layout over the same three-tone signal must come out of both within a
+// few 16 bit LSBs, and no further from a double precision cascade than
+// the Q30 kernel is. Also reports what each costs per stereo frame on the
+// host, where 64 bit multiplies are cheap; dspCycles in the [I2S] stats line
+// is the number that counts on the board.
+#include <Arduino.h>
+#include <Preferences.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#include "app/eq_dsp.h"
+#include "check.h"
+
+// eq_fixed_kernel.cpp
+namespace app::eq_fixed {
+void init();
+void load_settings();
+void set_sample_rate(uint32_t sample_rate);
+void process_block(int32_t *buffer, uint16_t frames, uint32_t sample_rate);
+} // namespace app::eq_fixed
+
+using namespace app;
+
+namespace {
+
+constexpr uint16_t kBlock = 512;
+constexpr int kBlocks = 2000;
+constexpr int kSettleBlocks = 20; // ramp and filter transients
+constexpr double kLsb = 4096.0;   // one 16 bit step, see Audio::DSP_SHIFT
+// Rounding noise of either kernel, mostly the 80 Hz shelf's: its poles sit
+// close to 1, so each rounding error circulates for a long time.
+constexpr double kMatchLsb = 4.0;
+
+using Clock = std::chrono::steady_clock;
+
+// Both shelves, cuts and boosts, a band at 0 dB and a preamp.
+void set_layout(uint32_t rate) {
+  Preferences::clear_all();
+  eq::init();
+  eq::set_band_count(6);
+  eq::set_band_params(0, {eq::BandType::LowShelf, 80, 7, 5});
+  eq::set_band_params(1, {eq::BandType::Peaking, 250, 10, -3});
+  eq::set_band_params(2, {eq::BandType::Peaking, 1000, 14, 4});
+  eq::set_band_params(3, {eq::BandType::Peaking, 3000, 20, -6});
+  eq::set_band_params(4, {eq::BandType::Peaking, 6000, 12, 0});
+  eq::set_band_params(5, {eq::BandType::HighShelf, 10000, 7, 6});
+  eq::set_preamp(-4);
+  eq::set_sample_rate(rate);
+  g_host_millis += 5000; // past the save delay
+  eq::tick();
+  CHECK(eq::is_enabled());
+
+  // The Q30 build picks the layout up from storage, as after a reboot.
+  eq_fixed::init();
+  eq_fixed::set_sample_rate(rate);
+  eq_fixed::load_settings();
+}
+
+// The same RBJ designs run in double as a plain direct form I cascade.
+struct Reference {
+  struct Stage {
+    double b0, b1, b2, a1, a2;
+    double x1[2] = {}, x2[2] = {}, y1[2] = {}, y2[2] = {};
+  };
+  std::vector<Stage> stages;
+  double preamp = 1.0;
+
+  explicit Reference(uint32_t rate) {
+    const eq::Settings s = eq::get_settings();
+    preamp = std::pow(10.0, s.preamp_db / 20.0);
+    for (int i = 0; i < s.band_count; ++i) {
+      const eq::Band &b = s.bands[i];
+      if (b.gain_db != 0) {
+        stages.push_back(design(b, rate));
+      }
+    }
+  }
+
+  // Designed in float like eq_dsp.cpp, so that only the cascade's own
+  // arithmetic differs.
+  static Stage design(const eq::Band &b, uint32_t rate) {
+    const float freq = std::min(static_cast<float>(b.freq_hz), 0.45f * rate);
+    const float w0 = 2 * static_cast<float>(M_PI) * (freq / rate);
+    const float c = cosf(w0);
+    const float alpha = sinf(w0) / (2 * static_cast<float>(b.q_x10) / 10);
+    const float A = powf(10, b.gain_db / 40.0f);
+    const float k = 2 * powf(10, b.gain_db / 80.0f) * alpha;
+    float b0, b1, b2, a0, a1, a2;
+    if (b.type == eq::BandType::Peaking) {
+      b0 = 1 + alpha * A;
+      b1 = -2 * c;
+      b2 = 1 - alpha * A;
+      a0 = 1 + alpha / A;
+      a1 = -2 * c;
+      a2 = 1 - alpha / A;
+    } else if (b.type == eq::BandType::LowShelf) {
+      b0 = A * ((A + 1) - (A - 1) * c + k);
+      b1 = 2 * A * ((A - 1) - (A + 1) * c);
+      b2 = A * ((A + 1) - (A - 1) * c - k);
+      a0 = (A + 1) + (A - 1) * c + k;
+      a1 = -2 * ((A - 1) + (A + 1) * c);
+      a2 = (A + 1) + (A - 1) * c - k;
+    } else {
+      b0 = A * ((A + 1) + (A - 1) * c + k);
+      b1 = -2 * A * ((A - 1) + (A + 1) * c);
+      b2 = A * ((A + 1) + (A - 1) * c - k);
+      a0 = (A + 1) - (A - 1) * c + k;
+      a1 = 2 * ((A - 1) - (A + 1) * c);
+      a2 = (A + 1) - (A - 1) * c - k;
+    }
+    const float inv_a0 = 1 / a0;
+    return {b0 * inv_a0, b1 * inv_a0, b2 * inv_a0, a1 * inv_a0, a2 * inv_a0};
+  }
+
+  double run(double x, int ch) {
+    x *= preamp;
+    for (Stage &s : stages) {
+      const double y = s.b0 * x + s.b1 * s.x1[ch] + s.b2 * s.x2[ch] -
+                       s.a1 * s.y1[ch] - s.a2 * s.y2[ch];
+      s.x2[ch] = s.x1[ch];
+      s.x1[ch] = x;
+      s.y2[ch] = s.y1[ch];
+      s.y1[ch] = y;
+      x = y;
+    }
+    return x;
+  }
+};
+
+// Bass, mid and treble tones, a different mix on each channel, peaking near
+// half of the 16 bit range.
+void fill_block(int32_t *buf, int block, uint32_t rate) {
+  for (int i = 0; i < kBlock; ++i) {
+    const double t = static_cast<double>(block * kBlock + i) / rate;
+    const double bass = std::sin(2 * M_PI * 95 * t);
+    const double mid = std::sin(2 * M_PI * 1020 * t);
+    const double treble = std::sin(2 * M_PI * 7300 * t);
+    const double l = 6000 * bass + 5000 * mid + 3000 * treble;
+    const double r = 3000 * bass + 5000 * mid + 6000 * treble;
+    buf[2 * i] = static_cast<int32_t>(l) << 12;
+    buf[2 * i + 1] = static_cast<int32_t>(r) << 12;
+  }
+}
+
+struct Error {
+  double sum_sq = 0;
+  double max = 0;
+  long count = 0;
+
+  void add(double diff) {
+    sum_sq += diff * diff;
+    max = std::max(max, std::fabs(diff));
+    ++count;
+  }
+  double rms() const { return count ? std::sqrt(sum_sq / count) : 0; }
+};
+
+void compare_kernels(uint32_t rate) {
+  set_layout(rate);
+  Reference ref(rate);
+  CHECK(ref.stages.size() == 5);
+
+  int32_t in[kBlock * 2];
+  int32_t fl[kBlock * 2];
+  int32_t fx[kBlock * 2];
+  Clock::duration float_time{};
+  Clock::duration fixed_time{};
+  Error float_fixed, float_ref, fixed_ref;
+  double changed = 0;
+  for (int block = 0; block < kBlocks; ++block) {
+    fill_block(in, block, rate);
+    std::copy(in, in + kBlock * 2, fl);
+    std::copy(in, in + kBlock * 2, fx);
+    auto start = Clock::now();
+    eq::process_block(fl, kBlock, rate);
+    float_time += Clock::now() - start;
+    start = Clock::now();
+    eq_fixed::process_block(fx, kBlock, rate);
+    fixed_time += Clock::now() - start;
+
+    for (int i = 0; i < kBlock * 2; ++i) {
+      const double want = ref.run(in[i], i & 1);
+      if (block < kSettleBlocks) {
+        continue;
+      }
+      float_fixed.add((static_cast<double>(fl[i]) - fx[i]) / kLsb);
+      float_ref.add((fl[i] - want) / kLsb);
+      fixed_ref.add((fx[i] - want) / kLsb);
+      changed = std::max(changed, std::fabs(fl[i] - in[i]) / kLsb);
+    }
+  }
+
+  const double frames = static_cast<double>(kBlocks) * kBlock;
+  std::printf(
+      "%u Hz: float %.1f ns/frame, Q30 %.1f ns/frame\n", rate,
+      std::chrono::duration<double, std::nano>(float_time).count() / frames,
+      std::chrono::duration<double, std::nano>(fixed_time).count() / frames);
+  std::printf("  float vs Q30: max %.2f LSB, rms %.2f LSB\n", float_fixed.max,
+              float_fixed.rms());
+  std::printf("  vs double: float rms %.2f LSB (max %.2f), Q30 rms %.2f LSB "
+              "(max %.2f)\n",
+              float_ref.rms(), float_ref.max, fixed_ref.rms(), fixed_ref.max);
+
+  CHECK(changed > 1000); // the layout did something
+  CHECK(float_fixed.max <= kMatchLsb);
+  CHECK(float_fixed.rms() <= kMatchLsb / 2);
+  CHECK(float_ref.max <= kMatchLsb && fixed_ref.max <= kMatchLsb * 1.5);
+  CHECK(float_ref.rms() <= fixed_ref.rms());
+}
+
+} // namespace
+
+int main() {
+  for (uint32_t rate : {44100u, 48000u}) {
+    compare_kernels(rate);
+  }
+  std::printf("%d failures\n", g_failures);
+  return g_failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
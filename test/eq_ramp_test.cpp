@@ -0,0 +1,298 @@
+// Coefficient changes while audio plays: a band stepped a dB at a time over
+// its whole range must not click, a new set must fade in over kRampSteps
+// sub-blocks and then stop changing, disabling the EQ must fade it out to a
+// bit exact bypass, and banks handed over while the audio side runs on
+// another thread must never leave it with a broken filter. The float and the
+// Q30 kernel both go through the same steps.
+#include <Arduino.h>
+#include <Preferences.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+
+#include "app/eq_dsp.h"
+#include "check.h"
+
+// eq_fixed_kernel.cpp
+namespace app::eq_fixed {
+void init();
+void load_settings();
+void set_band(int band, int8_t db);
+void set_enabled(bool enabled);
+void tick();
+void process_block(int32_t *buffer, uint16_t frames, uint32_t sample_rate);
+} // namespace app::eq_fixed
+
+using namespace app;
+
+namespace {
+
+constexpr uint32_t kRate = 44100;
+constexpr uint16_t kBlock = 512;
+constexpr int kRampLength = 64 * 8; // kRampSteps sub-blocks of kRampFrames
+constexpr double kLsb = 4096.0;     // one 16 bit step, see Audio::DSP_SHIFT
+constexpr double kAmplitude = 8000; // in 16 bit steps
+
+struct Kernel {
+  const char *name;
+  void (*init)();
+  void (*load_settings)();
+  void (*set_band)(int, int8_t);
+  void (*set_enabled)(bool);
+  void (*tick)();
+  void (*process_block)(int32_t *, uint16_t, uint32_t);
+};
+
+const Kernel kFloat = {"float",
+                       eq::init,
+                       eq::load_settings,
+                       eq::set_band,
+                       eq::set_enabled,
+                       eq::tick,
+                       eq::process_block};
+const Kernel kFixed = {"Q30",
+                       eq_fixed::init,
+                       eq_fixed::load_settings,
+                       eq_fixed::set_band,
+                       eq_fixed::set_enabled,
+                       eq_fixed::tick,
+                       eq_fixed::process_block};
+
+// A tone on both channels that carries on from one block to the next.
+struct Tone {
+  double step;
+  double phase = 0;
+
+  explicit Tone(double freq) : step(2 * M_PI * freq / kRate) {}
+
+  void fill(int32_t *buf, uint16_t frames) {
+    for (uint16_t i = 0; i < frames; ++i) {
+      const auto s = static_cast<int32_t>(kAmplitude * std::sin(phase));
+      buf[2 * i] = buf[2 * i + 1] = s << 12;
+      phase += step;
+    }
+  }
+};
+
+// Largest second difference of the left channel, in 16 bit steps: a smooth
+// signal keeps it small, a step in gain or phase shows up as a spike.
+struct Curvature {
+  double prev[2] = {};
+  int seen = 0;
+  double max = 0;
+
+  void add(const int32_t *buf, uint16_t frames) {
+    for (uint16_t i = 0; i < frames; ++i) {
+      const double y = buf[2 * i] / kLsb;
+      if (seen >= 2) {
+        max = std::max(max, std::fabs(y - 2 * prev[1] + prev[0]));
+      }
+      prev[0] = prev[1];
+      prev[1] = y;
+      ++seen;
+    }
+  }
+};
+
+// One peaking band, run until its ramp and the filter have settled. The
+// layout is made in the float build and reaches either one from storage,
+// as after a reboot.
+void settle_band(const Kernel &k, Tone &tone, uint16_t freq, int8_t db) {
+  Preferences::clear_all();
+  eq::init();
+  eq::set_band_count(1);
+  eq::set_preamp(0);
+  eq::set_band_params(0, {eq::BandType::Peaking, freq, 10, db});
+  eq::set_enabled(true);
+  g_host_millis += 5000; // past the save delay
+  eq::tick();
+  k.init();
+  k.load_settings();
+  int32_t buf[kBlock * 2];
+  for (int block = 0; block < 40; ++block) {
+    k.tick();
+    tone.fill(buf, kBlock);
+    k.process_block(buf, kBlock, kRate);
+  }
+}
+
+// Holding a key on the EQ screen: a dB step every 23 ms, from -12 to +12 dB
+// on a 90 Hz band, compared with the same band held at +12 dB.
+void test_steps(const Kernel &k) {
+  Tone tone(90);
+  settle_band(k, tone, 90, eq::kMinBandDb);
+  int32_t buf[kBlock * 2];
+  Curvature stepping;
+  for (int db = eq::kMinBandDb + 1; db <= eq::kMaxBandDb; ++db) {
+    k.set_band(0, static_cast<int8_t>(db));
+    for (int block = 0; block < 2; ++block) {
+      k.tick();
+      tone.fill(buf, kBlock);
+      k.process_block(buf, kBlock, kRate);
+      stepping.add(buf, kBlock);
+    }
+  }
+  Curvature steady;
+  for (int block = 0; block < 40; ++block) {
+    k.tick();
+    tone.fill(buf, kBlock);
+    k.process_block(buf, kBlock, kRate);
+    if (block >= 20) {
+      steady.add(buf, kBlock);
+    }
+  }
+  std::printf("%s: 1 dB steps peak curvature %.1f LSB, steady %.1f LSB\n",
+              k.name, stepping.max, steady.max);
+  CHECK(steady.max > 1);
+  CHECK(stepping.max <= 2 * steady.max);
+}
+
+// From bypass to +12 dB at 1 kHz: the first sub-block is barely touched,
+// and a few ramp lengths in the output is what a band that had been at
+// +12 dB all along gives, and stays there.
+void test_fade_in(const Kernel &k) {
+  Tone tone(1000);
+  settle_band(k, tone, 1000, 0);
+  k.set_band(0, eq::kMaxBandDb);
+  k.tick();
+  std::vector<int32_t> in(kRate * 2), out(kRate * 2);
+  tone.fill(in.data(), kRate);
+  out = in;
+  for (uint32_t i = 0; i < kRate; i += kBlock) {
+    const auto n = static_cast<uint16_t>(std::min<uint32_t>(kBlock, kRate - i));
+    k.process_block(out.data() + i * 2, n, kRate);
+  }
+
+  double first = 0;
+  for (int i = 0; i < 8; ++i) {
+    first = std::max(first, std::fabs(out[2 * i] - in[2 * i]) / kLsb);
+  }
+  // Peak level per ramp length, once the filter has settled behind it.
+  auto peak = [&](uint32_t from) {
+    double most = 0;
+    for (uint32_t i = from; i < from + kRampLength; ++i) {
+      most = std::max(most, std::fabs(out[2 * i] / kLsb));
+    }
+    return most;
+  };
+  const double boosted = kAmplitude * std::pow(10, 12 / 20.0);
+  std::printf("%s: fade in moves the first sub-block %.0f LSB, "
+              "settles at %.0f LSB\n",
+              k.name, first, peak(kRate - kRampLength));
+  CHECK(first < kAmplitude / 20);
+  CHECK(std::fabs(peak(8 * kRampLength) - boosted) < boosted * 0.02);
+  CHECK(std::fabs(peak(kRate - kRampLength) - boosted) < boosted * 0.02);
+}
+
+// Turning the EQ off fades the band out; once what the band still holds has
+// rung out the samples go through untouched, well within 100 ms.
+void test_fade_out(const Kernel &k) {
+  Tone tone(90);
+  settle_band(k, tone, 90, eq::kMaxBandDb);
+  int32_t buf[kBlock * 2];
+  Curvature steady;
+  for (int block = 0; block < 10; ++block) {
+    k.tick();
+    tone.fill(buf, kBlock);
+    k.process_block(buf, kBlock, kRate);
+    steady.add(buf, kBlock);
+  }
+
+  k.set_enabled(false);
+  k.tick();
+  Curvature fading = steady;
+  fading.max = 0;
+  int touched = 0; // blocks until the first one that goes through as is
+  bool bypassed = true;
+  for (int block = 0; block < 40; ++block) {
+    int32_t in[kBlock * 2];
+    tone.fill(in, kBlock);
+    std::copy(in, in + kBlock * 2, buf);
+    k.process_block(buf, kBlock, kRate);
+    fading.add(buf, kBlock);
+    const bool same = std::equal(in, in + kBlock * 2, buf);
+    if (!same && touched == block) {
+      ++touched;
+    } else {
+      bypassed = bypassed && same;
+    }
+  }
+  std::printf("%s: fade out peak curvature %.1f LSB, steady %.1f LSB, "
+              "bypassed after %d frames\n",
+              k.name, fading.max, steady.max, touched * kBlock);
+  CHECK(touched * kBlock >= kRampLength && bypassed);
+  CHECK(touched * kBlock <= kRate / 10);
+  CHECK(fading.max <= 2 * steady.max);
+}
+
+// The UI loop edits and publishes as fast as it can while the audio side
+// takes banks on its own thread. Every filter it runs is one of the stable
+// designs or a blend of two, so the output never goes past the largest
+// boost; after the last edit it settles on that edit.
+void test_concurrent_handoff() {
+  Tone tone(1000);
+  settle_band(kFloat, tone, 1000, 0);
+  std::atomic<bool> done{false};
+  double loudest = 0;
+  long blocks = 0;
+  std::thread audio([&] {
+    int32_t buf[kBlock * 2];
+    while (!done.load(std::memory_order_acquire)) {
+      tone.fill(buf, kBlock);
+      eq::process_block(buf, kBlock, kRate);
+      for (int i = 0; i < kBlock * 2; ++i) {
+        loudest = std::max(loudest, std::fabs(buf[i] / kLsb));
+      }
+      ++blocks;
+    }
+  });
+  uint32_t seed = 1;
+  for (int edit = 0; edit < 200000; ++edit) {
+    seed = seed * 1664525u + 1013904223u;
+    const int range = eq::kMaxBandDb - eq::kMinBandDb + 1;
+    eq::set_band(0, static_cast<int8_t>(eq::kMinBandDb +
+                                        static_cast<int>(seed >> 16) % range));
+    eq::tick();
+  }
+  eq::set_band(0, 6);
+  eq::tick();
+  done.store(true, std::memory_order_release);
+  audio.join();
+
+  int32_t buf[kBlock * 2];
+  double last = 0;
+  for (int block = 0; block < 40; ++block) {
+    eq::tick();
+    tone.fill(buf, kBlock);
+    eq::process_block(buf, kBlock, kRate);
+    if (block == 39) {
+      for (int i = 0; i < kBlock; ++i) {
+        last = std::max(last, std::fabs(buf[2 * i] / kLsb));
+      }
+    }
+  }
+  const double boosted = kAmplitude * std::pow(10, 6 / 20.0);
+  std::printf("concurrent: %ld blocks, loudest %.0f LSB, settled at %.0f LSB\n",
+              blocks, loudest, last);
+  CHECK(blocks > 0);
+  CHECK(loudest <= kAmplitude * std::pow(10, 12 / 20.0) * 1.1);
+  CHECK(std::fabs(last - boosted) < boosted * 0.02);
+}
+
+} // namespace
+
+int main() {
+  for (const Kernel *k : {&kFloat, &kFixed}) {
+    test_steps(*k);
+    test_fade_in(*k);
+    test_fade_out(*k);
+  }
+  test_concurrent_handoff();
+  std::printf("%d failures\n", g_failures);
+  return g_failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
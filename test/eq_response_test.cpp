@@ -0,0 +1,146 @@
+// Measures the EQ's gain with sine sweeps and checks every band type, every
+// band slot and the stored settings against what they were set to.
+#include <Preferences.h>
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+
+#include "app/eq_dsp.h"
+#include "check.h"
+
+using namespace app::eq;
+
+namespace {
+
+constexpr uint16_t kBlock = 512;
+constexpr double kTolDb = 0.3;
+
+// Gain in dB at freq, once the band ramps and the filters have settled.
+double gain_at(double freq, uint32_t rate) {
+  const double step = 2 * M_PI * freq / rate;
+  double phase = 0;
+  double in_energy = 0;
+  double out_energy = 0;
+  for (int block = 0; block < 200; ++block) {
+    tick();
+    int32_t in[kBlock];
+    int32_t buf[kBlock * 2];
+    for (int i = 0; i < kBlock; ++i) {
+      in[i] = static_cast<int32_t>(0.25 * 32767 * std::sin(phase)) << 12;
+      buf[2 * i] = buf[2 * i + 1] = in[i];
+      phase += step;
+    }
+    process_block(buf, kBlock, rate);
+    if (block >= 100) {
+      for (int i = 0; i < kBlock; ++i) {
+        in_energy += static_cast<double>(in[i]) * in[i];
+        out_energy += static_cast<double>(buf[2 * i]) * buf[2 * i];
+      }
+    }
+  }
+  return 10 * std::log10(out_energy / in_energy);
+}
+
+bool near(double measured, double expected) {
+  if (std::fabs(measured - expected) <= kTolDb) {
+    return true;
+  }
+  std::fprintf(stderr, "  measured %+.2f dB, expected %+.2f dB\n", measured,
+               expected);
+  return false;
+}
+
+void single_band(const Band &band) {
+  init();
+  set_band_count(1);
+  set_preamp(0);
+  set_band_params(0, band);
+  set_enabled(true);
+}
+
+void test_peaking(uint32_t rate) {
+  for (int8_t db : {9, -9, 3}) {
+    single_band({BandType::Peaking, 1000, 10, db});
+    CHECK(near(gain_at(1000, rate), db));
+    CHECK(near(gain_at(30, rate), 0));
+    CHECK(near(gain_at(15000, rate), 0));
+  }
+}
+
+// A shelf reaches its gain far past the corner and half of it at the
+// corner itself.
+void test_low_shelf(uint32_t rate) {
+  single_band({BandType::LowShelf, 300, 7, 8});
+  CHECK(near(gain_at(30, rate), 8));
+  CHECK(near(gain_at(300, rate), 4));
+  CHECK(near(gain_at(10000, rate), 0));
+}
+
+void test_high_shelf(uint32_t rate) {
+  single_band({BandType::HighShelf, 3000, 7, -8});
+  CHECK(near(gain_at(100, rate), 0));
+  CHECK(near(gain_at(3000, rate), -4));
+  CHECK(near(gain_at(15000, rate), -8));
+}
+
+// Each slot of a full bank boosts only its own narrow band.
+void test_every_slot(uint32_t rate) {
+  static const uint16_t kFreqs[kMaxBands] = {40,   80,   160,  315,  630,
+                                             1250, 2500, 5000, 8000, 16000};
+  for (int slot = 0; slot < kMaxBands; ++slot) {
+    init();
+    set_band_count(kMaxBands);
+    for (int band = 0; band < kMaxBands; ++band) {
+      set_band_params(band, {BandType::Peaking, kFreqs[band], 40, 0});
+    }
+    set_band(slot, 6);
+    set_enabled(true);
+    CHECK(near(gain_at(kFreqs[slot], rate), 6));
+    const int other = slot == 0 ? kMaxBands - 1 : 0;
+    CHECK(near(gain_at(kFreqs[other], rate), 0));
+  }
+}
+
+void test_preamp(uint32_t rate) {
+  single_band({BandType::Peaking, 1000, 10, 6});
+  set_preamp(-4);
+  CHECK(near(gain_at(1000, rate), 2));
+  CHECK(near(gain_at(60, rate), -4));
+}
+
+// The custom layout comes back from storage after the save delay.
+void test_saved_layout() {
+  Preferences::clear_all();
+  init();
+  set_band_count(3);
+  set_band_params(0, {BandType::LowShelf, 120, 7, 5});
+  set_band_params(1, {BandType::Peaking, 2200, 25, -3});
+  set_band_params(2, {BandType::HighShelf, 9000, 7, 4});
+  g_host_millis += 5000;
+  tick();
+
+  init();
+  load_settings();
+  CHECK(get_preset() == kPresetCustom);
+  CHECK(band_count() == 3);
+  const Band b = get_band_params(1);
+  CHECK(b.type == BandType::Peaking && b.freq_hz == 2200 && b.q_x10 == 25 &&
+        b.gain_db == -3);
+  CHECK(get_band_params(2).type == BandType::HighShelf);
+}
+
+} // namespace
+
+int main() {
+  for (uint32_t rate : {44100u, 48000u}) {
+    test_peaking(rate);
+    test_low_shelf(rate);
+    test_high_shelf(rate);
+    test_every_slot(rate);
+    test_preamp(rate);
+  }
+  test_saved_layout();
+  std::printf("%d failures\n", g_failures);
+  return g_failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
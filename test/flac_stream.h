@@ -0,0 +1,383 @@
+// Synthetic FLAC frames for the decoder tests.
+//
+// make_flac_stream() writes raw 16-bit stereo frames (no STREAMINFO, the
+// player sets the block params itself) together with the PCM they must
+// decode to. Every frame draws its own block size, channel assignment,
+// subframe types, rice parameters and partitions, so a few hundred frames
+// cover the decoder's paths. CRCs are left zero, the decoder skips them.
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <initializer_list>
+#include <random>
+#include <vector>
+
+#include "flac_decoder.h"
+
+struct FlacStream {
+  std::vector<uint8_t> bytes;
+  std::vector<int16_t> pcm; // interleaved L/R
+};
+
+namespace flac_stream {
+
+class BitWriter {
+public:
+  void put(uint32_t value, int bits) {
+    for (int i = bits - 1; i >= 0; --i) {
+      put_bit((value >> i) & 1);
+    }
+  }
+  void put_signed(int32_t value, int bits) {
+    put(static_cast<uint32_t>(value) & mask(bits), bits);
+  }
+  void put_bit(int bit) {
+    cur_ = static_cast<uint8_t>(cur_ << 1 | bit);
+    if (++fill_ == 8) {
+      out_.push_back(cur_);
+      cur_ = 0;
+      fill_ = 0;
+    }
+  }
+  void align() {
+    while (fill_ != 0) {
+      put_bit(0);
+    }
+  }
+  std::vector<uint8_t> &bytes() { return out_; }
+
+private:
+  static uint32_t mask(int bits) {
+    return bits >= 32 ? 0xFFFFFFFFu : (1u << bits) - 1;
+  }
+
+  std::vector<uint8_t> out_;
+  uint8_t cur_ = 0;
+  int fill_ = 0;
+};
+
+class Generator {
+public:
+  explicit Generator(uint32_t seed) : rng_(seed) {}
+
+  // Returns false when the frame came out too large for one decode call.
+  bool frame(uint32_t number, FlacStream &out) {
+    BitWriter w;
+    const int code = pick({12, 12, 12, 1, 2, 3, 6, 7, 8, 11});
+    int bs = 0;
+    if (code == 1) {
+      bs = 192;
+    } else if (code >= 2 && code <= 5) {
+      bs = 576 << (code - 2);
+    } else if (code == 6) {
+      bs = range(40, 256);
+    } else if (code == 7) {
+      bs = range(257, 4608);
+    } else {
+      bs = 256 << (code - 8);
+    }
+    const int chan = pick({1, 8, 9, 10});
+
+    w.put(0x3FFE, 14);
+    w.put(0, 1);    // reserved
+    w.put(0, 1);    // fixed block size
+    w.put(code, 4);
+    w.put(9, 4);    // 44.1 kHz
+    w.put(chan, 4);
+    w.put(4, 3);    // 16 bits per sample
+    w.put(0, 1);    // reserved
+    w.put(number % 128, 8);
+    if (code == 6) {
+      w.put(bs - 1, 8);
+    } else if (code == 7) {
+      w.put(bs - 1, 16);
+    }
+    w.put(0, 8); // CRC-8
+
+    // Samples whose low bits are all zero exercise the wasted-bits path;
+    // keep one spare bit so mid = (L + R) >> 1 still has them.
+    const int wasted = chance(10) ? range(1, 3) : 0;
+    std::vector<int32_t> left(bs);
+    std::vector<int32_t> right(bs);
+    if (chance(5)) {
+      // Constant subframes store the value in 16 bits, so keep the side
+      // channel in range.
+      const int32_t l = clear_low(range(-16000, 16000), wasted);
+      const int32_t r = clear_low(range(-16000, 16000), wasted);
+      std::fill(left.begin(), left.end(), l);
+      std::fill(right.begin(), right.end(), r);
+    } else {
+      signal(left, wasted);
+      signal(right, wasted);
+    }
+
+    std::vector<int32_t> ch0(bs);
+    std::vector<int32_t> ch1(bs);
+    for (int i = 0; i < bs; ++i) {
+      const int32_t side = left[i] - right[i];
+      switch (chan) {
+      case 1:
+        ch0[i] = left[i];
+        ch1[i] = right[i];
+        break;
+      case 8:
+        ch0[i] = left[i];
+        ch1[i] = side;
+        break;
+      case 9:
+        ch0[i] = side;
+        ch1[i] = right[i];
+        break;
+      default:
+        ch0[i] = (left[i] + right[i]) >> 1;
+        ch1[i] = side;
+        break;
+      }
+    }
+    subframe(w, ch0, chan == 9 ? 17 : 16, wasted);
+    subframe(w, ch1, chan == 8 || chan == 10 ? 17 : 16, wasted);
+    w.align();
+    w.put(0, 16); // CRC-16
+
+    if (w.bytes().size() > 15000) {
+      return false;
+    }
+    out.bytes.insert(out.bytes.end(), w.bytes().begin(), w.bytes().end());
+    for (int i = 0; i < bs; ++i) {
+      out.pcm.push_back(static_cast<int16_t>(left[i]));
+      out.pcm.push_back(static_cast<int16_t>(right[i]));
+    }
+    return true;
+  }
+
+private:
+  int range(int lo, int hi) {
+    return std::uniform_int_distribution<int>(lo, hi)(rng_);
+  }
+  bool chance(int percent) { return range(0, 99) < percent; }
+  int pick(std::initializer_list<int> values) {
+    return values.begin()[range(0, static_cast<int>(values.size()) - 1)];
+  }
+
+  static int32_t clear_low(int32_t v, int wasted) {
+    return wasted > 0 ? v & ~((2 << wasted) - 1) : v;
+  }
+
+  // A sine with noise, from near silence to loud hiss.
+  void signal(std::vector<int32_t> &x, int wasted) {
+    const double freq =
+        std::uniform_real_distribution<double>(0.001, 0.05)(rng_);
+    const double amp =
+        std::uniform_real_distribution<double>(0.05, 0.9)(rng_) * 32767;
+    const double phase = std::uniform_real_distribution<double>(0, 6)(rng_);
+    const int noise = pick({0, 3, 40, 400, 4000});
+    for (size_t i = 0; i < x.size(); ++i) {
+      int32_t v = static_cast<int32_t>(amp * std::sin(phase + freq * i)) +
+                  range(-noise, noise);
+      x[i] = clear_low(std::max(-32767, std::min(32767, v)), wasted);
+    }
+  }
+
+  void subframe(BitWriter &w, const std::vector<int32_t> &samples, int depth,
+                int wasted) {
+    const int bs = static_cast<int>(samples.size());
+    std::vector<int32_t> x(bs);
+    for (int i = 0; i < bs; ++i) {
+      x[i] = samples[i] >> wasted;
+    }
+    const int d = depth - wasted;
+    auto header = [&](int type) {
+      w.put(0, 1);
+      w.put(type, 6);
+      if (wasted > 0) {
+        w.put(1, 1);
+        w.put(0, wasted - 1);
+        w.put(1, 1);
+      } else {
+        w.put(0, 1);
+      }
+    };
+
+    const bool constant = std::all_of(x.begin(), x.end(),
+                                      [&](int32_t v) { return v == x[0]; });
+    if (constant) {
+      header(0);
+      w.put_signed(x[0], d);
+      return;
+    }
+    const int kind = range(0, 5);
+    if (kind == 0) {
+      header(1);
+      for (int32_t v : x) {
+        w.put_signed(v, d);
+      }
+      return;
+    }
+
+    static const int kFixed[5][4] = {
+        {0, 0, 0, 0}, {1, 0, 0, 0}, {2, -1, 0, 0}, {3, -3, 1, 0},
+        {4, -6, 4, -1}};
+    std::vector<int32_t> coefs;
+    int order = 0;
+    int shift = 0;
+    int precision = 0;
+    if (kind <= 2) {
+      order = range(0, 4);
+      coefs.assign(kFixed[order], kFixed[order] + order);
+      header(8 + order);
+    } else {
+      // A fixed predictor scaled up and perturbed, so the residuals stay
+      // small while the coefficients are arbitrary.
+      order = pick({1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 12, 16, 32});
+      shift = range(0, 10);
+      const int base = range(0, std::min(order, 2));
+      const int jitter = std::max(1, (1 << shift) / 8);
+      int peak = 0;
+      for (int j = 0; j < order; ++j) {
+        int32_t c = j < base ? kFixed[base][j] * (1 << shift) : 0;
+        c += range(-jitter, jitter) / (j < base ? 1 : order);
+        coefs.push_back(c);
+        peak = std::max(peak, c < 0 ? -c - 1 : c);
+      }
+      int bits = 1;
+      while ((peak >> (bits - 1)) != 0) {
+        ++bits;
+      }
+      precision = std::min(15, bits + range(0, 1));
+      header(31 + order);
+    }
+    for (int i = 0; i < order; ++i) {
+      w.put_signed(x[i], d);
+    }
+    if (kind > 2) {
+      w.put(precision - 1, 4);
+      w.put_signed(shift, 5);
+      for (int32_t c : coefs) {
+        w.put_signed(c, precision);
+      }
+    }
+    std::vector<int32_t> residual(bs);
+    for (int i = order; i < bs; ++i) {
+      int64_t sum = 0;
+      for (int j = 0; j < order; ++j) {
+        sum += static_cast<int64_t>(coefs[j]) * x[i - 1 - j];
+      }
+      residual[i] = x[i] - static_cast<int32_t>(sum >> shift);
+    }
+    residuals(w, residual, order);
+  }
+
+  void residuals(BitWriter &w, const std::vector<int32_t> &res, int order) {
+    const int bs = static_cast<int>(res.size());
+    const int method = range(0, 1);
+    const int param_bits = method == 0 ? 4 : 5;
+    const int escape = method == 0 ? 15 : 31;
+    w.put(method, 2);
+    int porder = 0;
+    for (int po = 8; po >= 0; --po) {
+      if (bs % (1 << po) == 0 && bs / (1 << po) > order && chance(30)) {
+        porder = po;
+        break;
+      }
+    }
+    w.put(porder, 4);
+    const int size = bs >> porder;
+    for (int p = 0; p < (1 << porder); ++p) {
+      const int start = p * size + (p == 0 ? order : 0);
+      const int end = (p + 1) * size;
+      if (chance(5)) {
+        int32_t peak = 0;
+        for (int i = start; i < end; ++i) {
+          peak = std::max(peak, res[i] < 0 ? -res[i] : res[i]);
+        }
+        int bits = 1;
+        while ((peak >> (bits - 1)) != 0) {
+          ++bits;
+        }
+        w.put(escape, param_bits);
+        w.put(bits, 5);
+        for (int i = start; i < end; ++i) {
+          w.put_signed(res[i], bits);
+        }
+        continue;
+      }
+      double mean = 0;
+      for (int i = start; i < end; ++i) {
+        mean += zigzag(res[i]);
+      }
+      mean /= std::max(1, end - start);
+      int k = mean >= 1 ? static_cast<int>(std::log2(mean)) : 0;
+      k = std::max(0, std::min(escape - 1, k + pick({-1, 0, 0, 1})));
+      w.put(k, param_bits);
+      for (int i = start; i < end; ++i) {
+        const uint32_t u = zigzag(res[i]);
+        for (uint32_t q = u >> k; q > 0; --q) {
+          w.put_bit(0);
+        }
+        w.put_bit(1);
+        w.put(u & ((1u << k) - 1), k);
+      }
+    }
+  }
+
+  static uint32_t zigzag(int32_t v) {
+    return (static_cast<uint32_t>(v) << 1) ^ static_cast<uint32_t>(v >> 31);
+  }
+
+  std::mt19937 rng_;
+};
+
+} // namespace flac_stream
+
+inline FlacStream make_flac_stream(uint32_t seed, int frames) {
+  FlacStream stream;
+  flac_stream::Generator gen(seed);
+  for (int i = 0; i < frames; ++i) {
+    gen.frame(static_cast<uint32_t>(i), stream);
+  }
+  stream.bytes.resize(stream.bytes.size() + 8, 0); // slack for the bit reader
+  return stream;
+}
+
+// Decodes a stream made above with whatever FLAC context is selected.
+// step() runs one FLACDecode call, the way Audio feeds the decoder.
+class FlacReader {
+public:
+  FlacReader(const FlacStream &stream, FLACDecoder_t *ctx)
+      : stream_(stream), ctx_(ctx) {
+    FLACDecoder_SelectContext(ctx_);
+    ok_ = FLACDecoder_AllocateBuffers();
+    FLACSetRawBlockParams(2, 44100, 16, 0, 0);
+    FLACDecoderReset();
+  }
+
+  bool done() const { return !ok_ || pos_ >= stream_.bytes.size() - 8; }
+  bool ok() const { return ok_; }
+  const std::vector<int16_t> &pcm() const { return pcm_; }
+
+  void step() {
+    FLACDecoder_SelectContext(ctx_);
+    const size_t left = stream_.bytes.size() - 8 - pos_;
+    int bytes = static_cast<int>(left < 16000 ? left : 16000);
+    const int before = bytes;
+    const int ret =
+        FLACDecode(const_cast<uint8_t *>(&stream_.bytes[pos_]), &bytes, out_);
+    if (ret < 0) {
+      ok_ = false;
+      return;
+    }
+    pos_ += before - bytes;
+    const int n = FLACGetOutputSamps();
+    pcm_.insert(pcm_.end(), out_, out_ + n);
+  }
+
+private:
+  const FlacStream &stream_;
+  FLACDecoder_t *ctx_;
+  size_t pos_ = 0;
+  bool ok_ = false;
+  std::vector<int16_t> pcm_;
+  short out_[2 * 2048];
+};
@@ -0,0 +1,199 @@
+// Host stand-in for the parts of the Arduino core the tested sources use.
+#pragma once
+
+#include <cctype>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <type_traits>
+
+#include "esp_heap_caps.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#define PROGMEM
+#define pgm_read_byte(addr) (*reinterpret_cast<const uint8_t *>(addr))
+#define pgm_read_word(addr) (*reinterpret_cast<const uint16_t *>(addr))
+#define IRAM_ATTR
+#define PI 3.1415926535897932384626433832795
+
+typedef bool boolean;
+typedef int esp_err_t;
+#define ESP_OK 0
+#define ESP_FAIL (-1)
+#define ESP_ERR_INVALID_ARG 0x102
+
+#define log_i(...) ((void)0)
+#define log_w(...) ((void)0)
+#define log_e(...) ((void)0)
+#define log_d(...) ((void)0)
+#define log_v(...) ((void)0)
+
+// Tests move the clock by hand.
+inline uint32_t g_host_millis = 0;
+inline unsigned long millis() { return g_host_millis; }
+inline unsigned long micros() { return g_host_millis * 1000ul; }
+inline void yield() {}
+
+// No PSRAM unless a test sets this before it creates what looks for it.
+inline bool g_host_psram_found = false;
+inline bool psramFound() { return g_host_psram_found; }
+inline bool psramInit() { return psramFound(); }
+inline void *ps_malloc(size_t size) { return malloc(size); }
+inline void *ps_calloc(size_t n, size_t size) { return calloc(n, size); }
+
+// On the board size_t and uint32_t are the same type, so the core's min()
+// and max() take them mixed.
+template <typename A, typename B>
+inline std::common_type_t<A, B> min(const A &a, const B &b) {
+  return b < a ? b : a;
+}
+template <typename A, typename B>
+inline std::common_type_t<A, B> max(const A &a, const B &b) {
+  return a < b ? b : a;
+}
+
+inline int toLowerCase(int c) { return tolower(c); }
+
+// Nanoseconds stand in for CPU cycles.
+struct HostEsp {
+  uint32_t getCycleCount() {
+    return static_cast<uint32_t>(
+        std::chrono::steady_clock::now().time_since_epoch().count());
+  }
+  uint32_t getFreeHeap() { return 256u << 10; }
+};
+static HostEsp ESP;
+
+// Log output is dropped; tests report through their own checks.
+struct HostSerial {
+  template <typename... Args> int printf(const char *, Args...) { return 0; }
+  template <typename T> size_t print(const T &) { return 0; }
+  template <typename T> size_t println(const T &) { return 0; }
+  size_t println() { return 0; }
+};
+inline HostSerial Serial;
+
+// The subset of Arduino's String the app code calls.
+class String {
+public:
+  String() = default;
+  String(const char *s) : s_(s ? s : "") {}
+  String(const std::string &s) : s_(s) {}
+  explicit String(char c) : s_(1, c) {}
+  explicit String(int v) : s_(std::to_string(v)) {}
+  explicit String(unsigned v) : s_(std::to_string(v)) {}
+  explicit String(long v) : s_(std::to_string(v)) {}
+  explicit String(unsigned long v) : s_(std::to_string(v)) {}
+
+  const char *c_str() const { return s_.c_str(); }
+  unsigned length() const { return static_cast<unsigned>(s_.size()); }
+  bool isEmpty() const { return s_.empty(); }
+  bool reserve(unsigned size) {
+    s_.reserve(size);
+    return true;
+  }
+  char operator[](unsigned i) const { return i < s_.size() ? s_[i] : 0; }
+  char &operator[](unsigned i) { return s_[i]; }
+  char charAt(unsigned i) const { return (*this)[i]; }
+
+  bool equals(const String &o) const { return s_ == o.s_; }
+  bool equalsIgnoreCase(const String &o) const {
+    if (s_.size() != o.s_.size()) {
+      return false;
+    }
+    for (size_t i = 0; i < s_.size(); ++i) {
+      if (tolower(static_cast<unsigned char>(s_[i])) !=
+          tolower(static_cast<unsigned char>(o.s_[i]))) {
+        return false;
+      }
+    }
+    return true;
+  }
+  bool startsWith(const String &p) const { return s_.rfind(p.s_, 0) == 0; }
+  bool endsWith(const String &p) const {
+    return s_.size() >= p.s_.size() &&
+           s_.compare(s_.size() - p.s_.size(), p.s_.size(), p.s_) == 0;
+  }
+  int indexOf(char c, unsigned from = 0) const { return pos(s_.find(c, from)); }
+  int indexOf(const String &p, unsigned from = 0) const {
+    return pos(s_.find(p.s_, from));
+  }
+  int lastIndexOf(char c) const { return pos(s_.rfind(c)); }
+  int lastIndexOf(const String &p) const { return pos(s_.rfind(p.s_)); }
+  String substring(unsigned from) const {
+    return from < s_.size() ? String(s_.substr(from)) : String();
+  }
+  String substring(unsigned from, unsigned to) const {
+    if (from > to) {
+      std::swap(from, to);
+    }
+    return from < s_.size() ? String(s_.substr(from, to - from)) : String();
+  }
+
+  void trim() {
+    const size_t a = s_.find_first_not_of(" \t\r\n");
+    const size_t b = s_.find_last_not_of(" \t\r\n");
+    s_ = a == std::string::npos ? std::string() : s_.substr(a, b - a + 1);
+  }
+  void toLowerCase() {
+    for (char &c : s_) {
+      c = static_cast<char>(tolower(static_cast<unsigned char>(c)));
+    }
+  }
+  void toUpperCase() {
+    for (char &c : s_) {
+      c = static_cast<char>(toupper(static_cast<unsigned char>(c)));
+    }
+  }
+  void remove(unsigned index) {
+    if (index < s_.size()) {
+      s_.erase(index);
+    }
+  }
+  void remove(unsigned index, unsigned count) {
+    if (index < s_.size()) {
+      s_.erase(index, count);
+    }
+  }
+  bool concat(const String &o) {
+    s_ += o.s_;
+    return true;
+  }
+  bool concat(char c) {
+    s_ += c;
+    return true;
+  }
+
+  String &operator+=(const String &o) {
+    s_ += o.s_;
+    return *this;
+  }
+  String &operator+=(const char *o) {
+    s_ += o ? o : "";
+    return *this;
+  }
+  String &operator+=(char c) {
+    s_ += c;
+    return *this;
+  }
+  friend String operator+(String a, const String &b) { return a += b; }
+  friend String operator+(String a, const char *b) { return a += b; }
+  friend String operator+(String a, char b) { return a += b; }
+  bool operator==(const String &o) const { return s_ == o.s_; }
+  bool operator==(const char *o) const { return s_ == (o ? o : ""); }
+  bool operator!=(const String &o) const { return s_ != o.s_; }
+  bool operator!=(const char *o) const { return !(*this == o); }
+  bool operator<(const String &o) const { return s_ < o.s_; }
+
+private:
+  static int pos(size_t p) {
+    return p == std::string::npos ? -1 : static_cast<int>(p);
+  }
+
+  std::string s_;
+};
@@ -0,0 +1,278 @@
+// Host stand-in for the Arduino fs::FS API over an in-memory card.
+//
+// Written bytes are durable as soon as write() returns, like the firmware
+// assumes after each slice. cut_power_after(n) lets n more bytes through
+// and then fails every write, open for writing, remove and rename until
+// power_on(), which is how the tests model pulling the battery mid-write.
+#pragma once
+
+#include <Arduino.h>
+
+#include <algorithm>
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+#include <vector>
+
+#define FILE_READ "r"
+#define FILE_WRITE "w"
+#define FILE_APPEND "a"
+
+namespace fs {
+
+enum SeekMode { SeekSet = 0, SeekCur = 1, SeekEnd = 2 };
+
+using Bytes = std::vector<uint8_t>;
+
+struct HostCard {
+  std::map<std::string, std::shared_ptr<Bytes>> files;
+  std::set<std::string> dirs;
+  std::map<std::string, uint32_t> mtimes; // set when opened for writing
+  uint32_t now = 1;                        // what getLastWrite() records
+  long write_budget = -1; // bytes left before the power cut, -1 = none
+  bool power_lost = false;
+  size_t reads = 0; // read() calls, each a card round trip on the board
+  size_t read_bytes = 0;
+
+  // Takes n bytes off the budget; returns how many may still be written.
+  size_t allow(size_t n) {
+    if (power_lost) {
+      return 0;
+    }
+    if (write_budget >= 0 && static_cast<long>(n) > write_budget) {
+      n = static_cast<size_t>(write_budget);
+      power_lost = true;
+    }
+    if (write_budget >= 0) {
+      write_budget -= static_cast<long>(n);
+    }
+    return n;
+  }
+};
+
+class File {
+public:
+  File() = default;
+  File(HostCard *card, std::string path, std::shared_ptr<Bytes> data,
+       bool writable, bool append)
+      : card_(card), path_(std::move(path)), data_(std::move(data)),
+        writable_(writable), pos_(append ? data_->size() : 0) {}
+  // A directory handle for openNextFile().
+  File(HostCard *card, std::string path) : card_(card), path_(std::move(path)) {
+    const std::string prefix = path_ == "/" ? "/" : path_ + "/";
+    std::set<std::string> seen;
+    for (const auto &f : card_->files) {
+      add_child(prefix, f.first, seen);
+    }
+    for (const std::string &d : card_->dirs) {
+      add_child(prefix, d, seen);
+    }
+    dir_ = true;
+  }
+
+  explicit operator bool() const { return card_ != nullptr; }
+  bool isDirectory() const { return dir_; }
+  const char *path() const { return path_.c_str(); }
+  const char *name() const {
+    const size_t slash = path_.rfind('/');
+    return path_.c_str() + (slash == std::string::npos ? 0 : slash + 1);
+  }
+
+  size_t size() const { return data_ ? data_->size() : 0; }
+  time_t getLastWrite() const {
+    if (!card_) {
+      return 0;
+    }
+    auto it = card_->mtimes.find(path_);
+    return it == card_->mtimes.end() ? 0 : it->second;
+  }
+  size_t position() const { return pos_; }
+  int available() const {
+    return data_ ? static_cast<int>(data_->size() - pos_) : 0;
+  }
+  bool seek(uint32_t pos, SeekMode mode = SeekSet) {
+    if (!data_) {
+      return false;
+    }
+    const size_t base =
+        mode == SeekSet ? 0 : (mode == SeekCur ? pos_ : data_->size());
+    if (base + pos > data_->size()) {
+      return false;
+    }
+    pos_ = base + pos;
+    return true;
+  }
+
+  size_t read(uint8_t *buf, size_t len) {
+    if (!data_ || pos_ >= data_->size()) {
+      return 0;
+    }
+    const size_t n = std::min(len, data_->size() - pos_);
+    memcpy(buf, data_->data() + pos_, n);
+    pos_ += n;
+    card_->reads++;
+    card_->read_bytes += n;
+    return n;
+  }
+  int read() {
+    uint8_t b = 0;
+    return read(&b, 1) == 1 ? b : -1;
+  }
+  size_t readBytes(char *buf, size_t len) {
+    return read(reinterpret_cast<uint8_t *>(buf), len);
+  }
+
+  size_t write(const uint8_t *buf, size_t len) {
+    if (!data_ || !writable_) {
+      return 0;
+    }
+    const size_t n = card_->allow(len);
+    if (pos_ + n > data_->size()) {
+      data_->resize(pos_ + n);
+    }
+    memcpy(data_->data() + pos_, buf, n);
+    pos_ += n;
+    return card_->power_lost ? 0 : n;
+  }
+  size_t write(uint8_t b) { return write(&b, 1); }
+  void flush() {}
+
+  File openNextFile() {
+    if (!dir_ || next_ >= children_.size()) {
+      return File();
+    }
+    const std::string &child = children_[next_++];
+    auto it = card_->files.find(child);
+    if (it != card_->files.end()) {
+      return File(card_, child, it->second, false, false);
+    }
+    return File(card_, child);
+  }
+
+  void close() {
+    card_ = nullptr;
+    data_.reset();
+  }
+
+private:
+  void add_child(const std::string &prefix, const std::string &p,
+                 std::set<std::string> &seen) {
+    if (p.size() <= prefix.size() || p.compare(0, prefix.size(), prefix)) {
+      return;
+    }
+    const size_t slash = p.find('/', prefix.size());
+    const std::string child = p.substr(0, slash);
+    if (seen.insert(child).second) {
+      children_.push_back(child);
+    }
+  }
+
+  HostCard *card_ = nullptr;
+  std::string path_;
+  std::shared_ptr<Bytes> data_;
+  bool writable_ = false;
+  bool dir_ = false;
+  size_t pos_ = 0;
+  std::vector<std::string> children_;
+  size_t next_ = 0;
+};
+
+class FS {
+public:
+  File open(const char *path, const char *mode = FILE_READ,
+            bool create = false) {
+    (void)create;
+    const std::string p = path;
+    if (mode[0] == 'r') {
+      auto it = card_.files.find(p);
+      if (it != card_.files.end()) {
+        return File(&card_, p, it->second, false, false);
+      }
+      return is_dir(p) ? File(&card_, p) : File();
+    }
+    if (card_.power_lost || is_dir(p)) {
+      return File();
+    }
+    std::shared_ptr<Bytes> &data = card_.files[p];
+    if (mode[0] == 'w' || !data) {
+      data = std::make_shared<Bytes>(); // readers keep the old contents
+    }
+    card_.mtimes[p] = card_.now;
+    return File(&card_, p, data, true, mode[0] == 'a');
+  }
+  File open(const String &path, const char *mode = FILE_READ) {
+    return open(path.c_str(), mode);
+  }
+
+  bool exists(const char *path) {
+    return card_.files.count(path) > 0 || is_dir(path);
+  }
+  bool exists(const String &path) { return exists(path.c_str()); }
+  bool remove(const char *path) {
+    return !card_.power_lost && card_.files.erase(path) > 0;
+  }
+  bool remove(const String &path) { return remove(path.c_str()); }
+  bool rename(const char *from, const char *to) {
+    auto it = card_.files.find(from);
+    if (card_.power_lost || it == card_.files.end()) {
+      return false;
+    }
+    std::shared_ptr<Bytes> data = it->second;
+    card_.files.erase(it);
+    card_.files[to] = data;
+    card_.mtimes[to] = card_.mtimes[from];
+    return true;
+  }
+  bool rename(const String &from, const String &to) {
+    return rename(from.c_str(), to.c_str());
+  }
+  bool mkdir(const char *path) {
+    if (card_.power_lost) {
+      return false;
+    }
+    card_.dirs.insert(path);
+    return true;
+  }
+  bool mkdir(const String &path) { return mkdir(path.c_str()); }
+  bool rmdir(const char *path) {
+    return !card_.power_lost && card_.dirs.erase(path) > 0;
+  }
+
+  // Test controls.
+  void cut_power_after(long bytes) {
+    card_.write_budget = bytes;
+    card_.power_lost = false;
+  }
+  void power_on() {
+    card_.write_budget = -1;
+    card_.power_lost = false;
+  }
+  bool power_lost() const { return card_.power_lost; }
+  void format() {
+    card_ = HostCard();
+  }
+  HostCard &card() { return card_; }
+
+private:
+  bool is_dir(const std::string &p) const {
+    if (p == "/" || card_.dirs.count(p)) {
+      return true;
+    }
+    const std::string prefix = p + "/";
+    auto it = card_.files.lower_bound(prefix);
+    return it != card_.files.end() &&
+           it->first.compare(0, prefix.size(), prefix) == 0;
+  }
+
+  HostCard card_;
+};
+
+} // namespace fs
+
+using fs::File;
+using fs::FS;
+using fs::SeekMode;
+using fs::SeekCur;
+using fs::SeekEnd;
+using fs::SeekSet;
@@ -0,0 +1,53 @@
+// Host stand-in for the NVS Preferences API: one in-memory store shared by
+// every instance, so settings survive an app-level re-init like on the
+// board.
+#pragma once
+
+#include <Arduino.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+class Preferences {
+public:
+  bool begin(const char *name, bool read_only = false) {
+    ns_ = name;
+    read_only_ = read_only;
+    return true;
+  }
+  void end() {}
+
+  size_t putBytes(const char *key, const void *value, size_t len) {
+    if (read_only_) {
+      return 0;
+    }
+    const uint8_t *p = static_cast<const uint8_t *>(value);
+    store()[ns_ + "/" + key].assign(p, p + len);
+    return len;
+  }
+  size_t getBytesLength(const char *key) {
+    auto it = store().find(ns_ + "/" + key);
+    return it == store().end() ? 0 : it->second.size();
+  }
+  size_t getBytes(const char *key, void *buf, size_t max_len) {
+    auto it = store().find(ns_ + "/" + key);
+    if (it == store().end() || it->second.size() > max_len) {
+      return 0;
+    }
+    memcpy(buf, it->second.data(), it->second.size());
+    return it->second.size();
+  }
+  bool remove(const char *key) { return store().erase(ns_ + "/" + key) > 0; }
+
+  static void clear_all() { store().clear(); }
+
+private:
+  static std::map<std::string, std::vector<uint8_t>> &store() {
+    static std::map<std::string, std::vector<uint8_t>> s;
+    return s;
+  }
+
+  std::string ns_;
+  bool read_only_ = false;
+};
@@ -0,0 +1,6 @@
+// Host stand-in: the SD card is one in-memory fs::FS.
+#pragma once
+
+#include <FS.h>
+
+inline fs::FS SD;
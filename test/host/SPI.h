@@ -0,0 +1,4 @@
+// Host stand-in: nothing in the host builds drives the bus.
+#pragma once
+
+#include <Arduino.h>
@@ -0,0 +1,4 @@
+// Host stand-in: declared for code that names it; tests use SD.
+#pragma once
+
+#include <FS.h>
@@ -0,0 +1,97 @@
+// Host stand-in for the legacy ESP-IDF I2S driver. Nothing is played:
+// i2s_write() takes up to accept bytes per call into written and counts
+// the calls, so tests can see how output reaches the driver and make the
+// DMA look full.
+#pragma once
+
+#include <Arduino.h>
+
+#include <vector>
+
+typedef int i2s_port_t;
+typedef int i2s_mode_t;
+typedef int i2s_comm_format_t;
+typedef int i2s_bits_per_sample_t;
+typedef int i2s_channel_fmt_t;
+typedef int i2s_dac_mode_t;
+typedef int i2s_channel_t;
+
+#define I2S_NUM_0 0
+#define I2S_NUM_1 1
+#define I2S_PIN_NO_CHANGE (-1)
+#define I2S_MODE_MASTER 1
+#define I2S_MODE_TX 4
+#define I2S_MODE_DAC_BUILT_IN 16
+#define I2S_COMM_FORMAT_STAND_I2S 1
+#define I2S_COMM_FORMAT_STAND_MSB 3
+#define I2S_COMM_FORMAT_I2S 1
+#define I2S_COMM_FORMAT_I2S_MSB 2
+#define I2S_COMM_FORMAT_I2S_LSB 4
+#define I2S_BITS_PER_SAMPLE_16BIT 16
+#define I2S_CHANNEL_FMT_RIGHT_LEFT 0
+#define I2S_CHANNEL_MONO 1
+#define I2S_CHANNEL_STEREO 2
+#define I2S_DAC_CHANNEL_DISABLE 0
+#define I2S_DAC_CHANNEL_RIGHT_EN 1
+#define I2S_DAC_CHANNEL_LEFT_EN 2
+#define I2S_DAC_CHANNEL_BOTH_EN 3
+#define I2S_DAC_CHANNEL_MAX 4
+#define ESP_INTR_FLAG_LEVEL1 (1 << 1)
+
+struct i2s_config_t {
+  i2s_mode_t mode;
+  int sample_rate;
+  i2s_bits_per_sample_t bits_per_sample;
+  i2s_channel_fmt_t channel_format;
+  i2s_comm_format_t communication_format;
+  int intr_alloc_flags;
+  int dma_buf_count;
+  int dma_buf_len;
+  bool use_apll;
+  bool tx_desc_auto_clear;
+  int fixed_mclk;
+  int mclk_multiple;
+  int bits_per_chan;
+};
+
+struct i2s_pin_config_t {
+  int mck_io_num;
+  int bck_io_num;
+  int ws_io_num;
+  int data_out_num;
+  int data_in_num;
+};
+
+struct HostI2S {
+  std::vector<uint8_t> written;
+  size_t writes = 0;       // i2s_write() calls
+  size_t accept = SIZE_MAX; // bytes each call takes at most
+  uint32_t sample_rate = 0;
+};
+inline HostI2S g_host_i2s;
+
+inline esp_err_t i2s_write(i2s_port_t, const void *src, size_t size,
+                           size_t *bytes_written, TickType_t) {
+  const size_t n = size < g_host_i2s.accept ? size : g_host_i2s.accept;
+  const uint8_t *p = static_cast<const uint8_t *>(src);
+  g_host_i2s.written.insert(g_host_i2s.written.end(), p, p + n);
+  g_host_i2s.writes++;
+  *bytes_written = n;
+  return ESP_OK;
+}
+inline esp_err_t i2s_zero_dma_buffer(i2s_port_t) { return ESP_OK; }
+inline esp_err_t i2s_driver_install(i2s_port_t, const i2s_config_t *, int,
+                                    void *) {
+  return ESP_OK;
+}
+inline esp_err_t i2s_driver_uninstall(i2s_port_t) { return ESP_OK; }
+inline esp_err_t i2s_set_dac_mode(i2s_dac_mode_t) { return ESP_OK; }
+inline esp_err_t i2s_set_pin(i2s_port_t, const i2s_pin_config_t *) {
+  return ESP_OK;
+}
+inline esp_err_t i2s_start(i2s_port_t) { return ESP_OK; }
+inline esp_err_t i2s_stop(i2s_port_t) { return ESP_OK; }
+inline esp_err_t i2s_set_sample_rates(i2s_port_t, uint32_t rate) {
+  g_host_i2s.sample_rate = rate;
+  return ESP_OK;
+}
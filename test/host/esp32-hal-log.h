@@ -0,0 +1,4 @@
+// Host stand-in: the log macros live in Arduino.h.
+#pragma once
+
+#include <Arduino.h>
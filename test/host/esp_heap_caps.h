@@ -0,0 +1,23 @@
+// Host stand-in: every capability is plain heap.
+#pragma once
+
+#include <cstdint>
+#include <cstdlib>
+
+#define MALLOC_CAP_8BIT (1 << 2)
+#define MALLOC_CAP_SPIRAM (1 << 10)
+#define MALLOC_CAP_INTERNAL (1 << 11)
+#define MALLOC_CAP_DEFAULT (1 << 12)
+
+inline void *heap_caps_malloc(size_t size, uint32_t) { return malloc(size); }
+inline void *heap_caps_malloc_prefer(size_t size, size_t, ...) {
+  return malloc(size);
+}
+inline void *heap_caps_realloc(void *ptr, size_t size, uint32_t) {
+  return realloc(ptr, size);
+}
+// Free PSRAM as the library sizes itself from it; tests raise it to reach
+// larger track capacities.
+inline size_t g_host_psram_free = 8u << 20;
+inline size_t heap_caps_get_free_size(uint32_t) { return g_host_psram_free; }
+inline void heap_caps_free(void *ptr) { free(ptr); }
@@ -0,0 +1,21 @@
+// Host stand-in for FreeRTOS. The tests run the code on one thread, so
+// locks always succeed and never block.
+#pragma once
+
+#include <cstdint>
+
+typedef uint32_t TickType_t;
+typedef int BaseType_t;
+typedef void *SemaphoreHandle_t;
+typedef void *TaskHandle_t;
+struct portMUX_TYPE {
+  int unused;
+};
+
+#define pdTRUE 1
+#define pdFALSE 0
+#define portMAX_DELAY 0xFFFFFFFFu
+#define portMUX_INITIALIZER_UNLOCKED {0}
+#define portENTER_CRITICAL(mux) ((void)(mux))
+#define portEXIT_CRITICAL(mux) ((void)(mux))
+#define pdMS_TO_TICKS(ms) (ms)
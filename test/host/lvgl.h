@@ -0,0 +1,12 @@
+// Host stand-in: the LVGL types UI headers name. Nothing here draws, so only
+// code that never calls into LVGL can be built against it.
+#pragma once
+
+#include <cstdint>
+
+struct lv_obj_t;
+struct lv_group_t;
+struct lv_timer_t;
+struct lv_image_dsc_t;
+typedef int32_t lv_coord_t;
+typedef void (*lv_timer_cb_t)(lv_timer_t *);
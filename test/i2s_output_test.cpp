@@ -0,0 +1,170 @@
+// Audio's output path against a stand-in I2S driver: a WAV file played to
+// the end must reach the driver one i2s_write() per block, not one per
+// frame; a DMA that takes part of a block gets the rest in follow-up calls
+// without losing frames; and a DMA that takes nothing costs a block at most
+// I2S_MAX_STALLS calls instead of hanging the caller.
+#include <SD.h>
+#include <driver/i2s.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include "Audio.h"
+#include "check.h"
+
+namespace {
+
+constexpr uint32_t kRate = 44100;
+constexpr uint32_t kFrames = kRate * 2; // two seconds
+
+void put32(std::vector<uint8_t> &b, uint32_t v) {
+  for (int i = 0; i < 4; ++i) {
+    b.push_back(static_cast<uint8_t>(v >> (8 * i)));
+  }
+}
+
+void put16(std::vector<uint8_t> &b, uint16_t v) {
+  b.push_back(static_cast<uint8_t>(v));
+  b.push_back(static_cast<uint8_t>(v >> 8));
+}
+
+// 16-bit PCM WAV with a 440 Hz tone on both channels.
+void write_wav(const char *path, uint16_t channels, uint32_t frames) {
+  const uint32_t data = frames * channels * 2;
+  std::vector<uint8_t> b = {'R', 'I', 'F', 'F'};
+  put32(b, 36 + data);
+  for (char c : std::string("WAVEfmt ")) {
+    b.push_back(static_cast<uint8_t>(c));
+  }
+  put32(b, 16);
+  put16(b, 1);
+  put16(b, channels);
+  put32(b, kRate);
+  put32(b, kRate * channels * 2);
+  put16(b, channels * 2);
+  put16(b, 16);
+  for (char c : std::string("data")) {
+    b.push_back(static_cast<uint8_t>(c));
+  }
+  put32(b, data);
+  for (uint32_t i = 0; i < frames; ++i) {
+    const auto s = static_cast<int16_t>(
+        8000 * std::sin(2 * M_PI * 440 * static_cast<double>(i) / kRate));
+    for (uint16_t c = 0; c < channels; ++c) {
+      put16(b, static_cast<uint16_t>(s));
+    }
+  }
+  File f = SD.open(path, FILE_WRITE);
+  f.write(b.data(), b.size());
+  f.close();
+}
+
+struct Played {
+  Audio::I2SStats stats;
+  uint32_t silence = 0; // pushed when the track opened and after its end
+  bool finished = false;
+};
+
+Played play(Audio &audio, const char *path, size_t accept) {
+  g_host_i2s = HostI2S();
+  g_host_i2s.accept = accept;
+  audio.resetI2SStats();
+  Played out;
+  CHECK(audio.connecttoFS(SD, path));
+  // Opening flushes the DMA with silence before the file starts.
+  const uint32_t opened = audio.getI2SStats().frames;
+  for (int guard = 0; audio.isRunning() && guard < 100000; ++guard) {
+    audio.loop();
+  }
+  out.finished = !audio.isRunning();
+  out.stats = audio.getI2SStats();
+  out.silence = opened + audio.getSilenceSinceEof();
+  return out;
+}
+
+// Largest left-channel sample the driver was handed.
+int peak() {
+  int most = 0;
+  const std::vector<uint8_t> &w = g_host_i2s.written;
+  for (size_t i = 0; i + 4 <= w.size(); i += 4) {
+    const auto left = static_cast<int16_t>(w[i + 2] | (w[i + 3] << 8));
+    most = std::max(most, std::abs(static_cast<int>(left)));
+  }
+  return most;
+}
+
+void report(const char *what, const Played &p) {
+  std::printf("%s: %u frames in %u blocks, %u i2s_write calls "
+              "(%.0f frames per call), %u short, %u dropped\n",
+              what, p.stats.frames, p.stats.blocks, p.stats.writeCalls,
+              p.stats.writeCalls
+                  ? static_cast<double>(p.stats.frames) / p.stats.writeCalls
+                  : 0.0,
+              p.stats.shortWrites, p.stats.droppedBlocks);
+}
+
+void test_whole_blocks(Audio &audio) {
+  for (uint16_t channels : {2, 1}) {
+    const char *path = channels == 2 ? "/stereo.wav" : "/mono.wav";
+    write_wav(path, channels, kFrames);
+    const Played p = play(audio, path, SIZE_MAX);
+    report(channels == 2 ? "stereo" : "mono", p);
+    CHECK(p.finished);
+    // Every frame of the file, plus the silence that flushes the DMA.
+    CHECK(p.stats.frames == kFrames + p.silence);
+    CHECK(g_host_i2s.written.size() == p.stats.frames * 4u);
+    CHECK(peak() > 2000);
+    CHECK(p.stats.writeCalls == p.stats.blocks);
+    CHECK(p.stats.frames / p.stats.blocks >= 256);
+    CHECK(p.stats.shortWrites == 0 && p.stats.droppedBlocks == 0);
+  }
+}
+
+// The DMA has room for 100 frames per call: each block takes several calls,
+// and nothing is lost.
+void test_partial_writes(Audio &audio) {
+  const Played p = play(audio, "/stereo.wav", 400);
+  report("100 frames per call", p);
+  CHECK(p.finished);
+  CHECK(p.stats.frames == kFrames + p.silence);
+  CHECK(g_host_i2s.written.size() == p.stats.frames * 4u);
+  CHECK(p.stats.writeCalls > p.stats.blocks * 3);
+  CHECK(p.stats.shortWrites == p.stats.writeCalls - p.stats.blocks);
+  CHECK(p.stats.droppedBlocks == 0);
+}
+
+// A DMA that never drains: each block is given up after I2S_MAX_STALLS
+// calls, and playback still runs to the end of the file.
+void test_stalled(Audio &audio) {
+  uint32_t block[64] = {};
+  g_host_i2s = HostI2S();
+  g_host_i2s.accept = 0;
+  audio.resetI2SStats();
+  CHECK(!audio.writeI2SBlock(block, 64));
+  CHECK(g_host_i2s.writes == Audio::I2S_MAX_STALLS);
+  CHECK(audio.getI2SStats().droppedBlocks == 1);
+
+  const Played p = play(audio, "/stereo.wav", 0);
+  report("stalled", p);
+  CHECK(p.finished);
+  CHECK(g_host_i2s.written.empty());
+  CHECK(p.stats.droppedBlocks == p.stats.blocks);
+  CHECK(p.stats.writeCalls == p.stats.blocks * Audio::I2S_MAX_STALLS);
+}
+
+} // namespace
+
+int main() {
+  static Audio audio;
+  CHECK(audio.setPinout(1, 2, 3));
+  audio.setVolume(21);
+  test_whole_blocks(audio);
+  test_partial_writes(audio);
+  test_stalled(audio);
+  std::printf("%d failures\n", g_failures);
+  return g_failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,225 @@
+// Catalog lookups at 500, 5000 and 32000 tracks (the largest table a board
+// can size): every artist, album, genre and composer must list exactly the
+// tracks a scan of the table finds, and a name lookup must cost the same at
+// every size rather than grow with the catalog like a linear search does.
+#include <esp_heap_caps.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "app/library.h"
+#include "check.h"
+
+using namespace app;
+
+namespace {
+
+Library g_lib;
+int g_ids[kMaxTrackCapacity];
+
+using Clock = std::chrono::steady_clock;
+
+double ns_since(Clock::time_point start, int ops) {
+  const auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                      Clock::now() - start)
+                      .count();
+  return static_cast<double>(ns) / ops;
+}
+
+// Sized to stay inside the catalog capacities library_reset() picks: a
+// quarter as many artists and half as many albums as tracks. Album names
+// repeat across artists, as "Greatest Hits" does.
+TrackTags tags_for(int i, int n) {
+  const int artist = (i * 7919) % (n / 20);
+  TrackTags tags;
+  tags.title = ("Song " + std::to_string(i)).c_str();
+  tags.artist = ("Artist " + std::to_string(artist)).c_str();
+  tags.album = ("Album " + std::to_string((i / 3) % 5)).c_str();
+  tags.genre = (i % 11 == 0) ? "" : ("Genre " + std::to_string(i % 40)).c_str();
+  tags.composer = ("Composer " + std::to_string(i % (n / 40))).c_str();
+  return tags;
+}
+
+void fill_library(int n) {
+  library_reset(g_lib);
+  CHECK(g_lib.track_capacity >= n);
+  for (int i = 0; i < n; ++i) {
+    const String path = ("/music/t" + std::to_string(i) + ".mp3").c_str();
+    library_store_track(g_lib, path, 1000 + i, 500 + i, tags_for(i, n),
+                        g_lib.tracks[g_lib.track_count++]);
+  }
+  const auto start = Clock::now();
+  library_rebuild_catalogs(g_lib);
+  std::printf("%5d tracks: rebuild %.2f ms, %d artists, %d albums, "
+              "%d genres, %d composers\n",
+              n, ns_since(start, 1) / 1e6, g_lib.artist_count,
+              g_lib.album_count, g_lib.genre_count, g_lib.composer_count);
+}
+
+using Postings = std::map<std::string, std::vector<int>>;
+
+// The tracks of each name by brute force over the track table.
+Postings scan_table(const char *TrackInfo::*field) {
+  Postings out;
+  for (int i = 0; i < g_lib.track_count; ++i) {
+    out[g_lib.tracks[i].*field].push_back(i);
+  }
+  return out;
+}
+
+std::vector<int> sorted(int count) {
+  std::vector<int> out(g_ids, g_ids + count);
+  std::sort(out.begin(), out.end());
+  return out;
+}
+
+template <typename Lookup>
+void check_postings(const char *what, const Postings &want, int catalog_count,
+                    Lookup lookup) {
+  bool same = static_cast<int>(want.size()) == catalog_count;
+  for (const auto &entry : want) {
+    if (!same) {
+      break;
+    }
+    same = sorted(lookup(String(entry.first.c_str()))) == entry.second;
+    if (!same) {
+      std::fprintf(stderr, "%s '%s' lists the wrong tracks\n", what,
+                   entry.first.c_str());
+    }
+  }
+  CHECK(same);
+  CHECK(lookup(String("Nobody")) == 0);
+}
+
+void check_lookups() {
+  check_postings("artist", scan_table(&TrackInfo::artist), g_lib.artist_count,
+                 [](const String &name) {
+                   return library_tracks_for_artist(g_lib, name, g_ids,
+                                                    kMaxTrackCapacity);
+                 });
+  check_postings("genre", scan_table(&TrackInfo::genre), g_lib.genre_count,
+                 [](const String &name) {
+                   return library_tracks_for_genre(g_lib, name, g_ids,
+                                                   kMaxTrackCapacity);
+                 });
+  check_postings("composer", scan_table(&TrackInfo::composer),
+                 g_lib.composer_count, [](const String &name) {
+                   return library_tracks_for_composer(g_lib, name, g_ids,
+                                                      kMaxTrackCapacity);
+                 });
+
+  // Albums are keyed by name and artist; without an artist every album of
+  // that name counts.
+  std::map<std::pair<std::string, std::string>, std::vector<int>> albums;
+  Postings album_names;
+  std::map<std::string, std::set<std::string>> artist_albums;
+  for (int i = 0; i < g_lib.track_count; ++i) {
+    const TrackInfo &t = g_lib.tracks[i];
+    albums[{t.album, t.artist}].push_back(i);
+    album_names[t.album].push_back(i);
+    artist_albums[t.artist].insert(t.album);
+  }
+  CHECK(static_cast<int>(albums.size()) == g_lib.album_count);
+  bool same = true;
+  for (const auto &entry : albums) {
+    const String album = entry.first.first.c_str();
+    const String artist = entry.first.second.c_str();
+    const int id = library_find_album(g_lib, album, artist);
+    same = same && id >= 0 && entry.first.first == g_lib.albums[id].name &&
+           entry.first.second == g_lib.albums[id].artist &&
+           sorted(library_tracks_for_album(g_lib, artist, album, g_ids,
+                                           kMaxTrackCapacity)) == entry.second;
+  }
+  CHECK(same);
+  for (const auto &entry : album_names) {
+    same = same && sorted(library_tracks_for_album(
+                       g_lib, String(), String(entry.first.c_str()), g_ids,
+                       kMaxTrackCapacity)) == entry.second;
+  }
+  CHECK(same);
+  CHECK(library_find_album(g_lib, "Album 0", "Nobody") < 0);
+
+  for (const auto &entry : artist_albums) {
+    const int count = library_albums_for_artist(
+        g_lib, String(entry.first.c_str()), g_ids, kMaxTrackCapacity);
+    std::set<std::string> got;
+    for (int i = 0; i < count; ++i) {
+      got.insert(g_lib.albums[g_ids[i]].name);
+    }
+    same = same && got == entry.second;
+  }
+  CHECK(same);
+}
+
+// The hashed lookup against the strcmp walk it replaced, over every artist
+// and one miss.
+void time_lookups(int n, double &hashed_ns, double &linear_ns) {
+  std::vector<String> names;
+  for (int a = 0; a < g_lib.artist_count; ++a) {
+    names.emplace_back(g_lib.artists[a]);
+  }
+  names.emplace_back("Nobody");
+  const int rounds = std::max(1, 200000 / static_cast<int>(names.size()));
+  const int ops = rounds * static_cast<int>(names.size());
+
+  long found = 0;
+  auto start = Clock::now();
+  for (int r = 0; r < rounds; ++r) {
+    for (const String &name : names) {
+      found += library_find_artist(g_lib, name);
+    }
+  }
+  hashed_ns = ns_since(start, ops);
+
+  const int linear_rounds = std::max(1, rounds / 50);
+  const int linear_ops = linear_rounds * static_cast<int>(names.size());
+  long linear_found = 0;
+  start = Clock::now();
+  for (int r = 0; r < linear_rounds; ++r) {
+    for (const String &name : names) {
+      int id = -1;
+      for (int a = 0; a < g_lib.artist_count; ++a) {
+        if (strcmp(g_lib.artists[a], name.c_str()) == 0) {
+          id = a;
+          break;
+        }
+      }
+      linear_found += id;
+    }
+  }
+  linear_ns = ns_since(start, linear_ops);
+  CHECK(found / rounds == linear_found / linear_rounds);
+  std::printf("%5d tracks: find_artist %.0f ns, linear walk %.0f ns\n", n,
+              hashed_ns, linear_ns);
+}
+
+} // namespace
+
+int main() {
+  g_host_psram_free = 64u << 20; // room for kMaxTrackCapacity tracks
+  double first_ns = 0;
+  for (int n : {500, 5000, kMaxTrackCapacity}) {
+    fill_library(n);
+    check_lookups();
+    double hashed_ns = 0;
+    double linear_ns = 0;
+    time_lookups(n, hashed_ns, linear_ns);
+    if (n == 500) {
+      first_ns = hashed_ns;
+    } else if (n == kMaxTrackCapacity) {
+      // 1600 artists: the walk is far behind, the hash barely moves.
+      CHECK(hashed_ns * 10 < linear_ns);
+      CHECK(hashed_ns < first_ns * 10);
+    }
+  }
+  std::printf("%d failures\n", g_failures);
+  return g_failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,217 @@
+// Library index on the card: a saved index loads back into the same track
+// table, removed tracks stay out of it, and an index that was damaged,
+// truncated or written by another format is refused rather than trusted.
+#include <SD.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "app/library.h"
+#include "app/library_index.h"
+#include "check.h"
+
+using namespace app;
+
+namespace {
+
+constexpr int kTracks = 300;
+constexpr const char *kPath = "/lofibox_library.idx";
+
+Library g_lib;
+
+TrackTags tags_for(int i) {
+  TrackTags tags;
+  tags.title = ("Song " + std::to_string(i)).c_str();
+  tags.artist = ("Artist " + std::to_string(i % 17)).c_str();
+  tags.album = ("Album " + std::to_string(i % 41)).c_str();
+  tags.genre = (i % 3 == 0) ? "Jazz" : "Ambient";
+  tags.composer = (i % 5 == 0) ? "" : "Someone";
+  tags.cover_pos = 1000 + i;
+  tags.cover_len = 20000 + i;
+  tags.cover_format = CoverFormat::Jpeg;
+  tags.duration_sec = 180 + i;
+  tags.start.data_start = 4096 + i;
+  tags.start.sample_rate = 44100;
+  tags.start.channels = 2;
+  tags.start.bits_per_sample = 16;
+  tags.start.total_samples = 8000000 + i;
+  tags.start.max_block = 4096;
+  tags.start.max_frame = 14000;
+  return tags;
+}
+
+String path_for(int i) {
+  return ("/music/a" + std::to_string(i % 17) + "/t" + std::to_string(i) +
+          ".flac")
+      .c_str();
+}
+
+void fill_library() {
+  library_reset(g_lib);
+  for (int i = 0; i < kTracks; ++i) {
+    CHECK(library_add_track(g_lib, path_for(i), 3000000 + i, 500 + i,
+                            tags_for(i)) == i);
+  }
+}
+
+bool same_track(const TrackInfo &a, const TrackInfo &b) {
+  return strcmp(a.path, b.path) == 0 && strcmp(a.title, b.title) == 0 &&
+         strcmp(a.artist, b.artist) == 0 && strcmp(a.album, b.album) == 0 &&
+         strcmp(a.genre, b.genre) == 0 &&
+         strcmp(a.composer, b.composer) == 0 && a.cover_pos == b.cover_pos &&
+         a.cover_len == b.cover_len && a.cover_format == b.cover_format &&
+         a.duration_sec == b.duration_sec && a.file_size == b.file_size &&
+         a.added_time == b.added_time &&
+         memcmp(&a.start, &b.start, sizeof(a.start)) == 0;
+}
+
+std::vector<uint8_t> read_file(const char *path) {
+  std::vector<uint8_t> out;
+  File f = SD.open(path, FILE_READ);
+  out.resize(f.size());
+  f.read(out.data(), out.size());
+  f.close();
+  return out;
+}
+
+void write_file(const char *path, const std::vector<uint8_t> &bytes) {
+  File f = SD.open(path, FILE_WRITE);
+  f.write(bytes.data(), bytes.size());
+  f.close();
+}
+
+void test_round_trip() {
+  fill_library();
+  CHECK(library_remove_track(g_lib, 7));
+  CHECK(library_remove_track(g_lib, 200));
+  std::vector<TrackInfo> saved;
+  for (int i = 0; i < g_lib.track_count; ++i) {
+    if (library_track_live(g_lib, i)) {
+      TrackInfo t = g_lib.tracks[i];
+      // Copy the strings out; the reload resets the pool under them.
+      static std::vector<std::string> keep;
+      keep.reserve(kTracks * 6);
+      for (const char **s : {&t.path, &t.title, &t.artist, &t.album,
+                             &t.genre, &t.composer}) {
+        keep.emplace_back(*s);
+        *s = keep.back().c_str();
+      }
+      saved.push_back(t);
+    }
+  }
+  CHECK(library_index_save(g_lib, SD, kPath));
+
+  CHECK(library_load_index(g_lib, SD, kPath));
+  CHECK(g_lib.track_count == kTracks - 2);
+  CHECK(g_lib.removed_count == 0);
+  bool all_same = g_lib.track_count == static_cast<int>(saved.size());
+  for (int i = 0; all_same && i < g_lib.track_count; ++i) {
+    all_same = same_track(g_lib.tracks[i], saved[i]);
+    if (!all_same) {
+      std::fprintf(stderr, "track %d differs after reload\n", i);
+    }
+  }
+  CHECK(all_same);
+  CHECK(library_find_artist(g_lib, "Artist 3") >= 0);
+  int ids[kTracks];
+  // Every third track is Jazz; neither removed track was.
+  CHECK(library_tracks_for_genre(g_lib, "Jazz", ids, kTracks) == kTracks / 3);
+
+  // Lookups during a rescan: unchanged files hit, changed ones miss.
+  LibraryIndex index;
+  CHECK(index.load(SD, kPath));
+  CHECK(index.count == static_cast<uint32_t>(kTracks - 2));
+  const LibraryIndexRecord *r = index.find(path_for(42).c_str(), 3000042, 542);
+  CHECK(r != nullptr && strcmp(index.str(r->title), "Song 42") == 0);
+  CHECK(index.find(path_for(42).c_str(), 3000043, 542) == nullptr);
+  CHECK(index.find(path_for(42).c_str(), 3000042, 543) == nullptr);
+  CHECK(index.find(path_for(7).c_str(), 3000007, 507) == nullptr);
+  CHECK(index.find("/music/none.flac", 1, 1) == nullptr);
+  CHECK(index.hits == 1);
+  index.release();
+}
+
+// Every damaged copy must be refused, and refusing it must leave the
+// library as it was.
+void expect_refused(const char *what, const std::vector<uint8_t> &bytes) {
+  write_file(kPath, bytes);
+  LibraryIndex index;
+  const bool loaded = index.load(SD, kPath);
+  index.release();
+  const int before = g_lib.track_count;
+  const bool filled = library_load_index(g_lib, SD, kPath);
+  if (loaded || filled) {
+    std::fprintf(stderr, "%s index was accepted\n", what);
+  }
+  CHECK(!loaded);
+  CHECK(!filled);
+  CHECK(g_lib.track_count == before);
+}
+
+void test_damaged() {
+  fill_library();
+  CHECK(library_index_save(g_lib, SD, kPath));
+  const std::vector<uint8_t> good = read_file(kPath);
+  const size_t header = sizeof(LibraryIndexHeader);
+  const size_t records = kTracks * sizeof(LibraryIndexRecord);
+  CHECK(good.size() > header + records);
+
+  std::vector<uint8_t> bytes = good;
+  bytes[header + 5 * sizeof(LibraryIndexRecord) + 1] ^= 0x40;
+  expect_refused("record bit flip", bytes);
+
+  bytes = good;
+  bytes[header + records + 3] ^= 0x01;
+  expect_refused("string bit flip", bytes);
+
+  for (size_t cut : {size_t{0}, header - 1, header, header + records,
+                     good.size() - 1}) {
+    bytes.assign(good.begin(), good.begin() + cut);
+    expect_refused("truncated", bytes);
+  }
+
+  bytes = good;
+  bytes.push_back(0);
+  expect_refused("extended", bytes);
+
+  // Consistent checksum, but a string offset past the end of the strings.
+  bytes = good;
+  LibraryIndexHeader h;
+  memcpy(&h, bytes.data(), sizeof(h));
+  LibraryIndexRecord rec;
+  memcpy(&rec, &bytes[header], sizeof(rec));
+  rec.title = h.strings_size + 10;
+  memcpy(&bytes[header], &rec, sizeof(rec));
+  h.checksum = library_hash(&bytes[header], bytes.size() - header);
+  memcpy(bytes.data(), &h, sizeof(h));
+  expect_refused("offset out of range", bytes);
+
+  bytes = good;
+  memcpy(&h, bytes.data(), sizeof(h));
+  h.version = kLibraryIndexVersion - 1;
+  memcpy(bytes.data(), &h, sizeof(h));
+  expect_refused("older version", bytes);
+
+  bytes = good;
+  memcpy(&h, bytes.data(), sizeof(h));
+  h.record_size = sizeof(LibraryIndexRecord) - 4;
+  memcpy(bytes.data(), &h, sizeof(h));
+  expect_refused("record size", bytes);
+
+  // The untouched copy still loads after all that.
+  write_file(kPath, good);
+  CHECK(library_load_index(g_lib, SD, kPath));
+  CHECK(g_lib.track_count == kTracks);
+}
+
+} // namespace
+
+int main() {
+  test_round_trip();
+  test_damaged();
+  std::printf("%d failures\n", g_failures);
+  return g_failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
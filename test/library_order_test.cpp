@@ -0,0 +1,274 @@
+// Precomputed sort orders at 500, 5000 and 32000 tracks: after a rebuild
+// every order must list its live ids in the documented order with ranks that
+// point back at them, and plays, removals, re-tags and additions must keep
+// them that way without a rebuild. Also times reading a page of titles from
+// the order against sorting the table for it, as list screens used to.
+#include <esp_heap_caps.h>
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "app/library.h"
+#include "check.h"
+
+using namespace app;
+
+namespace {
+
+constexpr int kEdits = 50;
+constexpr int kPage = 1000;
+
+Library g_lib;
+
+using Clock = std::chrono::steady_clock;
+
+double ms_since(Clock::time_point start) {
+  return std::chrono::duration<double, std::milli>(Clock::now() - start)
+      .count();
+}
+
+// Written independently of library_compare_names: ASCII case folded, bytes
+// compared unsigned.
+int fold_compare(const char *a, const char *b) {
+  std::string fa = a;
+  std::string fb = b;
+  for (std::string *s : {&fa, &fb}) {
+    for (char &c : *s) {
+      if (c >= 'A' && c <= 'Z') {
+        c = static_cast<char>(c + ('a' - 'A'));
+      }
+    }
+  }
+  const int c = std::memcmp(fa.c_str(), fb.c_str(),
+                            std::min(fa.size(), fb.size()) + 1);
+  return c == 0 ? 0 : (c < 0 ? -1 : 1);
+}
+
+// Names that differ only in case compare equal and fall back to id; a few
+// start with bytes above ASCII.
+std::string name(const char *kind, int k) {
+  static const char *const kPrefixes[] = {"", "the ", "The ", "\xc3\x89"};
+  std::string s = kPrefixes[k % 4];
+  s += kind;
+  s += ' ';
+  s += std::to_string(k / 4);
+  if (k % 3 == 0) {
+    for (char &c : s) {
+      c = static_cast<char>(std::toupper(static_cast<unsigned char>(c)));
+    }
+  }
+  return s;
+}
+
+TrackTags tags_for(int i, int n) {
+  TrackTags tags;
+  tags.title = name("song", (i * 7919) % n).c_str();
+  tags.artist = name("artist", i % (n / 10)).c_str();
+  // Three albums per artist.
+  tags.album = name("album", i % (n / 10) * 3 + i / (n / 10) % 3).c_str();
+  tags.genre = name("genre", i % 30).c_str();
+  tags.composer = name("composer", i % (n / 20)).c_str();
+  return tags;
+}
+
+String path_for(int i) {
+  return ("/music/t" + std::to_string(i) + ".mp3").c_str();
+}
+
+void fill_library(int n) {
+  library_reset(g_lib);
+  CHECK(g_lib.track_capacity >= n);
+  for (int i = 0; i < n; ++i) {
+    TrackInfo &t = g_lib.tracks[g_lib.track_count++];
+    library_store_track(g_lib, path_for(i), 1000, (i * 31) % 997,
+                        tags_for(i, n), t);
+    t.play_count = (i * 13) % 50;
+    t.last_played = t.play_count ? 10000 + (i * 17) % 5000 : 0;
+  }
+  const auto start = Clock::now();
+  library_rebuild_catalogs(g_lib);
+  std::printf("%5d tracks: rebuild with orders %.2f ms\n", n, ms_since(start));
+}
+
+// Every listed id appears once with its rank, no unlisted one can be found
+// through rank, and each neighbouring pair is in order. ties_by_id also
+// requires equal keys to keep id order, which plays are allowed to break.
+template <typename Compare, typename Listed>
+bool order_ok(const char *what, const SortOrder &order, int total,
+              Compare compare, Listed listed, bool ties_by_id = true) {
+  int want = 0;
+  for (int id = 0; id < total; ++id) {
+    want += listed(id) ? 1 : 0;
+  }
+  bool ok = order.count == want;
+  std::vector<bool> seen(total, false);
+  for (int i = 0; ok && i < order.count; ++i) {
+    const int id = order.ids[i];
+    ok = id < total && listed(id) && !seen[id] && order.rank[id] == i;
+    seen[id] = true;
+    if (ok && i > 0) {
+      const int prev = order.ids[i - 1];
+      const int c = compare(prev, id);
+      ok = c < 0 || (c == 0 && (!ties_by_id || prev < id));
+    }
+  }
+  // Unlisted ids may keep a stale rank, but it never points at themselves.
+  for (int id = 0; ok && id < total; ++id) {
+    ok = seen[id] || order.rank[id] >= order.count ||
+         order.ids[order.rank[id]] != id;
+  }
+  if (!ok) {
+    std::fprintf(stderr, "%s order is wrong\n", what);
+  }
+  return ok;
+}
+
+int compare_desc(uint32_t a, uint32_t b) {
+  return a == b ? 0 : (a > b ? -1 : 1);
+}
+
+void check_orders(bool ties_by_id = true) {
+  const TrackInfo *t = g_lib.tracks;
+  const int n = g_lib.track_count;
+  auto live = [](int i) { return library_track_live(g_lib, i); };
+  CHECK(order_ok(
+      "title", g_lib.order.title, n,
+      [t](int a, int b) {
+        const int c = fold_compare(t[a].title, t[b].title);
+        return c != 0 ? c : fold_compare(t[a].artist, t[b].artist);
+      },
+      live));
+  CHECK(order_ok(
+      "added", g_lib.order.added, n,
+      [t](int a, int b) {
+        return compare_desc(t[a].added_time, t[b].added_time);
+      },
+      live));
+  CHECK(order_ok(
+      "play count", g_lib.order.play_count, n,
+      [t](int a, int b) {
+        return compare_desc(t[a].play_count, t[b].play_count);
+      },
+      live, ties_by_id));
+  CHECK(order_ok(
+      "last played", g_lib.order.last_played, n,
+      [t](int a, int b) {
+        return compare_desc(t[a].last_played, t[b].last_played);
+      },
+      live, ties_by_id));
+
+  auto names = [](const char *const *list) {
+    return [list](int a, int b) { return fold_compare(list[a], list[b]); };
+  };
+  auto in_use = [](const CatalogIndex &index) {
+    return [&index](int id) { return library_catalog_size(index, id) > 0; };
+  };
+  CHECK(order_ok("artists", g_lib.order.artists, g_lib.artist_count,
+                 names(g_lib.artists), in_use(g_lib.artist_index)));
+  CHECK(order_ok("genres", g_lib.order.genres, g_lib.genre_count,
+                 names(g_lib.genres), in_use(g_lib.genre_index)));
+  CHECK(order_ok("composers", g_lib.order.composers, g_lib.composer_count,
+                 names(g_lib.composers), in_use(g_lib.composer_index)));
+  const AlbumInfo *albums = g_lib.albums;
+  CHECK(order_ok(
+      "albums", g_lib.order.albums, g_lib.album_count,
+      [albums](int a, int b) {
+        const int c = fold_compare(albums[a].name, albums[b].name);
+        return c != 0 ? c : fold_compare(albums[a].artist, albums[b].artist);
+      },
+      in_use(g_lib.album_index)));
+}
+
+void check_edits(int n) {
+  // Plays move tracks up past fewer plays and to the front of last played.
+  for (int k = 0; k < kEdits * 4; ++k) {
+    library_mark_played(g_lib, (k * 4099) % n, 20000 + k);
+  }
+  CHECK(g_lib.order.last_played.ids[0] == ((kEdits * 4 - 1) * 4099) % n);
+  check_orders(false);
+
+  for (int k = 0; k < kEdits; ++k) {
+    const int i = (k * 6151 + 3) % n;
+    if (library_track_live(g_lib, i)) {
+      CHECK(library_remove_track(g_lib, i));
+    }
+    const int j = (k * 3571 + 11) % n;
+    if (library_track_live(g_lib, j)) {
+      TrackTags tags = tags_for(j, n);
+      tags.title = name("retitled", k).c_str();
+      tags.artist = name("newcomer", k % 7).c_str();
+      library_retag_track(g_lib, j, path_for(j), 1000, 2000 + k, tags);
+    }
+  }
+  check_orders(false);
+
+  static int16_t remap[kMaxTrackCapacity];
+  CHECK(library_compact(g_lib, remap));
+  check_orders();
+  for (int k = 0; k < kEdits; ++k) {
+    TrackTags tags = tags_for(k, n);
+    tags.title = name("added", k).c_str();
+    tags.album = name("album", n + k).c_str();
+    CHECK(library_add_track(g_lib, path_for(n + k), 1000, 3000 + k, tags) >=
+          0);
+  }
+  check_orders();
+}
+
+// First page of the title list: from the order, then by sorting the live
+// tracks the way the list screens did before the orders existed.
+void time_page(int n) {
+  std::vector<const char *> page;
+  page.reserve(kPage);
+  auto start = Clock::now();
+  for (int i = 0; i < g_lib.order.title.count && i < kPage; ++i) {
+    page.push_back(g_lib.tracks[g_lib.order.title.ids[i]].title);
+  }
+  const double cached_ms = ms_since(start);
+
+  start = Clock::now();
+  std::vector<int> ids;
+  ids.reserve(g_lib.track_count);
+  for (int i = 0; i < g_lib.track_count; ++i) {
+    if (library_track_live(g_lib, i)) {
+      ids.push_back(i);
+    }
+  }
+  const TrackInfo *t = g_lib.tracks;
+  std::sort(ids.begin(), ids.end(), [t](int a, int b) {
+    int c = library_compare_names(t[a].title, t[b].title);
+    c = c != 0 ? c : library_compare_names(t[a].artist, t[b].artist);
+    return c != 0 ? c < 0 : a < b;
+  });
+  const double sorted_ms = ms_since(start);
+  bool same = true;
+  for (size_t i = 0; i < page.size(); ++i) {
+    same = same && page[i] == t[ids[i]].title;
+  }
+  CHECK(same);
+  std::printf("%5d tracks: title page from order %.3f ms, sorted %.2f ms\n", n,
+              cached_ms, sorted_ms);
+}
+
+} // namespace
+
+int main() {
+  g_host_psram_free = 64u << 20; // room for kMaxTrackCapacity tracks
+  CHECK(library_compare_names("abc", "ABC") == 0);
+  CHECK(library_compare_names(nullptr, "") == 0);
+  CHECK(library_compare_names("Zed", "\xc3\x89t\xc3\xa9") < 0);
+  for (int n : {500, 5000, kMaxTrackCapacity}) {
+    fill_library(n);
+    check_orders();
+    check_edits(n);
+    time_page(n);
+  }
+  std::printf("%d failures\n", g_failures);
+  return g_failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
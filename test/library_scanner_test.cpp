@@ -0,0 +1,241 @@
+// Background rescan against a card that changed since the library was
+// built: files added, deleted, rewritten and touched, some of it while the
+// walk is under way, with the library edited and renumbered under the
+// scanner. Afterwards the library must list exactly what is on the card,
+// and every index the player held must map to the same file.
+#include <SD.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include "app/library.h"
+#include "app/library_index.h"
+#include "app/library_scanner.h"
+#include "check.h"
+
+using namespace app;
+
+namespace {
+
+constexpr const char *kRoot = "/music";
+constexpr uint8_t kDepth = 3;
+
+Library g_lib;
+LibraryScanner g_scanner;
+
+using Entry = std::tuple<std::string, uint32_t, uint32_t>;
+
+std::string track_path(int artist, int album, int track) {
+  return std::string(kRoot) + "/artist" + std::to_string(artist) + "/album" +
+         std::to_string(album) + "/t" + std::to_string(track) + ".mp3";
+}
+
+void write_file(const std::string &path, size_t size) {
+  File f = SD.open(path.c_str(), FILE_WRITE);
+  std::vector<uint8_t> bytes(size, 0);
+  f.write(bytes.data(), bytes.size());
+  f.close();
+}
+
+void build_card() {
+  SD.format();
+  SD.card().now = 100;
+  for (int artist = 0; artist < 3; ++artist) {
+    for (int album = 0; album < 2; ++album) {
+      for (int track = 0; track < 10; ++track) {
+        write_file(track_path(artist, album, track), 1000 + track);
+      }
+    }
+  }
+  write_file(std::string(kRoot) + "/notes.txt", 10);
+}
+
+// What the library should hold: every audio file on the card.
+std::vector<Entry> card_entries() {
+  std::vector<Entry> out;
+  for (const auto &f : SD.card().files) {
+    if (f.first.rfind(std::string(kRoot) + "/", 0) == 0 &&
+        library_is_supported_audio(String(f.first.c_str()))) {
+      out.emplace_back(f.first, static_cast<uint32_t>(f.second->size()),
+                       SD.card().mtimes[f.first]);
+    }
+  }
+  std::sort(out.begin(), out.end());
+  return out;
+}
+
+std::vector<Entry> library_entries() {
+  std::vector<Entry> out;
+  for (int i = 0; i < g_lib.track_count; ++i) {
+    if (library_track_live(g_lib, i)) {
+      const TrackInfo &t = g_lib.tracks[i];
+      out.emplace_back(t.path, t.file_size, t.added_time);
+    }
+  }
+  std::sort(out.begin(), out.end());
+  return out;
+}
+
+int index_of(const std::string &path) {
+  for (int i = 0; i < g_lib.track_count; ++i) {
+    if (library_track_live(g_lib, i) && path == g_lib.tracks[i].path) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+// The player's view: an index it holds, remapped whenever apply() moves
+// tracks.
+struct Held {
+  std::string path;
+  int index;
+};
+
+// Runs step()/apply() like the main loop does, calling between() after
+// every applied batch. Returns the number of batches.
+template <typename Fn> int run_scan(std::vector<Held> &held, Fn between) {
+  g_scanner.start(g_lib, SD, kRoot, kDepth);
+  int batches = 0;
+  for (int guard = 0; g_scanner.active() && guard < 1000; ++guard) {
+    if (!g_scanner.step(5)) {
+      continue;
+    }
+    if (g_scanner.apply()) {
+      for (Held &h : held) {
+        h.index = (h.index >= 0 && h.index < g_scanner.remap_count())
+                      ? g_scanner.remap()[h.index]
+                      : -1;
+      }
+    }
+    ++batches;
+    between(batches);
+  }
+  CHECK(!g_scanner.active());
+  return batches;
+}
+
+void check_catalogs() {
+  // Every live track is reachable through its artist and the title order,
+  // and no removed slot is left behind after the final compaction.
+  CHECK(g_lib.removed_count == 0);
+  CHECK(g_lib.order.title.count == g_lib.track_count);
+  int total = 0;
+  static int ids[kMaxTrackCapacity];
+  for (int a = 0; a < g_lib.artist_count; ++a) {
+    total += library_tracks_for_artist(g_lib, g_lib.artists[a], ids,
+                                       kMaxTrackCapacity);
+  }
+  CHECK(total == g_lib.track_count);
+}
+
+void test_card_changes() {
+  build_card();
+  library_scan(g_lib, SD, kRoot, kDepth);
+  CHECK(g_lib.track_count == 60);
+  CHECK(library_entries() == card_entries());
+
+  std::vector<Held> held;
+  for (const std::string &p :
+       {track_path(0, 0, 0), track_path(1, 1, 5), track_path(2, 1, 9)}) {
+    held.push_back({p, index_of(p)});
+  }
+
+  SD.card().now = 200;
+  for (int track = 0; track < 5; ++track) {
+    SD.remove(track_path(0, 1, track).c_str()); // deleted
+  }
+  write_file(track_path(1, 0, 3), 5000);  // rewritten, new size
+  write_file(track_path(1, 0, 4), 1004);  // same size, new mtime
+  for (int track = 0; track < 40; ++track) {
+    write_file(track_path(3, 0, track), 2000 + track); // new artist
+  }
+
+  const int batches = run_scan(held, [](int) {});
+  std::printf("rescan applied %d batches\n", batches);
+  CHECK(batches > 1); // more changes than one journal holds
+  CHECK(library_entries() == card_entries());
+  CHECK(g_lib.track_count == 60 - 5 + 40);
+  check_catalogs();
+  for (const Held &h : held) {
+    CHECK(h.index >= 0 && h.index < g_lib.track_count &&
+          h.path == g_lib.tracks[h.index].path);
+  }
+
+  // The saved index matches, so the next boot can load it as is.
+  LibraryIndex index;
+  CHECK(index.load(SD, kLibraryIndexPath));
+  CHECK(index.count == static_cast<uint32_t>(g_lib.track_count));
+  index.release();
+
+  // Nothing changed: the walk finds nothing to apply.
+  const uint32_t generation = g_lib.generation;
+  run_scan(held, [](int) {});
+  CHECK(g_lib.generation == generation);
+  CHECK(library_entries() == card_entries());
+}
+
+// The user deletes and the tag editor re-tags while the walk is under way,
+// and a compaction renumbers the table under it, which restarts the walk.
+void test_edits_during_walk() {
+  build_card();
+  library_scan(g_lib, SD, kRoot, kDepth);
+  SD.card().now = 300;
+  // Enough new files for three journal batches, so both edits land while
+  // the walk still has directories to go.
+  for (int track = 0; track < 80; ++track) {
+    write_file(track_path(4, track / 40, track), 3000 + track);
+  }
+  const std::string kept = track_path(2, 0, 2);
+  std::vector<Held> held = {{kept, index_of(kept)}};
+
+  const std::string deleted = track_path(1, 1, 1);
+  const std::string retagged = track_path(0, 0, 7);
+  const int batches = run_scan(held, [&](int batch) {
+    if (batch == 1) {
+      const int i = index_of(deleted);
+      CHECK(i >= 0 && library_remove_track(g_lib, i));
+      SD.remove(deleted.c_str());
+      const int j = index_of(retagged);
+      TrackTags tags;
+      tags.title = "Edited";
+      tags.artist = "Someone Else";
+      library_retag_track(g_lib, j, retagged.c_str(),
+                          g_lib.tracks[j].file_size,
+                          g_lib.tracks[j].added_time, tags);
+    } else if (batch == 2) {
+      // As if another caller compacted: everything the scanner knew about
+      // indexes is stale now.
+      const int i = index_of(track_path(2, 1, 0));
+      CHECK(i >= 0 && library_remove_track(g_lib, i));
+      SD.remove(track_path(2, 1, 0).c_str());
+      static int16_t remap[kMaxTrackCapacity];
+      const int count = g_lib.track_count;
+      CHECK(library_compact(g_lib, remap));
+      held[0].index = held[0].index < count ? remap[held[0].index] : -1;
+    }
+  });
+  std::printf("rescan with edits applied %d batches\n", batches);
+  CHECK(batches >= 3); // both edits landed before the walk ended
+  CHECK(library_entries() == card_entries());
+  check_catalogs();
+  CHECK(index_of(deleted) < 0);
+  const int j = index_of(retagged);
+  CHECK(j >= 0 && strcmp(g_lib.tracks[j].title, "Edited") == 0);
+  CHECK(library_find_artist(g_lib, "Someone Else") >= 0);
+  CHECK(held[0].index >= 0 && held[0].path == g_lib.tracks[held[0].index].path);
+}
+
+} // namespace
+
+int main() {
+  test_card_changes();
+  test_edits_during_walk();
+  std::printf("%d failures\n", g_failures);
+  return g_failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
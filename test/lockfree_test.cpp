@@ -0,0 +1,128 @@
+// SpscQueue and Seqlock under real threads: the queue must hand every item
+// over once and in order through a small ring that wraps many times, and a
+// Seqlock reader must never see a half-written snapshot.
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+
+#include "app/lockfree.h"
+#include "check.h"
+
+using namespace app;
+
+namespace {
+
+constexpr uint32_t kItems = 2000000;
+constexpr uint32_t kStores = 200000;
+
+struct Item {
+  uint32_t seq;
+  uint32_t check; // ~seq, so a torn copy shows up
+};
+
+void test_queue_order() {
+  static SpscQueue<Item, 8> queue;
+  std::thread producer([] {
+    for (uint32_t i = 0; i < kItems;) {
+      if (queue.push({i, ~i})) {
+        ++i;
+      } else {
+        std::this_thread::yield();
+      }
+    }
+  });
+
+  uint32_t expected = 0;
+  bool in_order = true;
+  while (expected < kItems) {
+    Item item;
+    if (!queue.pop(item)) {
+      std::this_thread::yield();
+      continue;
+    }
+    if (item.seq != expected || item.check != ~expected) {
+      std::fprintf(stderr, "got item %u, expected %u\n", item.seq, expected);
+      in_order = false;
+      break;
+    }
+    ++expected;
+  }
+  producer.join();
+  CHECK(in_order);
+  Item extra;
+  CHECK(!queue.pop(extra));
+  CHECK(queue.empty());
+}
+
+// A full queue refuses items and an empty one yields nothing.
+void test_queue_bounds() {
+  SpscQueue<int, 4> queue;
+  for (int i = 0; i < 4; ++i) {
+    CHECK(queue.push(i));
+  }
+  CHECK(!queue.push(4));
+  int out = -1;
+  CHECK(queue.pop(out) && out == 0);
+  CHECK(queue.push(4));
+  for (int want = 1; want <= 4; ++want) {
+    CHECK(queue.pop(out) && out == want);
+  }
+  CHECK(!queue.pop(out));
+  CHECK(queue.empty());
+}
+
+// Big enough that readers regularly overlap a store.
+struct Snapshot {
+  uint32_t words[1024];
+};
+
+void test_seqlock() {
+  static Seqlock<Snapshot> cell;
+  std::atomic<bool> done{false};
+  std::thread writer([&done] {
+    Snapshot s;
+    for (uint32_t i = 1; i <= kStores; ++i) {
+      for (uint32_t &w : s.words) {
+        w = i;
+      }
+      cell.store(s);
+    }
+    done.store(true, std::memory_order_release);
+  });
+
+  uint32_t torn = 0;
+  uint32_t backwards = 0;
+  uint32_t last = 0;
+  uint32_t reads = 0;
+  while (!done.load(std::memory_order_acquire)) {
+    const Snapshot s = cell.load();
+    for (uint32_t w : s.words) {
+      if (w != s.words[0]) {
+        ++torn;
+        break;
+      }
+    }
+    if (s.words[0] < last) {
+      ++backwards;
+    }
+    last = s.words[0];
+    ++reads;
+  }
+  writer.join();
+  std::printf("seqlock: %u reads during %u stores\n", reads, kStores);
+  CHECK(torn == 0);
+  CHECK(backwards == 0);
+  CHECK(cell.load().words[1023] == kStores);
+  CHECK(cell.version() == 2 * kStores);
+}
+
+} // namespace
+
+int main() {
+  test_queue_bounds();
+  test_queue_order();
+  test_seqlock();
+  std::printf("%d failures\n", g_failures);
+  return g_failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
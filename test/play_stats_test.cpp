@@ -0,0 +1,195 @@
+// Play stats across power cuts: the card loses power a given number of bytes
+// into a flush, for every cut point through the append, and after the
+// reboot each track must show either its last flushed counts or the ones
+// the interrupted flush was writing. Plays after the recovery must survive
+// the next reboot too. Last, load() is timed at the library's full size.
+#include <FS.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "app/library_index.h"
+#include "app/play_stats.h"
+#include "check.h"
+
+// The library's FNV-1a, without building the library around it.
+namespace app {
+uint32_t library_hash(const void *data, size_t len, uint32_t hash) {
+  const uint8_t *p = static_cast<const uint8_t *>(data);
+  for (size_t i = 0; i < len; ++i) {
+    hash ^= p[i];
+    hash *= 16777619u;
+  }
+  return hash;
+}
+
+uint32_t library_path_hash(const char *path) {
+  return library_hash(path, strlen(path));
+}
+} // namespace app
+
+using namespace app;
+
+namespace {
+
+constexpr int kTracks = 200;
+constexpr uint32_t kMinuteMs = 61 * 1000;
+
+struct Counts {
+  uint32_t plays = 0;
+  uint32_t last = 0;
+  bool operator==(const Counts &o) const {
+    return plays == o.plays && last == o.last;
+  }
+};
+
+char g_paths[kTracks][32];
+fs::FS g_card;
+
+void boot() {
+  g_card.power_on();
+  g_host_millis = 0;
+  stats::load(g_card);
+}
+
+void play(Counts *model, int i) {
+  TrackInfo t;
+  t.path = g_paths[i];
+  t.play_count = ++model[i].plays;
+  t.last_played = model[i].last = stats::now_sec();
+  stats::record(t);
+  g_host_millis += kMinuteMs;
+}
+
+void read_back(Counts *out) {
+  for (int i = 0; i < kTracks; ++i) {
+    TrackInfo t;
+    t.path = g_paths[i];
+    stats::fill(t);
+    out[i] = Counts{t.play_count, t.last_played};
+  }
+}
+
+// Returns false at the first track that matches neither model.
+bool matches_either(const Counts *got, const Counts *durable,
+                    const Counts *attempt, long budget) {
+  for (int i = 0; i < kTracks; ++i) {
+    if (!(got[i] == durable[i]) && !(got[i] == attempt[i])) {
+      std::fprintf(stderr,
+                   "cut after %ld B: track %d has %u/%u, flushed %u/%u, "
+                   "attempted %u/%u\n",
+                   budget, i, got[i].plays, got[i].last, durable[i].plays,
+                   durable[i].last, attempt[i].plays, attempt[i].last);
+      return false;
+    }
+  }
+  return true;
+}
+
+void run(long budget) {
+  std::mt19937 rng(static_cast<uint32_t>(budget));
+  g_card.format();
+  boot();
+
+  // Enough flushes that the log gets folded into a snapshot on the way.
+  Counts model[kTracks];
+  for (int round = 0; round < 25; ++round) {
+    for (int k = 0; k < 50; ++k) {
+      play(model, rng() % kTracks);
+    }
+    stats::tick();
+  }
+  CHECK(stats::flush());
+  Counts durable[kTracks];
+  std::copy(model, model + kTracks, durable);
+
+  for (int k = 0; k < 70; ++k) {
+    play(model, rng() % kTracks);
+  }
+  Counts attempt[kTracks];
+  std::copy(model, model + kTracks, attempt);
+  g_card.cut_power_after(budget);
+  stats::flush();
+
+  boot();
+  Counts got[kTracks];
+  read_back(got);
+  CHECK(matches_either(got, durable, attempt, budget));
+
+  for (int k = 0; k < 5; ++k) {
+    play(got, k);
+  }
+  CHECK(stats::flush());
+  boot();
+  Counts after[kTracks];
+  read_back(after);
+  CHECK(std::equal(after, after + kTracks, got));
+}
+
+// Boot cost at the library's full size: a snapshot of every track plus a
+// log just short of the fold threshold, the most load() ever replays.
+void test_boot_cost() {
+  constexpr int kLibrary = 32000;
+  constexpr int kLogRecords = 1000;
+  std::vector<std::string> paths(kLibrary);
+  for (int i = 0; i < kLibrary; ++i) {
+    paths[i] = "/music/library/track" + std::to_string(i) + ".flac";
+  }
+  g_card.format();
+  boot();
+  for (int i = 0; i < kLibrary; ++i) {
+    TrackInfo t;
+    t.path = paths[i].c_str();
+    t.play_count = 1;
+    t.last_played = stats::now_sec();
+    stats::record(t);
+  }
+  CHECK(stats::flush()); // big enough to be folded into the snapshot
+  for (int i = 0; i < kLogRecords; ++i) {
+    TrackInfo t;
+    t.path = paths[i].c_str();
+    t.play_count = 2;
+    t.last_played = stats::now_sec();
+    stats::record(t);
+  }
+  CHECK(stats::flush());
+
+  const auto start = std::chrono::steady_clock::now();
+  boot();
+  const auto us = std::chrono::duration_cast<std::chrono::microseconds>(
+                      std::chrono::steady_clock::now() - start)
+                      .count();
+  std::printf("load: %d snapshot + %d log records in %lld us\n", kLibrary,
+              kLogRecords, static_cast<long long>(us));
+
+  TrackInfo t;
+  t.path = paths[0].c_str();
+  stats::fill(t);
+  CHECK(t.play_count == 2);
+  t.path = paths[kLibrary - 1].c_str();
+  stats::fill(t);
+  CHECK(t.play_count == 1);
+}
+
+} // namespace
+
+int main() {
+  for (int i = 0; i < kTracks; ++i) {
+    std::snprintf(g_paths[i], sizeof(g_paths[i]), "/music/t%03d.mp3", i);
+  }
+  // Every byte of the first records, then a stride through the rest of
+  // the 70-record append.
+  int trials = 0;
+  const long append = 70 * static_cast<long>(sizeof(stats::StatsRecord));
+  for (long budget = 0; budget <= append; budget += budget < 200 ? 1 : 7) {
+    run(budget);
+    ++trials;
+  }
+  test_boot_cost();
+  std::printf("%d cut points, %d failures\n", trials, g_failures);
+  return g_failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
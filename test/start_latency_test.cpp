@@ -0,0 +1,225 @@
+// Track start from the scanned header against the header walk: for MP3 and
+// FLAC files behind a 300 KB cover, the start parameters the tag reader
+// records must take Audio to the first decoded frame without reading the
+// cover, the rest of the file must play the same either way, and start
+// parameters that no longer fit the file must fall back to the walk.
+// Reports the card traffic and loop() passes up to the first frame, which is
+// what the board's "[I2S] start latency" line is made of.
+#include <SD.h>
+#include <driver/i2s.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include "Audio.h"
+#include "app/library_tags.h"
+#include "check.h"
+#include "flac_stream.h"
+
+using namespace app;
+
+namespace {
+
+constexpr size_t kCover = 300000;
+
+using Bytes = std::vector<uint8_t>;
+
+void put_be(Bytes &b, uint32_t v, int n) {
+  for (int i = n - 1; i >= 0; --i) {
+    b.push_back(static_cast<uint8_t>(v >> (8 * i)));
+  }
+}
+
+void put_str(Bytes &b, const std::string &s) {
+  b.insert(b.end(), s.begin(), s.end());
+}
+
+void put_jpeg(Bytes &b, size_t size) {
+  put_str(b, "\xff\xd8\xff\xe0");
+  b.insert(b.end(), size - 4, 'J');
+}
+
+void store(const char *path, const Bytes &data) {
+  File f = SD.open(path, FILE_WRITE);
+  f.write(data.data(), data.size());
+  f.close();
+}
+
+// ID3v2.3 with a title and a front cover, then MPEG-1 Layer III frames at
+// 128 kbit/s and 44.1 kHz whose side info is all zero: valid, silent frames.
+Bytes make_mp3(int frames) {
+  Bytes apic;
+  put_str(apic, std::string("\0image/jpeg\0\x03\0", 14));
+  put_jpeg(apic, kCover);
+  Bytes body;
+  put_str(body, "TIT2");
+  put_be(body, 10, 4);
+  put_be(body, 0, 2);
+  put_str(body, std::string("\0Start mp3", 10));
+  put_str(body, "APIC");
+  put_be(body, static_cast<uint32_t>(apic.size()), 4);
+  put_be(body, 0, 2);
+  body.insert(body.end(), apic.begin(), apic.end());
+
+  Bytes file;
+  put_str(file, std::string("ID3\x03\0\0", 6));
+  const uint32_t n = static_cast<uint32_t>(body.size());
+  for (int shift : {21, 14, 7, 0}) {
+    file.push_back(static_cast<uint8_t>((n >> shift) & 127));
+  }
+  file.insert(file.end(), body.begin(), body.end());
+  for (int i = 0; i < frames; ++i) {
+    put_be(file, 0xFFFB9000u, 4);
+    file.insert(file.end(), 417 - 4, 0);
+  }
+  return file;
+}
+
+// STREAMINFO and a PICTURE block ahead of frames from flac_stream.h.
+Bytes make_flac(const FlacStream &stream) {
+  const uint64_t samples = stream.pcm.size() / 2;
+  Bytes info;
+  put_be(info, 16, 2);    // min block
+  put_be(info, 4608, 2);  // max block
+  put_be(info, 0, 3);     // min frame
+  put_be(info, 15000, 3); // max frame
+  const uint64_t packed =
+      (44100ull << 44) | (1ull << 41) | (15ull << 36) | samples;
+  put_be(info, static_cast<uint32_t>(packed >> 32), 4);
+  put_be(info, static_cast<uint32_t>(packed), 4);
+  info.insert(info.end(), 16, 0); // MD5
+
+  Bytes pic;
+  put_be(pic, 3, 4);
+  put_be(pic, 10, 4);
+  put_str(pic, "image/jpeg");
+  put_be(pic, 0, 4);
+  pic.insert(pic.end(), 16, 0);
+  put_be(pic, kCover, 4);
+  put_jpeg(pic, kCover);
+
+  Bytes file;
+  put_str(file, "fLaC");
+  file.push_back(0);
+  put_be(file, static_cast<uint32_t>(info.size()), 3);
+  file.insert(file.end(), info.begin(), info.end());
+  file.push_back(0x80 | 6);
+  put_be(file, static_cast<uint32_t>(pic.size()), 3);
+  file.insert(file.end(), pic.begin(), pic.end());
+  file.insert(file.end(), stream.bytes.begin(), stream.bytes.end() - 8);
+  return file;
+}
+
+// What start_track() hands Audio for a scanned track.
+Audio::StartInfo scanned_start(const char *path) {
+  TrackTags tags;
+  CHECK(library_read_file_tags(SD, path, tags));
+  File f = SD.open(path);
+  Audio::StartInfo start{};
+  start.fileSize = static_cast<uint32_t>(f.size());
+  start.dataStart = tags.start.data_start;
+  start.sampleRate = tags.start.sample_rate;
+  start.channels = tags.start.channels;
+  start.bitsPerSample = tags.start.bits_per_sample;
+  start.flacMaxBlockSize = tags.start.max_block;
+  start.flacMaxFrameSize = tags.start.max_frame;
+  start.flacTotalSamples = tags.start.total_samples;
+  return start;
+}
+
+struct Started {
+  size_t bytes = 0; // read from the card up to the first decoded frame
+  size_t reads = 0;
+  int loops = 0;
+  double us = 0;
+  uint32_t frames = 0; // decoded, to the end of the file
+  bool finished = false;
+  std::vector<uint8_t> output; // what the driver was handed
+};
+
+// start == nullptr takes the plain connecttoFS() and its header walk.
+Started start_track(Audio &audio, const char *path,
+                    const Audio::StartInfo *start) {
+  g_host_i2s = HostI2S();
+  SD.card().reads = 0;
+  SD.card().read_bytes = 0;
+  Started out;
+  const auto t0 = std::chrono::steady_clock::now();
+  CHECK(start ? audio.connecttoFS(SD, path, *start)
+              : audio.connecttoFS(SD, path));
+  // Opening flushes the DMA with silence; the track starts after it.
+  const uint32_t opened = audio.getI2SStats().frames;
+  while (audio.isRunning() && audio.getI2SStats().frames == opened &&
+         out.loops < 10000) {
+    audio.loop();
+    ++out.loops;
+  }
+  out.us = std::chrono::duration<double, std::micro>(
+               std::chrono::steady_clock::now() - t0)
+               .count();
+  out.bytes = SD.card().read_bytes;
+  out.reads = SD.card().reads;
+  for (int guard = 0; audio.isRunning() && guard < 100000; ++guard) {
+    audio.loop();
+  }
+  out.finished = !audio.isRunning();
+  out.frames = audio.getI2SStats().frames - opened - audio.getSilenceSinceEof();
+  out.output = g_host_i2s.written;
+  return out;
+}
+
+void report(const char *what, const Started &s) {
+  std::printf("%-18s first frame after %7zu bytes in %3zu reads, %3d loops, "
+              "%8.1f us; %u frames played\n",
+              what, s.bytes, s.reads, s.loops, s.us, s.frames);
+}
+
+void compare(Audio &audio, const char *path, uint32_t want_frames) {
+  const Audio::StartInfo start = scanned_start(path);
+  CHECK(start.dataStart > kCover && start.sampleRate == 44100);
+
+  audio.resetI2SStats();
+  const Started walk = start_track(audio, path, nullptr);
+  audio.resetI2SStats();
+  const Started fast = start_track(audio, path, &start);
+  std::printf("%s\n", path);
+  report("  header walk", walk);
+  report("  scanned start", fast);
+  CHECK(walk.finished && fast.finished);
+  CHECK(walk.frames == want_frames && fast.frames == want_frames);
+  CHECK(walk.output == fast.output);
+  CHECK(walk.bytes > kCover);
+  CHECK(fast.bytes < kCover / 2);
+  CHECK(fast.loops <= walk.loops);
+
+  // A file rewritten since the scan: the walk takes over.
+  Audio::StartInfo stale = start;
+  stale.fileSize += 1;
+  audio.resetI2SStats();
+  const Started fallback = start_track(audio, path, &stale);
+  CHECK(fallback.finished && fallback.output == walk.output);
+  CHECK(fallback.bytes > kCover);
+}
+
+} // namespace
+
+int main() {
+  g_host_psram_found = true; // FLAC needs it, as on the board
+  static Audio audio;
+  CHECK(audio.setPinout(1, 2, 3));
+  audio.setVolume(21);
+
+  constexpr int kMp3Frames = 200;
+  store("/start.mp3", make_mp3(kMp3Frames));
+  compare(audio, "/start.mp3", kMp3Frames * 1152);
+
+  const FlacStream stream = make_flac_stream(7, 120);
+  store("/start.flac", make_flac(stream));
+  compare(audio, "/start.flac", static_cast<uint32_t>(stream.pcm.size() / 2));
+
+  std::printf("%d failures\n", g_failures);
+  return g_failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
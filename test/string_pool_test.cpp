@@ -0,0 +1,172 @@
+// StringPool: equal strings share one copy wherever they were stored, the
+// intern table keeps finding them as it grows, strings past the main block
+// go to overflow pages without moving anything stored before, and reset()
+// gives all of it back.
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "app/library.h"
+#include "check.h"
+
+using namespace app;
+
+namespace {
+
+constexpr size_t kBlock = 4096;
+constexpr int kUnique = 20000;
+
+using Clock = std::chrono::steady_clock;
+
+double ns_since(Clock::time_point start, int ops) {
+  const auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                      Clock::now() - start)
+                      .count();
+  return static_cast<double>(ns) / ops;
+}
+
+std::string artist(int k) { return "Artist number " + std::to_string(k); }
+
+bool in_block(const StringPool &pool, const char *s) {
+  return s >= pool.data && s < pool.data + pool.capacity;
+}
+
+void test_interning() {
+  StringPool pool;
+  pool.init(kBlock);
+  CHECK(pool.data != nullptr && pool.capacity == kBlock);
+
+  const char *a = pool.store("Miles Davis");
+  const char *b = pool.store(String("Miles") + " Davis");
+  CHECK(a == b);
+  CHECK(strcmp(a, "Miles Davis") == 0);
+  CHECK(pool.store("miles davis") != a); // exact match only
+  CHECK(pool.strings == 2);
+  CHECK(pool.hits == 1);
+  CHECK(pool.bytes_saved == strlen("Miles Davis") + 1);
+
+  // Unique stores skip the table: a fresh copy every time.
+  const char *path1 = pool.store("/music/a.mp3", false);
+  const char *path2 = pool.store("/music/a.mp3", false);
+  CHECK(path1 != path2 && strcmp(path1, path2) == 0);
+  CHECK(pool.strings == 2);
+
+  const size_t used = pool.used;
+  CHECK(strcmp(pool.store(""), "") == 0);
+  CHECK(strcmp(pool.store_cstr(nullptr), "") == 0);
+  CHECK(pool.used == used);
+  pool.reset();
+}
+
+// Far more strings than the block holds: the table grows and the rest go
+// to pages, and every string stays where it was first stored.
+void test_overflow() {
+  StringPool pool;
+  pool.init(kBlock);
+  const uint32_t first_mask = pool.slot_mask;
+
+  std::vector<const char *> stored;
+  for (int k = 0; k < kUnique; ++k) {
+    stored.push_back(pool.store(artist(k).c_str()));
+  }
+  CHECK(pool.strings == kUnique);
+  CHECK(pool.slot_mask > first_mask);
+  CHECK(pool.page_count > 0);
+  CHECK(pool.used <= pool.capacity);
+  CHECK(in_block(pool, stored.front()));
+  CHECK(!in_block(pool, stored.back()));
+
+  // A string bigger than a page gets a page of its own.
+  const std::string big(StringPool::kPageSize + 100, 'x');
+  const size_t pages = pool.page_count;
+  const char *huge = pool.store(big.c_str());
+  CHECK(huge != nullptr && big == huge);
+  CHECK(pool.page_count == pages + 1);
+  CHECK(pool.store(big.c_str()) == huge);
+
+  bool intact = true;
+  bool shared = true;
+  for (int k = 0; k < kUnique; ++k) {
+    intact = intact && artist(k) == stored[k];
+    shared = shared && pool.store(artist(k).c_str()) == stored[k];
+  }
+  CHECK(intact);
+  CHECK(shared);
+  CHECK(pool.strings == kUnique + 1);
+  CHECK(pool.hits == kUnique + 1);
+  std::printf("%d strings: %zu block bytes, %zu pages of %zu bytes, "
+              "%u table slots\n",
+              kUnique + 1, pool.used, pool.page_count, pool.page_bytes,
+              pool.slot_mask + 1);
+
+  pool.reset();
+  CHECK(pool.pages == nullptr && pool.page_count == 0);
+  CHECK(pool.page_bytes == 0 && pool.used == 0);
+  CHECK(pool.strings == 0 && pool.hits == 0 && pool.bytes_saved == 0);
+  const char *again = pool.store(artist(0).c_str());
+  CHECK(in_block(pool, again) && artist(0) == again);
+  CHECK(pool.hits == 0);
+  pool.reset();
+}
+
+// Tag strings as a library stores them: a few artists and genres repeated
+// across many tracks. Reports the bytes interning saved and what a hit and
+// a miss cost.
+void test_library_shaped() {
+  constexpr int kTracks = 10000;
+  StringPool pool;
+  pool.init(kTracks * 128);
+
+  std::vector<std::string> names;
+  for (int i = 0; i < kTracks; ++i) {
+    names.push_back(artist(i % 400));
+    names.push_back("Album " + std::to_string(i % 1200));
+    names.push_back((i % 3) ? "Jazz" : "Ambient");
+  }
+  auto start = Clock::now();
+  for (const std::string &s : names) {
+    pool.store(s.c_str());
+  }
+  const double mixed_ns = ns_since(start, static_cast<int>(names.size()));
+  size_t raw = 0;
+  for (const std::string &s : names) {
+    raw += s.size() + 1;
+  }
+  CHECK(pool.strings == 400 + 1200 + 2);
+  CHECK(pool.used + pool.bytes_saved == raw);
+  CHECK(pool.page_count == 0);
+
+  std::vector<std::string> fresh;
+  for (int i = 0; i < kTracks; ++i) {
+    fresh.push_back("Title " + std::to_string(i));
+  }
+  start = Clock::now();
+  for (const std::string &s : fresh) {
+    pool.store(s.c_str());
+  }
+  const double miss_ns = ns_since(start, kTracks);
+  start = Clock::now();
+  for (const std::string &s : fresh) {
+    pool.store(s.c_str());
+  }
+  const double hit_ns = ns_since(start, kTracks);
+  std::printf("%d tag strings: %zu bytes stored, %zu saved; store %.0f ns "
+              "(miss %.0f ns, hit %.0f ns)\n",
+              static_cast<int>(names.size()), pool.used, pool.bytes_saved,
+              mixed_ns, miss_ns, hit_ns);
+  CHECK(pool.bytes_saved * 2 > raw);
+  pool.reset();
+}
+
+} // namespace
+
+int main() {
+  test_interning();
+  test_overflow();
+  test_library_shaped();
+  std::printf("%d failures\n", g_failures);
+  return g_failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,412 @@
+// Tag readers against a corpus of small tagged files built in memory: FLAC,
+// MP4, Ogg FLAC and ID3v2.2/2.3/2.4 with extended headers, unsync and
+// pictures large enough that reading them would show in the byte count.
+// Also times each format's reader on album-sized files.
+#include <FS.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include "app/library_tags.h"
+#include "check.h"
+
+using namespace app;
+using namespace std::string_literals;
+
+namespace {
+
+using Bytes = std::string; // binary-safe with the ""s literals
+
+Bytes be(uint32_t v, int n) {
+  Bytes out;
+  for (int i = n - 1; i >= 0; --i) {
+    out += static_cast<char>(v >> (8 * i));
+  }
+  return out;
+}
+
+Bytes le32(uint32_t v) {
+  Bytes out;
+  for (int i = 0; i < 4; ++i) {
+    out += static_cast<char>(v >> (8 * i));
+  }
+  return out;
+}
+
+Bytes syncsafe(uint32_t v) {
+  return {static_cast<char>((v >> 21) & 127),
+          static_cast<char>((v >> 14) & 127), static_cast<char>((v >> 7) & 127),
+          static_cast<char>(v & 127)};
+}
+
+// ID3 unsynchronisation: a zero after every 0xFF that could read as sync.
+Bytes unsync(const Bytes &in) {
+  Bytes out;
+  for (size_t i = 0; i < in.size(); ++i) {
+    out += in[i];
+    const uint8_t next = i + 1 < in.size() ? in[i + 1] : 0;
+    if (static_cast<uint8_t>(in[i]) == 0xFF && (next == 0 || next >= 0xE0)) {
+      out += '\0';
+    }
+  }
+  return out;
+}
+
+Bytes jpeg(size_t size) { return "\xff\xd8\xff\xe0"s + Bytes(size - 4, 'J'); }
+
+// FLAC pieces.
+Bytes streaminfo(uint32_t rate, uint32_t total) {
+  const uint64_t packed = (static_cast<uint64_t>(rate) << 44) | (1ull << 41) |
+                          (15ull << 36) | total;
+  return be(4096, 2) + be(4096, 2) + Bytes(6, '\0') +
+         be(static_cast<uint32_t>(packed >> 32), 4) +
+         be(static_cast<uint32_t>(packed), 4) + Bytes(16, '\0');
+}
+
+Bytes vorbis_comments(std::initializer_list<std::pair<Bytes, Bytes>> pairs) {
+  Bytes out = le32(3) + "ref" + le32(static_cast<uint32_t>(pairs.size()));
+  for (const auto &kv : pairs) {
+    const Bytes entry = kv.first + "=" + kv.second;
+    out += le32(static_cast<uint32_t>(entry.size())) + entry;
+  }
+  return out;
+}
+
+Bytes flac_block(int type, const Bytes &data, bool last = false) {
+  return static_cast<char>(type | (last ? 0x80 : 0)) +
+         be(static_cast<uint32_t>(data.size()), 3) + data;
+}
+
+// MP4 pieces.
+Bytes box(const char *type, const Bytes &data) {
+  return be(static_cast<uint32_t>(8 + data.size()), 4) + type + data;
+}
+
+Bytes ilst_item(const char *type, uint32_t kind, const Bytes &data) {
+  return box(type, box("data", be(kind, 4) + Bytes(4, '\0') + data));
+}
+
+// Ogg page holding the given lacing values.
+Bytes ogg_page(const std::vector<uint8_t> &segs, const Bytes &data) {
+  Bytes out = "OggS"s + Bytes(22, '\0') + static_cast<char>(segs.size());
+  for (uint8_t s : segs) {
+    out += static_cast<char>(s);
+  }
+  return out + data;
+}
+
+std::vector<uint8_t> lacing(size_t n) {
+  std::vector<uint8_t> segs(n / 255, 255);
+  segs.push_back(static_cast<uint8_t>(n % 255));
+  return segs;
+}
+
+// ID3 frames, v2.2 / v2.3 / v2.4.
+Bytes id3v22_frame(const char *id, const Bytes &d) {
+  return id + be(static_cast<uint32_t>(d.size()), 3) + d;
+}
+Bytes id3v23_frame(const char *id, const Bytes &d, uint8_t flags = 0) {
+  return id + be(static_cast<uint32_t>(d.size()), 4) + '\0' +
+         static_cast<char>(flags) + d;
+}
+Bytes id3v24_frame(const char *id, const Bytes &d, uint8_t flags = 0) {
+  return id + syncsafe(static_cast<uint32_t>(d.size())) + '\0' +
+         static_cast<char>(flags) + d;
+}
+Bytes id3_tag(int version, uint8_t flags, const Bytes &body) {
+  return "ID3"s + static_cast<char>(version) + '\0' + static_cast<char>(flags) +
+         syncsafe(static_cast<uint32_t>(body.size())) + body;
+}
+
+fs::FS g_card;
+
+void store(const char *path, const Bytes &data) {
+  File f = g_card.open(path, FILE_WRITE);
+  f.write(reinterpret_cast<const uint8_t *>(data.data()), data.size());
+  f.close();
+}
+
+// Reads path's tags, counting the card traffic it took.
+TrackTags read_tags(const char *path, bool expect_ok = true) {
+  g_card.card().reads = 0;
+  g_card.card().read_bytes = 0;
+  TrackTags tags;
+  CHECK(library_read_file_tags(g_card, path, tags) == expect_ok);
+  return tags;
+}
+
+void test_flac() {
+  const Bytes img = jpeg(100);
+  const Bytes pic = be(3, 4) + be(10, 4) + "image/jpeg" + be(3, 4) + "abc" +
+                    Bytes(16, '\0') + be(static_cast<uint32_t>(img.size()), 4) +
+                    img;
+  const Bytes head =
+      "fLaC"s + flac_block(0, streaminfo(44100, 44100 * 185)) +
+      flac_block(1, Bytes(100, '\0')) +
+      flac_block(4, vorbis_comments({{"title", "Song A"},
+                                     {"ARTIST", "Art"},
+                                     {"Album", "Alb"},
+                                     {"GENRE", "Jazz"},
+                                     {"composer", "Cmp"},
+                                     {"X", "y"}})) +
+      flac_block(6, pic, true);
+  store("/a.flac", head + "\xff\xf8"s + Bytes(1000, '\0'));
+
+  const TrackTags t = read_tags("/a.flac");
+  CHECK(t.title == "Song A");
+  CHECK(t.artist == "Art");
+  CHECK(t.album == "Alb");
+  CHECK(t.genre == "Jazz");
+  CHECK(t.composer == "Cmp");
+  CHECK(t.duration_sec == 185);
+  CHECK(t.cover_pos == head.find(img) && t.cover_len == img.size());
+  CHECK(t.cover_format == CoverFormat::Jpeg);
+  CHECK(t.start.data_start == head.size());
+  CHECK(t.start.sample_rate == 44100 && t.start.channels == 2 &&
+        t.start.bits_per_sample == 16);
+  CHECK(t.start.max_block == 4096 && t.start.total_samples == 44100 * 185);
+}
+
+void test_mp4() {
+  const Bytes ilst =
+      box("ilst", ilst_item("\xa9nam", 1, "T\xc3\xaftle") +
+                      ilst_item("\xa9" "ART", 1, "MArt") +
+                      ilst_item("covr", 14, "\x89PNGxxxx"));
+  const Bytes hdlr = box("hdlr", Bytes(8, '\0') + "mdir" + Bytes(13, '\0'));
+  const Bytes meta = box("meta", Bytes(4, '\0') + hdlr + ilst);
+  const Bytes mvhd = box("mvhd", Bytes(12, '\0') + be(1000, 4) +
+                                     be(200500, 4) + Bytes(80, '\0'));
+  const Bytes file = box("ftyp", "M4A \0\0\0\0"s) +
+                     box("mdat", Bytes(5000, '\0')) +
+                     box("moov", mvhd + box("udta", meta));
+  store("/a.m4a", file);
+
+  const TrackTags t = read_tags("/a.m4a");
+  CHECK(t.title == "T\xc3\xaftle");
+  CHECK(t.artist == "MArt");
+  CHECK(t.duration_sec == 200);
+  CHECK(t.cover_pos == file.find("\x89PNG") && t.cover_len == 8);
+  CHECK(t.cover_format == CoverFormat::Png);
+}
+
+// The comment packet is split over two pages.
+void test_ogg() {
+  const Bytes first = "\x7f" "FLAC\x01\x00\x00\x01" "fLaC"s + be(34, 4) +
+                      streaminfo(48000, 48000 * 61);
+  const Bytes long_title = "Ogg " + Bytes(600, 'x');
+  const Bytes comments =
+      "\x04"s + be(0, 3) +
+      vorbis_comments({{"TITLE", long_title}, {"ARTIST", "OArt"}});
+  const std::vector<uint8_t> segs = lacing(comments.size());
+  const size_t half = segs.size() / 2;
+  const std::vector<uint8_t> segs1(segs.begin(), segs.begin() + half);
+  const std::vector<uint8_t> segs2(segs.begin() + half, segs.end());
+  store("/a.oga", ogg_page(lacing(first.size()), first) +
+                      ogg_page(segs1, comments.substr(0, 255 * half)) +
+                      ogg_page(segs2, comments.substr(255 * half)) +
+                      Bytes(100, '\0'));
+
+  const TrackTags t = read_tags("/a.oga");
+  // Whole "TITLE=..." entries are cut at the reader's 256-byte limit.
+  CHECK(t.title == long_title.substr(0, 250).c_str());
+  CHECK(t.artist == "OArt");
+  CHECK(t.duration_sec == 61);
+}
+
+void test_id3v23() {
+  const Bytes tag = id3_tag(3, 0,
+                            id3v23_frame("TIT2", "\x03MP3 title"s) +
+                                id3v23_frame("TPE1", "\x00" "Art\xe9"s));
+  store("/a.mp3", tag + "\xff\xfb"s + Bytes(100, '\0'));
+
+  const TrackTags t = read_tags("/a.mp3");
+  CHECK(t.title == "MP3 title");
+  CHECK(t.artist == "Art\xc3\xa9"); // Latin-1 to UTF-8
+  CHECK(t.start.data_start == tag.size());
+  CHECK(t.start.sample_rate == 44100 && t.start.channels == 2);
+  CHECK(g_card.card().reads <= 4);
+}
+
+// v2.2 three-character frames; the album comes after a 200 KB picture
+// that must be skipped, not read.
+void test_id3v22() {
+  const Bytes img = jpeg(200000);
+  const Bytes body =
+      id3v22_frame("TT2", "\x00Two Title"s) +
+      id3v22_frame("TP1", "\x01\xff\xfe" "A\0r\0t\0"s) +
+      id3v22_frame("PIC", "\x00JPG\x03" "desc\x00"s + img) +
+      id3v22_frame("TAL", "\x00" "AlbumAfterPic"s);
+  const Bytes file = id3_tag(2, 0, body);
+  store("/v22.mp3", file + "\xff\xfb\xff\xfb"s);
+
+  const TrackTags t = read_tags("/v22.mp3");
+  CHECK(t.title == "Two Title");
+  CHECK(t.artist == "Art"); // UTF-16 with BOM
+  CHECK(t.album == "AlbumAfterPic");
+  CHECK(t.cover_pos == file.find(img) && t.cover_len == img.size());
+  CHECK(t.cover_format == CoverFormat::Jpeg);
+  CHECK(g_card.card().read_bytes < 16 * 1024);
+}
+
+// Whole-tag unsynchronisation plus an extended header.
+void test_id3v23_unsync() {
+  const Bytes body =
+      be(6, 4) + Bytes(6, '\0') + id3v23_frame("TIT2", "\x00Un\xffsync"s) +
+      id3v23_frame("APIC", "\x00image/jpeg\x00\x03\x00"s + jpeg(5000)) +
+      id3v23_frame("TPE1", "\x00" "Art3"s);
+  store("/v23u.mp3", id3_tag(3, 0xC0, unsync(body)) + Bytes(100, '\0'));
+
+  const TrackTags t = read_tags("/v23u.mp3");
+  CHECK(t.title == "Un\xc3\xbfsync");
+  CHECK(t.artist == "Art3");
+  // Unsynchronised picture bytes are not contiguous in the file.
+  CHECK(t.cover_len == 0);
+}
+
+// v2.4 extended header, per-frame unsync with a data length indicator, a
+// non-front picture before the front cover, and padding.
+void test_id3v24() {
+  const Bytes title = "\x03Ti\xff\xe0tle4"s;
+  const Bytes img = jpeg(200000);
+  const Bytes body =
+      syncsafe(6) + "\x01\x00"s +
+      id3v24_frame("TIT2", be(static_cast<uint32_t>(title.size()), 4) +
+                               unsync(title),
+                   0x03) +
+      id3v24_frame("APIC", "\x00image/png\x00\x00x\x00"s + "\x89PNG" +
+                               Bytes(3000, 'p')) +
+      id3v24_frame("APIC", "\x00image/jpeg\x00\x03" "front\x00"s + img) +
+      id3v24_frame("TALB", "\x03" "Alb4"s) + Bytes(2048, '\0');
+  const Bytes file = id3_tag(4, 0x40, body);
+  store("/v24.mp3", file + Bytes(10, '\0'));
+
+  const TrackTags t = read_tags("/v24.mp3");
+  CHECK(t.title == "Ti\xff\xe0tle4");
+  CHECK(t.album == "Alb4");
+  CHECK(t.cover_pos == file.find(img) && t.cover_len == img.size());
+  CHECK(t.cover_format == CoverFormat::Jpeg);
+  CHECK(g_card.card().read_bytes < 16 * 1024);
+}
+
+// Garbage sizes must stop the parser, not send it off the end.
+void test_truncated() {
+  store("/bad.mp3", "ID3\x03\x00\x00\x7f\x7f\x7f\x7f" "TIT2\xff\xff"s);
+  const TrackTags t = read_tags("/bad.mp3");
+  CHECK(t.title.length() == 0);
+  store("/empty.flac", "");
+  read_tags("/empty.flac", false);
+}
+
+// One file per format the way a ripper writes it: five text tags, a 300 KB
+// front cover (none in the Ogg) and 4 MB of audio, the MP4 with its moov after the mdat. Each
+// reader must take the tags at a fixed, small cost in card traffic and time,
+// however large the cover and the audio are.
+void bench_formats() {
+  constexpr int kRounds = 2000;
+  const Bytes img = jpeg(300000);
+  const Bytes audio(4 << 20, '\x55');
+  const Bytes comments = vorbis_comments({{"TITLE", "Bench title"},
+                                         {"ARTIST", "Bench artist"},
+                                         {"ALBUM", "Bench album"},
+                                         {"GENRE", "Jazz"},
+                                         {"COMPOSER", "Bench composer"}});
+  const Bytes flac_pic = be(3, 4) + be(10, 4) + "image/jpeg" + be(0, 4) +
+                         Bytes(16, '\0') +
+                         be(static_cast<uint32_t>(img.size()), 4) + img;
+
+  const Bytes mp3 =
+      id3_tag(4, 0,
+              id3v24_frame("TIT2", "\x03" "Bench title"s) +
+                  id3v24_frame("TPE1", "\x03" "Bench artist"s) +
+                  id3v24_frame("TALB", "\x03" "Bench album"s) +
+                  id3v24_frame("TCON", "\x03" "Jazz"s) +
+                  id3v24_frame("TCOM", "\x03" "Bench composer"s) +
+                  id3v24_frame("APIC", "\x00image/jpeg\x00\x03\x00"s + img) +
+                  Bytes(4096, '\0')) +
+      "\xff\xfb\x90\x00"s + audio;
+
+  const Bytes flac = "fLaC"s + flac_block(0, streaminfo(44100, 44100 * 240)) +
+                     flac_block(4, comments) + flac_block(6, flac_pic) +
+                     flac_block(1, Bytes(8192, '\0'), true) + "\xff\xf8"s +
+                     audio;
+
+  const Bytes ilst =
+      box("ilst", ilst_item("\xa9nam", 1, "Bench title") +
+                      ilst_item("\xa9" "ART", 1, "Bench artist") +
+                      ilst_item("\xa9" "alb", 1, "Bench album") +
+                      ilst_item("\xa9" "gen", 1, "Jazz") +
+                      ilst_item("\xa9wrt", 1, "Bench composer") +
+                      ilst_item("covr", 13, img));
+  const Bytes hdlr = box("hdlr", Bytes(8, '\0') + "mdir" + Bytes(13, '\0'));
+  const Bytes mvhd = box("mvhd", Bytes(12, '\0') + be(1000, 4) +
+                                     be(240000, 4) + Bytes(80, '\0'));
+  const Bytes m4a =
+      box("ftyp", "M4A \0\0\0\0"s) + box("mdat", audio) +
+      box("moov", mvhd + box("udta", box("meta", Bytes(4, '\0') + hdlr +
+                                                     ilst)));
+
+  const Bytes first = "\x7f" "FLAC\x01\x00\x00\x01" "fLaC"s + be(34, 4) +
+                      streaminfo(44100, 44100 * 240);
+  const Bytes packet = "\x04"s + be(0, 3) + comments;
+  Bytes ogg = ogg_page(lacing(first.size()), first) +
+              ogg_page(lacing(packet.size()), packet);
+  for (size_t at = 0; at < audio.size(); at += 255 * 16) {
+    ogg += ogg_page(std::vector<uint8_t>(16, 255), audio.substr(at, 255 * 16));
+  }
+
+  struct Case {
+    const char *path;
+    const Bytes &data;
+    bool cover;
+  };
+  const Case cases[] = {{"/bench.mp3", mp3, true},
+                        {"/bench.flac", flac, true},
+                        {"/bench.m4a", m4a, true},
+                        {"/bench.oga", ogg, false}};
+  for (const Case &c : cases) {
+    store(c.path, c.data);
+    const TrackTags t = read_tags(c.path);
+    CHECK(t.title == "Bench title" && t.artist == "Bench artist");
+    CHECK(t.album == "Bench album" && t.composer == "Bench composer");
+    CHECK(t.cover_len == (c.cover ? img.size() : 0));
+    const size_t reads = g_card.card().reads;
+    const size_t bytes = g_card.card().read_bytes;
+
+    const auto start = std::chrono::steady_clock::now();
+    for (int r = 0; r < kRounds; ++r) {
+      TrackTags again;
+      library_read_file_tags(g_card, c.path, again);
+    }
+    const double us = std::chrono::duration<double, std::micro>(
+                          std::chrono::steady_clock::now() - start)
+                          .count() /
+                      kRounds;
+    std::printf("%-12s %8zu bytes: %.2f us per parse, %zu reads, %zu bytes "
+                "read\n",
+                c.path, c.data.size(), us, reads, bytes);
+    // A read per header walked, none for the cover or the audio.
+    CHECK(bytes < 16 * 1024);
+    CHECK(reads <= 64);
+    // Far below copying the file, even out of memory.
+    CHECK(us < 50);
+  }
+}
+
+} // namespace
+
+int main() {
+  test_flac();
+  test_mp4();
+  test_ogg();
+  test_id3v23();
+  test_id3v22();
+  test_id3v23_unsync();
+  test_id3v24();
+  test_truncated();
+  bench_formats();
+  std::printf("%d failures\n", g_failures);
+  return g_failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}